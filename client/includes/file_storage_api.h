@@ -2,19 +2,25 @@
 #define _FILE_STORAGE_API_H
 
 #include <stdlib.h>
+#include <stdint.h>
 #include "client_params.h"
 
 /*
     Viene aperta una connessione AF_UNIX al socket file sockname. Se il server non accetta immediatamente la
     richiesta di connessione, la connessione da parte del client viene ripetuta dopo ‘msec’ millisecondi e fino allo
-    scadere del tempo assoluto ‘abstime’ specificato come terzo argomento. Ritorna 0 in caso di successo, -1 in caso
-    di fallimento, errno viene settato opportunamente.
+    scadere del tempo assoluto ‘abstime’ specificato come terzo argomento. Se il server è diviso tra più processi,
+    sockname restituisce la mappa degli shard ed ogni richiesta viene spedita al processo che possiede il file, la
+    connessione a ciascuno viene aperta alla sua prima richiesta. La connessione appartiene al thread che la apre:
+    ogni thread può aprirne una propria ed usarla in parallelo agli altri, le impostazioni (setDurability,
+    setWriteByHash) valgono invece per tutti i thread. Ritorna 0 in caso di successo, -1 in caso di fallimento,
+    errno viene settato opportunamente.
 */
 int openConnection(const char* sockname, int msec, const struct timespec abstime);
 
 /*
-    Chiude la connessione AF_UNIX associata al socket file sockname. Ritorna 0 in caso di successo, -1 in caso di
-    fallimento, errno viene settato opportunamente.
+    Chiude la connessione AF_UNIX associata al socket file sockname, dopo aver ricevuto e salvato i file espulsi
+    che il server deve ancora spedire. Ritorna 0 in caso di successo, -1 in caso di fallimento, errno viene settato
+    opportunamente.
 */
 int closeConnection(const char* sockname);
 
@@ -26,7 +32,9 @@ int closeConnection(const char* sockname);
     avvenire solo in append. Se viene passato il flag O_LOCK (eventualmente in OR con O_CREATE) il file viene
     aperto e/o creato in modalità locked, che vuol dire che l’unico che può leggere o scrivere il file ‘pathname’ è il
     processo che lo ha aperto. Il flag O_LOCK può essere esplicitamente resettato utilizzando la chiamata unlockFile,
-    descritta di seguito.
+    descritta di seguito. Con il flag O_LOCK_SHARED il file viene invece aperto con una lock condivisa: più processi
+    possono possederla insieme e leggere il file, mentre nessuno può scriverlo finchè la lock condivisa non viene
+    rilasciata. Se vengono passati sia O_LOCK che O_LOCK_SHARED vale O_LOCK.
     Ritorna 0 in caso di successo, -1 in caso di fallimento, errno viene settato opportunamente.
 */
 int openFile(const char* pathname, int flags);
@@ -39,6 +47,25 @@ int openFile(const char* pathname, int flags);
 */
 int readFile(const char* pathname, void** buf, size_t* size);
 
+/*
+    Legge il file solo se è cambiato rispetto alla versione ‘version’ che il client ne possiede. Ogni modifica del file
+    gli assegna una nuova versione, mai usata prima da nessun file: se la versione è ancora la stessa il server non
+    invia il contenuto, ‘buf’ viene settato a NULL e ‘size’ a 0. Altrimenti il contenuto viene ritornato come dalla
+    readFile e ‘version’ viene aggiornata con la versione letta, passando 0 il file viene sempre letto. Se il file è
+    nella cache del client la risposta non contatta il server. Ritorna 1 se il file è stato letto, 0 se non è
+    cambiato, -1 in caso di fallimento, errno viene settato opportunamente.
+*/
+int readFileIfModified(const char* pathname, uint64_t* version, void** buf, size_t* size);
+
+/*
+    Legge al più ‘length’ bytes del file ‘pathname’ a partire dalla posizione ‘offset’, senza trasferire il resto del
+    file. Ritorna un puntatore ad un’area allocata sullo heap nel parametro ‘buf’, mentre ‘size’ conterrà i bytes letti:
+    meno di ‘length’ se il file finisce prima, 0 (e ‘buf’ a NULL) se ‘offset’ è oltre la fine del file. Se il file è nella
+    cache del client la risposta non contatta il server. Ritorna 0 in caso di successo, -1 in caso di fallimento, errno
+    viene settato opportunamente.
+*/
+int readFileRange(const char* pathname, size_t offset, size_t length, void** buf, size_t* size);
+
 /*
     Richiede al server la lettura di ‘N’ files qualsiasi da memorizzare nella directory ‘dirname’ lato client. Se il server
     ha meno di ‘N’ file disponibili, li invia tutti. Se N<=0 la richiesta al server è quella di leggere tutti i file
@@ -51,18 +78,36 @@ int readNFiles(int N, const char* dirname);
     Scrive tutto il file puntato da pathname nel file server. Ritorna successo solo se non è stata effettuata nessuna operazione
     di scrittura dopo la openFile(O_CREATE | O_LOCK) su questo file. Se ‘dirname’ è diverso da NULL, il
     file eventualmente spedito dal server perchè espulso dalla cache per far posto al file ‘pathname’ dovrà essere
-    scritto in ‘dirname’; Ritorna 0 in caso di successo, -1 in caso di fallimento, errno viene settato opportunamente.
+    scritto in ‘dirname’. I file espulsi arrivano dopo la risposta, il server li spedisce mentre il client è inattivo e
+    vengono salvati durante le operazioni successive o alla closeConnection; se il client ne ha troppi in attesa il
+    server non li spedisce. Ritorna 0 in caso di successo, -1 in caso di fallimento, errno viene settato opportunamente.
 */
 int writeFile(const char* pathname, const char* dirname);
 
+/*
+    Come la writeFile, ma il contenuto del file ‘pathname’ sono i ‘size’ bytes del buffer ‘buf’ invece del file su disco,
+    che può quindi essere letto in anticipo dal chiamante. ‘buf’ resta del chiamante. Ritorna 0 in caso di successo,
+    -1 in caso di fallimento, errno viene settato opportunamente.
+*/
+int writeFileBuffer(const char* pathname, const void* buf, size_t size, const char* dirname);
+
 /*
     Richiesta di scrivere in append al file ‘pathname‘ i ‘size‘ bytes contenuti nel buffer ‘buf’. L’operazione di append
     nel file è garantita essere atomica dal file server. Se ‘dirname’ è diverso da NULL, il file eventualmente spedito
-    dal server perchè espulso dalla cache per far posto ai nuovi dati di ‘pathname’ dovrà essere scritto in ‘dirname’;
-    Ritorna 0 in caso di successo, -1 in caso di fallimento, errno viene settato opportunamente.
+    dal server perchè espulso dalla cache per far posto ai nuovi dati di ‘pathname’ dovrà essere scritto in ‘dirname’,
+    come per la writeFile arriva dopo la risposta. Ritorna 0 in caso di successo, -1 in caso di fallimento, errno viene settato opportunamente.
 */
 int appendToFile(const char* pathname, void* buf, size_t size, const char* dirname);
 
+/*
+    Scrive i ‘size’ bytes contenuti nel buffer ‘buf’ nel file ‘pathname’ a partire dalla posizione ‘offset’, sovrascrivendo
+    i bytes presenti; quelli oltre la fine del file vengono aggiunti in append. ‘offset’ non può superare la dimensione del
+    file (EINVAL), così il file non ha mai buchi. Come per la appendToFile il file deve essere aperto dal client e non in
+    stato locked da parte di un altro client, e i file espulsi arrivano in ‘dirname’ se diverso da NULL. Ritorna 0 in caso
+    di successo, -1 in caso di fallimento, errno viene settato opportunamente.
+*/
+int writeFileAt(const char* pathname, size_t offset, void* buf, size_t size, const char* dirname);
+
 /*
     In caso di successo setta il flag O_LOCK al file. Se il file era stato aperto/creato con il flag O_LOCK e la
     richiesta proviene dallo stesso processo, oppure se il file non ha il flag O_LOCK settato, l’operazione termina
@@ -73,8 +118,21 @@ int appendToFile(const char* pathname, void* buf, size_t size, const char* dirna
 int lockFile(const char* pathname);
 
 /*
-    Resetta il flag O_LOCK sul file ‘pathname’. L’operazione ha successo solo se l’owner della lock è il processo che
-    ha richiesto l’operazione, altrimenti l’operazione termina con errore. Ritorna 0 in caso di successo, -1 in caso di
+    Come lockFile, ma la richiesta porta dei flag ed un timeout. Con il flag L_TRY l’operazione non attende mai: se la
+    lock è posseduta da un altro processo termina subito con errore ed errno settato a EBUSY. Se ‘timeout_ms’ è
+    maggiore di 0 l’attesa della lock dura al massimo ‘timeout_ms’ millisecondi, poi l’operazione termina con errore ed
+    errno settato a ETIMEDOUT; con ‘timeout_ms’ uguale a 0 l’attesa non ha limiti come in lockFile.
+    Con il flag L_SHARED viene richiesta la lock condivisa, concessa insieme agli altri lettori a meno che un processo
+    non sia già in attesa della lock esclusiva (chi scrive ha la precedenza). L’unico possessore della lock condivisa
+    può chiedere la lock esclusiva e la ottiene subito; se la lock condivisa è posseduta anche da altri processi la
+    richiesta termina con errore ed errno settato a EDEADLK.
+    Ritorna 0 in caso di successo, -1 in caso di fallimento, errno viene settato opportunamente.
+*/
+int lockFileEx(const char* pathname, int flags, long timeout_ms);
+
+/*
+    Resetta il flag O_LOCK sul file ‘pathname’, o rilascia la lock condivisa del processo. L’operazione ha successo solo
+    se l’owner della lock è il processo che ha richiesto l’operazione, altrimenti l’operazione termina con errore. Ritorna 0 in caso di successo, -1 in caso di
     fallimento, errno viene settato opportunamente.
 */
 int unlockFile(const char* pathname);
@@ -92,4 +150,33 @@ int closeFile(const char* pathname);
 */
 int removeFile(const char* pathname);
 
-#endif
\ No newline at end of file
+/*
+    Imposta quando le successive writeFile, appendToFile e writeFileAt vengono confermate dal server. Con D_ASYNC la risposta
+    arriva appena i dati sono in memoria, con D_WRITTEN quando sono stati scritti nel write-ahead log del server e con
+    D_SYNC solo dopo che il log è stato sincronizzato su disco, così la scrittura sopravvive ad un crash. D_DEFAULT
+    usa il livello configurato nel server. Se il server non ha un write-ahead log il livello non ha effetto.
+    Ritorna 0 in caso di successo, -1 se il livello non è valido ed errno viene settato a EINVAL.
+*/
+int setDurability(int level);
+
+/*
+    Abilita o disabilita l'invio del solo digest SHA-256 da parte delle successive writeFile. Se abilitato, per i file
+    di almeno 64KB viene prima inviato il digest del contenuto e il contenuto viene caricato solo se il server non ne ha
+    già una copia, altrimenti viene condiviso con i file scritti con gli stessi byte. Abilitato di default, richiede
+    che il server abbia la deduplicazione attiva per avere effetto.
+    Ritorna sempre 0.
+*/
+int setWriteByHash(int enabled);
+
+/*
+    Abilita la cache dei file letti con readFile, che può contenere fino a max_bytes byte di dati (0 la disabilita,
+    disabilitata di default). Le letture successive di un file in cache non contattano il server: il server avvisa il
+    client quando la sua copia non è più valida, perchè il file è stato scritto, rimosso o bloccato in modalità
+    esclusiva da un altro client, e gli avvisi arrivati vengono letti prima di usare la cache. Un file in cache può
+    essere letto anche dopo la sua closeFile. Quando la cache è piena vengono scartate le copie più vecchie, alla
+    closeConnection viene svuotata. Come la connessione la cache appartiene al thread che la abilita. Ritorna 0 in caso di successo, -1 in caso di fallimento, errno viene settato
+    opportunamente.
+*/
+int setReadCache(size_t max_bytes);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef _PARALLEL_UPLOAD_H_
+#define _PARALLEL_UPLOAD_H_
+
+#include "client_params.h"
+
+// Most connections opened by a parallel upload
+#define UPLOAD_MAX_CONNECTIONS 64
+// Files read ahead for each connection
+#define UPLOAD_READ_AHEAD_FILES 4
+// Bytes of the files read ahead and not uploaded yet, a bigger file waits until the others are uploaded
+#define UPLOAD_READ_AHEAD_BYTES (64 * 1024 * 1024)
+
+// Options of a parallel upload
+typedef struct upload_options {
+    const char* sockname;
+    // connections uploading at the same time, capped to UPLOAD_MAX_CONNECTIONS
+    int connections;
+    // folder where the files evicted by the writes are saved, NULL to drop them
+    const char* repl_dirname;
+    // ms waited by each connection after each of its requests
+    long ms_between_reqs;
+} upload_options_t;
+
+// Write to the server the files inside dirname and its subfolders, the first n found (all of them if n is 0)
+// Each of the connections is used by a thread of its own, while the calling thread walks the folders and reads the
+// files ahead of them. Returns the count of files written, -1 if no connection could be opened
+int upload_dir_parallel(const char* dirname, int n, const upload_options_t* options);
+
+#endif
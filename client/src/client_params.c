@@ -101,7 +101,7 @@ static void add_op_filename_list(client_params_t* params, char op, char* str)
     if(count_q(files_q) == 0)
     {
         PRINT_WARNING(ENOENT, "Ignoring option %c because no list is provided!", op);
-        free(files_q);
+        free_q(files_q, free);
         free(api_opt);
         return;
     }
@@ -115,7 +115,7 @@ int read_args_client_params(int argc, char** argv, client_params_t* params)
 
     char* save_ptr;
     int c;
-    while ((c = getopt(argc, argv, "hf:w:W:r:R:d:l:u:c:pD:t:")) != -1)
+    while ((c = getopt(argc, argv, "hf:w:W:r:R:d:l:u:c:pD:t:P:")) != -1)
     {
         save_ptr = NULL;
 
@@ -168,6 +168,7 @@ int read_args_client_params(int argc, char** argv, client_params_t* params)
 
         case 'R':
         case 't':
+        case 'P':
             num = 0;
             n = strtok_r(optarg, COMMA, &save_ptr);
             if(n)
@@ -4,20 +4,27 @@
 #include <unistd.h>
 #include <time.h>
 #include <stdio.h>
+#include <poll.h>
+#include <signal.h>
 
 #include "file_storage_api.h"
 #include "server_api_utils.h"
 #include "client_params.h"
+#include "sha256.h"
+#include "queue.h"
+#include "icl_hash.h"
 
 // Check whether the result of a write is valid, return if not
 #define CHECK_WRITE_PACKET(write_res) if(write_res == -1) { \
                                                 PRINT_WARNING(errno, "Cannot write data inside packet!"); \
+                                                drop_broken_shard(); \
                                                 return -1; \
                                             }
 
 // Check whether the result of a read is valid, return if not
 #define CHECK_READ_PACKET(read_res) if(read_res == -1) { \
                                                 PRINT_WARNING(errno, "Cannot read data inside packet!"); \
+                                                drop_broken_shard(); \
                                                 return -1; \
                                             }
 
@@ -41,8 +48,8 @@
 #define RET_ON_ERROR(fd, pathname)\
                                 { \
                                     server_packet_op_t op; \
-                                    int read_res; \
-                                    READ_PACKET(fd, read_res, &op, sizeof(server_packet_op_t)); \
+                                    int read_res = read_response_op(fd, &op); \
+                                    CHECK_READ_PACKET(read_res); \
                                     if(op == OP_ERROR) { \
                                         int err; \
                                         READ_PACKET(fd, read_res, &err, sizeof(int)); \
@@ -54,10 +61,61 @@
                                     } \
                                 }
 
+// The connection and the cache belong to the thread which opened them, each thread can have a connection of its own
 // FD of server
-int fd_server;
+__thread int fd_server;
 // First byte sent to the server
 char first_byte[1] = { 0 };
+// Durability requested by the writes, D_DEFAULT uses the one of the server
+static int durability = D_DEFAULT;
+// Files at least this big are written sending only their digest first, the hash is cheaper than the upload
+#define WRITE_HASH_MIN_SIZE (64 * 1024)
+// Are the writes sending the digest of the content first
+static bool_t write_by_hash = TRUE;
+
+// Files evicted by a write and still to be pushed by the server, they are saved inside dirname
+typedef struct pending_push {
+    char dirname[MAX_PATHNAME_API_LENGTH + 1];
+    size_t count;
+} pending_push_t;
+
+// Connection to a server process, the server may be split among processes each owning the files of a shard
+typedef struct shard_connection {
+    char sockname[MAX_PATHNAME_API_LENGTH + 1];
+    // -1 until the first request on the files of the shard
+    int fd;
+    // Writes waiting for their evicted files, in the same order the server pushes them
+    queue_t* pending_pushes;
+} shard_connection_t;
+// Shards of the server from its shard map, a single one if the server is not split
+static __thread shard_connection_t* shards = NULL;
+static __thread size_t shards_count = 0;
+// Shard of fd_server
+static __thread shard_connection_t* current_shard = NULL;
+// Retry interval and deadline of openConnection, used by the connections to the shards too
+static __thread int connect_msec;
+static __thread struct timespec connect_abstime;
+
+// Buckets of the index of the copies of the files
+#define CACHE_BUCKETS 1024
+
+// Copy of a file read by the client, used by the next reads until the server tells it's stale
+typedef struct cached_file {
+    char pathname[MAX_PATHNAME_API_LENGTH + 1];
+    uint64_t version;
+    void* data;
+    size_t size;
+    // order of the copies, the oldest ones are dropped first once the cache is full
+    struct cached_file* prev;
+    struct cached_file* next;
+} cached_file_t;
+// Copies of the files by pathname, NULL if the cache is disabled
+static __thread icl_hash_t* cache = NULL;
+static __thread cached_file_t* cache_oldest = NULL;
+static __thread cached_file_t* cache_newest = NULL;
+// Bytes of data of the copies and the most they can take
+static __thread size_t cache_size = 0;
+static __thread size_t cache_max_size = 0;
 
 // Wait until data is available from server
 static int wait_response_from_server()
@@ -92,37 +150,395 @@ static int msleep(long msec)
     return res;
 }
 
-int openConnection(const char* sockname, int msec, const struct timespec abstime)
+// Save the file pathname inside dirname, action is used by the error messages
+static void save_file_in_dir(const char* dirname, const char* pathname, void* data, size_t size, const char* action)
+{
+    char full_path[MAX_PATHNAME_API_LENGTH + 1];
+    size_t dirname_len = strnlen(dirname, MAX_PATHNAME_API_LENGTH);
+    size_t filename_len = 0;
+    char* filename = get_filename_from_path(pathname, strnlen(pathname, MAX_PATHNAME_API_LENGTH), &filename_len);
+    if(buildpath(full_path, (char*)dirname, filename, dirname_len, filename_len) == -1)
+    {
+        PRINT_ERROR(errno, "%s (Replaced Files) %s exceeded max path length (%zu)!", action, pathname, dirname_len + filename_len + 1);
+    }
+    else
+    {
+        if(write_file_util(full_path, data, size) == -1)
+        {
+            PRINT_ERROR(errno, "%s (Replaced Files) %s failed!", action, pathname);
+        }
+    }
+}
+
+// Remember that count files evicted by the last write will be pushed and must be saved inside dirname
+static void expect_pushed_files(const char* dirname, size_t count)
+{
+    if(!current_shard->pending_pushes)
+        current_shard->pending_pushes = create_q();
+
+    pending_push_t* push;
+    CHECK_FATAL_EQ(push, malloc(sizeof(pending_push_t)), NULL, NO_MEM_FATAL);
+    strncpy(push->dirname, dirname, MAX_PATHNAME_API_LENGTH);
+    push->dirname[MAX_PATHNAME_API_LENGTH] = '\0';
+    push->count = count;
+    enqueue(current_shard->pending_pushes, push);
+}
+
+// Drop the copy of pathname if the client has one
+static void cache_drop(const char* pathname)
+{
+    NRET_IF(!cache);
+    cached_file_t* copy = icl_hash_find(cache, (void*)pathname);
+    NRET_IF(!copy);
+
+    if(copy->prev)
+        copy->prev->next = copy->next;
+    else
+        cache_oldest = copy->next;
+    if(copy->next)
+        copy->next->prev = copy->prev;
+    else
+        cache_newest = copy->prev;
+
+    icl_hash_delete(cache, copy->pathname, NULL, NULL);
+    cache_size -= copy->size;
+    free(copy->data);
+    free(copy);
+}
+
+// Drop the oldest copies until size more bytes fit inside the cache
+static void cache_make_room(size_t size)
+{
+    while(cache_oldest && cache_size + size > cache_max_size)
+        cache_drop(cache_oldest->pathname);
+}
+
+// Keep a copy of the data of pathname at version, the copy is not kept if it doesn't fit inside the cache
+static void cache_insert(const char* pathname, uint64_t version, const void* data, size_t size)
+{
+    NRET_IF(!cache);
+    cache_drop(pathname);
+    NRET_IF(size > cache_max_size);
+    cache_make_room(size);
+
+    cached_file_t* copy;
+    CHECK_FATAL_EQ(copy, malloc(sizeof(cached_file_t)), NULL, NO_MEM_FATAL);
+    strncpy(copy->pathname, pathname, MAX_PATHNAME_API_LENGTH);
+    copy->pathname[MAX_PATHNAME_API_LENGTH] = '\0';
+    copy->version = version;
+    copy->size = size;
+    copy->data = NULL;
+    if(size > 0)
+    {
+        CHECK_FATAL_EQ(copy->data, malloc(size), NULL, NO_MEM_FATAL);
+        memcpy(copy->data, data, size);
+    }
+
+    copy->next = NULL;
+    copy->prev = cache_newest;
+    if(cache_newest)
+        cache_newest->next = copy;
+    else
+        cache_oldest = copy;
+    cache_newest = copy;
+    icl_hash_insert(cache, copy->pathname, copy);
+    cache_size += size;
+}
+
+// Drop every copy, they can't be kept up to date once the connection is closed
+static void cache_clear()
+{
+    while(cache_oldest)
+        cache_drop(cache_oldest->pathname);
+}
+
+// Forget the connection to the current shard once it broke, the supervisor could have restarted the shard process:
+// the next request on its files connects again. Its pushes and notices are lost, so are the copies of the files
+static void drop_broken_shard()
+{
+    NRET_IF(shards_count <= 1 || !current_shard || current_shard->fd != fd_server || (errno != EPIPE && errno != ECONNRESET));
+
+    int err = errno;
+    close(current_shard->fd);
+    current_shard->fd = -1;
+    fd_server = -1;
+    free_q(current_shard->pending_pushes, free);
+    current_shard->pending_pushes = NULL;
+    cache_clear();
+    errno = err;
+}
+
+// Receive a file pushed by the server through fd after its OP_PUSH_FILE and save it for the oldest write waiting for it
+static int receive_pushed_file(int fd)
+{
+    int error;
+    char file_str[MAX_PATHNAME_API_LENGTH + 1];
+    size_t file_size;
+    void* file_data = NULL;
+    READ_PACKET_STR(fd, error, file_str, MAX_PATHNAME_API_LENGTH);
+    READ_PACKET(fd, error, &file_size, sizeof(size_t));
+    if(file_size > 0)
+    {
+        CHECK_FATAL_EQ(file_data, malloc(file_size), NULL, NO_MEM_FATAL);
+        READ_PACKET(fd, error, file_data, file_size);
+    }
+
+    queue_t* pending_pushes = current_shard ? current_shard->pending_pushes : NULL;
+    pending_push_t* push = pending_pushes ? node_get_value(get_head_node_q(pending_pushes)) : NULL;
+    if(push)
+    {
+        save_file_in_dir(push->dirname, file_str, file_data, file_size, "Push file");
+        if(--push->count == 0)
+            free(dequeue(pending_pushes));
+    }
+    free(file_data);
+
+    if(g_params->print_operations)
+    {
+        PRINT_INFO("Received the replaced file %s, %zu bytes! [%s]", file_str, file_size, strerror(0));
+    }
+    return 1;
+}
+
+// Receive through fd the pathname of a file changed after its OP_INVALIDATE_FILE, its copy is stale
+static int receive_invalidation(int fd)
+{
+    int error;
+    char file_str[MAX_PATHNAME_API_LENGTH + 1];
+    READ_PACKET_STR(fd, error, file_str, MAX_PATHNAME_API_LENGTH);
+    cache_drop(file_str);
+
+    if(g_params->print_operations)
+    {
+        PRINT_INFO("The cached copy of %s is stale! [%s]", file_str, strerror(0));
+    }
+    return 1;
+}
+
+// Receive a message the server sends between the replies after its op, a pushed file or a notice
+static int receive_server_message(int fd, server_packet_op_t op)
+{
+    if(op == OP_PUSH_FILE)
+        return receive_pushed_file(fd);
+    if(op == OP_INVALIDATE_FILE)
+        return receive_invalidation(fd);
+
+    errno = EPROTO;
+    return -1;
+}
+
+// Read the op of a response, the files pushed and the notices sent by the server meanwhile are received first
+static int read_response_op(int fd, server_packet_op_t* op)
+{
+    int res;
+    while((res = readn(fd, op, sizeof(server_packet_op_t))) > 0 && (*op == OP_PUSH_FILE || *op == OP_INVALIDATE_FILE))
+    {
+        if(receive_server_message(fd, *op) == -1)
+            return -1;
+    }
+
+    return res;
+}
+
+// Receive the messages the server sent while the client was idle without waiting for more
+// Returns 0 once there's nothing left to read, -1 if the connection is broken
+static int receive_idle_messages()
+{
+    struct pollfd pfd = { fd_server, POLLIN, 0 };
+    server_packet_op_t op;
+    while(poll(&pfd, 1, 0) == 1)
+    {
+        if(!(pfd.revents & POLLIN) || readn(fd_server, &op, sizeof(server_packet_op_t)) <= 0 || receive_server_message(fd_server, op) == -1)
+            return -1;
+    }
+
+    return 0;
+}
+
+// Get the copy of pathname if the client has one up to date, the notices sent meanwhile are received first
+static cached_file_t* cache_find(const char* pathname)
+{
+    RET_IF(!cache || receive_idle_messages() == -1, NULL);
+    return icl_hash_find(cache, (void*)pathname);
+}
+
+// Copy the data of a cached file inside a new buffer
+static void cache_copy_out(cached_file_t* copy, void** buf, size_t* size)
+{
+    *size = copy->size;
+    *buf = NULL;
+    if(copy->size > 0)
+    {
+        CHECK_FATAL_ERRNO(*buf, malloc(copy->size), NO_MEM_FATAL);
+        memcpy(*buf, copy->data, copy->size);
+    }
+}
+
+// Connect to sockname retrying every msec until abstime, it's tried at least once
+// Returns the descriptor connected, -1 on failure with errno set
+static int connect_socket(const char* sockname, int msec, const struct timespec abstime)
 {
-    CHECK_ERROR_EQ(fd_server, socket(AF_UNIX, SOCK_STREAM, 0), -1, -1, "Cannot connect to server!");
+    int fd;
+    CHECK_ERROR_EQ(fd, socket(AF_UNIX, SOCK_STREAM, 0), -1, -1, "Cannot connect to server!");
     long remaining_msec = (abstime.tv_sec * 1000 + abstime.tv_nsec / 1000000000) - time(0) * 1000;
 
     struct sockaddr_un sa;
-    strncpy(sa.sun_path, sockname, MAX_PATHNAME_API_LENGTH);
+    memset(&sa, 0, sizeof(sa));
+    strncpy(sa.sun_path, sockname, sizeof(sa.sun_path) - 1);
     sa.sun_family = AF_UNIX;
 
-    int result_socket;
-    while(remaining_msec > 0 && (result_socket = connect(fd_server, (struct sockaddr*)&sa, sizeof(sa))) == -1)
+    while(connect(fd, (struct sockaddr*)&sa, sizeof(sa)) == -1)
     {
+        if(remaining_msec <= 0 || msleep(msec) == -1)
+        {
+            int err = errno;
+            close(fd);
+            errno = err;
+            return -1;
+        }
         remaining_msec -= msec;
-        if(msleep(msec) == -1)
+    }
+
+    return fd;
+}
+
+// Ask the shard map to the server connected by fd, count is 0 if the server is not split among processes
+// otherwise the names of the sockets of the shards are stored inside a new array. Returns 0 on success, -1 on failure
+static int read_shard_map(int fd, size_t* count, shard_connection_t** map)
+{
+    int error;
+    server_packet_op_t op = OP_SHARD_MAP;
+    WRITE_PACKET(fd, error, &first_byte, sizeof(char));
+    WRITE_PACKET(fd, error, &op, sizeof(server_packet_op_t));
+
+    // the messages sent before the reply are received like for any other response
+    error = read_response_op(fd, &op);
+    CHECK_READ_PACKET(error);
+    if(op != OP_OK)
+    {
+        errno = EPROTO;
+        return -1;
+    }
+    READ_PACKET(fd, error, count, sizeof(size_t));
+    if(*count == 0)
+        return 0;
+
+    shard_connection_t* new_map;
+    CHECK_FATAL_EQ(new_map, calloc(*count, sizeof(shard_connection_t)), NULL, NO_MEM_FATAL);
+    for(size_t i = 0; i < *count; ++i)
+    {
+        new_map[i].fd = -1;
+        if(readn_string(fd, new_map[i].sockname, MAX_PATHNAME_API_LENGTH) == -1)
+        {
+            PRINT_WARNING(errno, "Cannot read data inside packet!");
+            free(new_map);
+            return -1;
+        }
+    }
+    *map = new_map;
+    return 0;
+}
+
+// Send the next requests to shard, it's connected if it wasn't yet. Returns 0 on success, -1 on failure
+static int use_shard(shard_connection_t* shard)
+{
+    if(shard->fd == -1)
+    {
+        shard->fd = connect_socket(shard->sockname, connect_msec, connect_abstime);
+        if(shard->fd == -1)
         {
+            PRINT_WARNING(errno, "Cannot connect to the shard %s of the server!", shard->sockname);
             return -1;
         }
     }
 
+    current_shard = shard;
+    fd_server = shard->fd;
+    return 0;
+}
+
+// Send the next requests to the shard owning pathname, the same hash chooses it inside the server
+#define USE_SHARD_OF(pathname) RET_IF(shards_count > 1 && use_shard(&shards[hash_pathname(pathname) % shards_count]) == -1, -1)
+
+int openConnection(const char* sockname, int msec, const struct timespec abstime)
+{
+    int fd = connect_socket(sockname, msec, abstime);
+    RET_IF(fd == -1, -1);
+
+    // a server split among processes replies with its shard map and closes the connection
+    size_t count;
+    shard_connection_t* map = NULL;
+    if(read_shard_map(fd, &count, &map) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    connect_msec = msec;
+    connect_abstime = abstime;
+    if(count == 0)
+    {
+        CHECK_FATAL_EQ(shards, calloc(1, sizeof(shard_connection_t)), NULL, NO_MEM_FATAL);
+        strncpy(shards[0].sockname, sockname, MAX_PATHNAME_API_LENGTH);
+        shards[0].fd = fd;
+        shards_count = 1;
+    }
+    else
+    {
+        close(fd);
+        shards = map;
+        shards_count = count;
+        // a shard restarted by the supervisor breaks its connection, the write failing with EPIPE must not kill the client
+        struct sigaction sig_act;
+        if(sigaction(SIGPIPE, NULL, &sig_act) == 0 && sig_act.sa_handler == SIG_DFL)
+        {
+            sig_act.sa_handler = SIG_IGN;
+            sigaction(SIGPIPE, &sig_act, NULL);
+        }
+    }
+    // the shards are connected by their first request
+    current_shard = &shards[0];
+    fd_server = shards[0].fd;
+
     errno = 0;
-    return result_socket;
+    return 0;
 }
 
 int closeConnection(const char* sockname)
 {
-    return close(fd_server);
+    int result = 0;
+    for(size_t i = 0; i < shards_count; ++i)
+    {
+        if(shards[i].fd == -1)
+            continue;
+
+        // the files still to be pushed are received first, the server writes them while the client is idle
+        current_shard = &shards[i];
+        fd_server = shards[i].fd;
+        server_packet_op_t op;
+        while(shards[i].pending_pushes && count_q(shards[i].pending_pushes) > 0)
+        {
+            if(readn(fd_server, &op, sizeof(server_packet_op_t)) <= 0 || receive_server_message(fd_server, op) == -1)
+                break;
+        }
+        free_q(shards[i].pending_pushes, NULL);
+
+        if(close(shards[i].fd) == -1)
+            result = -1;
+    }
+    free(shards);
+    shards = NULL;
+    shards_count = 0;
+    current_shard = NULL;
+    cache_clear();
+
+    return result;
 }
 
 int openFile(const char* pathname, int flags)
 {
     size_t path_size = strnlen(pathname, MAX_PATHNAME_API_LENGTH);
+    USE_SHARD_OF(pathname);
     int error;
     server_packet_op_t op = OP_OPEN_FILE;
     WRITE_PACKET(fd_server, error, &first_byte, sizeof(char));
@@ -144,8 +560,20 @@ int openFile(const char* pathname, int flags)
 int readFile(const char* pathname, void** buf, size_t* size)
 {
     size_t path_size = strnlen(pathname, MAX_PATHNAME_API_LENGTH);
+    USE_SHARD_OF(pathname);
+    cached_file_t* copy = cache_find(pathname);
+    if(copy)
+    {
+        cache_copy_out(copy, buf, size);
+        if(g_params->print_operations)
+        {
+            PRINT_INFO("readFile on %s ended with success, %zu bytes read from the cache! [%s]", pathname, *size, strerror(0));
+        }
+        return 0;
+    }
+
     int error;
-    server_packet_op_t op = OP_READ_FILE;
+    server_packet_op_t op = cache ? OP_READ_FILE_CACHE : OP_READ_FILE;
     WRITE_PACKET(fd_server, error, &first_byte, sizeof(char));
     WRITE_PACKET(fd_server, error, &op, sizeof(server_packet_op_t));
     WRITE_PACKET_STR(fd_server, error, pathname, path_size);
@@ -153,6 +581,11 @@ int readFile(const char* pathname, void** buf, size_t* size)
     CHECK_FATAL_EQ(error, wait_response_from_server(), -1, "Cannot receive response from server!");
     RET_ON_ERROR(fd_server, pathname);
 
+    uint64_t version = 0;
+    if(cache)
+    {
+        READ_PACKET(fd_server, error, &version, sizeof(uint64_t));
+    }
     READ_PACKET(fd_server, error, size, sizeof(size_t));
     if(*size > 0)
     {
@@ -161,6 +594,8 @@ int readFile(const char* pathname, void** buf, size_t* size)
     }
     else
         *buf = NULL;
+    if(cache)
+        cache_insert(pathname, version, *buf, *size);
 
     if(g_params->print_operations)
     {
@@ -170,7 +605,122 @@ int readFile(const char* pathname, void** buf, size_t* size)
     return 0;
 }
 
-int readNFiles(int N, const char* dirname)
+int readFileIfModified(const char* pathname, uint64_t* version, void** buf, size_t* size)
+{
+    size_t path_size = strnlen(pathname, MAX_PATHNAME_API_LENGTH);
+    USE_SHARD_OF(pathname);
+    *buf = NULL;
+    *size = 0;
+
+    // a copy cached is up to date, its version answers without asking the server
+    cached_file_t* copy = cache_find(pathname);
+    if(copy && copy->version == *version)
+        return 0;
+    if(copy)
+    {
+        cache_copy_out(copy, buf, size);
+        *version = copy->version;
+        return 1;
+    }
+
+    int error;
+    server_packet_op_t op = OP_READ_FILE_IF_MODIFIED;
+    WRITE_PACKET(fd_server, error, &first_byte, sizeof(char));
+    WRITE_PACKET(fd_server, error, &op, sizeof(server_packet_op_t));
+    WRITE_PACKET(fd_server, error, version, sizeof(uint64_t));
+    WRITE_PACKET_STR(fd_server, error, pathname, path_size);
+
+    CHECK_FATAL_EQ(error, wait_response_from_server(), -1, "Cannot receive response from server!");
+    error = read_response_op(fd_server, &op);
+    CHECK_READ_PACKET(error);
+    if(op == OP_NOT_MODIFIED)
+    {
+        if(g_params->print_operations)
+        {
+            PRINT_INFO("readFileIfModified on %s ended with success, not modified! [%s]", pathname, strerror(0));
+        }
+        return 0;
+    }
+    if(op == OP_ERROR)
+    {
+        int err;
+        READ_PACKET(fd_server, error, &err, sizeof(int));
+        errno = err;
+        if(g_params->print_operations)
+        {
+            PRINT_INFO("readFileIfModified on %s ended with failure! [%s]", pathname, strerror(err));
+        }
+        return -1;
+    }
+
+    READ_PACKET(fd_server, error, version, sizeof(uint64_t));
+    READ_PACKET(fd_server, error, size, sizeof(size_t));
+    if(*size > 0)
+    {
+        CHECK_FATAL_ERRNO(*buf, malloc(*size), NO_MEM_FATAL);
+        READ_PACKET(fd_server, error, *buf, *size);
+    }
+
+    if(g_params->print_operations)
+    {
+        PRINT_INFO("readFileIfModified on %s ended with success, %zu bytes read! [%s]", pathname, *size, strerror(0));
+    }
+
+    return 1;
+}
+
+int readFileRange(const char* pathname, size_t offset, size_t length, void** buf, size_t* size)
+{
+    size_t path_size = strnlen(pathname, MAX_PATHNAME_API_LENGTH);
+    USE_SHARD_OF(pathname);
+    *buf = NULL;
+    *size = 0;
+
+    // a copy cached is up to date, the range is taken from it
+    cached_file_t* copy = cache_find(pathname);
+    if(copy)
+    {
+        *size = offset < copy->size ? MIN(length, copy->size - offset) : 0;
+        if(*size > 0)
+        {
+            CHECK_FATAL_ERRNO(*buf, malloc(*size), NO_MEM_FATAL);
+            memcpy(*buf, (char*)copy->data + offset, *size);
+        }
+        if(g_params->print_operations)
+        {
+            PRINT_INFO("readFileRange on %s ended with success, %zu bytes read at %zu from the cache! [%s]", pathname, *size, offset, strerror(0));
+        }
+        return 0;
+    }
+
+    int error;
+    server_packet_op_t op = OP_READ_FILE_RANGE;
+    WRITE_PACKET(fd_server, error, &first_byte, sizeof(char));
+    WRITE_PACKET(fd_server, error, &op, sizeof(server_packet_op_t));
+    WRITE_PACKET_STR(fd_server, error, pathname, path_size);
+    WRITE_PACKET(fd_server, error, &offset, sizeof(size_t));
+    WRITE_PACKET(fd_server, error, &length, sizeof(size_t));
+
+    CHECK_FATAL_EQ(error, wait_response_from_server(), -1, "Cannot receive response from server!");
+    RET_ON_ERROR(fd_server, pathname);
+
+    READ_PACKET(fd_server, error, size, sizeof(size_t));
+    if(*size > 0)
+    {
+        CHECK_FATAL_ERRNO(*buf, malloc(*size), NO_MEM_FATAL);
+        READ_PACKET(fd_server, error, *buf, *size);
+    }
+
+    if(g_params->print_operations)
+    {
+        PRINT_INFO("readFileRange on %s ended with success, %zu bytes read at %zu! [%s]", pathname, *size, offset, strerror(0));
+    }
+
+    return 0;
+}
+
+// Read N files from the shard of fd_server, N <= 0 reads all of them. Returns the count of files read, -1 on failure
+static int read_n_files_from_shard(int N, const char* dirname)
 {
     int error;
     server_packet_op_t op = OP_READN_FILES;
@@ -231,77 +781,107 @@ int readNFiles(int N, const char* dirname)
     return num_read;
 }
 
-int writeFile(const char* pathname, const char* dirname)
+int readNFiles(int N, const char* dirname)
 {
-    if(!pathname)
+    // the files are gathered from the shards in order until N are read
+    int total_read = 0;
+    int result = 0;
+    for(size_t i = 0; i < shards_count && (N <= 0 || total_read < N); ++i)
     {
-        errno = EINVAL;
-        return -1;
+        if(use_shard(&shards[i]) == -1)
+        {
+            result = -1;
+            continue;
+        }
+
+        int num_read = read_n_files_from_shard(N <= 0 ? N : N - total_read, dirname);
+        if(num_read == -1)
+            result = -1;
+        else
+            total_read += num_read;
     }
-    size_t path_len = strnlen(pathname, MAX_PATHNAME_API_LENGTH);
 
-    void* data;
-    size_t data_size;
-    read_file_util(pathname, &data, &data_size);
+    // a shard not available doesn't hide the files read from the others
+    return total_read > 0 || result == 0 ? total_read : -1;
+}
+
+// Write pathname sending only the digest of its data
+// Returns 1 if written, 0 if the server doesn't have the content and it must be uploaded, -1 on failure
+static int write_file_hash(const char* pathname, size_t path_len, bool_t receive_back_files, const void* data, size_t data_size)
+{
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256(data, data_size, digest);
 
     int error;
-    server_packet_op_t op = OP_WRITE_FILE;
+    server_packet_op_t op = OP_WRITE_FILE_HASH;
     WRITE_PACKET(fd_server, error, &first_byte, sizeof(char));
     WRITE_PACKET(fd_server, error, &op, sizeof(server_packet_op_t));
     WRITE_PACKET_STR(fd_server, error, pathname, path_len);
-    bool_t receive_back_files = dirname != NULL;
     WRITE_PACKET(fd_server, error, &receive_back_files, sizeof(bool_t));
+    WRITE_PACKET(fd_server, error, &durability, sizeof(int));
     WRITE_PACKET(fd_server, error, &data_size, sizeof(size_t));
-    
-    if(data_size > 0)
-    {
-        WRITE_PACKET(fd_server, error, data, data_size);
-        free(data);
-    }
+    WRITE_PACKET(fd_server, error, digest, SHA256_DIGEST_SIZE);
 
     CHECK_FATAL_EQ(error, wait_response_from_server(), -1, "Cannot receive response from server!");
-    RET_ON_ERROR(fd_server, pathname);
+    error = read_response_op(fd_server, &op);
+    CHECK_READ_PACKET(error);
+    if(op != OP_ERROR)
+        return 1;
 
-    size_t num_read = 0;
-    if(receive_back_files)
+    int err;
+    READ_PACKET(fd_server, error, &err, sizeof(int));
+    if(err == ENOENT)
+        return 0;
+
+    errno = err;
+    if(g_params->print_operations)
     {
-        READ_PACKET(fd_server, error, &num_read, sizeof(size_t));
-        char full_path[MAX_PATHNAME_API_LENGTH + 1];
+        PRINT_INFO("writeFile on %s ended with failure! [%s]", pathname, strerror(err));
+    }
+    return -1;
+}
 
-        char file_str[MAX_PATHNAME_API_LENGTH + 1];
-        size_t file_size;
-        void* file_data;
+// Write data_size bytes of data as the content of pathname, the caller keeps the ownership of data
+static int write_file_data(const char* pathname, const void* data, size_t data_size, const char* dirname)
+{
+    size_t path_len = strnlen(pathname, MAX_PATHNAME_API_LENGTH);
+    USE_SHARD_OF(pathname);
+    // the notice of the change follows the reply, the copy of the client is dropped at once
+    cache_drop(pathname);
 
-        for(int i = 0; i < num_read; ++i)
+    int error;
+    bool_t receive_back_files = dirname != NULL;
+    // the content is uploaded only if the server doesn't already have it
+    int written = 0;
+    if(write_by_hash && data_size >= WRITE_HASH_MIN_SIZE)
+        written = write_file_hash(pathname, path_len, receive_back_files, data, data_size);
+    RET_IF(written == -1, -1);
+
+    if(written == 0)
+    {
+        server_packet_op_t op = OP_WRITE_FILE;
+        WRITE_PACKET(fd_server, error, &first_byte, sizeof(char));
+        WRITE_PACKET(fd_server, error, &op, sizeof(server_packet_op_t));
+        WRITE_PACKET_STR(fd_server, error, pathname, path_len);
+        WRITE_PACKET(fd_server, error, &receive_back_files, sizeof(bool_t));
+        WRITE_PACKET(fd_server, error, &durability, sizeof(int));
+        WRITE_PACKET(fd_server, error, &data_size, sizeof(size_t));
+        
+        if(data_size > 0)
         {
-            READ_PACKET_STR(fd_server, error, file_str, MAX_PATHNAME_API_LENGTH);
-            READ_PACKET(fd_server, error, &file_size, sizeof(size_t));
-            if(file_size > 0)
-            {
-                CHECK_FATAL_EQ(file_data, malloc(file_size), NULL, NO_MEM_FATAL);
-                READ_PACKET(fd_server, error, file_data, file_size);
-            }
-            else
-                file_data = NULL;
-
-            // save file
-            size_t dirname_len = strnlen(dirname, MAX_PATHNAME_API_LENGTH);
-            size_t filename_len = 0;
-            char* filename = get_filename_from_path(file_str, strnlen(file_str, MAX_PATHNAME_API_LENGTH), &filename_len);
-            if(buildpath(full_path, (char*)dirname, filename, dirname_len, filename_len) == -1)
-            {
-                PRINT_ERROR(errno, "Write file (Replaced Files) %s exceeded max path length (%zu)!", file_str, dirname_len + filename_len + 1);
-            }
-            else
-            {
-                if(write_file_util(full_path, file_data, file_size) == -1)
-                {
-                    PRINT_ERROR(errno, "Write file (Replaced Files) %s failed!", file_str);
-                }
-            }
-            
-            free(file_data);
+            WRITE_PACKET(fd_server, error, (void*)data, data_size);
         }
+
+        CHECK_FATAL_EQ(error, wait_response_from_server(), -1, "Cannot receive response from server!");
+        RET_ON_ERROR(fd_server, pathname);
+    }
+
+    size_t num_read = 0;
+    if(receive_back_files)
+    {
+        READ_PACKET(fd_server, error, &num_read, sizeof(size_t));
+        if(num_read > 0)
+            expect_pushed_files(dirname, num_read);
     }
 
     if(g_params->print_operations)
@@ -313,9 +893,39 @@ int writeFile(const char* pathname, const char* dirname)
     return 0;
 }
 
+int writeFile(const char* pathname, const char* dirname)
+{
+    if(!pathname)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    void* data;
+    size_t data_size;
+    RET_IF(read_file_util(pathname, &data, &data_size) == -1, -1);
+
+    int res = write_file_data(pathname, data, data_size, dirname);
+    free(data);
+    return res;
+}
+
+int writeFileBuffer(const char* pathname, const void* buf, size_t size, const char* dirname)
+{
+    if(!pathname || (!buf && size > 0))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return write_file_data(pathname, buf, size, dirname);
+}
+
 int appendToFile(const char* pathname, void* buf, size_t size, const char* dirname)
 {
     size_t path_size = strnlen(pathname, MAX_PATHNAME_API_LENGTH);
+    USE_SHARD_OF(pathname);
+    cache_drop(pathname);
     int error;
     server_packet_op_t op = OP_APPEND_FILE;
     WRITE_PACKET(fd_server, error, &first_byte, sizeof(char));
@@ -323,6 +933,7 @@ int appendToFile(const char* pathname, void* buf, size_t size, const char* dirna
     WRITE_PACKET_STR(fd_server, error, pathname, path_size);
     bool_t receive_back_files = dirname != NULL;
     WRITE_PACKET(fd_server, error, &receive_back_files, sizeof(bool_t));
+    WRITE_PACKET(fd_server, error, &durability, sizeof(int));
     WRITE_PACKET(fd_server, error, &size, sizeof(size_t));
 
     if(size > 0)
@@ -337,46 +948,55 @@ int appendToFile(const char* pathname, void* buf, size_t size, const char* dirna
     if(receive_back_files)
     {
         READ_PACKET(fd_server, error, &num_read, sizeof(size_t));
-        char full_path[MAX_PATHNAME_API_LENGTH + 1];
+        if(num_read > 0)
+            expect_pushed_files(dirname, num_read);
+    }
 
-        char file_str[MAX_PATHNAME_API_LENGTH + 1];
-        size_t file_size;
-        void* file_data = NULL;
+    if(g_params->print_operations)
+    {
+        PRINT_INFO("appendFile on %s ended with success! %zu bytes written and %zu files replaced! [%s]", 
+                                pathname, size, num_read, strerror(0));
+    }
 
-        for(int i = 0; i < num_read; ++i)
-        {
-            READ_PACKET_STR(fd_server, error, file_str, MAX_PATHNAME_API_LENGTH);
-            READ_PACKET(fd_server, error, &file_size, sizeof(size_t));
-            if(file_size > 0)
-            {
-                CHECK_FATAL_EQ(file_data, malloc(file_size), NULL, NO_MEM_FATAL);
-                READ_PACKET(fd_server, error, file_data, file_size);
-            }
+    return 0;
+}
 
-            // save file
-            size_t dirname_len = strnlen(dirname, MAX_PATHNAME_API_LENGTH);
-            size_t filename_len = 0;
-            char* filename = get_filename_from_path(file_str, strnlen(file_str, MAX_PATHNAME_API_LENGTH), &filename_len);
-            if(buildpath(full_path, (char*)dirname, filename, dirname_len, filename_len) == -1)
-            {
-                PRINT_ERROR(errno, "Append file (Replaced Files) %s exceeded max path length (%zu)!", file_str, dirname_len + filename_len + 1);
-            }
-            else
-            {
-                if(write_file_util(full_path, file_data, file_size) == -1)
-                {
-                    PRINT_ERROR(errno, "Append file (Replaced Files) %s failed!", file_str);
-                }
-            }
+int writeFileAt(const char* pathname, size_t offset, void* buf, size_t size, const char* dirname)
+{
+    size_t path_size = strnlen(pathname, MAX_PATHNAME_API_LENGTH);
+    USE_SHARD_OF(pathname);
+    cache_drop(pathname);
+    int error;
+    server_packet_op_t op = OP_WRITE_FILE_AT;
+    WRITE_PACKET(fd_server, error, &first_byte, sizeof(char));
+    WRITE_PACKET(fd_server, error, &op, sizeof(server_packet_op_t));
+    WRITE_PACKET_STR(fd_server, error, pathname, path_size);
+    bool_t receive_back_files = dirname != NULL;
+    WRITE_PACKET(fd_server, error, &receive_back_files, sizeof(bool_t));
+    WRITE_PACKET(fd_server, error, &durability, sizeof(int));
+    WRITE_PACKET(fd_server, error, &offset, sizeof(size_t));
+    WRITE_PACKET(fd_server, error, &size, sizeof(size_t));
 
-            free(file_data);
-        }
+    if(size > 0)
+    {
+        WRITE_PACKET(fd_server, error, buf, size);
+    }
+
+    CHECK_FATAL_EQ(error, wait_response_from_server(), -1, "Cannot receive response from server!");
+    RET_ON_ERROR(fd_server, pathname);
+
+    size_t num_read = 0;
+    if(receive_back_files)
+    {
+        READ_PACKET(fd_server, error, &num_read, sizeof(size_t));
+        if(num_read > 0)
+            expect_pushed_files(dirname, num_read);
     }
 
     if(g_params->print_operations)
     {
-        PRINT_INFO("appendFile on %s ended with success! %zu bytes written and %zu files replaced! [%s]", 
-                                pathname, size, num_read, strerror(0));
+        PRINT_INFO("writeFileAt on %s ended with success! %zu bytes written at %zu and %zu files replaced! [%s]", 
+                                pathname, size, offset, num_read, strerror(0));
     }
 
     return 0;
@@ -385,6 +1005,7 @@ int appendToFile(const char* pathname, void* buf, size_t size, const char* dirna
 int closeFile(const char* pathname)
 {
     size_t path_size = strnlen(pathname, MAX_PATHNAME_API_LENGTH);
+    USE_SHARD_OF(pathname);
     int error;
     server_packet_op_t op = OP_CLOSE_FILE;
     WRITE_PACKET(fd_server, error, &first_byte, sizeof(char));
@@ -405,6 +1026,8 @@ int closeFile(const char* pathname)
 int removeFile(const char* pathname)
 {
     size_t path_size = strnlen(pathname, MAX_PATHNAME_API_LENGTH);
+    USE_SHARD_OF(pathname);
+    cache_drop(pathname);
     int error;
     server_packet_op_t op = OP_REMOVE_FILE;
     WRITE_PACKET(fd_server, error, &first_byte, sizeof(char));
@@ -425,6 +1048,7 @@ int removeFile(const char* pathname)
 int lockFile(const char* pathname)
 {
     size_t path_size = strnlen(pathname, MAX_PATHNAME_API_LENGTH);
+    USE_SHARD_OF(pathname);
     int error;
     server_packet_op_t op = OP_LOCK_FILE;
     WRITE_PACKET(fd_server, error, &first_byte, sizeof(char));
@@ -442,9 +1066,33 @@ int lockFile(const char* pathname)
     return 0;
 }
 
+int lockFileEx(const char* pathname, int flags, long timeout_ms)
+{
+    size_t path_size = strnlen(pathname, MAX_PATHNAME_API_LENGTH);
+    USE_SHARD_OF(pathname);
+    int error;
+    server_packet_op_t op = OP_LOCK_FILE_EX;
+    WRITE_PACKET(fd_server, error, &first_byte, sizeof(char));
+    WRITE_PACKET(fd_server, error, &op, sizeof(server_packet_op_t));
+    WRITE_PACKET(fd_server, error, &flags, sizeof(int));
+    WRITE_PACKET(fd_server, error, &timeout_ms, sizeof(long));
+    WRITE_PACKET_STR(fd_server, error, pathname, path_size);
+
+    CHECK_FATAL_EQ(error, wait_response_from_server(), -1, "Cannot receive response from server!");
+    RET_ON_ERROR(fd_server, pathname);
+
+    if(g_params->print_operations)
+    {
+        PRINT_INFO("lockFileEx on %s ended with success! [%s]", pathname, strerror(0));
+    }
+
+    return 0;
+}
+
 int unlockFile(const char* pathname)
 {
     size_t path_size = strnlen(pathname, MAX_PATHNAME_API_LENGTH);
+    USE_SHARD_OF(pathname);
     int error;
     server_packet_op_t op = OP_UNLOCK_FILE;
     WRITE_PACKET(fd_server, error, &first_byte, sizeof(char));
@@ -460,4 +1108,42 @@ int unlockFile(const char* pathname)
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+int setDurability(int level)
+{
+    if(level < D_DEFAULT || level > D_SYNC)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    durability = level;
+    return 0;
+}
+
+int setWriteByHash(int enabled)
+{
+    write_by_hash = enabled ? TRUE : FALSE;
+    return 0;
+}
+
+int setReadCache(size_t max_bytes)
+{
+    if(max_bytes == 0)
+    {
+        cache_clear();
+        icl_hash_destroy(cache, NULL, NULL);
+        cache = NULL;
+        cache_max_size = 0;
+        return 0;
+    }
+
+    if(!cache)
+    {
+        CHECK_ERROR_EQ(cache, icl_hash_create(CACHE_BUCKETS, NULL, NULL), NULL, -1, "Cannot create the cache!");
+    }
+    cache_max_size = max_bytes;
+    cache_make_room(0);
+    return 0;
+}
@@ -10,6 +10,7 @@
 #include "client_params.h"
 #include "utils.h"
 #include "file_storage_api.h"
+#include "parallel_upload.h"
 
 // Print --help for this program
 void print_help();
@@ -56,6 +57,8 @@ long current_ms_between_reqs = 0;
 char* current_save_folder = NULL;
 // Current folder where to save replaced files
 char* current_save_repl_folder = NULL;
+// Current connections uploading the files of a folder, 1 uploads them one at a time over the main connection
+long current_upload_connections = 1;
 
 // Utility macro to make an api request and wait for sleep timer
 #define API_CALL(fn_call) fn_call; \
@@ -117,6 +120,9 @@ int main(int argc, char **argv)
         case 'D':
             current_save_repl_folder = curr_opt->args;
             break;
+        case 'P':
+            current_upload_connections = *((long*)&curr_opt->args);
+            break;
 
         case 'w':
             send_folder_files(curr_opt->args);
@@ -254,7 +260,23 @@ int send_files_inside_dir_rec(const char* dirname, bool_t send_all, int* remaini
 void send_folder_files(pair_int_str_t* pair)
 {
     int n = pair->num;
-    send_files_inside_dir_rec(pair->str, n == 0, &n);
+    if(current_upload_connections <= 1)
+    {
+        send_files_inside_dir_rec(pair->str, n == 0, &n);
+        return;
+    }
+
+    // the round trips of each file overlap with the ones of the others, the files are read ahead meanwhile
+    upload_options_t options = {
+        .sockname = g_params->server_socket_name,
+        .connections = current_upload_connections,
+        .repl_dirname = current_save_repl_folder,
+        .ms_between_reqs = current_ms_between_reqs
+    };
+    if(upload_dir_parallel(pair->str, n, &options) == -1)
+    {
+        PRINT_ERROR(errno, "Parallel upload of %s failed!", pair->str);
+    }
 }
 
 void send_files(queue_t* files)
@@ -353,7 +375,7 @@ int remove_file(const char* pathname)
 
 void print_help()
 {
-    // hf:w:W:r:R:d:l:u:c:p
+    // hf:w:W:r:R:d:l:u:c:pD:t:P:
     PRINT_INFO(
             "-h print all commands available\n"
             "-f pathname, socket file pathname to the server\n"
@@ -363,6 +385,7 @@ void print_help()
             "-R [n=0], read N numbers of files stored inside the server (n=0 means all)\n"
             "-d dirname, dirname in which every file reader with -r -R flags will be saved, can only be used with those flags.\n"
             "-t time, time between every request-response from the server\n"
+            "-P n, number of connections uploading in parallel the files of the next -w flags (default 1)\n"
             "-c file1[,file2], which files will be removed from the server separated by a comma (if they exists)\n"
             "-l file1[,file2], which files will be locked from the server separated by a comma (if they exists)\n"
             "-u file1[,file2], which files will be unlocked from the server separated by a comma (if they exists)\n"
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <dirent.h>
+
+#include "parallel_upload.h"
+#include "file_storage_api.h"
+#include "queue.h"
+
+// A file read ahead, waiting for a connection to upload it
+typedef struct upload_job {
+    char* pathname;
+    void* data;
+    size_t size;
+} upload_job_t;
+
+// State shared by the reader and the uploaders, everything is protected by mutex
+typedef struct upload_pool {
+    const upload_options_t* options;
+    queue_t* jobs;
+    size_t max_jobs;
+    size_t buffered_bytes;
+    // the reader walked every folder, the uploaders quit once the jobs left are taken
+    bool_t done;
+    // uploaders still running and the ones which could connect
+    int running;
+    int connected;
+    int uploaded;
+    pthread_mutex_t mutex;
+    pthread_cond_t job_ready;
+    pthread_cond_t job_taken;
+} upload_pool_t;
+
+// Wait between the requests of a connection, like the sequential upload does
+#define UPLOAD_CALL(options, fn_call) fn_call; \
+                            if((options)->ms_between_reqs > 0) \
+                                usleep(1000 * (options)->ms_between_reqs)
+
+static void free_job(upload_job_t* job)
+{
+    free(job->pathname);
+    free(job->data);
+    free(job);
+}
+
+// Create, write and close the file of job over the connection of the calling thread
+static int upload_file(const upload_job_t* job, const upload_options_t* options)
+{
+    int result = UPLOAD_CALL(options, openFile(job->pathname, O_CREATE | O_LOCK));
+    RET_IF(result == -1, -1);
+
+    int did_write = UPLOAD_CALL(options, writeFileBuffer(job->pathname, job->data, job->size, options->repl_dirname));
+    UPLOAD_CALL(options, closeFile(job->pathname));
+    return did_write;
+}
+
+// Take the next job of pool, waits until one is read. Returns NULL once the reader is done and no job is left
+static upload_job_t* take_job(upload_pool_t* pool)
+{
+    LOCK_MUTEX(&pool->mutex);
+    while(count_q(pool->jobs) == 0 && !pool->done)
+        COND_WAIT(&pool->job_ready, &pool->mutex);
+
+    upload_job_t* job = dequeue(pool->jobs);
+    if(job)
+    {
+        pool->buffered_bytes -= job->size;
+        COND_SIGNAL(&pool->job_taken);
+    }
+    UNLOCK_MUTEX(&pool->mutex);
+    return job;
+}
+
+// Thread of an uploader, the connection opened belongs to it alone
+static void* run_uploader(void* arg)
+{
+    upload_pool_t* pool = arg;
+    const upload_options_t* options = pool->options;
+
+    struct timespec timeout = { time(0) + 5, 0 };
+    if(openConnection(options->sockname, 400, timeout) == -1)
+    {
+        PRINT_ERROR(errno, "Parallel upload couldn't connect to host!");
+        LOCK_MUTEX(&pool->mutex);
+        --pool->running;
+        COND_SIGNAL(&pool->job_taken);
+        UNLOCK_MUTEX(&pool->mutex);
+        return NULL;
+    }
+    EXEC_WITH_MUTEX(++pool->connected, &pool->mutex);
+
+    upload_job_t* job;
+    while((job = take_job(pool)) != NULL)
+    {
+        if(upload_file(job, options) != -1)
+        {
+            EXEC_WITH_MUTEX(++pool->uploaded, &pool->mutex);
+        }
+        free_job(job);
+    }
+
+    if(closeConnection(options->sockname) == -1)
+    {
+        PRINT_ERROR(errno, "Parallel upload had problems during close connection!");
+    }
+    LOCK_MUTEX(&pool->mutex);
+    --pool->running;
+    COND_SIGNAL(&pool->job_taken);
+    UNLOCK_MUTEX(&pool->mutex);
+    return NULL;
+}
+
+// Queue a job read ahead, waits while too many files or bytes are waiting for the uploaders
+// A single file always fits. Returns -1 if every uploader quit, the job is freed
+static int add_job(upload_pool_t* pool, upload_job_t* job)
+{
+    LOCK_MUTEX(&pool->mutex);
+    while(pool->running > 0 && count_q(pool->jobs) > 0
+            && (count_q(pool->jobs) >= pool->max_jobs || pool->buffered_bytes + job->size > UPLOAD_READ_AHEAD_BYTES))
+        COND_WAIT(&pool->job_taken, &pool->mutex);
+
+    if(pool->running == 0)
+    {
+        UNLOCK_MUTEX(&pool->mutex);
+        free_job(job);
+        return -1;
+    }
+
+    enqueue(pool->jobs, job);
+    pool->buffered_bytes += job->size;
+    COND_SIGNAL(&pool->job_ready);
+    UNLOCK_MUTEX(&pool->mutex);
+    return 0;
+}
+
+// Read ahead the files inside dirname and its subfolders for the uploaders, like the sequential walk of the client
+// Returns -1 once the uploaders quit, 0 otherwise
+static int read_dir_rec(upload_pool_t* pool, const char* dirname, bool_t send_all, int* remaining)
+{
+    DIR* d;
+    struct dirent *dir;
+
+    CHECK_ERROR_EQ(d, opendir(dirname), NULL, 0, "Parallel upload cannot opendir %s!", dirname);
+
+    char pathname_file[MAX_PATHNAME_API_LENGTH + 1];
+    size_t dir_len = strnlen(dirname, MAX_PATHNAME_API_LENGTH);
+
+    int res = 0;
+    while (res != -1 && (dir = readdir(d)) != NULL && (send_all == TRUE || *remaining > 0)) {
+        bool_t is_dir = dir->d_type == DT_DIR;
+        if(is_dir && (strcmp(dir->d_name,".") == 0 || strcmp(dir->d_name,"..") == 0))
+            continue;
+
+        size_t file_len = strnlen(dir->d_name, MAX_PATHNAME_API_LENGTH);
+        if(buildpath(pathname_file, dirname, dir->d_name, dir_len, file_len) == -1)
+        {
+            PRINT_ERROR(errno, "Write File %s exceeded max path length (%zu)!", dir->d_name, dir_len + file_len + 1);
+            continue;
+        }
+
+        if(is_dir)
+        {
+            res = read_dir_rec(pool, pathname_file, send_all, remaining);
+            continue;
+        }
+
+        upload_job_t* job;
+        CHECK_FATAL_EQ(job, malloc(sizeof(upload_job_t)), NULL, NO_MEM_FATAL);
+        if(read_file_util(pathname_file, &job->data, &job->size) == -1)
+        {
+            free(job);
+            continue;
+        }
+        CHECK_FATAL_EQ(job->pathname, strndup(pathname_file, MAX_PATHNAME_API_LENGTH), NULL, NO_MEM_FATAL);
+
+        res = add_job(pool, job);
+        *remaining -= 1;
+    }
+
+    closedir(d);
+    return res;
+}
+
+int upload_dir_parallel(const char* dirname, int n, const upload_options_t* options)
+{
+    RET_IF(!dirname || !options || options->connections <= 0, -1);
+
+    int connections = MIN(options->connections, UPLOAD_MAX_CONNECTIONS);
+    upload_pool_t pool;
+    memset(&pool, 0, sizeof(upload_pool_t));
+    pool.options = options;
+    pool.jobs = create_q();
+    pool.max_jobs = connections * UPLOAD_READ_AHEAD_FILES;
+    pool.running = connections;
+    INIT_MUTEX(&pool.mutex);
+    INIT_COND(&pool.job_ready);
+    INIT_COND(&pool.job_taken);
+
+    pthread_t* uploaders;
+    CHECK_FATAL_EQ(uploaders, malloc(connections * sizeof(pthread_t)), NULL, NO_MEM_FATAL);
+    for(int i = 0; i < connections; ++i)
+        CHECK_FATAL_EVAL(pthread_create(&uploaders[i], NULL, run_uploader, &pool) != 0, "Cannot start an upload thread!");
+
+    read_dir_rec(&pool, dirname, n == 0, &n);
+
+    LOCK_MUTEX(&pool.mutex);
+    pool.done = TRUE;
+    COND_BROADCAST(&pool.job_ready);
+    UNLOCK_MUTEX(&pool.mutex);
+    for(int i = 0; i < connections; ++i)
+        pthread_join(uploaders[i], NULL);
+    free(uploaders);
+
+    // the jobs left are there only if every uploader quit
+    free_q(pool.jobs, FREE_FUNC(free_job));
+    pthread_mutex_destroy(&pool.mutex);
+    pthread_cond_destroy(&pool.job_ready);
+    pthread_cond_destroy(&pool.job_taken);
+
+    if(g_params->print_operations)
+    {
+        PRINT_INFO("Parallel upload of %s ended! %d files written over %d connections!", dirname, pool.uploaded, pool.connected);
+    }
+    return pool.connected > 0 ? pool.uploaded : -1;
+}
@@ -52,10 +52,11 @@ avgSumBytesInMB() {
 
 NUM_LOGS=$(grep "\- START \-" -c $LOG_PATH)
 
-N_READ=$(grep "OP_READ_FILE" -c $LOG_PATH)
-AVG_READ=$(grep "OP_READ_FILE" $LOG_PATH | grep -o "data read [[:digit:]]*" | grep -o "[[:digit:]]*" | avgSumBytesInMB)
-N_WRITE=$(grep "OP_WRITE_FILE" -c $LOG_PATH)
-AVG_WRITE=$(grep "OP_WRITE_FILE" $LOG_PATH | grep -o "data written [[:digit:]]*" | grep -o "[[:digit:]]*" | avgSumBytesInMB)
+# the exact op names, OP_READ_FILE and OP_WRITE_FILE are prefixes of the range, cached, conditional, positioned and hash ops
+N_READ=$(grep "OP_READ_FILE run by" -c $LOG_PATH)
+AVG_READ=$(grep "OP_READ_FILE run by" $LOG_PATH | grep -o "data read [[:digit:]]*" | grep -o "[[:digit:]]*" | avgSumBytesInMB)
+N_WRITE=$(grep "OP_WRITE_FILE run by" -c $LOG_PATH)
+AVG_WRITE=$(grep "OP_WRITE_FILE run by" $LOG_PATH | grep -o "data written [[:digit:]]*" | grep -o "[[:digit:]]*" | avgSumBytesInMB)
 N_LOCK=$(grep "OP_LOCK_FILE" -c $LOG_PATH)
 N_OPENLOCK=$(grep "OP_OPEN_FILE" $LOG_PATH | grep -c "flags 2\|flags 3")
 N_UNLOCK=$(grep "OP_UNLOCK_FILE" -c $LOG_PATH)
@@ -0,0 +1,103 @@
+#!/bin/bash
+
+################################################################################################
+# This script runs the fourth test case, it generates some random data and checks the files    #
+# survive the restarts of the server. The first half is written and the server is closed, so   #
+# it's restored from the snapshot, the second half is written and the server is killed, so it  #
+# is restored from the write-ahead log. In the end every file is read back and compared with   #
+# the original, both with a single server process and with the files split among processes    #
+################################################################################################
+
+
+MAINDIR=$(pwd)
+TESTDIR=$MAINDIR/tests
+SCRIPTDIR=$MAINDIR/script
+DATADIR=$TESTDIR/test4/test_data
+NFILES=12
+
+rm -rf $DATADIR && mkdir -p $DATADIR
+
+# the character filter reduces each file to about 1/4 of its size
+for i in $(seq 1 $NFILES)
+do
+   head -c ${i}MB /dev/urandom | tr -dc 'A-Za-z0-9' > $DATADIR/file$i.txt
+done
+
+FAILED=0
+
+runTest() {
+    startServer() {
+        $SERVER_PATH/server.out ./$NAME-config.txt &
+        SERVER_PID=$!
+        sleep 2s
+    }
+
+    PROCESSES=$1
+    NAME=processes$PROCESSES
+
+    rm -rf $TESTDIR/test4/$NAME && mkdir -p $TESTDIR/test4/$NAME
+    cd $TESTDIR/test4/$NAME
+
+    SERVER_PATH="../../../server/bin"
+    TMP_SOCKET="./tmp_socket.sk"
+
+    echo "SERVER_SOCKET_NAME=$TMP_SOCKET
+SERVER_THREAD_WORKERS=4
+SERVER_BYTE_STORAGE_AVAILABLE=128MB
+SERVER_MAX_FILES_NUM=100
+POLICY_NAME=LRU
+SERVER_BACKLOG_NUM=10
+SERVER_LOG_NAME=$NAME-logs.log
+SNAPSHOT_PATH=./snapshot.bin
+WAL_PATH=./wal.log
+SHARD_PROCESSES=$PROCESSES" > $NAME-config.txt
+
+    chmod +x $SCRIPTDIR/utils/run_client.sh
+    HALF=$(($NFILES / 2))
+    FIRST_FILES=$(seq -f "$DATADIR/file%g.txt" 1 $HALF | paste -sd,)
+    SECOND_FILES=$(seq -f "$DATADIR/file%g.txt" $(($HALF + 1)) $NFILES | paste -sd,)
+
+    # Write the first half, the snapshot written while closing keeps it
+    startServer
+    $SCRIPTDIR/utils/run_client.sh 1 $TMP_SOCKET "-p -t 0 -W $FIRST_FILES"
+    kill -s HUP "$SERVER_PID"
+    wait $SERVER_PID
+
+    # Write the second half, only the write-ahead log keeps it: every process is killed at once
+    startServer
+    $SCRIPTDIR/utils/run_client.sh 2 $TMP_SOCKET "-p -t 0 -W $SECOND_FILES"
+    kill -s KILL "$SERVER_PID" $(pgrep -P "$SERVER_PID")
+    wait $SERVER_PID 2>/dev/null
+
+    # Read all files OK -> Each file must match the original
+    startServer
+    $SCRIPTDIR/utils/run_client.sh 3 $TMP_SOCKET "-p -t 0 -R 0"
+    kill -s HUP "$SERVER_PID"
+    wait $SERVER_PID
+
+    for i in $(seq 1 $NFILES)
+    do
+        if ! cmp -s $DATADIR/file$i.txt ./client3/readed/file$i.txt ; then
+            echo "file$i.txt was not restored with $PROCESSES server processes!"
+            FAILED=1
+        fi
+    done
+
+    if [ -S "$TMP_SOCKET" ] ; then
+        rm "$TMP_SOCKET"
+    fi
+    cd $MAINDIR
+}
+
+echo "------------- RUNNING TEST4 1 PROCESS -------------"
+runTest 1
+
+echo "------------- RUNNING TEST4 2 PROCESSES -------------"
+runTest 2
+
+if [ $FAILED -eq 0 ] ; then
+    echo "------------- TEST4 PASSED -------------"
+else
+    echo "------------- TEST4 FAILED -------------"
+fi
+exit $FAILED
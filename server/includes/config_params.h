@@ -18,7 +18,7 @@ configuration_params_t* load_config_params(const char* config_path_name);
 unsigned int config_get_num_workers(const configuration_params_t* config);
 
 // Get the max server size of this config
-unsigned int config_get_max_server_size(const configuration_params_t* config);
+size_t config_get_max_server_size(const configuration_params_t* config);
 
 // Get the max file count of this config
 unsigned int config_get_max_files_count(const configuration_params_t* config);
@@ -35,6 +35,72 @@ void config_get_log_name(const configuration_params_t* config, char output[MAX_P
 // Get the policy name of this config
 void config_get_policy_name(const configuration_params_t* config, char output[MAX_POLICY_LENGTH + 1]);
 
+// Get the lock queue policy name of this config
+void config_get_lock_policy_name(const configuration_params_t* config, char output[MAX_POLICY_LENGTH + 1]);
+
+// Get the pathname of the snapshot of the files of this server, empty if the snapshots are disabled
+void config_get_snapshot_path(const configuration_params_t* config, char output[MAX_PATHNAME_API_LENGTH + 1]);
+
+// Get the seconds between two snapshots of this config, 0 means only on shutdown
+unsigned int config_get_snapshot_interval(const configuration_params_t* config);
+
+// Get the pathname of the write-ahead log of this server, empty if the writes are not logged
+void config_get_wal_path(const configuration_params_t* config, char output[MAX_PATHNAME_API_LENGTH + 1]);
+
+// Get the default durability of the writes of this config (ASYNC, WRITTEN or SYNC)
+void config_get_wal_durability_name(const configuration_params_t* config, char output[MAX_POLICY_LENGTH + 1]);
+
+// Get the directory of the disk tier receiving the evicted files, empty if the evicted files are discarded
+void config_get_disk_tier_path(const configuration_params_t* config, char output[MAX_PATHNAME_API_LENGTH + 1]);
+
+// Get the max bytes stored by the disk tier, separate from the storage available in memory
+size_t config_get_disk_tier_capacity(const configuration_params_t* config);
+
+// Get the compression of the contents of the files of this config (NONE or LZ)
+void config_get_compression_name(const configuration_params_t* config, char output[MAX_POLICY_LENGTH + 1]);
+
+// Get the deduplication of the contents of the files of this config (NONE or SHA256)
+void config_get_deduplication_name(const configuration_params_t* config, char output[MAX_POLICY_LENGTH + 1]);
+
+// Get how the big contents of the files of this config get huge pages (NONE, MADVISE or HUGETLB)
+void config_get_huge_pages_name(const configuration_params_t* config, char output[MAX_POLICY_LENGTH + 1]);
+
+// Get the NUMA placement of the workers and of the contents of this config (NONE or AUTO)
+void config_get_numa_placement_name(const configuration_params_t* config, char output[MAX_POLICY_LENGTH + 1]);
+
+// Get the percentage of the storage used which wakes up the reclaimer, 0 means the files are evicted only by the writes
+unsigned int config_get_eviction_high_watermark(const configuration_params_t* config);
+
+// Get the percentage of the storage used the reclaimer evicts the files down to
+unsigned int config_get_eviction_low_watermark(const configuration_params_t* config);
+
+// Get the max bytes of the evicted files waiting to be pushed to each client, 0 means the default
+size_t config_get_send_back_max_bytes(const configuration_params_t* config);
+
+// Get the max bytes of the output waiting for each client, a client going over it is disconnected, 0 means the default
+size_t config_get_output_buffer_max_bytes(const configuration_params_t* config);
+
+// Get the seconds a client can leave its output or a request half read before being disconnected, 0 means the default
+unsigned int config_get_slow_client_timeout(const configuration_params_t* config);
+
+// Get the count of the shards the files are split into, each one owned by a single worker pinned to its own core
+// 0 or 1 means the files are shared by every worker
+unsigned int config_get_shards_count(const configuration_params_t* config);
+
+// Get the count of the server processes the files are split into, 0 or 1 means a single process
+unsigned int config_get_shard_processes(const configuration_params_t* config);
+
+// Get the index of the process among the shard processes, 0 for a single process
+unsigned int config_get_shard_process_index(const configuration_params_t* config);
+
+// Get the I/O engine of the connection handler of this config (EPOLL or IO_URING)
+void config_get_io_engine_name(const configuration_params_t* config, char output[MAX_POLICY_LENGTH + 1]);
+
+// Get a copy of config for the shard process index: its socket, log, snapshot, write-ahead log and disk tier paths end
+// with .index and it gets its slice of the storage, files count and disk tier capacity
+// Returns NULL if config has no shard processes or with errno ENAMETOOLONG if a path gets too long, free it with free_config
+configuration_params_t* config_for_shard_process(const configuration_params_t* config, unsigned int index);
+
 // Free this config
 void free_config(configuration_params_t* config);
 
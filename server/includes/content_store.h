@@ -0,0 +1,73 @@
+#ifndef _CONTENT_STORE_H_
+#define _CONTENT_STORE_H_
+
+#include <stdint.h>
+
+#include "segment_list.h"
+#include "sha256.h"
+#include "utils.h"
+
+// Contents of the files indexed by their SHA-256 digest, the files written with the same bytes share a single copy
+// Each content lives as long as a segment list references it, the files stored by the FS are counted separately
+// so its memory is accounted once while at least one of them holds it
+typedef struct content_store content_store_t;
+typedef struct content_entry content_entry_t;
+
+// Metrics of a content store
+typedef struct content_store_metrics {
+    size_t stored;
+    size_t hits;
+    size_t saved_bytes;
+    size_t max_entries;
+} content_store_metrics_t;
+
+// Create an empty content store, used by a single FS so the files holding its contents are counted under the lock of that FS
+content_store_t* create_content_store();
+
+// Find the content with digest and take a reference to it, NULL if not stored or if store is NULL
+content_entry_t* content_store_find(content_store_t* store, const uint8_t digest[SHA256_DIGEST_SIZE]);
+
+// Store size bytes of data with digest and take a reference to it, the store becomes the owner of data
+// If the same digest is already stored data is freed and the stored content is returned
+content_entry_t* content_store_add(content_store_t* store, const uint8_t digest[SHA256_DIGEST_SIZE], void* data, size_t size);
+
+// Find the content of entry inside store and take a reference to it, entry can belong to another store
+// If store doesn't have it yet it gets its own copy of the data. NULL if store or entry is NULL
+content_entry_t* content_store_adopt(content_store_t* store, const content_entry_t* entry);
+
+// Drop a reference taken by find or add, the content is freed with the last one
+void content_store_release(content_entry_t* entry);
+
+// Give a reference of entry to sl as its whole content, dropped once sl doesn't use it anymore
+void content_entry_attach(content_entry_t* entry, segment_list_t* sl);
+
+// Get the data of this content
+const void* content_entry_get_data(const content_entry_t* entry);
+
+// Get the size of this content
+size_t content_entry_get_size(const content_entry_t* entry);
+
+// Get the number of files of the FS holding this content
+// The file counts are changed and read only with the FS write lock acquired (or its read lock to read them)
+size_t content_entry_get_files(const content_entry_t* entry);
+
+// Count a file of the FS holding this content
+void content_entry_add_file(content_entry_t* entry);
+
+// Stop counting a file of the FS holding this content
+void content_entry_remove_file(content_entry_t* entry);
+
+// Count a file holding this content among the victims of a replacement, returns the victims counted so far
+// The content is freed by the replacement once they match its files
+size_t content_entry_add_victim(content_entry_t* entry);
+
+// Reset the victims counted by a replacement
+void content_entry_clear_victims(content_entry_t* entry);
+
+// Get the metrics of this store
+content_store_metrics_t content_store_get_metrics(content_store_t* store);
+
+// Free this store and the contents left inside, every list referencing them must be already freed
+void free_content_store(content_store_t* store);
+
+#endif
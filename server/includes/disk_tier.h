@@ -0,0 +1,54 @@
+#ifndef _DISK_TIER_H_
+#define _DISK_TIER_H_
+
+#include "segment_list.h"
+#include "utils.h"
+
+// Second tier of the storage inside a local directory, the files evicted from memory are demoted here and promoted
+// back when opened again. Each file is stored in its own file of the directory, the index is kept only in memory
+// so the tier starts empty on every run
+typedef struct disk_tier disk_tier_t;
+
+// Metrics of a disk tier
+typedef struct disk_tier_metrics {
+    size_t demoted;
+    size_t promoted;
+    size_t misses;
+    size_t dropped;
+    size_t max_size;
+} disk_tier_metrics_t;
+
+// Create a disk tier inside dir holding at most capacity bytes, a demoter thread writes the evicted files
+// The files left inside dir by a previous run are deleted. Returns NULL on failure with errno set
+disk_tier_t* create_disk_tier(const char* dir, size_t capacity);
+
+// Register the file pathname as demoted before its content is given, called with the FS write lock acquired while the
+// file is replaced so it's never missing from both the memory and this tier. The promotions of the file wait until
+// disk_tier_demote gives its content
+void disk_tier_reserve(disk_tier_t* tier, const char* pathname);
+
+// Demote the file pathname to this tier, the content is written later by the demoter and this tier becomes its owner
+// The file must have been registered by disk_tier_reserve or taken by disk_tier_take, if it was dropped meanwhile
+// the content is stale and just freed, as it is if tier is NULL
+// The oldest files are dropped when the capacity is exceeded
+void disk_tier_demote(disk_tier_t* tier, const char* pathname, segment_list_t* content);
+
+// Take the file pathname out of this tier to promote it, its content is returned inside a new buffer of size bytes
+// given by content_alloc. The file stays registered until it's dropped once back in memory or demoted again
+// Returns 1 if found, 0 if the file is not inside this tier, -1 if its content cannot be read anymore
+int disk_tier_take(disk_tier_t* tier, const char* pathname, void** data, size_t* size);
+
+// Drop the file pathname from this tier, called with the FS write lock acquired once a promoted file is back in memory
+// and when a file is removed or created, so an older content is never promoted over it
+void disk_tier_drop(disk_tier_t* tier, const char* pathname);
+
+// Check whether the file pathname is inside this tier
+bool_t disk_tier_contains(disk_tier_t* tier, const char* pathname);
+
+// Get the metrics of this tier
+disk_tier_metrics_t disk_tier_get_metrics(disk_tier_t* tier);
+
+// Stop the demoter, delete the files of this tier and free it
+void free_disk_tier(disk_tier_t* tier);
+
+#endif
@@ -3,25 +3,60 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <sys/types.h>
 #include "queue.h"
 #include "linked_list.h"
+#include "segment_list.h"
+#include "client_set.h"
+#include "wait_queue.h"
+#include "content_store.h"
 #include "utils.h"
 
 typedef struct file_stored file_stored_t;
 
+// Bytes appended or written since the last compression after which the content of a file is compressed again
+#define FILE_COMPRESS_MIN_SIZE (16 * 1024)
+
+// NUMA nodes whose reads are counted by each file, the reads of the other nodes are ignored
+#define FILE_NUMA_NODES 8
+// Reads from a node after which the content of a file may be moved to it
+#define FILE_NUMA_MIN_READS 16
+
+// How the next lock owner is chosen among the clients waiting for a file
+// FIFO gives the lock to the oldest waiter, LIFO to the newest one (higher throughput, but a waiter may starve)
+typedef enum lock_handoff {
+    LOCK_HANDOFF_FIFO,
+    LOCK_HANDOFF_LIFO
+} lock_handoff_t;
+
+// Lock metrics of a file, waits are measured from the enqueue to the handoff of the lock
+typedef struct lock_wait_metrics {
+    size_t acquisitions;
+    size_t waits;
+    uint64_t total_wait_ns;
+    uint64_t max_wait_ns;
+} lock_wait_metrics_t;
+
 // Create and initialize a file with pathname
 file_stored_t* create_file(const char* pathname);
 
 // Get pathname of a file
 char* file_get_pathname(file_stored_t* file);
 
-// Get data buffer of file
-char* file_get_data(file_stored_t* file);
+// Get the segments where the data of file is stored
+segment_list_t* file_get_content(file_stored_t* file);
 
 // Get data size of buffer of file
 size_t file_get_size(file_stored_t* file);
 
-// Get current lock owner of file
+// Get the bytes of memory used by the content of file, less than its size when compressed
+// A shared content counts only for the last file holding it
+size_t file_get_memory_size(file_stored_t* file);
+
+// Get the content shared by file with other files, NULL if its content is private
+content_entry_t* file_get_shared_content(file_stored_t* file);
+
+// Get current exclusive lock owner of file
 int file_get_lock_owner(file_stored_t* file);
 
 // Get creation time of file
@@ -33,7 +68,7 @@ struct timespec* file_get_last_use_time(file_stored_t* file);
 // Get use frenquency of file
 int file_get_use_frequency(file_stored_t* file);
 
-// Let a client open this file
+// Let a client open this file, returns 1 if the client was added, 0 if it had already opened it
 int file_add_client(file_stored_t* file, int client);
 
 // Check whether the client had open this file
@@ -42,17 +77,55 @@ bool_t file_is_opened_by(file_stored_t* file, int client);
 // Let a client close this file
 int file_close_client(file_stored_t* file, int client);
 
-// Enqueue the client to the lock queue of this file
-int file_enqueue_lock(file_stored_t* file, int client);
+// Get the set of clients which opened this file
+client_set_t* file_get_clients(file_stored_t* file);
+
+// Track a client caching the content of this file, it's told once its copy is stale: the content changed, the file was
+// removed or another client got its exclusive lock. Then it's not tracked anymore. Returns 1 if added, 0 if already tracked
+int file_add_cache_client(file_stored_t* file, int client);
+
+// Stop tracking a client caching the content of this file without telling it, used once the client disconnected
+int file_remove_cache_client(file_stored_t* file, int client);
+
+// Get the set of clients caching the content of this file
+client_set_t* file_get_cache_clients(file_stored_t* file);
+
+// Get the version of the content of this file, a new one is given by each change
+uint64_t file_get_version(file_stored_t* file);
+
+// Set the function called for each client whose copy of a file is stale, shared by every file
+// It's called with the lock of the file (or of its FS) acquired, the client stops being tracked by the file right after
+void file_set_cache_invalidation(void (*invalidation)(file_stored_t* file, int client));
 
 // Check whether the client is already in the lock queue of this file
 bool_t file_is_client_already_queued(file_stored_t* file, int client);
 
-// Delete the client from the lock queue of this file
-int file_delete_lock_client(file_stored_t* file, int client);
+// Check whether the client owns a shared lock of this file
+bool_t file_is_lock_shared_by(file_stored_t* file, int client);
+
+// Get the set of clients which own a shared lock of this file
+client_set_t* file_get_lock_sharers(file_stored_t* file);
+
+// Check whether the client would get the lock of this file without waiting (or already owns it)
+// Many clients can own the shared lock at once, the exclusive one only when nobody else owns the lock
+// A shared lock is never given while a client waits for the exclusive one, so writers don't starve
+bool_t file_can_acquire_lock(file_stored_t* file, int client, bool_t shared);
+
+// Give the lock of this file to the client (shared or exclusive) or enqueue it if the lock can't be given now
+// The only owner of a shared lock gets the exclusive one immediately (upgrade)
+// Returns 0 if the client owns the lock, -1 if the client was enqueued
+int file_acquire_lock(file_stored_t* file, int client, bool_t shared);
+
+// Delete the client from the lock queue of this file in O(1) and release the lock owned by it
+// The lock is then handed to the next waiters following the lock handoff policy, they are added to granted
+// Returns the number of clients which got the lock
+size_t file_delete_lock_client(file_stored_t* file, int client, client_set_t* granted);
 
-// Dequeue the client from the lock queue of this file
-int file_dequeue_lock(file_stored_t* file);
+// Get the lock wait metrics of this file
+const lock_wait_metrics_t* file_get_lock_wait_metrics(file_stored_t* file);
+
+// Set the lock handoff policy used by every file
+void file_set_lock_handoff(lock_handoff_t handoff);
 
 // Set the current lock owner of this file
 void file_set_lock_owner(file_stored_t* file, int lock_owner);
@@ -60,17 +133,52 @@ void file_set_lock_owner(file_stored_t* file, int lock_owner);
 // Set the current last use time of this file
 void file_set_last_use_time(file_stored_t* file, struct timespec new_use_time);
 
+// Set the creation time of this file
+void file_set_creation_time(file_stored_t* file, struct timespec creation_time);
+
+// Set the use frequency of this file
+void file_set_use_frequency(file_stored_t* file, uint32_t use_frequency);
+
 // Set the write mode of this file
 void file_set_write_enabled(file_stored_t* file, bool_t is_enabled);
 
 // Get the write mode of this file
 bool_t file_is_write_enabled(file_stored_t* file);
 
-// Replace the current data content with the new one of this file
-int file_replace_content(file_stored_t* file, void* content, size_t content_size);
+// Replace the current data content with the new one of this file, returns the size of the previous one
+size_t file_replace_content(file_stored_t* file, void* content, size_t content_size);
+
+// Replace the current data content of this file with a reference of a shared content, which is consumed
+// The shared bytes are never written, the appends are stored after them. Returns the size of the previous content
+size_t file_share_content(file_stored_t* file, content_entry_t* entry);
+
+// Append the new content data to the old one of this file, returns the new size
+size_t file_append_content(file_stored_t* file, void* content, size_t content_size);
+
+// Append a copy of the new content data to the old one of this file, the caller keeps the ownership of content
+// Returns the new size
+size_t file_append_content_copy(file_stored_t* file, const void* content, size_t content_size);
 
-// Append the new content data to the old one of this file
-int file_append_content(file_stored_t* file, void* content, size_t content_size);
+// Write a copy of content at offset of this file, overwriting its bytes and appending the ones past the end
+// offset must not be past the end of the file. Returns the change of the memory size of the file, which is
+// negative if the file stops counting a shared content
+ssize_t file_write_content_at(file_stored_t* file, size_t offset, const void* content, size_t content_size);
+
+// Check whether a write at offset of this file touches the blocks it doesn't own in private, the shared content or the
+// sealed blocks, which are copied and change the holders of the shared content
+bool_t file_write_copies_blocks(file_stored_t* file, size_t offset);
+
+// Get the bytes of memory that file_write_content_at of content_size bytes at offset would take at most
+size_t file_write_cost_at(file_stored_t* file, size_t offset, size_t content_size);
+
+// Check whether the content of this file is fragmented in too many segments
+bool_t file_needs_compaction(file_stored_t* file);
+
+// Merge the content segments of this file in a single buffer
+int file_compact_content(file_stored_t* file);
+
+// Check whether enough content was added to this file since its last compression
+bool_t file_needs_compression(file_stored_t* file);
 
 // Acquire the read lock of this file
 void acquire_read_lock_file(file_stored_t* file);
@@ -87,11 +195,15 @@ void release_write_lock_file(file_stored_t* file);
 // Notify when this file is getting used
 void notify_used_file(file_stored_t* file);
 
+// Count a read of this file served by a worker of node
+// Returns the node the content must be moved to once node serves twice the reads of the node it's placed on, -1 otherwise
+int file_count_node_read(file_stored_t* file, int node);
+
 // Increment the frequency by a step of this file
 uint32_t file_inc_frequency(file_stored_t* file, int step);
 
 // Get the lock queue of this file
-queue_t* file_get_locks_queue(file_stored_t* file);
+wait_queue_t* file_get_locks_queue(file_stored_t* file);
 
 // Free this file
 void free_file(file_stored_t* file);
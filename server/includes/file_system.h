@@ -1,7 +1,11 @@
 #ifndef __FILE_SYSTEM__
 #define __FILE_SYSTEM__
 
+#include <sys/types.h>
+
 #include "icl_hash.h"
+#include "arena.h"
+#include "timer_wheel.h"
 #include "file_stored.h"
 
 typedef struct file_system file_system_t;
@@ -15,6 +19,9 @@ file_system_t* create_fs(size_t max_capacity_mem, size_t max_file_count);
 // Set the replacement policy of a FS
 void set_policy_fs(file_system_t* fs, char* policy);
 
+// Set the policy used to give the lock of a file to the clients waiting for it (FIFO or LIFO)
+void set_lock_policy_fs(file_system_t* fs, char* policy);
+
 // Set the workers which will access a FS, used for metrics purpose
 void set_workers_fs(file_system_t* fs, pthread_t* pids, int n);
 
@@ -30,8 +37,8 @@ void release_read_lock_fs(file_system_t* fs);
 // Release the write lock of a FS
 void release_write_lock_fs(file_system_t* fs);
 
-// Get an array rappresentation of the current FS
-file_stored_t** get_files_stored(file_system_t* fs);
+// Get an array rappresentation of the current FS, the array is allocated inside the arena
+file_stored_t** get_files_stored(file_system_t* fs, arena_t* arena);
 
 // Get the current FS count
 size_t get_file_count_fs(file_system_t* fs);
@@ -41,7 +48,24 @@ bool_t is_file_count_full_fs(file_system_t* fs);
 
 // Check whether there is at least size bytes available in the current FS
 // The result > 0 rappresent the bytes needed to be able to store those size bytes
-int is_size_available(file_system_t* fs, size_t size);
+size_t is_size_available(file_system_t* fs, size_t size);
+
+// Reserve size bytes of the current FS for a change in progress, no lock is needed
+// Returns TRUE if reserved, FALSE if they're not available now. A reservation must end with commit_memory_fs or rollback_memory_fs
+bool_t reserve_memory_fs(file_system_t* fs, size_t size);
+
+// End a reservation of reserved bytes once the change is stored, taking size bytes in its place (Can differ from reserved)
+void commit_memory_fs(file_system_t* fs, size_t reserved, size_t size);
+
+// End a reservation of reserved bytes whose change is not going to be stored
+void rollback_memory_fs(file_system_t* fs, size_t reserved);
+
+// Set the watermarks of the memory used by the current FS, once over high the files are evicted in background down to low
+// A high watermark of 0 leaves the eviction to the writes
+void set_watermarks_fs(file_system_t* fs, size_t low, size_t high);
+
+// Get the bytes to evict to bring the current FS down to its low watermark, 0 if the memory used is not over the high one
+size_t get_reclaim_size_fs(file_system_t* fs);
 
 // Check whether this size will overflow the current FS
 bool_t is_size_too_big(file_system_t* fs, size_t size);
@@ -57,14 +81,54 @@ int add_file_fs(file_system_t* fs, const char* pathname, file_stored_t* file);
 // (The soft remove is currently used from the replacement algorithm so that the files can be logged and eventually sent back to the client)
 int remove_file_fs(file_system_t* fs, const char* pathname, bool_t keep_data);
 
-// Update the current memory used by amount (Can be positive or negative)
-int notify_memory_changed_fs(file_system_t* fs, int amount);
+// Move every file of the current FS to the FS of shards picked by shard_of from its pathname, the current FS is left empty
+// A shared content moves to the store of the shard in stores (NULL if the contents are not deduplicated)
+// Used once the files of the last run are loaded, before any client is connected. A shard can end up over its capacity
+void split_fs(file_system_t* fs, file_system_t** shards, content_store_t** stores, size_t (*shard_of)(const char*));
+
+// Let client open file and track it inside the per client index of the current FS
+// Must be called with the file write lock or the FS write lock acquired
+int open_file_client_fs(file_system_t* fs, file_stored_t* file, int client);
+
+// Let client close file and remove it from the per client index of the current FS
+// Must be called with the file write lock or the FS write lock acquired
+int close_file_client_fs(file_system_t* fs, file_stored_t* file, int client);
+
+// Track client as caching file inside the per client index of the current FS, it's told once its copy is stale
+// Returns 1 if added, 0 if already caching it
+// Must be called with the file write lock or the FS write lock acquired
+int cache_file_client_fs(file_system_t* fs, file_stored_t* file, int client);
+
+// Remove file from the files cached by client inside the per client index of the current FS, called once the client
+// is told its copy is stale
+void uncache_file_client_fs(file_system_t* fs, file_stored_t* file, int client);
+
+// Give the lock of file (shared or exclusive) to client or enqueue it if the lock can't be given now, the client is tracked in the per client index
+// If timeout_ms > 0 a timer is started for the wait, once expired expire_lock_wait_fs must be called by the owner of the timers
+// Returns 0 if the client owns the lock, -1 if it was enqueued. Must be called with the file write lock or the FS write lock acquired
+int lock_file_client_fs(file_system_t* fs, file_stored_t* file, int client, bool_t shared, long timeout_ms);
+
+// Remove client from the lock queue of file if the wait with wait_id is still in progress (values given by the expired timer)
+// The clients which got the lock because of the removal are added to granted and must be notified too
+// Returns 1 if the wait expired and the client must be notified, 0 if the wait already ended. Must be called with the FS read lock acquired
+int expire_lock_wait_fs(file_system_t* fs, int client, uint64_t wait_id, file_stored_t* file, client_set_t* granted);
+
+// Get the timers of the lock waits of the current FS
+timer_wheel_t* get_lock_timers_fs(file_system_t* fs);
+
+// Release the lock of file (shared or exclusive) owned by client and give it to the next clients in the lock queue, which are added to granted
+// Returns the number of clients which got the lock or -1 if client didn't own it. Must be called with the file write lock or the FS write lock acquired
+int unlock_file_client_fs(file_system_t* fs, file_stored_t* file, int client, client_set_t* granted);
+
+// Update the current memory used by amount (Can be positive or negative), returns the memory used after the update
+size_t notify_memory_changed_fs(file_system_t* fs, ssize_t amount);
 
 // Increase the number of requests handled by a worker
 int notify_worker_handled_req_fs(file_system_t* fs, pthread_t pid);
 
 // Notify the current FS a client disconnected from the server, removes the client from the opened files and release the lock owned by it
-// (choose another client to own the lock)
+// (choose another client to own the lock). Only the files opened or locked by the client are visited, each one under its own lock
+// Must be called with the FS read lock acquired
 int notify_client_disconnected_fs(file_system_t* fs, int fd);
 
 // Executed before freeing the current FS, currently handles the logging/printing of FS Metrics of any kind
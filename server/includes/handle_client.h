@@ -2,94 +2,71 @@
 #define _HANDLE_CLIENT_H_
 
 #include "server_api_utils.h"
+#include "file_stored.h"
 
-// Used to awake a client waiting for the lock to be given, send back the OP_OK
-void notify_given_lock(int client);
-
-// Handles the sender open request by accessing the file system and returning a status code
-// This method fails if on O_CREATE the file already exists or viceversa
-// Returns -1 if the flag O_LOCK was sent but the lock is currently owned by another client
-//
-// The status code can be: 
-// 0) if the operation was succesfull and an OP_OK was sent back to the client
-// -1) if the operation was succesfull but the answer will be sent back to the client in the future
-// >0) if the operation was not succesfull and an OP_ERROR is sent back to the client with the relative error
-int handle_open_file_req(int sender);
-
-// Handles the sender write request by accessing the file system and returning a status code
-// This method fails if the file doesn't exist, if the previous sender request on this file was not an open with flags O_CREATE | O_LOCK or the data is too big
-//
-// The status code can be: 
-// 0) if the operation was succesfull and an OP_OK was sent back to the client
-// -1) if the operation was succesfull but the answer will be sent back to the client in the future
-// >0) if the operation was not succesfull and an OP_ERROR is sent back to the client with the relative error
-int handle_write_file_req(int sender);
-
-// Handles the sender append request by accessing the file system and returning a status code
-// This method fails if the file doesn't exist, if the file is not opened by the sender, if the file is owned by another client or the data to be appended is too big
-//
-// The status code can be: 
-// 0) if the operation was succesfull and an OP_OK was sent back to the client
-// -1) if the operation was succesfull but the answer will be sent back to the client in the future
-// >0) if the operation was not succesfull and an OP_ERROR is sent back to the client with the relative error
-int handle_append_file_req(int sender);
-
-// Handles the sender read request by accessing the file system and returning a status code
-// This method fails if the file doesn't exist, if the file is not opened by the sender or if the file is owned by another client
-//
-// The status code can be: 
-// 0) if the operation was succesfull and an OP_OK was sent back to the client
-// -1) if the operation was succesfull but the answer will be sent back to the client in the future
-// >0) if the operation was not succesfull and an OP_ERROR is sent back to the client with the relative error
-int handle_read_file_req(int sender);
-
-// Handles the sender nread request by accessing the file system and returning a status code
-// This method never fails
-//
-// The status code can be: 
-// 0) if the operation was succesfull and an OP_OK was sent back to the client
-// -1) if the operation was succesfull but the answer will be sent back to the client in the future
-// >0) if the operation was not succesfull and an OP_ERROR is sent back to the client with the relative error
-int handle_nread_files_req(int sender);
-
-// Handles the sender remove request by accessing the file system and returning a status code
-// This method fails if the file doesn't exist or if the file is not owned by the sender
-// Send back an OP_ERROR to all clients waiting for the lock to be given
-//
-// The status code can be: 
-// 0) if the operation was succesfull and an OP_OK was sent back to the client
-// -1) if the operation was succesfull but the answer will be sent back to the client in the future
-// >0) if the operation was not succesfull and an OP_ERROR is sent back to the client with the relative error
-int handle_remove_file_req(int sender);
-
-// Handles the sender open request by accessing the file system and returning a status code
-// This method fails if the file doesn't exist or if the file is not opened by the sender
-// Returns -1 if the file is already locked by another client
-//
-// The status code can be: 
-// 0) if the operation was succesfull and an OP_OK was sent back to the client
-// -1) if the operation was succesfull but the answer will be sent back to the client in the future
-// >0) if the operation was not succesfull and an OP_ERROR is sent back to the client with the relative error
-int handle_lock_file_req(int sender);
-
-// Handles the sender unlock request by accessing the file system and returning a status code
-// This method fails if the file doesn't exist, if the file is not opened by the sender or if the sender does not own the file
-// On success this function awake the top client in the queue waiting for the lock
-//
-// The status code can be: 
-// 0) if the operation was succesfull and an OP_OK was sent back to the client
-// -1) if the operation was succesfull but the answer will be sent back to the client in the future
-// >0) if the operation was not succesfull and an OP_ERROR is sent back to the client with the relative error
-int handle_unlock_file_req(int sender);
-
-// Handles the sender close request by accessing the file system and returning a status code
-// This method fails if the file doesn't exist, if the file is not opened by the sender
-// On success, if the sender owns the lock it is released and given to the next client waiting for it
-//
-// The status code can be: 
-// 0) if the operation was succesfull and an OP_OK was sent back to the client
-// -1) if the operation was succesfull but the answer will be sent back to the client in the future
-// >0) if the operation was not succesfull and an OP_ERROR is sent back to the client with the relative error
-int handle_close_file_req(int sender);
+// What the worker must listen to once it ran a request of a client as far as it could
+typedef enum request_status {
+    // the next request of the client, the current one is done or waits for a lock
+    REQ_NEXT,
+    // the rest of the current request, it's resumed once the client is readable again
+    REQ_READABLE,
+    // nothing, the request is resumed by wake_request or the client is already listened to
+    REQ_NOTHING,
+    // nothing, the request moved to the shard owning its file and must be scheduled again on its worker
+    REQ_FORWARDED,
+    // nothing, the client closed the connection
+    REQ_CLOSED,
+    // nothing, the client broke the protocol
+    REQ_INVALID
+} request_status_t;
+
+// Start the request of client once its first byte arrived, or resume it from where it stopped
+// Each request is a stackless coroutine: instead of blocking the worker it stops when the rest of it didn't arrive
+// yet, when the lock it asks for is owned by another client or when the client didn't read the output of the previous
+// requests, its state lives inside the table of the requests until a worker resumes it
+// The replies are queued inside the output buffer of the client, the worker flushes it afterwards
+// In shard mode a request stops too once its pathname is read if the file belongs to the shard of another worker
+request_status_t handle_request(int client);
+
+// Resume the request of client waiting for a lock or for its output to be read, by scheduling it on the workers
+// error is the outcome of the lock wait: 0 if the lock was given, ETIMEDOUT if the wait expired, EIDRM if the file was removed
+void wake_request(int client, int error);
+
+// Called when client hung up while the next request was listened to, returns TRUE if it can be disconnected at once
+// or FALSE if a worker is running its request, the worker disconnects it afterwards
+bool_t close_request(int client);
+
+// Disconnect the clients whose request waits for the rest of it since more than timeout_s seconds
+void expire_requests(unsigned int timeout_s);
+
+// Get the count of the requests waiting for the rest of them
+size_t count_waiting_requests();
+
+// Get the shard whose worker runs the requests of client, the one owning the file of its last request
+size_t get_request_shard(int client);
+
+// Get the count of the requests moved to the worker of another shard
+size_t count_forwarded_requests();
+
+// Tell client its copy of file is stale and stop tracking it as cached by client, set as the cache invalidation of the files
+// The notice never splits a reply, it waits until the replies of the request running are written
+void invalidate_cached_file(file_stored_t* file, int client);
+
+// Get the count of the copies of the files cached by the clients which were told to be stale
+size_t count_invalidated_caches();
+
+// Get the count of the conditional reads answered without the content, bytes_not_sent is the content they didn't send
+size_t count_reads_not_modified(size_t* bytes_not_sent);
+
+// Forget the request of client, called once it's disconnected
+void drop_request(int client);
+
+// Free the requests of every client, with the payloads not handled yet
+void free_requests();
+
+// Evict the files needed to bring the memory used down to the low watermark, called by the reclaimer so that the writes
+// find the memory already free. The evicted files are demoted like the ones replaced by the writes
+// Returns the number of files evicted
+size_t reclaim_files();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,62 @@
+#ifndef _INBOUND_H_
+#define _INBOUND_H_
+
+#include <sys/types.h>
+#include "utils.h"
+
+// Input buffers of the connections, used when the connection handler receives the bytes of the clients itself through
+// the streams of the I/O engine. The bytes are copied here as they arrive and the workers read the requests from here
+// instead of the sockets. A client with too many bytes waiting stops being received until its requests read most of them
+typedef struct inbound inbound_t;
+
+// What the connection handler must do with a client once its input changed
+typedef enum inbound_action {
+    // nothing
+    IN_NONE,
+    // schedule the request of the client, what it waited for arrived or the client hung up while it waited for the rest of it
+    IN_SCHEDULE,
+    // disconnect the client, it hung up while its next request was waited for
+    IN_HUNG_UP,
+    // receive the bytes of the client again, its requests read most of its input
+    IN_RECEIVE,
+    // close the socket of the client, it was disconnected while its bytes were still received
+    IN_CLOSE
+} inbound_action_t;
+
+// Create the input buffers, each client can have about max_buffer_bytes waiting to be read before it stops being received
+// on_drained is called by the worker reading the input of a client which stopped being received, once it can take more
+// Returns NULL on failure with errno set
+inbound_t* create_inbound(size_t max_buffer_bytes, void (*on_drained)(int client));
+
+// Start buffering the input of client, just connected, whose bytes are received from now on
+void inbound_open(inbound_t* in, int client);
+
+// Wait for the first byte of the next request of client if next, which carries nothing and is dropped, otherwise for the rest
+// of the current one. Returns IN_SCHEDULE if it's already here, IN_HUNG_UP or IN_SCHEDULE if the client hung up, IN_NONE
+// if it must wait: inbound_push or inbound_end tells when it arrives
+inbound_action_t inbound_wait(inbound_t* in, int client, bool_t next);
+
+// Append size bytes of data received from client. Returns IN_SCHEDULE if client waited for them, IN_NONE otherwise
+// full is set if client must stop being received, its buffer is full
+inbound_action_t inbound_push(inbound_t* in, int client, const void* data, size_t size, bool_t* full);
+
+// The bytes of client are not received anymore, error is 0 if it hung up, ECANCELED if it was stopped because of its full
+// buffer, the error of the connection otherwise. Returns the action for the input client waits for, IN_RECEIVE if it must
+// be received again or IN_CLOSE
+inbound_action_t inbound_end(inbound_t* in, int client, int error);
+
+// Called once on_drained(client) reaches the connection handler. Returns IN_RECEIVE, IN_CLOSE or IN_NONE
+inbound_action_t inbound_resume(inbound_t* in, int client);
+
+// Read at most size bytes of client into buf, as read does on its socket. Returns the bytes read, 0 if the client hung up
+// and its input is over, -1 with errno EAGAIN if no byte is waiting or the error of the connection
+ssize_t inbound_read(inbound_t* in, int client, void* buf, size_t size);
+
+// Drop the input of client, called once it's disconnected. Returns TRUE if its socket can be closed now, otherwise
+// the socket is shut down and its bytes are still being received: the connection handler closes it on IN_CLOSE
+bool_t inbound_close(inbound_t* in, int client);
+
+// Free the input buffers and every byte still waiting
+void free_inbound(inbound_t* in);
+
+#endif
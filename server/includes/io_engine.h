@@ -0,0 +1,95 @@
+#ifndef _IO_ENGINE_H_
+#define _IO_ENGINE_H_
+
+#include "utils.h"
+
+// Source of the events of the connection handler: the connections accepted, the first byte of each request and the
+// descriptors always listened to. The operations requested are queued and submitted together by the next wait
+// With epoll each operation is a syscall of its own, with io_uring they all go through its submission queue
+// inside a single syscall, the connections are accepted and the listened descriptors polled by multishot requests
+// io_uring can receive the bytes of the clients too: a multishot receive for each client takes the buffers the kernel
+// fills from a ring of buffers registered with it, which are given back once the events of the next wait are read
+typedef struct io_engine io_engine_t;
+
+// Backend of an engine
+typedef enum io_engine_type {
+    IO_ENGINE_EPOLL,
+    IO_ENGINE_URING
+} io_engine_type_t;
+
+// Type of an event returned by a wait
+typedef enum io_event_type {
+    // a descriptor listened to or polled is readable
+    IO_EV_READABLE,
+    // a connection was accepted, res is its descriptor (non-blocking) or -errno
+    IO_EV_ACCEPTED,
+    // the first byte of the next request of a client was read, res is 1, 0 if the client disconnected or -errno
+    IO_EV_RECEIVED,
+    // some bytes of a client streamed by io_engine_stream were received, res is their count and data points to them
+    // until the next wait. The last event of a stream has res 0 if the client disconnected, -ECANCELED if it was
+    // cancelled by io_engine_cancel or -errno
+    IO_EV_DATA
+} io_event_type_t;
+
+// An event returned by a wait
+typedef struct io_event {
+    io_event_type_t type;
+    int fd;
+    int res;
+    const void* data;
+} io_event_t;
+
+// Metrics of an engine, syscalls counts every syscall done by the engine, operations the events returned
+// and received the bytes of the clients streamed
+typedef struct io_engine_metrics {
+    size_t syscalls;
+    size_t operations;
+    size_t received;
+} io_engine_metrics_t;
+
+// Create an engine with the backend type, used by a single thread. Returns NULL on failure with errno set,
+// ENOSYS or EPERM if io_uring is not available
+io_engine_t* create_io_engine(io_engine_type_t type);
+
+// Get the backend of engine
+io_engine_type_t io_engine_get_type(io_engine_t* engine);
+
+// Listen to fd until the engine is freed, an IO_EV_READABLE is returned each time it's readable
+// Returns 0 on success, -1 on failure with errno set
+int io_engine_listen(io_engine_t* engine, int fd);
+
+// Accept the connections of server_fd until the engine is freed, an IO_EV_ACCEPTED is returned for each of them
+// Returns 0 on success, -1 on failure with errno set
+int io_engine_accept(io_engine_t* engine, int server_fd);
+
+// Read the first byte of the next request of client, a single IO_EV_RECEIVED is returned once it's read
+// client must not be closed until then. Returns 0 on success, -1 on failure with errno set
+int io_engine_receive(io_engine_t* engine, int client);
+
+// Check whether engine can stream the bytes of the clients, only io_uring does it on the kernels supporting the multishot
+// receive into a ring of buffers (6.0)
+bool_t io_engine_can_stream(io_engine_t* engine);
+
+// Receive the bytes of client as they arrive, an IO_EV_DATA is returned for each chunk of them until the client disconnects
+// or the stream is cancelled. client must not be closed until the last event. Returns 0 on success, -1 on failure with errno set
+int io_engine_stream(io_engine_t* engine, int client);
+
+// Stop receiving the bytes of client, the last IO_EV_DATA of its stream follows unless it already came
+// Returns 0 on success, -1 on failure with errno set
+int io_engine_cancel(io_engine_t* engine, int client);
+
+// Wait once for fd to be readable without reading it, a single IO_EV_READABLE is returned then
+// fd must not be closed until then. Returns 0 on success, -1 on failure with errno set
+int io_engine_poll(io_engine_t* engine, int fd);
+
+// Submit the operations queued and wait at most timeout_ms (forever if negative) for some events,
+// at most max (at least 2) are stored inside events. Returns the count of events stored, -1 on failure with errno set
+int io_engine_wait(io_engine_t* engine, io_event_t* events, int max, long timeout_ms);
+
+// Get the metrics of engine
+io_engine_metrics_t io_engine_get_metrics(io_engine_t* engine);
+
+// Free engine, the operations still pending are cancelled
+void free_io_engine(io_engine_t* engine);
+
+#endif
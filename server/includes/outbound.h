@@ -0,0 +1,101 @@
+#ifndef _OUTBOUND_H_
+#define _OUTBOUND_H_
+
+#include "segment_list.h"
+#include "utils.h"
+
+// Output buffers of the connections, every reply, notification and pushed file is queued here and written without
+// blocking. What the socket doesn't take at once is written by the connection handler once the client reads again,
+// so a client which stops reading never stalls the thread writing to it
+typedef struct outbound outbound_t;
+
+// A file pushed to a client, its data comes from content_alloc
+typedef struct outbound_file {
+    const char* pathname;
+    void* data;
+    size_t size;
+} outbound_file_t;
+
+// Metrics of the output buffers
+typedef struct outbound_metrics {
+    size_t pushed;
+    size_t pushed_bytes;
+    size_t dropped;
+    size_t max_retained;
+    size_t disconnected;
+} outbound_metrics_t;
+
+// Create the output buffers, each client can have at most max_buffer_bytes of pushed files and notices waiting to be written
+// and among them at most max_push_bytes of pushed files. The replies are asked by the client so they're not limited, its next
+// request waits until it read most of them. on_writable is called for the clients waiting with outbound_wait_writable
+// Returns NULL on failure with errno set
+outbound_t* create_outbound(size_t max_buffer_bytes, size_t max_push_bytes, void (*on_writable)(int client));
+
+// Get the descriptor which becomes readable once a client with some output waiting can be written again
+int outbound_get_fd(outbound_t* out);
+
+// Queue size bytes of buf for client, written at the latest by the next flush
+// Returns 1 on success, -1 if the client was disconnected
+int outbound_write(outbound_t* out, int client, const void* buf, size_t size);
+
+// Queue a whole message for client which is not a reply, like a notice of a change. Unlike the writes it can come from
+// any thread: while a reply of client is being written the notice waits for outbound_end_reply, otherwise it's
+// written at once. Returns 1 on success, -1 if the client was disconnected or it would exceed its buffer
+int outbound_notify(outbound_t* out, int client, const void* buf, size_t size);
+
+// Mark the start of the replies of a request of client, the notices wait until outbound_end_reply
+void outbound_begin_reply(outbound_t* out, int client);
+
+// Mark the end of the replies of a request of client, the notices which waited are queued after them
+void outbound_end_reply(outbound_t* out, int client);
+
+// Queue a string for client, its length followed by its characters as written by writen_string
+int outbound_write_string(outbound_t* out, int client, const char* str, size_t len);
+
+// Queue content for client without copying it, its segments are written as they are now even if it changes meanwhile
+// Same as outbound_write
+int outbound_write_sl(outbound_t* out, int client, const segment_list_t* content);
+
+// Queue size bytes of content starting at offset for client, which must be inside content. Same as outbound_write_sl
+int outbound_write_sl_range(outbound_t* out, int client, const segment_list_t* content, size_t offset, size_t size);
+
+// Queue for client the bytes read by view, taken while its list was locked. These buffers become the owner of view
+// Same as outbound_write_sl
+int outbound_write_view(outbound_t* out, int client, sl_view_t* view);
+
+// Queue for client the count of files pushed followed by each of them, the files are taken in order while the pushed
+// files waiting for client don't exceed its limits. These buffers become the owner of the data of every file (given by content_alloc),
+// the data of the files not pushed is freed. Returns the count of files pushed
+size_t outbound_push_files(outbound_t* out, int client, outbound_file_t* files, size_t count);
+
+// Write without blocking what client has in its buffer, the rest is written once the socket can take it
+// Returns 1 if some output is still waiting, 0 if the buffer is empty, -1 if the client was disconnected
+int outbound_flush(outbound_t* out, int client);
+
+// Flush the output of client and check whether it can take more, a client which didn't read most of it yet must wait
+// Returns 0 if client can take more output, 1 if it must wait: on_writable(client) is called once most of its output
+// is read or it's disconnected
+int outbound_wait_writable(outbound_t* out, int client);
+
+// Write the buffers of the clients whose socket can take more output, called once the descriptor of outbound_get_fd is readable
+void outbound_flush_ready(outbound_t* out);
+
+// Count the clients with some output waiting
+size_t outbound_count_waiting(outbound_t* out);
+
+// Disconnect the clients whose output is waiting since more than timeout_s seconds without any progress
+void outbound_expire(outbound_t* out, unsigned int timeout_s);
+
+// Disconnect client, its output is dropped and its socket shut down so that the connection handler closes it
+void outbound_shutdown(outbound_t* out, int client);
+
+// Drop the output of client, called once it disconnects before closing its socket
+void outbound_drop(outbound_t* out, int client);
+
+// Get the metrics of the output buffers
+outbound_metrics_t outbound_get_metrics(outbound_t* out);
+
+// Free the output buffers and everything still queued
+void free_outbound(outbound_t* out);
+
+#endif
@@ -12,6 +12,12 @@
 #include "utils.h"
 #include "logging.h"
 #include "file_system.h"
+#include "arena.h"
+#include "wal.h"
+#include "disk_tier.h"
+#include "content_store.h"
+#include "outbound.h"
+#include "inbound.h"
 
 typedef enum quit_signal {
     S_NONE,
@@ -26,6 +32,10 @@ typedef enum quit_signal {
 #define ERR_SOCKET_INIT_WORKERS -5
 #define ERR_SERVER_SIGNALS -6
 #define ERR_SOCKET_INIT_ACCEPTER -7
+#define ERR_SERVER_SNAPSHOTTER -8
+#define ERR_SERVER_WAL -9
+#define ERR_SERVER_DISK_TIER -10
+#define ERR_SERVER_RECLAIMER -11
 #define SERVER_OK 0
 
 typedef struct server server_t;
@@ -33,9 +43,55 @@ typedef struct server server_t;
 // Get the quit signal for the server
 quit_signal_t get_quit_signal();
 
-// Get the global file system for the server
+// Get the file system of the current thread: the shard of the worker in shard mode, the global one otherwise
 file_system_t* get_fs();
 
+// Get the count of the shards of the files, 1 if every worker shares the global file system
+size_t get_shards_count();
+
+// Get the file system of shard, the global one is the only shard if the files are not split
+file_system_t* get_shard_fs(size_t shard);
+
+// Get the shard owned by the current worker, 0 if the files are not split or for the other threads
+size_t get_current_shard();
+
+// Get the shard owning the file pathname
+size_t get_shard_of(const char* pathname);
+
+// Check whether the file pathname belongs to this server process, always TRUE unless it's one of the shard processes
+bool_t is_pathname_owned(const char* pathname);
+
+// Get the write-ahead log of the server, NULL if the writes are not logged
+wal_t* get_wal();
+
+// Get the disk tier of the server, NULL if the evicted files are discarded
+disk_tier_t* get_disk_tier();
+
+// Check whether the contents of the files are compressed once written
+bool_t is_compression_enabled();
+
+// Get the store of the contents shared by the files of the shard of the current worker, NULL if the contents are not deduplicated
+content_store_t* get_content_store();
+
+// Check whether the workers are pinned to the NUMA nodes and the big contents are moved to the nodes reading them
+bool_t is_numa_placement_enabled();
+
+// Get the output buffers of the clients, every write to a client goes through them
+outbound_t* get_outbound();
+
+// Get the input buffers of the clients the workers read the requests from, NULL if they read them from the sockets
+inbound_t* get_inbound();
+
+// Wake up the reclaimer to evict the files in background, called when the memory used goes over the high watermark
+void wake_reclaimer();
+
+// Queue client for the workers, which run its request as far as they can
+// In shard mode it's posted to the mailbox of the worker of the shard the request of client is routed to
+void schedule_client(int client);
+
+// Get the arena of the current worker, used for transient buffers which live until the request is handled
+arena_t* get_request_arena();
+
 // Get the global logger for the server
 // Use LOG_EVENT to log a formatted string
 logging_t* get_log();
@@ -0,0 +1,45 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "file_system.h"
+
+// Identifies the images written by write_snapshot_fs, the last characters are the format version
+#define SNAPSHOT_MAGIC "FSSNAP02"
+
+typedef struct snapshot snapshot_t;
+
+// Write an image of every file of the shards_count FS of shards (content, creation time, last use time and use frequency)
+// to path, a single FS is a single shard. The image doesn't depend on the shards, any count of them can load it
+// wal_generation is the first generation of the write-ahead log not included in the image, 0 if there is no log
+// The image is written to a temporary file which replaces path only once complete, the function succeeds only once
+// the image and its directory entry are on disk, so the log generations before wal_generation can then be deleted
+// No lock is taken: must be called with the write lock of every shard acquired or by a process owning a private copy of them
+// Returns 0 on success, -1 on failure with errno set
+int write_snapshot_fs(file_system_t** shards, size_t shards_count, const char* path, uint64_t wal_generation);
+
+// Fork a child which writes the image of the shards to path from its copy-on-write copy of the memory
+// Must be called with the write lock of every shard acquired, which can be released as soon as this returns, so the
+// writers are stopped only while forking. Returns the pid of the child which must be waited by the caller or -1 on failure
+pid_t fork_snapshot_fs(file_system_t** shards, size_t shards_count, const char* path, uint64_t wal_generation);
+
+// Load the image at path inside fs, the contents of the files are not copied but mapped and read lazily from the image
+// The files which don't fit the capacity of fs are skipped, the mapping is kept until free_snapshot is called after free_fs
+// Returns the loaded snapshot or NULL on failure with errno set (ENOENT if there is no image yet)
+snapshot_t* load_snapshot_fs(file_system_t* fs, const char* path);
+
+// Get the number of files loaded from this snapshot
+size_t snapshot_get_files_count(const snapshot_t* snapshot);
+
+// Get the first generation of the write-ahead log which must be replayed on top of this snapshot
+uint64_t snapshot_get_wal_generation(const snapshot_t* snapshot);
+
+// Get the number of files of this snapshot skipped because they did not fit the file system
+size_t snapshot_get_files_skipped(const snapshot_t* snapshot);
+
+// Unmap this snapshot, must be called once no file references its contents anymore
+void free_snapshot(snapshot_t* snapshot);
+
+#endif
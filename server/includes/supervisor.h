@@ -0,0 +1,13 @@
+#ifndef _SUPERVISOR_H_
+#define _SUPERVISOR_H_
+
+#include "config_params.h"
+
+// Run the shard processes of config, a whole server each owning the files whose pathname hash modulo their count is
+// its index, with its own socket, log, snapshot, write-ahead log, disk tier and slice of the storage (config_for_shard_process)
+// The supervisor listens to the socket of config only to reply the shard map, then the clients talk to the shards directly
+// A shard process which crashes is restarted alone, recovering its files from its own snapshot and write-ahead log
+// The quit signals are forwarded to every shard process. Returns once all of them quit, -1 if none could be started
+int run_shard_supervisor(const configuration_params_t* config);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef _WAL_H_
+#define _WAL_H_
+
+#include <stdint.h>
+
+#include "server_api_utils.h"
+#include "file_system.h"
+#include "content_store.h"
+
+// Each generation of the write-ahead log is a file named <path>.<generation>
+// A snapshot taken when generation G starts contains every change of the previous generations
+typedef struct wal wal_t;
+
+// Changes of the files stored inside the log
+typedef enum wal_record_type {
+    WAL_CREATE = 1,
+    WAL_WRITE,
+    WAL_APPEND,
+    WAL_REMOVE,
+    // the data starts with the offset of the write as an uint64_t
+    WAL_WRITE_AT
+} wal_record_type_t;
+
+// Metrics of a write-ahead log, the syncs are shared by all the records written before them (group commit)
+typedef struct wal_metrics {
+    size_t records;
+    size_t bytes;
+    size_t writes;
+    size_t syncs;
+} wal_metrics_t;
+
+// Create a write-ahead log which appends to the generation of path, a writer thread writes and syncs the records in batches
+// The log sequence numbers continue from last_lsn, default_level is used by the requests asking for D_DEFAULT
+// on_durable is called by the writer thread with each waiter given to wal_watch, once its record is durable or the log failed
+// Returns NULL on failure with errno set
+wal_t* create_wal(const char* path, uint64_t generation, uint64_t last_lsn, server_durability_t default_level, void (*on_durable)(int waiter));
+
+// Append a record of a change to this log and return its log sequence number, the record is written later by the writer thread
+// Nothing is logged if wal is NULL
+// The records of a file must follow the order of its changes: a write or an append is logged holding the write lock of
+// the file, a create or a remove holding the FS write lock
+uint64_t wal_append(wal_t* wal, wal_record_type_t type, const char* pathname, const void* data, size_t size);
+
+// Append a record of a write of size bytes of data at offset of a file, same as wal_append
+uint64_t wal_append_at(wal_t* wal, const char* pathname, size_t offset, const void* data, size_t size);
+
+// Check whether the record with lsn is durable as requested by level (D_ASYNC never waits), always if wal is NULL
+// Returns 1 if it is, -1 with errno set to EIO if the log cannot be written anymore, 0 otherwise: waiter is then given
+// to on_durable once the record is durable or the log fails, and the check is repeated. Nothing ever blocks
+int wal_watch(wal_t* wal, uint64_t lsn, server_durability_t level, int waiter);
+
+// Forget waiter, called once it's gone before its record was durable
+void wal_unwatch(wal_t* wal, int waiter);
+
+// Write and sync the pending records then start a new generation of this log, returns the new generation
+// Must be called with the FS write lock acquired, which keeps out every change and so every append: a snapshot taken
+// under the same lock replaces the previous generations
+uint64_t wal_rotate(wal_t* wal);
+
+// Delete the generations of this log older than generation, called once a snapshot containing them is on disk
+void wal_truncate(wal_t* wal, uint64_t generation);
+
+// Get the metrics of this log
+wal_metrics_t wal_get_metrics(wal_t* wal);
+
+// Write and sync the pending records, stop the writer thread and free this log
+void free_wal(wal_t* wal);
+
+// Replay on fs the records of every generation of the log at path starting from generation, in order
+// A torn or corrupted record ends the replay of its generation. next_generation is set to the generation the log must
+// continue with and last_lsn to the last log sequence number found. The written contents are shared through store
+// unless it's NULL. Returns the number of records replayed
+size_t replay_wal_fs(file_system_t* fs, content_store_t* store, const char* path, uint64_t generation, uint64_t* next_generation, uint64_t* last_lsn);
+
+#endif
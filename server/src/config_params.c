@@ -1,17 +1,86 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include "config_params.h"
 #include "utils.h"
 
 struct configuration_params {
     unsigned int thread_workers;
-    unsigned int bytes_storage_available;
+    size_t bytes_storage_available;
     unsigned int max_files_num;
     char socket_name[MAX_PATHNAME_API_LENGTH + 1];
     char log_name[MAX_PATHNAME_API_LENGTH + 1];
     char policy_type[MAX_POLICY_LENGTH + 1];
     unsigned int backlog_sockets_num;
+    char lock_policy_type[MAX_POLICY_LENGTH + 1];
+    char snapshot_path[MAX_PATHNAME_API_LENGTH + 1];
+    unsigned int snapshot_interval;
+    char wal_path[MAX_PATHNAME_API_LENGTH + 1];
+    char wal_durability[MAX_POLICY_LENGTH + 1];
+    char disk_tier_path[MAX_PATHNAME_API_LENGTH + 1];
+    size_t disk_tier_capacity;
+    char compression[MAX_POLICY_LENGTH + 1];
+    char deduplication[MAX_POLICY_LENGTH + 1];
+    char huge_pages[MAX_POLICY_LENGTH + 1];
+    char numa_placement[MAX_POLICY_LENGTH + 1];
+    unsigned int eviction_high_watermark;
+    unsigned int eviction_low_watermark;
+    size_t send_back_max_bytes;
+    size_t output_buffer_max_bytes;
+    unsigned int slow_client_timeout;
+    char io_engine[MAX_POLICY_LENGTH + 1];
+    unsigned int shards;
+    unsigned int shard_processes;
+    // index of the process among the shard processes, set only for them by config_for_shard_process
+    unsigned int shard_process_index;
+};
+
+// Type of the value of a configuration key, determines how the value is parsed
+typedef enum config_value_type {
+    CONFIG_UINT,
+    // a size with its unit of measure, stored as size_t
+    CONFIG_SIZE,
+    CONFIG_STRING
+} config_value_type_t;
+
+// A key recognized inside the configuration file, the value is stored at offset inside the configuration
+typedef struct config_key {
+    const char* name;
+    config_value_type_t type;
+    size_t offset;
+    size_t max_length;
+} config_key_t;
+
+#define CONFIG_KEY(name, type, field, max_length) { name, type, offsetof(configuration_params_t, field), max_length }
+
+static const config_key_t config_keys[] = {
+    CONFIG_KEY("SERVER_SOCKET_NAME", CONFIG_STRING, socket_name, MAX_PATHNAME_API_LENGTH),
+    CONFIG_KEY("SERVER_THREAD_WORKERS", CONFIG_UINT, thread_workers, 0),
+    CONFIG_KEY("SERVER_BYTE_STORAGE_AVAILABLE", CONFIG_SIZE, bytes_storage_available, 0),
+    CONFIG_KEY("SERVER_MAX_FILES_NUM", CONFIG_UINT, max_files_num, 0),
+    CONFIG_KEY("POLICY_NAME", CONFIG_STRING, policy_type, MAX_POLICY_LENGTH),
+    CONFIG_KEY("SERVER_BACKLOG_NUM", CONFIG_UINT, backlog_sockets_num, 0),
+    CONFIG_KEY("SERVER_LOG_NAME", CONFIG_STRING, log_name, MAX_PATHNAME_API_LENGTH),
+    CONFIG_KEY("LOCK_QUEUE_POLICY", CONFIG_STRING, lock_policy_type, MAX_POLICY_LENGTH),
+    CONFIG_KEY("SNAPSHOT_PATH", CONFIG_STRING, snapshot_path, MAX_PATHNAME_API_LENGTH),
+    CONFIG_KEY("SNAPSHOT_INTERVAL", CONFIG_UINT, snapshot_interval, 0),
+    CONFIG_KEY("WAL_PATH", CONFIG_STRING, wal_path, MAX_PATHNAME_API_LENGTH),
+    CONFIG_KEY("WAL_DURABILITY", CONFIG_STRING, wal_durability, MAX_POLICY_LENGTH),
+    CONFIG_KEY("DISK_TIER_PATH", CONFIG_STRING, disk_tier_path, MAX_PATHNAME_API_LENGTH),
+    CONFIG_KEY("DISK_TIER_CAPACITY", CONFIG_SIZE, disk_tier_capacity, 0),
+    CONFIG_KEY("COMPRESSION", CONFIG_STRING, compression, MAX_POLICY_LENGTH),
+    CONFIG_KEY("DEDUPLICATION", CONFIG_STRING, deduplication, MAX_POLICY_LENGTH),
+    CONFIG_KEY("HUGE_PAGES", CONFIG_STRING, huge_pages, MAX_POLICY_LENGTH),
+    CONFIG_KEY("NUMA_PLACEMENT", CONFIG_STRING, numa_placement, MAX_POLICY_LENGTH),
+    CONFIG_KEY("EVICTION_HIGH_WATERMARK", CONFIG_UINT, eviction_high_watermark, 0),
+    CONFIG_KEY("EVICTION_LOW_WATERMARK", CONFIG_UINT, eviction_low_watermark, 0),
+    CONFIG_KEY("SEND_BACK_MAX_BYTES", CONFIG_SIZE, send_back_max_bytes, 0),
+    CONFIG_KEY("OUTPUT_BUFFER_MAX_BYTES", CONFIG_SIZE, output_buffer_max_bytes, 0),
+    CONFIG_KEY("SLOW_CLIENT_TIMEOUT", CONFIG_UINT, slow_client_timeout, 0),
+    CONFIG_KEY("IO_ENGINE", CONFIG_STRING, io_engine, MAX_POLICY_LENGTH),
+    CONFIG_KEY("SHARDS", CONFIG_UINT, shards, 0),
+    CONFIG_KEY("SHARD_PROCESSES", CONFIG_UINT, shard_processes, 0)
 };
 
 void print_config_params(const configuration_params_t* config)
@@ -22,15 +91,70 @@ void print_config_params(const configuration_params_t* config)
 
     printf("Socket File Name: %s\n", config->socket_name);
     printf("Thread workers: %u\n", config->thread_workers);
-    printf("Storage available on startup (in bytes): %u\n", config->bytes_storage_available);
+    printf("Storage available on startup (in bytes): %zu\n", config->bytes_storage_available);
     printf("Max files number: %u\n", config->max_files_num);
     printf("Policy type: %s\n", config->policy_type);
     printf("Backlog sockets count: %u\n", config->backlog_sockets_num);
     printf("Log File Name: %s\n", config->log_name);
+    printf("Lock queue policy: %s\n", config->lock_policy_type);
+    printf("Snapshot File Name: %s\n", config->snapshot_path[0] ? config->snapshot_path : "(disabled)");
+    printf("Snapshot interval (in seconds): %u\n", config->snapshot_interval);
+    printf("Write-ahead log File Name: %s\n", config->wal_path[0] ? config->wal_path : "(disabled)");
+    printf("Write-ahead log durability: %s\n", config->wal_durability);
+    printf("Disk tier directory: %s\n", config->disk_tier_path[0] ? config->disk_tier_path : "(disabled)");
+    printf("Disk tier capacity (in bytes): %zu\n", config->disk_tier_capacity);
+    printf("Compression: %s\n", config->compression);
+    printf("Deduplication: %s\n", config->deduplication);
+    printf("Huge pages: %s\n", config->huge_pages);
+    printf("NUMA placement: %s\n", config->numa_placement);
+    if(config->eviction_high_watermark > 0)
+        printf("Eviction watermarks (in %% of the storage): low %u, high %u\n", config->eviction_low_watermark, config->eviction_high_watermark);
+    else
+        printf("Eviction watermarks (in %% of the storage): (disabled)\n");
+    if(config->send_back_max_bytes > 0)
+        printf("Evicted files waiting for each client (in bytes): %zu\n", config->send_back_max_bytes);
+    else
+        printf("Evicted files waiting for each client (in bytes): (default)\n");
+    if(config->output_buffer_max_bytes > 0)
+        printf("Pushed files and notices waiting for each client (in bytes): %zu\n", config->output_buffer_max_bytes);
+    else
+        printf("Output waiting for each client (in bytes): (default)\n");
+    if(config->slow_client_timeout > 0)
+        printf("Slow client timeout (in seconds): %u\n", config->slow_client_timeout);
+    else
+        printf("Slow client timeout (in seconds): (default)\n");
+    printf("I/O engine: %s\n", config->io_engine);
+    if(config->shards > 1)
+        printf("Shards (one worker each): %u\n", config->shards);
+    else
+        printf("Shards (one worker each): (disabled)\n");
+    if(config->shard_processes > 1)
+        printf("Shard processes: %u\n", config->shard_processes);
+    else
+        printf("Shard processes: (disabled)\n");
 
     printf("****************************************\n");
 }
 
+// Parse value and store it inside the configuration field described by key
+static void set_config_value(configuration_params_t* config, const config_key_t* key, char* value)
+{
+    void* field = (char*)config + key->offset;
+    switch(key->type)
+    {
+        case CONFIG_UINT:
+            *(unsigned int*)field = strtoul(value, NULL, 10);
+            break;
+        case CONFIG_SIZE:
+            *(size_t*)field = filesize_string_to_byte(value, 100);
+            break;
+        case CONFIG_STRING:
+            strncpy(field, value, key->max_length);
+            ((char*)field)[key->max_length] = '\0';
+            break;
+    }
+}
+
 configuration_params_t* load_config_params(const char* config_path_name)
 {
     FILE* fptr;
@@ -38,30 +162,104 @@ configuration_params_t* load_config_params(const char* config_path_name)
 
     CHECK_ERROR_EQ(fptr, fopen(config_path_name, "r"), NULL, NULL, "Configuration file cannot be opened!");
     CHECK_FATAL_ERRNO(config, malloc(sizeof(configuration_params_t)), NO_MEM_FATAL);
+    memset(config, 0, sizeof(configuration_params_t));
+
+    // optional keys
+    strncpy(config->policy_type, "FIFO", MAX_POLICY_LENGTH);
+    strncpy(config->lock_policy_type, "FIFO", MAX_POLICY_LENGTH);
+    strncpy(config->wal_durability, "SYNC", MAX_POLICY_LENGTH);
+    strncpy(config->compression, "NONE", MAX_POLICY_LENGTH);
+    strncpy(config->deduplication, "NONE", MAX_POLICY_LENGTH);
+    strncpy(config->huge_pages, "NONE", MAX_POLICY_LENGTH);
+    strncpy(config->numa_placement, "NONE", MAX_POLICY_LENGTH);
+    strncpy(config->io_engine, "EPOLL", MAX_POLICY_LENGTH);
 
-    fscanf(fptr, "SERVER_SOCKET_NAME=%108s\n", config->socket_name);
-    config->socket_name[MAX_PATHNAME_API_LENGTH] = '\0';
+    // each line is a KEY=VALUE pair in any order, empty lines and lines starting with # are skipped
+    char* line = NULL;
+    size_t line_capacity = 0;
+    ssize_t line_len;
+    while((line_len = getline(&line, &line_capacity, fptr)) != -1)
+    {
+        while(line_len > 0 && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r' || line[line_len - 1] == ' '))
+            line[--line_len] = '\0';
 
-    fscanf(fptr, "SERVER_THREAD_WORKERS=%u\n", &config->thread_workers);
+        if(line_len == 0 || line[0] == '#')
+            continue;
 
-    char storageSize[101] = { '\0' };
-    fscanf(fptr, "SERVER_BYTE_STORAGE_AVAILABLE=%100s\n", storageSize);
-    config->bytes_storage_available = filesize_string_to_byte(storageSize, 100);
-    
-    fscanf(fptr, "SERVER_MAX_FILES_NUM=%u\n", &config->max_files_num);
-    fscanf(fptr, "POLICY_NAME=%40s\n", config->policy_type);
-    config->policy_type[MAX_POLICY_LENGTH] = '\0';
+        char* separator = strchr(line, '=');
+        if(!separator)
+        {
+            PRINT_WARNING(EINVAL, "Configuration line without '=' ignored: %s", line);
+            continue;
+        }
 
-    fscanf(fptr, "SERVER_BACKLOG_NUM=%u\n", &config->backlog_sockets_num);
+        *separator = '\0';
+        char* value = separator + 1;
+        bool_t found = FALSE;
+        for(size_t i = 0; i < sizeof(config_keys) / sizeof(config_key_t); ++i)
+        {
+            if(strcmp(config_keys[i].name, line) == 0)
+            {
+                set_config_value(config, &config_keys[i], value);
+                found = TRUE;
+                break;
+            }
+        }
 
-    fscanf(fptr, "SERVER_LOG_NAME=%108s", config->log_name);
-    config->log_name[MAX_PATHNAME_API_LENGTH] = '\0';
+        if(!found)
+        {
+            PRINT_WARNING(EINVAL, "Unknown configuration key ignored: %s", line);
+        }
+    }
 
+    free(line);
     fclose(fptr);
 
     return config;
 }
 
+// Append .index to the path stored inside field if it's set, returns -1 if the result is too long
+static int add_shard_suffix(char field[MAX_PATHNAME_API_LENGTH + 1], unsigned int index)
+{
+    RET_IF(field[0] == '\0', 0);
+
+    char suffixed[MAX_PATHNAME_API_LENGTH + 1];
+    int len = snprintf(suffixed, sizeof(suffixed), "%s.%u", field, index);
+    if(len < 0 || len > MAX_PATHNAME_API_LENGTH)
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    memcpy(field, suffixed, len + 1);
+    return 0;
+}
+
+configuration_params_t* config_for_shard_process(const configuration_params_t* config, unsigned int index)
+{
+    RET_IF(!config || config->shard_processes <= 1 || index >= config->shard_processes, NULL);
+
+    configuration_params_t* shard_config;
+    CHECK_FATAL_ERRNO(shard_config, malloc(sizeof(configuration_params_t)), NO_MEM_FATAL);
+    memcpy(shard_config, config, sizeof(configuration_params_t));
+    shard_config->shard_process_index = index;
+
+    // every file written by a process is its own, the shards share nothing
+    if(add_shard_suffix(shard_config->socket_name, index) == -1 || add_shard_suffix(shard_config->log_name, index) == -1 ||
+        add_shard_suffix(shard_config->snapshot_path, index) == -1 || add_shard_suffix(shard_config->wal_path, index) == -1 ||
+        add_shard_suffix(shard_config->disk_tier_path, index) == -1)
+    {
+        free(shard_config);
+        return NULL;
+    }
+
+    unsigned int count = config->shard_processes;
+    shard_config->bytes_storage_available = config->bytes_storage_available / count;
+    shard_config->max_files_num = (config->max_files_num + count - 1) / count;
+    shard_config->disk_tier_capacity = config->disk_tier_capacity / count;
+    return shard_config;
+}
+
 void free_config(configuration_params_t* config)
 {
     free(config);
@@ -74,7 +272,7 @@ unsigned int config_get_num_workers(const configuration_params_t* config)
     return config->thread_workers;
 }
 
-unsigned int config_get_max_server_size(const configuration_params_t* config)
+size_t config_get_max_server_size(const configuration_params_t* config)
 {
     RET_IF(!config, 0);
 
@@ -129,4 +327,185 @@ void config_get_policy_name(const configuration_params_t* config, char output[MA
     }
 
     memcpy(output, config->policy_type, MAX_POLICY_LENGTH + 1);
+}
+
+unsigned int config_get_snapshot_interval(const configuration_params_t* config)
+{
+    RET_IF(!config, 0);
+
+    return config->snapshot_interval;
+}
+
+void config_get_snapshot_path(const configuration_params_t* config, char output[MAX_PATHNAME_API_LENGTH + 1])
+{
+    if(!config)
+    {
+        if(output)
+            output[0] = '\0';
+        return;
+    }
+
+    memcpy(output, config->snapshot_path, MAX_PATHNAME_API_LENGTH + 1);
+}
+
+void config_get_wal_path(const configuration_params_t* config, char output[MAX_PATHNAME_API_LENGTH + 1])
+{
+    if(!config)
+    {
+        if(output)
+            output[0] = '\0';
+        return;
+    }
+
+    memcpy(output, config->wal_path, MAX_PATHNAME_API_LENGTH + 1);
+}
+
+void config_get_wal_durability_name(const configuration_params_t* config, char output[MAX_POLICY_LENGTH + 1])
+{
+    if(!config)
+    {
+        if(output)
+            output[0] = '\0';
+        return;
+    }
+
+    memcpy(output, config->wal_durability, MAX_POLICY_LENGTH + 1);
+}
+
+void config_get_disk_tier_path(const configuration_params_t* config, char output[MAX_PATHNAME_API_LENGTH + 1])
+{
+    if(!config)
+    {
+        if(output)
+            output[0] = '\0';
+        return;
+    }
+
+    memcpy(output, config->disk_tier_path, MAX_PATHNAME_API_LENGTH + 1);
+}
+
+size_t config_get_disk_tier_capacity(const configuration_params_t* config)
+{
+    RET_IF(!config, 0);
+    return config->disk_tier_capacity;
+}
+
+void config_get_compression_name(const configuration_params_t* config, char output[MAX_POLICY_LENGTH + 1])
+{
+    if(!config)
+    {
+        if(output)
+            output[0] = '\0';
+        return;
+    }
+
+    memcpy(output, config->compression, MAX_POLICY_LENGTH + 1);
+}
+
+void config_get_deduplication_name(const configuration_params_t* config, char output[MAX_POLICY_LENGTH + 1])
+{
+    if(!config)
+    {
+        if(output)
+            output[0] = '\0';
+        return;
+    }
+
+    memcpy(output, config->deduplication, MAX_POLICY_LENGTH + 1);
+}
+
+void config_get_huge_pages_name(const configuration_params_t* config, char output[MAX_POLICY_LENGTH + 1])
+{
+    if(!config)
+    {
+        if(output)
+            output[0] = '\0';
+        return;
+    }
+
+    memcpy(output, config->huge_pages, MAX_POLICY_LENGTH + 1);
+}
+
+void config_get_numa_placement_name(const configuration_params_t* config, char output[MAX_POLICY_LENGTH + 1])
+{
+    if(!config)
+    {
+        if(output)
+            output[0] = '\0';
+        return;
+    }
+
+    memcpy(output, config->numa_placement, MAX_POLICY_LENGTH + 1);
+}
+
+void config_get_lock_policy_name(const configuration_params_t* config, char output[MAX_POLICY_LENGTH + 1])
+{
+    if(!config)
+    {
+        if(output)
+            output[0] = '\0';
+        return;
+    }
+
+    memcpy(output, config->lock_policy_type, MAX_POLICY_LENGTH + 1);
+}
+
+unsigned int config_get_eviction_high_watermark(const configuration_params_t* config)
+{
+    RET_IF(!config, 0);
+    return config->eviction_high_watermark;
+}
+
+unsigned int config_get_eviction_low_watermark(const configuration_params_t* config)
+{
+    RET_IF(!config, 0);
+    return config->eviction_low_watermark;
+}
+
+size_t config_get_send_back_max_bytes(const configuration_params_t* config)
+{
+    RET_IF(!config, 0);
+    return config->send_back_max_bytes;
+}
+
+size_t config_get_output_buffer_max_bytes(const configuration_params_t* config)
+{
+    RET_IF(!config, 0);
+    return config->output_buffer_max_bytes;
+}
+
+unsigned int config_get_slow_client_timeout(const configuration_params_t* config)
+{
+    RET_IF(!config, 0);
+    return config->slow_client_timeout;
+}
+
+unsigned int config_get_shards_count(const configuration_params_t* config)
+{
+    RET_IF(!config, 0);
+    return config->shards;
+}
+
+unsigned int config_get_shard_processes(const configuration_params_t* config)
+{
+    RET_IF(!config, 0);
+    return config->shard_processes;
+}
+
+unsigned int config_get_shard_process_index(const configuration_params_t* config)
+{
+    RET_IF(!config, 0);
+    return config->shard_process_index;
+}
+
+void config_get_io_engine_name(const configuration_params_t* config, char output[MAX_POLICY_LENGTH + 1])
+{
+    if(!config)
+    {
+        if(output)
+            output[0] = '\0';
+        return;
+    }
+
+    memcpy(output, config->io_engine, MAX_POLICY_LENGTH + 1);
 }
\ No newline at end of file
@@ -0,0 +1,216 @@
+#include <string.h>
+#include <pthread.h>
+
+#include "content_store.h"
+#include "icl_hash.h"
+#include "page_alloc.h"
+
+#define CONTENT_STORE_BUCKETS 1024
+
+struct content_entry {
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    void* data;
+    size_t size;
+    // references of the lists using this content, protected by the mutex of the store
+    size_t refs;
+    // files of the FS holding this content and how many of them are chosen by a replacement, protected by the FS lock
+    size_t files;
+    size_t victims;
+    content_store_t* store;
+};
+
+struct content_store {
+    icl_hash_t* index;
+    size_t entries;
+    content_store_metrics_t metrics;
+    // protects everything above and the references of the entries, taken after every other lock
+    pthread_mutex_t mutex;
+};
+
+// The digests are already uniformly distributed, their first bytes are enough
+static unsigned int hash_digest(void* key)
+{
+    unsigned int hash;
+    memcpy(&hash, key, sizeof(unsigned int));
+    return hash;
+}
+
+static int compare_digest(void* a, void* b)
+{
+    return memcmp(a, b, SHA256_DIGEST_SIZE) == 0;
+}
+
+static void free_entry(void* arg)
+{
+    content_entry_t* entry = arg;
+    content_free(entry->data);
+    free(entry);
+}
+
+static void release_entry(void* arg)
+{
+    content_store_release(arg);
+}
+
+content_store_t* create_content_store()
+{
+    content_store_t* store;
+    CHECK_FATAL_EQ(store, malloc(sizeof(content_store_t)), NULL, NO_MEM_FATAL);
+    memset(store, 0, sizeof(content_store_t));
+    store->index = icl_hash_create(CONTENT_STORE_BUCKETS, hash_digest, compare_digest);
+    INIT_MUTEX(&store->mutex);
+
+    return store;
+}
+
+content_entry_t* content_store_find(content_store_t* store, const uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    RET_IF(!store || !digest, NULL);
+
+    LOCK_MUTEX(&store->mutex);
+    content_entry_t* entry = icl_hash_find(store->index, (void*)digest);
+    if(entry)
+    {
+        ++entry->refs;
+        ++store->metrics.hits;
+        store->metrics.saved_bytes += entry->size;
+    }
+    UNLOCK_MUTEX(&store->mutex);
+
+    return entry;
+}
+
+content_entry_t* content_store_add(content_store_t* store, const uint8_t digest[SHA256_DIGEST_SIZE], void* data, size_t size)
+{
+    RET_IF(!store || !digest, NULL);
+
+    content_entry_t* entry;
+    CHECK_FATAL_EQ(entry, malloc(sizeof(content_entry_t)), NULL, NO_MEM_FATAL);
+    memcpy(entry->digest, digest, SHA256_DIGEST_SIZE);
+    entry->data = data;
+    entry->size = size;
+    entry->refs = 1;
+    entry->files = 0;
+    entry->victims = 0;
+    entry->store = store;
+
+    LOCK_MUTEX(&store->mutex);
+    content_entry_t* stored = icl_hash_find(store->index, entry->digest);
+    if(stored)
+    {
+        ++stored->refs;
+        ++store->metrics.hits;
+        store->metrics.saved_bytes += size;
+    }
+    else
+    {
+        icl_hash_insert(store->index, entry->digest, entry);
+        ++store->entries;
+        ++store->metrics.stored;
+        store->metrics.max_entries = MAX(store->metrics.max_entries, store->entries);
+    }
+    UNLOCK_MUTEX(&store->mutex);
+
+    if(!stored)
+        return entry;
+
+    free_entry(entry);
+    return stored;
+}
+
+content_entry_t* content_store_adopt(content_store_t* store, const content_entry_t* entry)
+{
+    RET_IF(!store || !entry, NULL);
+
+    content_entry_t* found = content_store_find(store, entry->digest);
+    RET_IF(found, found);
+
+    void* data = content_alloc(entry->size);
+    memcpy(data, entry->data, entry->size);
+    return content_store_add(store, entry->digest, data, entry->size);
+}
+
+void content_store_release(content_entry_t* entry)
+{
+    NRET_IF(!entry);
+
+    content_store_t* store = entry->store;
+    LOCK_MUTEX(&store->mutex);
+    bool_t is_last = --entry->refs == 0;
+    if(is_last)
+    {
+        icl_hash_delete(store->index, entry->digest, NULL, NULL);
+        --store->entries;
+    }
+    UNLOCK_MUTEX(&store->mutex);
+
+    if(is_last)
+        free_entry(entry);
+}
+
+void content_entry_attach(content_entry_t* entry, segment_list_t* sl)
+{
+    NRET_IF(!entry || !sl);
+    sl_replace_shared(sl, entry->data, entry->size, release_entry, entry);
+}
+
+const void* content_entry_get_data(const content_entry_t* entry)
+{
+    RET_IF(!entry, NULL);
+    return entry->data;
+}
+
+size_t content_entry_get_size(const content_entry_t* entry)
+{
+    RET_IF(!entry, 0);
+    return entry->size;
+}
+
+size_t content_entry_get_files(const content_entry_t* entry)
+{
+    RET_IF(!entry, 0);
+    return entry->files;
+}
+
+void content_entry_add_file(content_entry_t* entry)
+{
+    NRET_IF(!entry);
+    ++entry->files;
+}
+
+void content_entry_remove_file(content_entry_t* entry)
+{
+    NRET_IF(!entry || entry->files == 0);
+    --entry->files;
+}
+
+size_t content_entry_add_victim(content_entry_t* entry)
+{
+    RET_IF(!entry, 0);
+    return ++entry->victims;
+}
+
+void content_entry_clear_victims(content_entry_t* entry)
+{
+    NRET_IF(!entry);
+    entry->victims = 0;
+}
+
+content_store_metrics_t content_store_get_metrics(content_store_t* store)
+{
+    content_store_metrics_t metrics;
+    memset(&metrics, 0, sizeof(content_store_metrics_t));
+    RET_IF(!store, metrics);
+
+    EXEC_WITH_MUTEX(metrics = store->metrics, &store->mutex);
+    return metrics;
+}
+
+void free_content_store(content_store_t* store)
+{
+    NRET_IF(!store);
+
+    icl_hash_destroy(store->index, NULL, free_entry);
+    pthread_mutex_destroy(&store->mutex);
+    free(store);
+}
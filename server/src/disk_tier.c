@@ -0,0 +1,451 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "disk_tier.h"
+#include "icl_hash.h"
+#include "queue.h"
+#include "page_alloc.h"
+
+#define DISK_TIER_BUCKETS 1024
+// Each file of the tier is named by its id written with this many hex digits
+#define DISK_TIER_ID_DIGITS 16
+#define DISK_TIER_PATH_LENGTH (MAX_PATHNAME_API_LENGTH + DISK_TIER_ID_DIGITS + 2)
+
+typedef struct tier_entry {
+    char pathname[MAX_PATHNAME_API_LENGTH + 1];
+    uint64_t id;
+    size_t size;
+    // content waiting for the demoter, NULL once written to disk
+    segment_list_t* content;
+    // still referenced by the queue of the demoter
+    bool_t queued;
+    // being written by the demoter, the readers wait for it
+    bool_t writing;
+    // taken while queued, the demoter frees it
+    bool_t cancelled;
+    // the file is moving between the memory and this tier, there's no content yet and the readers wait for it
+    bool_t placeholder;
+    // order of the entries on disk, the oldest is dropped first
+    struct tier_entry* older;
+    struct tier_entry* newer;
+} tier_entry_t;
+
+struct disk_tier {
+    char dir[MAX_PATHNAME_API_LENGTH + 1];
+    size_t capacity;
+    // bytes written or being written to disk
+    size_t used;
+    uint64_t next_id;
+    icl_hash_t* index;
+    queue_t* pending;
+    tier_entry_t* oldest;
+    tier_entry_t* newest;
+    disk_tier_metrics_t metrics;
+    bool_t closing;
+
+    // protects everything above, the demoter waits on pending_cond and the readers of a file being written or moved
+    // on written_cond
+    pthread_mutex_t mutex;
+    pthread_cond_t pending_cond;
+    pthread_cond_t written_cond;
+    pthread_t demoter;
+};
+
+static void get_entry_path(const char* dir, uint64_t id, char output[DISK_TIER_PATH_LENGTH])
+{
+    snprintf(output, DISK_TIER_PATH_LENGTH, "%s/%0*" PRIx64, dir, DISK_TIER_ID_DIGITS, id);
+}
+
+// Delete the files of the tier inside dir, the other files are left untouched
+static void clear_dir(const char* dir)
+{
+    DIR* d = opendir(dir);
+    NRET_IF(!d);
+
+    char path[DISK_TIER_PATH_LENGTH];
+    struct dirent* ent;
+    while((ent = readdir(d)) != NULL)
+    {
+        if(strlen(ent->d_name) != DISK_TIER_ID_DIGITS || strspn(ent->d_name, "0123456789abcdef") != DISK_TIER_ID_DIGITS)
+            continue;
+
+        get_entry_path(dir, strtoull(ent->d_name, NULL, 16), path);
+        unlink(path);
+    }
+
+    closedir(d);
+}
+
+static void link_newest(disk_tier_t* tier, tier_entry_t* entry)
+{
+    entry->older = tier->newest;
+    entry->newer = NULL;
+    if(tier->newest)
+        tier->newest->newer = entry;
+    else
+        tier->oldest = entry;
+    tier->newest = entry;
+}
+
+static void unlink_entry(disk_tier_t* tier, tier_entry_t* entry)
+{
+    if(entry->older)
+        entry->older->newer = entry->newer;
+    else
+        tier->oldest = entry->newer;
+    if(entry->newer)
+        entry->newer->older = entry->older;
+    else
+        tier->newest = entry->older;
+}
+
+// Find the entry of pathname, waiting for the demoter if it's being written and with wait_placeholder for the file
+// being moved too. Only the callers without the FS lock wait for a placeholder, its owner needs that lock to resolve it
+// Must be called with the mutex of the tier acquired
+static tier_entry_t* find_entry(disk_tier_t* tier, const char* pathname, bool_t wait_placeholder)
+{
+    tier_entry_t* entry;
+    while((entry = icl_hash_find(tier->index, (char*)pathname)) && (entry->writing || (wait_placeholder && entry->placeholder)))
+        COND_WAIT(&tier->written_cond, &tier->mutex);
+
+    return entry;
+}
+
+// Add a placeholder for pathname to the index, its content is given later by disk_tier_demote
+// Must be called with the mutex of the tier acquired and no entry of pathname inside the index
+static void add_placeholder(disk_tier_t* tier, tier_entry_t* entry, const char* pathname)
+{
+    memset(entry, 0, sizeof(tier_entry_t));
+    strncpy(entry->pathname, pathname, MAX_PATHNAME_API_LENGTH);
+    entry->placeholder = TRUE;
+    icl_hash_insert(tier->index, entry->pathname, entry);
+}
+
+// Remove entry from the index, a queued entry is freed by the demoter, an entry on disk is deleted
+// Must be called with the mutex of the tier acquired
+static void drop_entry(disk_tier_t* tier, tier_entry_t* entry)
+{
+    icl_hash_delete(tier->index, entry->pathname, NULL, NULL);
+    if(entry->placeholder)
+    {
+        // the readers waiting for it find nothing
+        free(entry);
+        COND_BROADCAST(&tier->written_cond);
+        return;
+    }
+    if(entry->queued)
+    {
+        free_sl(entry->content);
+        entry->content = NULL;
+        entry->cancelled = TRUE;
+        return;
+    }
+
+    char path[DISK_TIER_PATH_LENGTH];
+    get_entry_path(tier->dir, entry->id, path);
+    unlink(path);
+    unlink_entry(tier, entry);
+    tier->used -= entry->size;
+    free(entry);
+}
+
+static bool_t write_entry(const char* path, const segment_list_t* content)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    RET_IF(fd == -1, FALSE);
+
+    bool_t res = sl_get_size(content) == 0 || sl_writen(fd, content) > 0;
+    close(fd);
+    if(!res)
+        unlink(path);
+
+    return res;
+}
+
+static void* demoter_routine(void* arg)
+{
+    disk_tier_t* tier = arg;
+    char path[DISK_TIER_PATH_LENGTH];
+
+    LOCK_MUTEX(&tier->mutex);
+    while(TRUE)
+    {
+        while(count_q(tier->pending) == 0 && !tier->closing)
+            COND_WAIT(&tier->pending_cond, &tier->mutex);
+        if(tier->closing)
+            break;
+
+        tier_entry_t* entry = dequeue(tier->pending);
+        entry->queued = FALSE;
+        if(entry->cancelled)
+        {
+            free(entry);
+            continue;
+        }
+
+        if(entry->size > tier->capacity)
+        {
+            icl_hash_delete(tier->index, entry->pathname, NULL, NULL);
+            free_sl(entry->content);
+            free(entry);
+            ++tier->metrics.dropped;
+            continue;
+        }
+
+        // room is made by dropping the files demoted first
+        while(tier->used + entry->size > tier->capacity && tier->oldest)
+        {
+            drop_entry(tier, tier->oldest);
+            ++tier->metrics.dropped;
+        }
+
+        entry->id = tier->next_id++;
+        entry->writing = TRUE;
+        tier->used += entry->size;
+        tier->metrics.max_size = MAX(tier->metrics.max_size, tier->used);
+        get_entry_path(tier->dir, entry->id, path);
+        UNLOCK_MUTEX(&tier->mutex);
+
+        bool_t written = write_entry(path, entry->content);
+
+        LOCK_MUTEX(&tier->mutex);
+        entry->writing = FALSE;
+        free_sl(entry->content);
+        entry->content = NULL;
+        if(written)
+        {
+            link_newest(tier, entry);
+            ++tier->metrics.demoted;
+        }
+        else
+        {
+            PRINT_WARNING(errno, "Cannot demote %s to the disk tier!", entry->pathname);
+            icl_hash_delete(tier->index, entry->pathname, NULL, NULL);
+            tier->used -= entry->size;
+            free(entry);
+            ++tier->metrics.dropped;
+        }
+        COND_BROADCAST(&tier->written_cond);
+    }
+    UNLOCK_MUTEX(&tier->mutex);
+
+    return NULL;
+}
+
+disk_tier_t* create_disk_tier(const char* dir, size_t capacity)
+{
+    RET_IF(!dir, NULL);
+    RET_IF(mkdir(dir, 0700) == -1 && errno != EEXIST, NULL);
+    clear_dir(dir);
+
+    disk_tier_t* tier;
+    CHECK_FATAL_EQ(tier, malloc(sizeof(disk_tier_t)), NULL, NO_MEM_FATAL);
+    memset(tier, 0, sizeof(disk_tier_t));
+    strncpy(tier->dir, dir, MAX_PATHNAME_API_LENGTH);
+    tier->capacity = capacity;
+    tier->index = icl_hash_create(DISK_TIER_BUCKETS, NULL, NULL);
+    tier->pending = create_q();
+
+    INIT_MUTEX(&tier->mutex);
+    INIT_COND(&tier->pending_cond);
+    INIT_COND(&tier->written_cond);
+    CHECK_FATAL_EVAL(pthread_create(&tier->demoter, NULL, demoter_routine, tier) != 0, THREAD_CREATE_FATAL);
+
+    return tier;
+}
+
+void disk_tier_reserve(disk_tier_t* tier, const char* pathname)
+{
+    NRET_IF(!tier || !pathname);
+
+    tier_entry_t* entry;
+    CHECK_FATAL_EQ(entry, malloc(sizeof(tier_entry_t)), NULL, NO_MEM_FATAL);
+
+    LOCK_MUTEX(&tier->mutex);
+    tier_entry_t* old = find_entry(tier, pathname, FALSE);
+    if(old)
+        drop_entry(tier, old);
+    add_placeholder(tier, entry, pathname);
+    UNLOCK_MUTEX(&tier->mutex);
+}
+
+void disk_tier_demote(disk_tier_t* tier, const char* pathname, segment_list_t* content)
+{
+    if(!tier || !pathname)
+    {
+        free_sl(content);
+        return;
+    }
+
+    LOCK_MUTEX(&tier->mutex);
+    tier_entry_t* entry = find_entry(tier, pathname, FALSE);
+    if(!entry || !entry->placeholder)
+    {
+        // the file was removed or created again meanwhile, this content is stale
+        UNLOCK_MUTEX(&tier->mutex);
+        free_sl(content);
+        return;
+    }
+
+    entry->placeholder = FALSE;
+    entry->size = sl_get_size(content);
+    entry->content = content;
+    entry->queued = TRUE;
+    enqueue(tier->pending, entry);
+    COND_SIGNAL(&tier->pending_cond);
+    COND_BROADCAST(&tier->written_cond);
+    UNLOCK_MUTEX(&tier->mutex);
+}
+
+int disk_tier_take(disk_tier_t* tier, const char* pathname, void** data, size_t* size)
+{
+    RET_IF(!tier || !pathname || !data || !size, 0);
+
+    tier_entry_t* placeholder;
+    CHECK_FATAL_EQ(placeholder, malloc(sizeof(tier_entry_t)), NULL, NO_MEM_FATAL);
+
+    LOCK_MUTEX(&tier->mutex);
+    tier_entry_t* entry = find_entry(tier, pathname, TRUE);
+    if(!entry)
+    {
+        ++tier->metrics.misses;
+        UNLOCK_MUTEX(&tier->mutex);
+        free(placeholder);
+        return 0;
+    }
+
+    ++tier->metrics.promoted;
+    icl_hash_delete(tier->index, entry->pathname, NULL, NULL);
+    // the file is still here for the others until it's back in memory
+    add_placeholder(tier, placeholder, pathname);
+    *size = entry->size;
+    *data = NULL;
+    if(entry->queued)
+    {
+        // not written yet, the content is still in memory and the demoter skips it
+        segment_list_t* content = entry->content;
+        entry->content = NULL;
+        entry->cancelled = TRUE;
+        UNLOCK_MUTEX(&tier->mutex);
+
+        if(*size > 0)
+        {
+            *data = content_alloc(*size);
+            sl_copy_to(content, *data, *size);
+        }
+        free_sl(content);
+        return 1;
+    }
+
+    char path[DISK_TIER_PATH_LENGTH];
+    get_entry_path(tier->dir, entry->id, path);
+    unlink_entry(tier, entry);
+    tier->used -= entry->size;
+    free(entry);
+    UNLOCK_MUTEX(&tier->mutex);
+
+    // the file is read outside of the lock, no one else uses its id anymore
+    int res = 1;
+    if(*size > 0)
+    {
+        *data = content_alloc(*size);
+        int fd = open(path, O_RDONLY);
+        if(fd == -1 || readn(fd, *data, *size) <= 0)
+        {
+            content_free(*data);
+            *data = NULL;
+            errno = EIO;
+            res = -1;
+        }
+        if(fd != -1)
+            close(fd);
+    }
+    unlink(path);
+
+    if(res == -1)
+    {
+        // the file is lost, so is its placeholder
+        LOCK_MUTEX(&tier->mutex);
+        if((entry = icl_hash_find(tier->index, (char*)pathname)) != NULL && entry->placeholder)
+            drop_entry(tier, entry);
+        UNLOCK_MUTEX(&tier->mutex);
+    }
+
+    return res;
+}
+
+void disk_tier_drop(disk_tier_t* tier, const char* pathname)
+{
+    NRET_IF(!tier || !pathname);
+
+    LOCK_MUTEX(&tier->mutex);
+    tier_entry_t* entry = find_entry(tier, pathname, FALSE);
+    if(entry)
+        drop_entry(tier, entry);
+    UNLOCK_MUTEX(&tier->mutex);
+}
+
+bool_t disk_tier_contains(disk_tier_t* tier, const char* pathname)
+{
+    RET_IF(!tier || !pathname, FALSE);
+
+    LOCK_MUTEX(&tier->mutex);
+    bool_t res = icl_hash_find(tier->index, (char*)pathname) != NULL;
+    UNLOCK_MUTEX(&tier->mutex);
+
+    return res;
+}
+
+disk_tier_metrics_t disk_tier_get_metrics(disk_tier_t* tier)
+{
+    disk_tier_metrics_t metrics;
+    memset(&metrics, 0, sizeof(disk_tier_metrics_t));
+    RET_IF(!tier, metrics);
+
+    EXEC_WITH_MUTEX(metrics = tier->metrics, &tier->mutex);
+    return metrics;
+}
+
+void free_disk_tier(disk_tier_t* tier)
+{
+    NRET_IF(!tier);
+
+    LOCK_MUTEX(&tier->mutex);
+    tier->closing = TRUE;
+    COND_SIGNAL(&tier->pending_cond);
+    UNLOCK_MUTEX(&tier->mutex);
+    pthread_join(tier->demoter, NULL);
+
+    tier_entry_t* entry;
+    while((entry = dequeue(tier->pending)) != NULL)
+    {
+        if(!entry->cancelled)
+            icl_hash_delete(tier->index, entry->pathname, NULL, NULL);
+        free_sl(entry->content);
+        free(entry);
+    }
+
+    char path[DISK_TIER_PATH_LENGTH];
+    while((entry = tier->oldest) != NULL)
+    {
+        get_entry_path(tier->dir, entry->id, path);
+        unlink(path);
+        tier->oldest = entry->newer;
+        icl_hash_delete(tier->index, entry->pathname, NULL, NULL);
+        free(entry);
+    }
+
+    // only the placeholders are left
+    icl_hash_destroy(tier->index, NULL, free);
+    free_q(tier->pending, ll_no_free);
+    pthread_mutex_destroy(&tier->mutex);
+    pthread_cond_destroy(&tier->pending_cond);
+    pthread_cond_destroy(&tier->written_cond);
+    free(tier);
+}
@@ -1,36 +1,104 @@
 #include "file_stored.h"
 
 #include <string.h>
+#include "slab.h"
+#include "client_set.h"
+#include "wait_queue.h"
+
+#define FILES_PER_CHUNK 128
 
 struct file_stored {
-    char* pathname;
-    char*     data;
-    size_t    size;
+    char pathname[MAX_PATHNAME_API_LENGTH + 1];
+    segment_list_t* content;
+    // content shared with the other files written with the same bytes, NULL if the content is private
+    content_entry_t* shared_content;
     int  locked_by;
-    linked_list_t* opened_by;
-    queue_t*      lock_queue;
+    client_set_t*  opened_by;
+    client_set_t*  shared_by;
+    wait_queue_t* lock_queue;
+    client_set_t*  shared_waiters;
+    // clients with a copy of the content, told once it's stale
+    client_set_t*  cached_by;
+    // changed with the content, never reused by another content of any file
+    uint64_t  version;
+    lock_wait_metrics_t lock_metrics;
     struct timespec creation_time;
     struct timespec last_use_time;
     bool_t    write_enabled;
     uint32_t  use_frequency;
+    // reads served by the workers of each NUMA node since the content was last placed, and the node it was placed on
+    uint32_t  node_reads[FILE_NUMA_NODES];
+    int       node;
     pthread_rwlock_t rwlock;
 };
 
+// Policy used to choose the next lock owner among the waiting clients, shared by every file
+static lock_handoff_t lock_handoff = LOCK_HANDOFF_FIFO;
+
+// Called for each client whose copy of a file is stale, NULL if the copies are not tracked
+static void (*cache_invalidation)(file_stored_t* file, int client) = NULL;
+
+// Last version given to a content, started from the clock so that the versions keep growing across the runs
+static uint64_t last_version = 0;
+
+// Files records are taken from a slab, the pathname is stored inside the record itself
+static slab_t* files_slab = NULL;
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+
+static void init_slab()
+{
+    files_slab = create_slab(sizeof(file_stored_t), FILES_PER_CHUNK);
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    last_version = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Tell the clients caching file except one that their copy is stale, they stop being tracked
+static void file_invalidate_cache(file_stored_t* file, int except)
+{
+    NRET_IF(cs_count(file->cached_by) == 0 || (cs_count(file->cached_by) == 1 && cs_contains(file->cached_by, except)));
+
+    bool_t keep_except = cs_contains(file->cached_by, except);
+    FOREACH_CS(file->cached_by, client)
+    {
+        if(client != except && cache_invalidation)
+            cache_invalidation(file, client);
+    }
+    free_cs(file->cached_by);
+    file->cached_by = create_cs();
+    if(keep_except)
+        cs_add(file->cached_by, except);
+}
+
+// The content of file changed, it gets a new version and the copies of the clients are stale
+static void file_content_changed(file_stored_t* file)
+{
+    file->version = __atomic_add_fetch(&last_version, 1, __ATOMIC_RELAXED);
+    file_invalidate_cache(file, -1);
+}
+
 file_stored_t* create_file(const char* pathname)
 {
     file_stored_t* file;
-    CHECK_FATAL_EQ(file, malloc(sizeof(file_stored_t)), NULL, NO_MEM_FATAL);
+    pthread_once(&slab_once, init_slab);
+    file = slab_alloc(files_slab);
     memset(file, 0, sizeof(file_stored_t));
 
-    size_t len = strnlen(pathname, 108);
-    MAKE_COPY_BYTES(file->pathname, len + 1, pathname);
+    strncpy(file->pathname, pathname, MAX_PATHNAME_API_LENGTH);
 
+    file->content = create_sl();
     file->locked_by = -1;
-    file->opened_by = ll_create();
-    file->lock_queue = create_q();
+    file->opened_by = create_cs();
+    file->shared_by = create_cs();
+    file->lock_queue = create_wq();
+    file->shared_waiters = create_cs();
+    file->cached_by = create_cs();
+    file->version = __atomic_add_fetch(&last_version, 1, __ATOMIC_RELAXED);
     clock_gettime(CLOCK_REALTIME, &file->creation_time);
     file->last_use_time = file->creation_time;
     file->use_frequency = 1;
+    file->node = -1;
     INIT_RWLOCK(&file->rwlock);
 
     return file;
@@ -42,29 +110,103 @@ char* file_get_pathname(file_stored_t* file)
     return file->pathname;
 }
 
-int file_replace_content(file_stored_t* file, void* content, size_t content_size)
+// Stop holding the shared content of this file, its data stays alive as long as a list references it
+static void file_drop_shared_content(file_stored_t* file)
+{
+    content_entry_remove_file(file->shared_content);
+    file->shared_content = NULL;
+}
+
+size_t file_replace_content(file_stored_t* file, void* content, size_t content_size)
 {
     RET_IF(!file, 0);
 
-    free(file->data);
-    file->data = content;
-    int prev = file->size;
-    file->size = content_size;
+    file_drop_shared_content(file);
+    size_t prev = sl_get_size(file->content);
+    sl_replace(file->content, content, content_size);
+    file_content_changed(file);
+    return prev;
+}
+
+size_t file_share_content(file_stored_t* file, content_entry_t* entry)
+{
+    RET_IF(!file || !entry, 0);
+
+    file_drop_shared_content(file);
+    size_t prev = sl_get_size(file->content);
+    content_entry_attach(entry, file->content);
+    content_entry_add_file(entry);
+    file->shared_content = entry;
+    file_content_changed(file);
     return prev;
 }
 
-int file_append_content(file_stored_t* file, void* content, size_t content_size)
+size_t file_append_content(file_stored_t* file, void* content, size_t content_size)
+{
+    RET_IF(!file, 0);
+
+    sl_append(file->content, content, content_size);
+    file_content_changed(file);
+    return sl_get_size(file->content);
+}
+
+size_t file_append_content_copy(file_stored_t* file, const void* content, size_t content_size)
 {
     RET_IF(!file, 0);
 
-    CHECK_FATAL_EQ(file->data, realloc(file->data, file->size + content_size), NULL, NO_MEM_FATAL);
-    memcpy(file->data + file->size, content, content_size);
-    int total = file->size + content_size;
-    file->size = content_size;
-    return total;
+    sl_append_copy(file->content, content, content_size);
+    file_content_changed(file);
+    return sl_get_size(file->content);
 }
 
-queue_t* file_get_locks_queue(file_stored_t* file)
+ssize_t file_write_content_at(file_stored_t* file, size_t offset, const void* content, size_t content_size)
+{
+    RET_IF(!file || content_size == 0, 0);
+
+    size_t memory = file_get_memory_size(file);
+    // the shared bytes get a private copy once they're overwritten, the file doesn't hold the shared content anymore
+    bool_t unshared = file->shared_content && offset < content_entry_get_size(file->shared_content);
+    sl_write_at(file->content, offset, content, content_size);
+    if(unshared)
+        file_drop_shared_content(file);
+    file_content_changed(file);
+    return (ssize_t)file_get_memory_size(file) - (ssize_t)memory;
+}
+
+bool_t file_write_copies_blocks(file_stored_t* file, size_t offset)
+{
+    RET_IF(!file, FALSE);
+
+    if(file->shared_content && offset < content_entry_get_size(file->shared_content))
+        return TRUE;
+    return offset < sl_get_size(file->content) - sl_get_unsealed_size(file->content);
+}
+
+size_t file_write_cost_at(file_stored_t* file, size_t offset, size_t content_size)
+{
+    RET_IF(!file, 0);
+    return sl_write_cost_at(file->content, offset, content_size);
+}
+
+bool_t file_needs_compaction(file_stored_t* file)
+{
+    RET_IF(!file, FALSE);
+    return sl_needs_compaction(file->content);
+}
+
+bool_t file_needs_compression(file_stored_t* file)
+{
+    RET_IF(!file, FALSE);
+    return sl_get_unsealed_size(file->content) >= FILE_COMPRESS_MIN_SIZE;
+}
+
+int file_compact_content(file_stored_t* file)
+{
+    RET_IF(!file, -1);
+    return sl_compact(file->content);
+}
+
+wait_queue_t* file_get_locks_queue(file_stored_t* file)
 {
     RET_IF(!file, NULL);
     return file->lock_queue;
@@ -72,124 +214,228 @@ queue_t* file_get_locks_queue(file_stored_t* file)
 
 void free_file(file_stored_t* file)
 {
-    free(file->pathname);
-    free(file->data);
-    ll_free(file->opened_by, free);
-    free_q(file->lock_queue, free);
+    file_invalidate_cache(file, -1);
+    free_cs(file->cached_by);
+    file_drop_shared_content(file);
+    free_sl(file->content);
+    free_cs(file->opened_by);
+    free_cs(file->shared_by);
+    free_wq(file->lock_queue);
+    free_cs(file->shared_waiters);
 
     pthread_rwlock_destroy(&file->rwlock);
-    free(file);
+    slab_free(files_slab, file);
 }
 
 void free_file_for_replacement(file_stored_t* file)
 {
-    ll_free(file->opened_by, free);
+    file_invalidate_cache(file, -1);
+    free_cs(file->cached_by);
+    file_drop_shared_content(file);
+    free_cs(file->opened_by);
+    free_cs(file->shared_by);
+    free_cs(file->shared_waiters);
     pthread_rwlock_destroy(&file->rwlock);
-    free(file);
+    slab_free(files_slab, file);
 }
 
 int file_add_client(file_stored_t* file, int client)
 {
     RET_IF(!file, -1);
 
-    int* new_client;
-    MAKE_COPY(new_client, int, client);
-
-    return ll_add_head(file->opened_by, new_client);
+    return cs_add(file->opened_by, client);
 }
 
 bool_t file_is_opened_by(file_stored_t* file, int client)
 {
     RET_IF(!file, FALSE);
 
-    FOREACH_LL(file->opened_by)
-    {
-        if(*VALUE_IT_LL(int*) == client)
-            return TRUE;
-    }
-
-    return FALSE;
+    return cs_contains(file->opened_by, client);
 }
 
 int file_close_client(file_stored_t* file, int client)
 {
     RET_IF(!file, -1);
 
-    node_t* remove_node = NULL;
-    FOREACH_LL(file->opened_by)
-    {
-        if(*VALUE_IT_LL(int*) == client)
-        {
-            remove_node = CURR_IT_LL;
-            break;
-        }
-    }
+    return cs_remove(file->opened_by, client) ? 1 : -1;
+}
 
-    if(remove_node)
-    {
-        free(node_get_value(remove_node));
-        return ll_remove_node(file->opened_by, remove_node);
-    }
+int file_add_cache_client(file_stored_t* file, int client)
+{
+    RET_IF(!file, -1);
 
-    return -1;
+    return cs_add(file->cached_by, client);
 }
 
-int file_enqueue_lock(file_stored_t* file, int client)
+int file_remove_cache_client(file_stored_t* file, int client)
 {
     RET_IF(!file, -1);
 
-    int* new_client;
-    MAKE_COPY(new_client, int, client);
+    return cs_remove(file->cached_by, client) ? 1 : -1;
+}
 
-    return enqueue(file->lock_queue, new_client);
+client_set_t* file_get_cache_clients(file_stored_t* file)
+{
+    RET_IF(!file, NULL);
+    return file->cached_by;
+}
+
+uint64_t file_get_version(file_stored_t* file)
+{
+    RET_IF(!file, 0);
+    return file->version;
+}
+
+void file_set_cache_invalidation(void (*invalidation)(file_stored_t* file, int client))
+{
+    cache_invalidation = invalidation;
+}
+
+client_set_t* file_get_clients(file_stored_t* file)
+{
+    RET_IF(!file, NULL);
+    return file->opened_by;
 }
 
 bool_t file_is_client_already_queued(file_stored_t* file, int client)
 {
     RET_IF(!file, FALSE);
 
-    FOREACH_Q(file->lock_queue)
+    return wq_contains(file->lock_queue, client);
+}
+
+bool_t file_is_lock_shared_by(file_stored_t* file, int client)
+{
+    RET_IF(!file, FALSE);
+    return cs_contains(file->shared_by, client);
+}
+
+client_set_t* file_get_lock_sharers(file_stored_t* file)
+{
+    RET_IF(!file, NULL);
+    return file->shared_by;
+}
+
+bool_t file_can_acquire_lock(file_stored_t* file, int client, bool_t shared)
+{
+    RET_IF(!file || client < 0, FALSE);
+
+    if(file->locked_by == client)
+        return TRUE;
+    if(file->locked_by != -1)
+        return FALSE;
+
+    size_t sharers = cs_count(file->shared_by);
+    bool_t is_sharer = cs_contains(file->shared_by, client);
+    if(shared)
     {
-        if(*VALUE_IT_Q(int*) == client)
-            return TRUE;
+        // writer preference, new readers don't overtake a waiting writer
+        size_t exclusive_waiters = count_wq(file->lock_queue) - cs_count(file->shared_waiters);
+        return is_sharer || exclusive_waiters == 0;
     }
 
-    return FALSE;
+    // the only reader can upgrade its lock
+    return sharers == 0 || (sharers == 1 && is_sharer);
 }
 
-int file_delete_lock_client(file_stored_t* file, int client)
+int file_acquire_lock(file_stored_t* file, int client, bool_t shared)
 {
-    RET_IF(!file || client == -1, -1);
+    RET_IF(!file || client < 0, -1);
+
+    if(file->locked_by == client || (shared && cs_contains(file->shared_by, client)))
+        return 0;
 
-    FOREACH_Q(file->lock_queue)
+    if(file_can_acquire_lock(file, client, shared))
     {
-        int* client_ptr = VALUE_IT_Q(int*);
-        if(*client_ptr == client)
+        if(shared)
         {
-            free(client_ptr);
-            remove_node_q(file->lock_queue, CURR_IT_LL);
-            break;
+            cs_add(file->shared_by, client);
+            ++file->lock_metrics.acquisitions;
+        }
+        else
+        {
+            cs_remove(file->shared_by, client);
+            file_set_lock_owner(file, client);
         }
+
+        return 0;
     }
 
-    if(file->locked_by == client)
+    if(wq_enqueue(file->lock_queue, client) == 1 && shared)
+        cs_add(file->shared_waiters, client);
+    return -1;
+}
+
+// Dequeue the next client from the lock queue of this file following the lock handoff policy, -1 if nobody is waiting
+static int file_dequeue_lock(file_stored_t* file)
+{
+    uint64_t waited_ns = 0;
+    int client = wq_dequeue(file->lock_queue, lock_handoff == LOCK_HANDOFF_LIFO, &waited_ns);
+    if(client != -1)
     {
-        file->locked_by = file_dequeue_lock(file);
-        return file->locked_by;
+        ++file->lock_metrics.waits;
+        file->lock_metrics.total_wait_ns += waited_ns;
+        file->lock_metrics.max_wait_ns = MAX(file->lock_metrics.max_wait_ns, waited_ns);
     }
 
-    return -1;
+    return client;
 }
 
-int file_dequeue_lock(file_stored_t* file)
+// Give the free lock to the next waiters: a single writer or every reader before the next writer in the queue
+static size_t file_grant_lock(file_stored_t* file, client_set_t* granted)
 {
-    RET_IF(!file, -1);
+    size_t granted_count = 0;
+    while(file->locked_by == -1 && count_wq(file->lock_queue) > 0)
+    {
+        int next = wq_peek(file->lock_queue, lock_handoff == LOCK_HANDOFF_LIFO);
+        bool_t is_shared = cs_contains(file->shared_waiters, next);
+        if(!is_shared && cs_count(file->shared_by) > 0)
+            break;
+
+        file_dequeue_lock(file);
+        if(is_shared)
+        {
+            cs_remove(file->shared_waiters, next);
+            cs_add(file->shared_by, next);
+            ++file->lock_metrics.acquisitions;
+        }
+        else
+        {
+            file_set_lock_owner(file, next);
+        }
+
+        cs_add(granted, next);
+        ++granted_count;
+    }
+
+    return granted_count;
+}
 
-    int* ptr = dequeue(file->lock_queue);
-    int new_client = ptr == NULL ? -1 : *ptr;
-    free(ptr);
+size_t file_delete_lock_client(file_stored_t* file, int client, client_set_t* granted)
+{
+    RET_IF(!file || client == -1, 0);
+
+    if(wq_cancel(file->lock_queue, client))
+        cs_remove(file->shared_waiters, client);
 
-    return new_client;
+    if(file->locked_by == client)
+        file->locked_by = -1;
+    else
+        cs_remove(file->shared_by, client);
+
+    // a cancelled writer may also unblock the readers queued behind it
+    return file_grant_lock(file, granted);
+}
+
+const lock_wait_metrics_t* file_get_lock_wait_metrics(file_stored_t* file)
+{
+    RET_IF(!file, NULL);
+    return &file->lock_metrics;
+}
+
+void file_set_lock_handoff(lock_handoff_t handoff)
+{
+    lock_handoff = handoff;
 }
 
 void notify_used_file(file_stored_t* file)
@@ -200,6 +446,27 @@ void notify_used_file(file_stored_t* file)
     clock_gettime(CLOCK_REALTIME, &file->last_use_time);
 }
 
+int file_count_node_read(file_stored_t* file, int node)
+{
+    RET_IF(!file || node < 0 || node >= FILE_NUMA_NODES, -1);
+
+    // the readers hold only the read lock of the file, the counters are atomic and a single reader wins the move
+    uint32_t reads = __atomic_add_fetch(&file->node_reads[node], 1, __ATOMIC_RELAXED);
+    int placed = __atomic_load_n(&file->node, __ATOMIC_RELAXED);
+    if(placed == node || reads < FILE_NUMA_MIN_READS)
+        return -1;
+
+    uint32_t placed_reads = placed >= 0 ? __atomic_load_n(&file->node_reads[placed], __ATOMIC_RELAXED) : 0;
+    if(reads < 2 * placed_reads)
+        return -1;
+    if(!__atomic_compare_exchange_n(&file->node, &placed, node, FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return -1;
+
+    for(int i = 0; i < FILE_NUMA_NODES; ++i)
+        __atomic_store_n(&file->node_reads[i], 0, __ATOMIC_RELAXED);
+    return node;
+}
+
 uint32_t file_inc_frequency(file_stored_t* file, int step)
 {
     RET_IF(!file, 0);
@@ -220,16 +487,31 @@ bool_t file_is_write_enabled(file_stored_t* file)
     return file->write_enabled;
 }
 
-char* file_get_data(file_stored_t* file)
+segment_list_t* file_get_content(file_stored_t* file)
 {
     RET_IF(!file, NULL);
-    return file->data;
+    return file->content;
 }
 
 size_t file_get_size(file_stored_t* file)
 {
     RET_IF(!file, 0);
-    return file->size;
+    return sl_get_size(file->content);
+}
+
+size_t file_get_memory_size(file_stored_t* file)
+{
+    RET_IF(!file, 0);
+
+    // the shared content is counted by the last file holding it, the one whose removal frees it
+    size_t shared_size = content_entry_get_files(file->shared_content) == 1 ? content_entry_get_size(file->shared_content) : 0;
+    return sl_get_memory_size(file->content) + shared_size;
+}
+
+content_entry_t* file_get_shared_content(file_stored_t* file)
+{
+    RET_IF(!file, NULL);
+    return file->shared_content;
 }
 
 int file_get_lock_owner(file_stored_t* file)
@@ -260,6 +542,12 @@ void file_set_lock_owner(file_stored_t* file, int lock_owner)
 {
     NRET_IF(!file);
     file->locked_by = lock_owner;
+    if(lock_owner != -1)
+    {
+        ++file->lock_metrics.acquisitions;
+        // the other clients can't read the file anymore, their copies must not be used either
+        file_invalidate_cache(file, lock_owner);
+    }
 }
 
 void file_set_last_use_time(file_stored_t* file, struct timespec new_use_time)
@@ -268,6 +556,18 @@ void file_set_last_use_time(file_stored_t* file, struct timespec new_use_time)
     file->last_use_time = new_use_time;
 }
 
+void file_set_creation_time(file_stored_t* file, struct timespec creation_time)
+{
+    NRET_IF(!file);
+    file->creation_time = creation_time;
+}
+
+void file_set_use_frequency(file_stored_t* file, uint32_t use_frequency)
+{
+    NRET_IF(!file);
+    file->use_frequency = use_frequency;
+}
+
 void acquire_read_lock_file(file_stored_t* file)
 {
     NRET_IF(!file);
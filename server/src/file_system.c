@@ -13,22 +13,57 @@ typedef struct pair_pthread_int {
 
 // Metrics to be logged
 struct file_system_metrics {
+    // updated atomically together with the memory used
     size_t max_memory_reached;
     size_t max_num_files_reached;
 
     linked_list_t* max_req_threads;
 };
 
+// Files opened by a client, files whose lock is owned or waited by it and files it caches
+typedef struct client_files {
+    linked_list_t* opened;
+    linked_list_t* locks;
+    linked_list_t* cached;
+
+    // Lock wait with a timeout, the id tells apart the different waits of the same fd
+    file_stored_t* waiting_file;
+    uint64_t wait_id;
+    timer_entry_t* wait_timer;
+} client_files_t;
+
+// The lists of files of a client inside the per client index
+typedef enum client_files_list {
+    CF_OPENED,
+    CF_LOCKS,
+    CF_CACHED
+} client_files_list_t;
+
 struct file_system {
     pthread_rwlock_t  rwlock;
     icl_hash_t* files_stored;
     linked_list_t* filenames_stored;
 
+    // bytes used by the files plus the ones reserved for the changes in progress, updated atomically so the
+    // reservations don't need any lock
     size_t current_used_memory;
     size_t current_file_count;
     size_t max_memory_size;
     size_t max_file_count;
 
+    // memory used which wakes up the reclaimer and memory used it evicts the files down to, 0 if there is no reclaimer
+    size_t high_watermark;
+    size_t low_watermark;
+
+    // Reverse index of the files used by each client, indexed by fd
+    client_files_t* clients_index;
+    size_t clients_index_size;
+    pthread_mutex_t clients_index_mutex;
+    uint64_t last_wait_id;
+
+    // Timers of the lock waits with a timeout, advanced by the connection handler
+    timer_wheel_t* lock_timers;
+
     struct file_system_metrics metrics;
     pthread_rwlock_t    rwlock_metrics;
 };
@@ -47,9 +82,11 @@ file_system_t* create_fs(size_t max_capacity, size_t max_file_count)
     fs->max_file_count = max_file_count;
 
     fs->metrics.max_req_threads = ll_create();
+    fs->lock_timers = create_tw(TW_DEFAULT_SLOTS, TW_DEFAULT_TICK_MS);
 
     INIT_RWLOCK(&fs->rwlock);
     INIT_RWLOCK(&fs->rwlock_metrics);
+    INIT_MUTEX(&fs->clients_index_mutex);
     return fs;
 }
 
@@ -109,6 +146,23 @@ void shutdown_fs(file_system_t* fs)
     LOG_EVENT("FINAL_METRICS last files remaining(%zu): [%s]", 60 + files_str_len, files_num, files_str_len > 0 ? files_printable : "NONE");
     free(files_printable);
 
+    // lock wait time of the files which had clients waiting for their lock
+    RLOCK_RWLOCK(&fs->rwlock);
+    FOREACH_LL(fs->filenames_stored) {
+        file_stored_t* file = icl_hash_find(fs->files_stored, VALUE_IT_LL(char*));
+        const lock_wait_metrics_t* lock_metrics = file_get_lock_wait_metrics(file);
+        if(!lock_metrics || lock_metrics->waits == 0)
+            continue;
+
+        double avg_wait_ms = lock_metrics->total_wait_ns / (double)lock_metrics->waits / 1000000.0;
+        double max_wait_ms = lock_metrics->max_wait_ns / 1000000.0;
+        PRINT_INFO_DEBUG("File %s lock acquired %zu times, %zu after a wait (avg %.3fms, max %.3fms)", file_get_pathname(file),
+                            lock_metrics->acquisitions, lock_metrics->waits, avg_wait_ms, max_wait_ms);
+        LOG_EVENT("FINAL_METRICS File %s lock acquired %zu times, %zu after a wait (avg %.3fms, max %.3fms)", -1,
+                    file_get_pathname(file), lock_metrics->acquisitions, lock_metrics->waits, avg_wait_ms, max_wait_ms);
+    }
+    UNLOCK_RWLOCK(&fs->rwlock);
+
     struct file_system_metrics* metrics = &fs->metrics;
     RLOCK_RWLOCK(&fs->rwlock_metrics);
 
@@ -150,16 +204,16 @@ void release_write_lock_fs(file_system_t* fs)
     UNLOCK_RWLOCK(&fs->rwlock);
 }
 
-file_stored_t** get_files_stored(file_system_t* fs)
+file_stored_t** get_files_stored(file_system_t* fs, arena_t* arena)
 {
-    RET_IF(!fs, NULL);
+    RET_IF(!fs || !arena, NULL);
 
     file_stored_t** files;
     size_t num = ll_count(fs->filenames_stored);
     if(num == 0)
         return NULL;
     
-    CHECK_FATAL_EQ(files, malloc(sizeof(file_stored_t*) * num), NULL, NO_MEM_FATAL);
+    files = arena_alloc(arena, sizeof(file_stored_t*) * num);
     
     int i = 0;
     FOREACH_LL(fs->filenames_stored) {
@@ -185,12 +239,78 @@ void set_policy_fs(file_system_t* fs, char* policy)
         fs_policy = replacement_policy_fifo;
 }
 
-int is_size_available(file_system_t* fs, size_t size)
+void set_lock_policy_fs(file_system_t* fs, char* policy)
+{
+    NRET_IF(!fs);
+
+    // pick a lock handoff policy, default is fifo
+    if(strncmp(policy, "LIFO", 4) == 0)
+        file_set_lock_handoff(LOCK_HANDOFF_LIFO);
+    else
+        file_set_lock_handoff(LOCK_HANDOFF_FIFO);
+}
+
+size_t is_size_available(file_system_t* fs, size_t size)
 {
     RET_IF(!fs, 0);
 
-    int remaining = fs->max_memory_size - (int)fs->current_used_memory;
-    return -(remaining - size);
+    size_t used = __atomic_load_n(&fs->current_used_memory, __ATOMIC_RELAXED);
+    return used + size > fs->max_memory_size ? used + size - fs->max_memory_size : 0;
+}
+
+// Raise the max memory reached to used if it's greater
+static void update_max_memory_reached(file_system_t* fs, size_t used)
+{
+    size_t max = __atomic_load_n(&fs->metrics.max_memory_reached, __ATOMIC_RELAXED);
+    while(used > max && !__atomic_compare_exchange_n(&fs->metrics.max_memory_reached, &max, used, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+bool_t reserve_memory_fs(file_system_t* fs, size_t size)
+{
+    RET_IF(!fs, FALSE);
+
+    size_t used = __atomic_load_n(&fs->current_used_memory, __ATOMIC_RELAXED);
+    do
+    {
+        if(size > fs->max_memory_size || used > fs->max_memory_size - size)
+            return FALSE;
+    } while(!__atomic_compare_exchange_n(&fs->current_used_memory, &used, used + size, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    update_max_memory_reached(fs, used + size);
+    return TRUE;
+}
+
+void commit_memory_fs(file_system_t* fs, size_t reserved, size_t size)
+{
+    NRET_IF(!fs);
+
+    if(size > reserved)
+        notify_memory_changed_fs(fs, size - reserved);
+    else if(size < reserved)
+        __atomic_sub_fetch(&fs->current_used_memory, reserved - size, __ATOMIC_RELAXED);
+}
+
+void rollback_memory_fs(file_system_t* fs, size_t reserved)
+{
+    NRET_IF(!fs || reserved == 0);
+
+    __atomic_sub_fetch(&fs->current_used_memory, reserved, __ATOMIC_RELAXED);
+}
+
+void set_watermarks_fs(file_system_t* fs, size_t low, size_t high)
+{
+    NRET_IF(!fs);
+
+    fs->low_watermark = MIN(low, high);
+    fs->high_watermark = high;
+}
+
+size_t get_reclaim_size_fs(file_system_t* fs)
+{
+    RET_IF(!fs || fs->high_watermark == 0, 0);
+
+    size_t used = __atomic_load_n(&fs->current_used_memory, __ATOMIC_RELAXED);
+    return used > fs->high_watermark ? used - fs->low_watermark : 0;
 }
 
 bool_t is_size_too_big(file_system_t* fs, size_t size)
@@ -209,7 +329,7 @@ size_t get_file_count_fs(file_system_t* fs)
 bool_t is_file_count_full_fs(file_system_t* fs)
 {
     RET_IF(!fs, TRUE);
-    return ((int)fs->max_file_count - (int)fs->current_file_count) <= 0;
+    return fs->current_file_count >= fs->max_file_count;
 }
 
 file_stored_t* find_file_fs(file_system_t* fs, const char* pathname)
@@ -218,23 +338,123 @@ file_stored_t* find_file_fs(file_system_t* fs, const char* pathname)
     return icl_hash_find(fs->files_stored, (char*)pathname);
 }
 
-int add_file_fs(file_system_t* fs, const char* pathname, file_stored_t* file)
+// Get the index entry of client, if create is TRUE the index grows to contain the client
+// Must be called with the clients index mutex acquired
+static client_files_t* get_client_entry(file_system_t* fs, int client, bool_t create)
 {
-    RET_IF(!fs, -1);
+    RET_IF(client < 0, NULL);
+
+    if(client >= fs->clients_index_size)
+    {
+        RET_IF(!create, NULL);
+
+        size_t new_size = MAX((size_t)client + 1, fs->clients_index_size * 2);
+        client_files_t* new_index;
+        CHECK_FATAL_EQ(new_index, realloc(fs->clients_index, new_size * sizeof(client_files_t)), NULL, NO_MEM_FATAL);
+        memset(new_index + fs->clients_index_size, 0, (new_size - fs->clients_index_size) * sizeof(client_files_t));
+        fs->clients_index = new_index;
+        fs->clients_index_size = new_size;
+    }
+
+    client_files_t* entry = &fs->clients_index[client];
+    if(create && !entry->opened)
+    {
+        entry->opened = ll_create();
+        entry->locks = ll_create();
+        entry->cached = ll_create();
+    }
+
+    return entry;
+}
+
+static linked_list_t* get_client_files(client_files_t* entry, client_files_list_t list)
+{
+    RET_IF(!entry, NULL);
+    return list == CF_OPENED ? entry->opened : (list == CF_LOCKS ? entry->locks : entry->cached);
+}
+
+// Stop the timer of the timed lock wait of client, if any
+// Must be called with the clients index mutex acquired
+static void end_client_wait(file_system_t* fs, int client)
+{
+    client_files_t* entry = get_client_entry(fs, client, FALSE);
+    NRET_IF(!entry || !entry->waiting_file);
+
+    // if the timer already fired the expiration sees a different wait and does nothing
+    tw_cancel(fs->lock_timers, entry->wait_timer);
+    entry->wait_timer = NULL;
+    entry->waiting_file = NULL;
+}
+
+// Add file to the list of files of client
+static void track_client_file(file_system_t* fs, file_stored_t* file, int client, client_files_list_t list)
+{
+    LOCK_MUTEX(&fs->clients_index_mutex);
+    client_files_t* entry = get_client_entry(fs, client, TRUE);
+    if(entry)
+        ll_add_head(get_client_files(entry, list), file);
+    UNLOCK_MUTEX(&fs->clients_index_mutex);
+}
+
+// Remove file from the list of files of client
+static void untrack_client_file(file_system_t* fs, file_stored_t* file, int client, client_files_list_t list)
+{
+    LOCK_MUTEX(&fs->clients_index_mutex);
+    client_files_t* entry = get_client_entry(fs, client, FALSE);
+    linked_list_t* files = get_client_files(entry, list);
+    FOREACH_LL(files)
+    {
+        if(VALUE_IT_LL(file_stored_t*) == file)
+        {
+            ll_remove_node(files, CURR_IT_LL);
+            break;
+        }
+    }
 
-    char* pathname_cpy;
-    int len = strnlen(pathname, MAX_PATHNAME_API_LENGTH);
-    MAKE_COPY_BYTES(pathname_cpy, len + 1, pathname);
+    if(list == CF_LOCKS && entry && entry->waiting_file == file)
+        end_client_wait(fs, client);
+    UNLOCK_MUTEX(&fs->clients_index_mutex);
+}
 
-    bool_t res = icl_hash_insert(fs->files_stored, pathname_cpy, file) != NULL;
-    if(!res)
-        free(pathname_cpy);
-    else {
-        // new copy to have unique ptrs
-        MAKE_COPY_BYTES(pathname_cpy, len + 1, pathname);
+// Stop the timed waits of the clients which got the lock
+static void end_granted_waits(file_system_t* fs, client_set_t* granted)
+{
+    LOCK_MUTEX(&fs->clients_index_mutex);
+    FOREACH_CS(granted, client)
+    {
+        end_client_wait(fs, client);
+    }
+    UNLOCK_MUTEX(&fs->clients_index_mutex);
+}
 
-        ll_add_head(fs->filenames_stored, pathname_cpy);
-        notify_memory_changed_fs(fs, file_get_size(file));
+// Move the files of a list inside an array allocated in arena and empty the list
+static file_stored_t** detach_client_files(linked_list_t* files, arena_t* arena, size_t* count)
+{
+    *count = ll_count(files);
+    RET_IF(*count == 0, NULL);
+
+    file_stored_t** array = arena_alloc(arena, sizeof(file_stored_t*) * (*count));
+    int i = 0;
+    FOREACH_LL(files)
+    {
+        array[i++] = VALUE_IT_LL(file_stored_t*);
+    }
+
+    ll_empty(files, ll_no_free);
+    return array;
+}
+
+int add_file_fs(file_system_t* fs, const char* pathname, file_stored_t* file)
+{
+    RET_IF(!fs, -1);
+
+    // the pathname stored inside the file is used as key, it lives as long as the file
+    char* file_pathname = file_get_pathname(file);
+    bool_t res = icl_hash_insert(fs->files_stored, file_pathname, file) != NULL;
+    if(res)
+    {
+        ll_add_head(fs->filenames_stored, file_pathname);
+        notify_memory_changed_fs(fs, file_get_memory_size(file));
         ++fs->current_file_count;
         SET_VAR_RWLOCK(fs->metrics.max_num_files_reached,
                         MAX(fs->metrics.max_num_files_reached, fs->current_file_count),
@@ -251,45 +471,245 @@ int remove_file_fs(file_system_t* fs, const char* pathname, bool_t is_replacemen
     if(!file)
         return 0;
 
-    size_t data_size = file_get_size(file);
-    ll_remove_str(fs->filenames_stored, (char*)pathname);
-    bool_t res = icl_hash_delete(fs->files_stored, (char*)pathname, free, FREE_FUNC(is_replacement ? free_file_for_replacement : free_file)) == 0;
+    FOREACH_CS(file_get_clients(file), client)
+    {
+        untrack_client_file(fs, file, client, CF_OPENED);
+    }
+
+    FOREACH_CS(file_get_cache_clients(file), client)
+    {
+        untrack_client_file(fs, file, client, CF_CACHED);
+    }
+
+    untrack_client_file(fs, file, file_get_lock_owner(file), CF_LOCKS);
+    FOREACH_CS(file_get_lock_sharers(file), client)
+    {
+        untrack_client_file(fs, file, client, CF_LOCKS);
+    }
+    FOREACH_WQ(file_get_locks_queue(file))
+    {
+        untrack_client_file(fs, file, CLIENT_IT_WQ, CF_LOCKS);
+    }
+
+    size_t data_size = file_get_memory_size(file);
+    ll_remove_str(fs->filenames_stored, (char*)pathname, NULL);
+    bool_t res = icl_hash_delete(fs->files_stored, (char*)pathname, NULL, FREE_FUNC(is_replacement ? free_file_for_replacement : free_file)) == 0;
     if(res)
     {
-        fs->current_used_memory -= data_size;
+        __atomic_sub_fetch(&fs->current_used_memory, data_size, __ATOMIC_RELAXED);
         --fs->current_file_count;
     }
 
     return res;
 }
 
-int notify_memory_changed_fs(file_system_t* fs, int amount)
+void split_fs(file_system_t* fs, file_system_t** shards, content_store_t** stores, size_t (*shard_of)(const char*))
+{
+    NRET_IF(!fs || !shards || !shard_of);
+
+    // the oldest files are added first so each shard keeps them in the same order
+    arena_t* arena = create_arena(0);
+    file_stored_t** files = get_files_stored(fs, arena);
+    for(size_t i = ll_count(fs->filenames_stored); i > 0; --i)
+    {
+        char* pathname = file_get_pathname(files[i - 1]);
+        size_t shard = shard_of(pathname);
+        // each shard counts the holders of its own contents, before the file is charged to it
+        content_entry_t* shared = file_get_shared_content(files[i - 1]);
+        if(stores && shared)
+            file_share_content(files[i - 1], content_store_adopt(stores[shard], shared));
+        add_file_fs(shards[shard], pathname, files[i - 1]);
+    }
+    free_arena(arena);
+
+    // the files belong to the shards now
+    icl_hash_destroy(fs->files_stored, NULL, NULL);
+    fs->files_stored = icl_hash_create(10, NULL, NULL);
+    ll_empty(fs->filenames_stored, ll_no_free);
+    fs->current_used_memory = 0;
+    fs->current_file_count = 0;
+}
+
+int open_file_client_fs(file_system_t* fs, file_stored_t* file, int client)
+{
+    RET_IF(!fs || !file, -1);
+
+    int added = file_add_client(file, client);
+    if(added == 1)
+        track_client_file(fs, file, client, CF_OPENED);
+
+    return added;
+}
+
+int close_file_client_fs(file_system_t* fs, file_stored_t* file, int client)
+{
+    RET_IF(!fs || !file, -1);
+
+    int closed = file_close_client(file, client);
+    if(closed == 1)
+        untrack_client_file(fs, file, client, CF_OPENED);
+
+    return closed;
+}
+
+int cache_file_client_fs(file_system_t* fs, file_stored_t* file, int client)
+{
+    RET_IF(!fs || !file, -1);
+
+    int added = file_add_cache_client(file, client);
+    if(added == 1)
+        track_client_file(fs, file, client, CF_CACHED);
+
+    return added;
+}
+
+void uncache_file_client_fs(file_system_t* fs, file_stored_t* file, int client)
+{
+    NRET_IF(!fs || !file);
+    untrack_client_file(fs, file, client, CF_CACHED);
+}
+
+int lock_file_client_fs(file_system_t* fs, file_stored_t* file, int client, bool_t shared, long timeout_ms)
+{
+    RET_IF(!fs || !file || client < 0, -1);
+
+    bool_t was_tracked = file_get_lock_owner(file) == client || file_is_lock_shared_by(file, client)
+                            || file_is_client_already_queued(file, client);
+    int res = file_acquire_lock(file, client, shared);
+    // the client is tracked both while waiting and while owning the lock
+    if(!was_tracked)
+        track_client_file(fs, file, client, CF_LOCKS);
+    if(res == 0)
+        return 0;
+
+    if(timeout_ms > 0)
+    {
+        LOCK_MUTEX(&fs->clients_index_mutex);
+        client_files_t* entry = get_client_entry(fs, client, TRUE);
+        end_client_wait(fs, client);
+        entry->waiting_file = file;
+        entry->wait_id = ++fs->last_wait_id;
+        entry->wait_timer = tw_add(fs->lock_timers, timeout_ms, client, entry->wait_id, file);
+        UNLOCK_MUTEX(&fs->clients_index_mutex);
+    }
+
+    return -1;
+}
+
+int expire_lock_wait_fs(file_system_t* fs, int client, uint64_t wait_id, file_stored_t* file, client_set_t* granted)
+{
+    RET_IF(!fs || !file, 0);
+
+    // while the wait is the same the file was not removed (removals end the waits), so it can be accessed
+    bool_t is_same_wait;
+    LOCK_MUTEX(&fs->clients_index_mutex);
+    client_files_t* entry = get_client_entry(fs, client, FALSE);
+    is_same_wait = entry && entry->wait_id == wait_id && entry->waiting_file == file;
+    UNLOCK_MUTEX(&fs->clients_index_mutex);
+    RET_IF(!is_same_wait, 0);
+
+    acquire_write_lock_file(file);
+    // check again, the lock could have been given to the client in the meantime
+    LOCK_MUTEX(&fs->clients_index_mutex);
+    entry = get_client_entry(fs, client, FALSE);
+    is_same_wait = entry && entry->wait_id == wait_id && entry->waiting_file == file;
+    if(is_same_wait)
+    {
+        // the timer is the one firing, it's freed by the wheel
+        entry->wait_timer = NULL;
+        entry->waiting_file = NULL;
+    }
+    UNLOCK_MUTEX(&fs->clients_index_mutex);
+
+    if(is_same_wait)
+    {
+        file_delete_lock_client(file, client, granted);
+        untrack_client_file(fs, file, client, CF_LOCKS);
+        end_granted_waits(fs, granted);
+    }
+    release_write_lock_file(file);
+
+    return is_same_wait;
+}
+
+timer_wheel_t* get_lock_timers_fs(file_system_t* fs)
+{
+    RET_IF(!fs, NULL);
+    return fs->lock_timers;
+}
+
+int unlock_file_client_fs(file_system_t* fs, file_stored_t* file, int client, client_set_t* granted)
+{
+    RET_IF(!fs || !file, -1);
+    RET_IF(file_get_lock_owner(file) != client && !file_is_lock_shared_by(file, client), -1);
+
+    size_t granted_count = file_delete_lock_client(file, client, granted);
+    untrack_client_file(fs, file, client, CF_LOCKS);
+    end_granted_waits(fs, granted);
+
+    return granted_count;
+}
+
+size_t notify_memory_changed_fs(file_system_t* fs, ssize_t amount)
 {
     RET_IF(!fs, 0);
-    if(amount == 0)
-        return fs->current_used_memory;
-    
-    fs->current_used_memory += amount;
-    SET_VAR_RWLOCK(fs->metrics.max_memory_reached,
-                        MAX(fs->metrics.max_memory_reached, fs->current_used_memory),
-                        &fs->rwlock_metrics);
 
-    return fs->current_used_memory;
+    size_t used = __atomic_add_fetch(&fs->current_used_memory, (size_t)amount, __ATOMIC_RELAXED);
+    if(amount > 0)
+        update_max_memory_reached(fs, used);
+
+    return used;
 }
 
 int notify_client_disconnected_fs(file_system_t* fs, int fd)
 {
     RET_IF(!fs || fd == -1, -1);
 
-    FOREACH_LL(fs->filenames_stored)
+    // the lists are emptied but kept, the fd can be reused by a new connection
+    size_t opened_count = 0, locks_count = 0, cached_count = 0;
+    file_stored_t** opened = NULL;
+    file_stored_t** locks = NULL;
+    file_stored_t** cached = NULL;
+    arena_t* arena = get_request_arena();
+    LOCK_MUTEX(&fs->clients_index_mutex);
+    client_files_t* entry = get_client_entry(fs, fd, FALSE);
+    if(entry && entry->opened)
     {
-        file_stored_t* file = icl_hash_find(fs->files_stored, VALUE_IT_LL(void*));
-        file_close_client(file, fd);
-        int new_owner = file_delete_lock_client(file, fd);
-        if(new_owner != -1)
+        opened = detach_client_files(entry->opened, arena, &opened_count);
+        locks = detach_client_files(entry->locks, arena, &locks_count);
+        cached = detach_client_files(entry->cached, arena, &cached_count);
+        end_client_wait(fs, fd);
+    }
+    UNLOCK_MUTEX(&fs->clients_index_mutex);
+
+    for(size_t i = 0; i < locks_count; ++i)
+    {
+        client_set_t* granted = create_cs();
+        acquire_write_lock_file(locks[i]);
+        file_delete_lock_client(locks[i], fd, granted);
+        end_granted_waits(fs, granted);
+        release_write_lock_file(locks[i]);
+
+        FOREACH_CS(granted, new_owner)
         {
-            notify_given_lock(new_owner);
+            wake_request(new_owner, 0);
         }
+        free_cs(granted);
+    }
+
+    for(size_t i = 0; i < opened_count; ++i)
+    {
+        acquire_write_lock_file(opened[i]);
+        file_close_client(opened[i], fd);
+        release_write_lock_file(opened[i]);
+    }
+
+    // the next client getting the descriptor isn't told about copies it never had
+    for(size_t i = 0; i < cached_count; ++i)
+    {
+        acquire_write_lock_file(cached[i]);
+        file_remove_cache_client(cached[i], fd);
+        release_write_lock_file(cached[i]);
     }
 
     return 0;
@@ -299,8 +719,20 @@ void free_fs(file_system_t* fs)
 {
     NRET_IF(!fs);
 
-    icl_hash_destroy(fs->files_stored, free, FREE_FUNC(free_file));
-    ll_free(fs->filenames_stored, free);
+    icl_hash_destroy(fs->files_stored, NULL, FREE_FUNC(free_file));
+    ll_free(fs->filenames_stored, ll_no_free);
+    for(size_t i = 0; i < fs->clients_index_size; ++i)
+    {
+        if(fs->clients_index[i].opened)
+        {
+            ll_free(fs->clients_index[i].opened, ll_no_free);
+            ll_free(fs->clients_index[i].locks, ll_no_free);
+            ll_free(fs->clients_index[i].cached, ll_no_free);
+        }
+    }
+    free(fs->clients_index);
+    pthread_mutex_destroy(&fs->clients_index_mutex);
+    free_tw(fs->lock_timers);
     pthread_rwlock_destroy(&fs->rwlock);
     pthread_rwlock_destroy(&fs->rwlock_metrics);
     ll_free(fs->metrics.max_req_threads, free);
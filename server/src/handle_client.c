@@ -1,45 +1,402 @@
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <time.h>
 
 #include "server.h"
 #include "replacement_policy.h"
 #include "handle_client.h"
 #include "replaced_file.h"
+#include "page_alloc.h"
+#include "numa.h"
+#include "coroutine.h"
+
+// Step the request of a client is at
+typedef enum request_state {
+    // no request is running, the next one starts once its first byte arrives
+    RS_IDLE,
+    // a worker is running the request
+    RS_RUNNING,
+    // the request waits for the rest of it
+    RS_WAIT_READ,
+    // the request waits for a lock owned by another client
+    RS_WAIT_LOCK,
+    // the request waits for the client to read the output of the previous requests
+    RS_WAIT_WRITE,
+    // the change of the request waits for its record to be durable
+    RS_WAIT_DURABLE,
+    // the request moves to the worker of the shard owning its file
+    RS_FORWARDED
+} request_state_t;
+
+// Where a handler stopped, returned each time it runs
+typedef enum step {
+    STEP_DONE,
+    STEP_WAIT_READ,
+    STEP_WAIT_LOCK,
+    STEP_WAIT_WRITE,
+    STEP_WAIT_DURABLE,
+    STEP_FORWARD,
+    STEP_CLOSED,
+    STEP_INVALID
+} step_t;
+
+// Outcome of the read of a field of a request
+typedef enum read_outcome {
+    READ_DONE,
+    // the rest of the field didn't arrive yet
+    READ_PENDING,
+    READ_CLOSED,
+    READ_FAILED,
+    // a pathname with no characters
+    READ_EMPTY
+} read_outcome_t;
+
+// A file replied by a READN, its content pinned while the shards were locked
+typedef struct reply_file {
+    char* pathname;
+    sl_view_t* content;
+} reply_file_t;
+
+// The request of a client, what a handler needs after a yield lives here since the locals don't survive it
+typedef struct request {
+    request_state_t state;
+    // shard whose worker runs the request, the one owning the file of the last request routed
+    size_t shard;
+    server_packet_op_t op;
+    bool_t op_read;
+    // line the handler of op resumes from
+    int line;
+    // bytes of the field being read already received
+    size_t read_offset;
+    bool_t path_len_read;
+    // the next request of the client is already listened to while this one waits for a lock
+    bool_t receiving;
+    // the next request arrived while a worker was still running this one
+    bool_t next_pending;
+    // the client hung up while a worker was running the request, the worker disconnects it
+    bool_t closed;
+    // set by wake_request, wake_error is the outcome of the lock wait
+    bool_t woken;
+    int wake_error;
+    // start of the wait for the rest of the request
+    time_t waiting_since;
+
+    // the arguments read so far
+    int flags;
+    long timeout_ms;
+    uint64_t version;
+    int n_to_read;
+    bool_t send_back;
+    int durability;
+    size_t pathname_len;
+    char pathname[MAX_PATHNAME_API_LENGTH + 1];
+    size_t data_size;
+    // the range of a ranged read or a positioned write
+    size_t offset;
+    size_t length;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    // the payload being received and the memory reserved for it, owned by the request until the change takes them
+    // a transient payload moves from the worker arena to the heap if the request waits for the rest of it
+    void* data;
+    size_t reserved;
+    bool_t is_transient;
+    bool_t payload_on_heap;
+    // the files a READN replies one at a time, the next one waits for the client to read most of the previous ones
+    reply_file_t* reply_files;
+    size_t reply_files_count;
+    size_t reply_files_next;
+    size_t reply_data_read;
+    // the change waits for its record of the write-ahead log, durable is 1 once it's durable or -1 if the log failed
+    uint64_t lsn;
+    int durable;
+    int open_result;
+    // what the change does once it's acknowledged: the copies of the files it replaced pushed back and the content to
+    // compress or compact
+    linked_list_t* replaced_files;
+    bool_t needs_compaction;
+    bool_t needs_compression;
+
+    pthread_mutex_t mutex;
+} request_t;
+
+// The request of each client indexed by its descriptor, created the first time the descriptor is used
+static request_t** requests = NULL;
+static size_t requests_size = 0;
+static pthread_mutex_t requests_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Count of the requests in RS_WAIT_READ
+static size_t requests_waiting_read = 0;
+// Count of the requests moved to the worker of another shard
+static size_t requests_forwarded = 0;
+// Copies of the files cached by the clients which were told to be stale
+static size_t caches_invalidated = 0;
+// Conditional reads answered without the content, and the bytes of content not sent
+static size_t reads_not_modified = 0;
+static size_t reads_not_modified_bytes = 0;
+
+// Get the request of client, creating it if needed
+static request_t* get_request(int client)
+{
+    request_t* req;
+    LOCK_MUTEX(&requests_mutex);
+    if(client >= requests_size)
+    {
+        size_t new_size = MAX(requests_size * 2, client + 1);
+        CHECK_FATAL_EQ(requests, realloc(requests, new_size * sizeof(request_t*)), NULL, NO_MEM_FATAL);
+        memset(requests + requests_size, 0, (new_size - requests_size) * sizeof(request_t*));
+        requests_size = new_size;
+    }
+
+    req = requests[client];
+    if(!req)
+    {
+        CHECK_FATAL_EQ(req, calloc(1, sizeof(request_t)), NULL, NO_MEM_FATAL);
+        req->state = RS_IDLE;
+        // the clients are spread over the shards until their first file
+        req->shard = client % get_shards_count();
+        INIT_MUTEX(&req->mutex);
+        requests[client] = req;
+    }
+    UNLOCK_MUTEX(&requests_mutex);
+    return req;
+}
+
+// Free the payload of req and give back the memory reserved for it, used when the request ends before the change
+static void release_payload(request_t* req)
+{
+    if(req->data)
+    {
+        if(req->payload_on_heap)
+            free(req->data);
+        else if(!req->is_transient)
+            content_free(req->data);
+    }
+    // reserved on the shard the request was routed to, the request can be dropped by any thread
+    rollback_memory_fs(get_shard_fs(req->shard), req->reserved);
+    req->data = NULL;
+    req->reserved = 0;
+    req->payload_on_heap = FALSE;
+}
+
+// Free the files of a READN not replied yet, used when the request ends or the client disconnects
+static void release_reply_files(request_t* req)
+{
+    for(size_t i = req->reply_files_next; i < req->reply_files_count; ++i)
+    {
+        free(req->reply_files[i].pathname);
+        free_sl_view(req->reply_files[i].content);
+    }
+    free(req->reply_files);
+    req->reply_files = NULL;
+    req->reply_files_count = 0;
+    req->reply_files_next = 0;
+}
+
+// The worker arena is reset once the step is handled, so a transient payload still arriving is moved to the heap
+static void keep_payload(request_t* req)
+{
+    NRET_IF(!req->is_transient || req->payload_on_heap);
+
+    void* data;
+    CHECK_FATAL_EQ(data, malloc(req->data_size), NULL, NO_MEM_FATAL);
+    memcpy(data, req->data, req->read_offset);
+    req->data = data;
+    req->payload_on_heap = TRUE;
+}
+
+// Take the payload of req once it's received, the change owns it and the memory reserved from now on
+static void* take_payload(request_t* req, size_t* reserved)
+{
+    void* data = req->data;
+    if(req->payload_on_heap)
+    {
+        data = arena_alloc(get_request_arena(), req->data_size);
+        memcpy(data, req->data, req->data_size);
+        free(req->data);
+    }
+    *reserved = req->reserved;
+    req->data = NULL;
+    req->reserved = 0;
+    req->payload_on_heap = FALSE;
+    return data;
+}
+
+// Read the rest of the size bytes of a field of the request of client into buf, without blocking
+static read_outcome_t read_request(request_t* req, int client, void* buf, size_t size)
+{
+    while(req->read_offset < size)
+    {
+        // the bytes streamed by the connection handler wait inside the input of the client
+        inbound_t* in = get_inbound();
+        ssize_t n = in ? inbound_read(in, client, (char*)buf + req->read_offset, size - req->read_offset)
+                       : read(client, (char*)buf + req->read_offset, size - req->read_offset);
+        if(n == 0)
+            return READ_CLOSED;
+        if(n == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? READ_PENDING : READ_FAILED;
+        }
+        req->read_offset += n;
+    }
+
+    req->read_offset = 0;
+    return READ_DONE;
+}
+
+// Read the pathname of the request of client, sent as its length followed by its characters
+// A length over MAX_PATHNAME_API_LENGTH breaks the protocol, the rest of the request can't be told apart
+static read_outcome_t read_request_path(request_t* req, int client)
+{
+    read_outcome_t outcome;
+    if(!req->path_len_read)
+    {
+        outcome = read_request(req, client, &req->pathname_len, sizeof(size_t));
+        RET_IF(outcome != READ_DONE, outcome);
+        RET_IF(req->pathname_len == 0, READ_EMPTY);
+        if(req->pathname_len > MAX_PATHNAME_API_LENGTH)
+        {
+            errno = EMSGSIZE;
+            return READ_FAILED;
+        }
+        req->path_len_read = TRUE;
+    }
+
+    outcome = read_request(req, client, req->pathname, req->pathname_len);
+    RET_IF(outcome != READ_DONE, outcome);
+    req->pathname[req->pathname_len] = '\0';
+    req->path_len_read = FALSE;
+    return READ_DONE;
+}
+
+// Used by the handlers when a field of the request cannot be read, the connection is closed or broken
+// Logs the failed action and frees what the request received so far, then the client is disconnected
+static step_t on_read_failed(request_t* req, int sender, const char* action, read_outcome_t outcome)
+{
+    LOG_EVENT("%s run by %d failed! [%s]", -1, action, sender, strerror(outcome == READ_CLOSED ? ECONNRESET : errno));
+    release_payload(req);
+    return STEP_CLOSED;
+}
+
+// Read a field of the request of sender into buf, the handler stops here until the whole field arrived
+#define CO_READ(req, sender, buf, size, action) \
+                                CO_LABEL((req)->line) \
+                                { \
+                                    read_outcome_t outcome = read_request(req, sender, buf, size); \
+                                    if(outcome == READ_PENDING) \
+                                        return STEP_WAIT_READ; \
+                                    if(outcome != READ_DONE) \
+                                        return on_read_failed(req, sender, action, outcome); \
+                                }
 
-// Read a string(in this program we just read pathnames) for a max of MAX_PATHNAME_API_LENGTH characters
-// If the return status is -1 a problem occured with the sender (probably connection closed) and we return with an error
-// If the return status is 0 the server was not able to read anything(we consider any param required) so we return with an error
-#define CHECK_READ_PATH(error, output, sender, action)\
-                                error = readn_string(sender, output, MAX_PATHNAME_API_LENGTH); \
-                                if(error == -1) { \
-                                    PRINT_WARNING_DEBUG(EINVAL, "Cannot read '" #output "' string inside packet! fd(%d)", sender); \
-                                    return return_response_error(action, NULL, sender, EINVAL); \
-                                } \
-                                if(error == 0) { \
-                                    PRINT_WARNING_DEBUG(EBADMSG, "Mandatory arg! '" #output "' cannot be empty! fd(%d)", sender); \
-                                    return return_response_error(action, NULL, sender, EBADMSG); \
+// Read the pathname of the request of sender, we consider it required so an empty one is answered with an error
+#define CO_READ_PATH(req, sender, action) \
+                                CO_LABEL((req)->line) \
+                                { \
+                                    read_outcome_t outcome = read_request_path(req, sender); \
+                                    if(outcome == READ_PENDING) \
+                                        return STEP_WAIT_READ; \
+                                    if(outcome == READ_EMPTY) \
+                                    { \
+                                        PRINT_WARNING_DEBUG(EBADMSG, "Mandatory arg! 'pathname' cannot be empty! fd(%d)", sender); \
+                                        return_response_error(action, NULL, sender, EBADMSG); \
+                                        return STEP_DONE; \
+                                    } \
+                                    if(outcome != READ_DONE) \
+                                        return on_read_failed(req, sender, action, outcome); \
                                 }
 
-// Read some data into the data buffer with length data_size
-// If the return status is -1 a problem occured with the sender (probably connection closed) and we return with an error
-// If the return status is 0 the server was not able to read anything(we consider any param required) so we return with an error
-#define CHECK_READ(error, data, data_size, sender, action) error = readn(sender, data, data_size); \
-                                                            if(error == -1) \
-                                                            { \
-                                                                PRINT_WARNING_DEBUG(EINVAL, "Cannot read '" #data "' string inside packet! fd(%d)", sender); \
-                                                                return return_response_error(action, NULL, sender, EINVAL); \
-                                                            } \
-                                                            if(error == 0) \
-                                                            { \
-                                                                PRINT_WARNING_DEBUG(EBADMSG, "Mandatory arg! '" #data "' cannot be empty! fd(%d)", sender); \
-                                                                return return_response_error(action, NULL, sender, EBADMSG); \
-                                                            }
+// Same as CO_READ for the payload of the request, data_size bytes read into data
+#define CO_READ_PAYLOAD(req, sender, action) \
+                                CO_LABEL((req)->line) \
+                                { \
+                                    read_outcome_t outcome = read_request(req, sender, (req)->data, (req)->data_size); \
+                                    if(outcome == READ_PENDING) \
+                                    { \
+                                        keep_payload(req); \
+                                        return STEP_WAIT_READ; \
+                                    } \
+                                    if(outcome != READ_DONE) \
+                                        return on_read_failed(req, sender, action, outcome); \
+                                }
+
+// Check whether the file of req belongs to the shard of another worker, in that case the request is routed to it
+static bool_t route_request(request_t* req)
+{
+    size_t shard = get_shard_of(req->pathname);
+    RET_IF(shard == get_current_shard(), FALSE);
+
+    __atomic_store_n(&req->shard, shard, __ATOMIC_RELAXED);
+    return TRUE;
+}
+
+// Used by the handlers when the file of the request belongs to another shard process, the client didn't follow the shard
+// map and the rest of the request can't be skipped, so it's disconnected
+static step_t on_pathname_not_owned(request_t* req, int sender, const char* action)
+{
+    LOG_EVENT("%s run by %d on file %s owned by another shard process! [%s]", -1, action, sender, req->pathname, strerror(EREMOTE));
+    return STEP_INVALID;
+}
+
+// Move the request to the worker of the shard owning its file before touching it, the handler resumes here on that worker
+#define CO_ROUTE(req, sender, action) \
+                                if(!is_pathname_owned((req)->pathname)) \
+                                    return on_pathname_not_owned(req, sender, action); \
+                                if(route_request(req)) \
+                                    CO_YIELD((req)->line, STEP_FORWARD)
+
+// The handlers replying the content of the files stop here until the client read most of its output
+#define CO_WAIT_WRITABLE(req, sender) \
+                                if(outbound_wait_writable(get_outbound(), sender) == 1) \
+                                    CO_YIELD((req)->line, STEP_WAIT_WRITE)
+
+// The changes stop here until their record is durable as level requests, instead of blocking the worker. The writer
+// of the log resumes them through wake_request, so many changes of the same worker share one sync
+#define CO_WAIT_DURABLE(req, sender, level) \
+                                CO_LABEL((req)->line) \
+                                if(((req)->durable = wal_watch(get_wal(), (req)->lsn, level, sender)) == 0) \
+                                    return STEP_WAIT_DURABLE
+
+// Free a payload buffer, transient payloads live inside the request arena and are freed with it
+#define FREE_PAYLOAD(data, is_transient) if(!(is_transient)) content_free(data)
 
 #define RESET_FILE_WRITEMODE(file) file_set_write_enabled(file, FALSE)
 
+// The replies are queued inside the output buffer of the client, the worker flushes it once the request is handled
+// so a client which stops reading never blocks the worker. The contents are not copied, their segments are written as they are
+static inline int reply(int client, const void* buf, size_t size)
+{
+    return outbound_write(get_outbound(), client, buf, size);
+}
+
+static inline int reply_string(int client, const char* str, size_t len)
+{
+    return outbound_write_string(get_outbound(), client, str, len);
+}
+
+static inline int reply_content(int client, const segment_list_t* content)
+{
+    return outbound_write_sl(get_outbound(), client, content);
+}
+
+static inline int reply_content_range(int client, const segment_list_t* content, size_t offset, size_t size)
+{
+    return outbound_write_sl_range(get_outbound(), client, content, offset, size);
+}
+
+// Release the write lock of file if is_write, its read lock otherwise
+static inline void release_lock_file(file_stored_t* file, bool_t is_write)
+{
+    if(is_write)
+        release_write_lock_file(file);
+    else
+        release_read_lock_file(file);
+}
+
 // Used by the server api handlers on error, logs the failed action, send back the error and set the errno value
-static inline int return_response_error(char* action, char* pathname, int sender, int error)
+static inline int return_response_error(const char* action, const char* pathname, int sender, int error)
 {
     if(pathname)
     {
@@ -51,63 +408,103 @@ static inline int return_response_error(char* action, char* pathname, int sender
     }
 
     server_packet_op_t res_op = OP_ERROR;
-    if(writen(sender, &res_op, sizeof(res_op)))
-        writen(sender, &error, sizeof(error));
+    if(reply(sender, &res_op, sizeof(res_op)))
+        reply(sender, &error, sizeof(error));
     errno = error;
     return error;
 }
 
-void notify_given_lock(int client)
+// Reply to a request which waited for a lock, with the outcome given to wake_request
+static void reply_lock_outcome(request_t* req, int sender)
 {
-    server_packet_op_t op = OP_OK;
-    writen(client, &op, sizeof(op));
+    server_packet_op_t op = req->wake_error == 0 ? OP_OK : OP_ERROR;
+    if(reply(sender, &op, sizeof(op)) == 1 && req->wake_error != 0)
+        reply(sender, &req->wake_error, sizeof(int));
 }
 
-// Used in handle_remove_file_req(sender), cleanup the lock queue and send back an OP_ERROR to each of them
-static inline void notify_file_removed_to_lockers(queue_t* locks_queue)
+// Resume every client inside granted, each got the lock it was waiting for
+static inline void notify_granted_locks(client_set_t* granted)
+{
+    FOREACH_CS(granted, client)
+    {
+        wake_request(client, 0);
+    }
+}
+
+// A reader asking for the exclusive lock while other readers own the shared one would wait for them forever
+// if they do the same, so the upgrade is refused
+static inline bool_t is_lock_upgrade_blocked(file_stored_t* file, int client, bool_t shared)
+{
+    return !shared && file_is_lock_shared_by(file, client) && !file_can_acquire_lock(file, client, FALSE);
+}
+
+// Used in handle_remove_file_req(sender), resume each client of the lock queue with an EIDRM
+static inline void notify_file_removed_to_lockers(wait_queue_t* locks_queue)
 {
     NRET_IF(!locks_queue);
 
-    server_packet_op_t op = OP_ERROR;
-    int error = EIDRM;
+    FOREACH_WQ(locks_queue) {
+        wake_request(CLIENT_IT_WQ, EIDRM);
+    }
+}
 
-    FOREACH_Q(locks_queue) {
-        int client_fd = *(VALUE_IT_Q(int*));
+// Queue inside the output buffer of client the count of the files replaced followed by the files, the client receives
+// them after the reply. The output buffer gets its own copy of each file, repl_list is left untouched
+static void push_replaced_files(int client, linked_list_t* repl_list)
+{
+    size_t num_files_replaced = repl_list ? ll_count(repl_list) : 0;
+    if(num_files_replaced == 0)
+    {
+        reply(client, &num_files_replaced, sizeof(num_files_replaced));
+        return;
+    }
 
-        if(writen(client_fd, &op, sizeof(op)))
-            writen(client_fd, &error, sizeof(error));
+    outbound_file_t* pushed_files = arena_alloc(get_request_arena(), num_files_replaced * sizeof(outbound_file_t));
+    size_t i = 0;
+    FOREACH_LL(repl_list) {
+        replaced_file_t* file = VALUE_IT_LL(replaced_file_t*);
+        outbound_file_t* pushed = &pushed_files[i++];
+        pushed->pathname = replfile_get_pathname(file);
+        pushed->size = replfile_get_data_size(file);
+        pushed->data = NULL;
+        if(pushed->size > 0)
+        {
+            pushed->data = content_alloc(pushed->size);
+            sl_copy_to(replfile_get_content(file), pushed->data, pushed->size);
+        }
+    }
+
+    // the pathnames live until the list is freed
+    size_t num_files_queued = outbound_push_files(get_outbound(), client, pushed_files, num_files_replaced);
+    if(num_files_queued < num_files_replaced)
+    {
+        LOG_EVENT("OP_REPLACEMENT %zu files not pushed to %d, too many bytes are waiting for it", -1, num_files_replaced - num_files_queued, client);
     }
 }
 
 // Handles the files replaced by the file system, used to notify the lock queue(the clients waiting for the locks) of each file that the files got removed,
-// logs the replacement action and if the send_back flag is set the data is sent back to the client making the request
+// logs the replacement action and if the send_back flag is set the count of the files sent back to the client making the request
+// is queued inside its output buffer followed by the files, the client receives them after the reply
 // Must be called regardless of your needs if the replacement policy is called because of memory cleanup
 static int on_files_replaced(int client, bool_t are_replaced, bool_t send_back, linked_list_t* repl_list)
 {
     if(!are_replaced || !repl_list)
     {
-        size_t zero = 0;
         if(send_back)
-        {
-            writen(client, &zero, sizeof(zero));
-        }
+            push_replaced_files(client, NULL);
 
         return 1;
     }
+
+    // the content itself goes to the disk tier right after
+    if(send_back)
+        push_replaced_files(client, repl_list);
     
     size_t num_files_replaced = ll_count(repl_list);
-    int writen_res = 1;
-    if(send_back)
-    {
-        if(writen_res)
-            writen_res = writen(client, &num_files_replaced, sizeof(num_files_replaced));
-    }
-
-    char* files_removed_str;
     size_t char_needed = num_files_replaced * (MAX_PATHNAME_API_LENGTH + 1);
-    CHECK_FATAL_EQ(files_removed_str, malloc(char_needed), NULL, NO_MEM_FATAL);
+    char* files_removed_str = arena_alloc(get_request_arena(), char_needed);
 
-    int data_cleaned = 0;
+    size_t data_cleaned = 0;
     int files_rem_str_index = 0;
     FOREACH_LL(repl_list) {
         replaced_file_t* file = VALUE_IT_LL(replaced_file_t*);
@@ -115,41 +512,235 @@ static int on_files_replaced(int client, bool_t are_replaced, bool_t send_back,
         data_cleaned += file_size;
         notify_file_removed_to_lockers(replfile_get_locks_queue(file));
 
-        char* pathname = replfile_get_pathname(file);
-        if(send_back)
-        {
-            size_t pathname_len = strnlen(pathname, MAX_PATHNAME_API_LENGTH);
-            if(writen_res && (writen_res = writen_string(client, pathname, pathname_len)))
-            {
-                if(writen_res && (writen_res = writen(client, &file_size, sizeof(size_t))) && file_size > 0)
-                    writen_res = writen(client, replfile_get_data(file), file_size);
-            }
-        }
-
         char* file_path = replfile_get_pathname(file);
         bool_t is_last = node_get_next(CURR_IT_LL) == NULL;
         char* next_token = is_last ? "%s\0" : "%s,\0";
         snprintf(files_removed_str + files_rem_str_index, char_needed, next_token, file_path);
         files_rem_str_index += strnlen(file_path, MAX_PATHNAME_API_LENGTH) + !is_last;
+
+        // without a disk tier the content is just freed
+        disk_tier_demote(get_disk_tier(), file_path, replfile_take_content(file));
     }
 
-    ll_empty(repl_list, FREE_FUNC(free_replfile));
-    free(repl_list);
+    ll_free(repl_list, FREE_FUNC(free_replfile));
     
     // enough length to log the entire formatted text
     size_t log_len = 150 + files_rem_str_index;
-    LOG_EVENT("OP_REPLACEMENT replaced %zu files and cleaned %d bytes. Files: [%s] [Success]", log_len, num_files_replaced, data_cleaned, files_removed_str);
-    free(files_removed_str);
+    LOG_EVENT("OP_REPLACEMENT replaced %zu files and cleaned %zu bytes. Files: [%s] [Success]", log_len, num_files_replaced, data_cleaned, files_removed_str);
     return 1;
 }
 
-int handle_open_file_req(int sender)
+// Wake up the reclaimer if the memory used went over the high watermark, called once a change took more memory
+static inline void check_memory_pressure(file_system_t* fs)
 {
-    int result = 0, error;
-    int flags;
-    CHECK_READ(error, &flags, sizeof(int), sender, "OP_OPEN_FILE");
-    char pathname[MAX_PATHNAME_API_LENGTH + 1];
-    CHECK_READ_PATH(error, pathname, sender, "OP_OPEN_FILE");
+    if(get_reclaim_size_fs(fs) > 0)
+        wake_reclaimer();
+}
+
+size_t reclaim_files()
+{
+    file_system_t* fs = get_fs();
+    linked_list_t* replaced_files = NULL;
+
+    acquire_write_lock_fs(fs);
+    // checked again under the lock, the writes could have replaced some files meanwhile
+    size_t size = get_reclaim_size_fs(fs);
+    if(size > 0)
+        run_replacement_algorithm("", size, &replaced_files);
+    release_write_lock_fs(fs);
+
+    // no client asked for these files, they're only demoted
+    size_t replaced_count = replaced_files ? ll_count(replaced_files) : 0;
+    on_files_replaced(-1, replaced_files != NULL, FALSE, replaced_files);
+    arena_reset(get_request_arena());
+    return replaced_count;
+}
+
+// Reserve size bytes of the FS for a change of the file pathname, replacing the other files until they fit
+// The room freed can be taken by the reservations made meanwhile without any lock, in that case more files are replaced
+// Returns FALSE if the files left cannot make enough room, the files replaced anyway are added to replaced_files
+// Must be called with the FS write lock acquired
+static bool_t reserve_with_replacement(const char* pathname, size_t size, linked_list_t** replaced_files)
+{
+    file_system_t* fs = get_fs();
+
+    *replaced_files = NULL;
+    while(!reserve_memory_fs(fs, size))
+    {
+        linked_list_t* replaced;
+        if(!run_replacement_algorithm(pathname, is_size_available(fs, size), &replaced))
+            return FALSE;
+
+        if(!*replaced_files)
+        {
+            *replaced_files = replaced;
+            continue;
+        }
+
+        void* entry;
+        while(ll_count(replaced) > 0)
+        {
+            ll_remove_first(replaced, &entry);
+            ll_add_tail(*replaced_files, entry);
+        }
+        ll_free(replaced, ll_no_free);
+    }
+
+    return TRUE;
+}
+
+// Check the durability requested by a write, done after reading the whole request so an invalid value doesn't break the stream
+#define IS_DURABILITY_VALID(durability) ((durability) >= D_DEFAULT && (durability) <= D_SYNC)
+
+// Merge the segments of a file fragmented by many appends, called once the response was already sent
+// so the client making the append doesn't wait for the copy
+static void compact_file_content(const char* pathname)
+{
+    file_system_t* fs = get_fs();
+
+    acquire_read_lock_fs(fs);
+    file_stored_t* file = find_file_fs(fs, pathname);
+    if(file)
+    {
+        acquire_write_lock_file(file);
+        if(file_needs_compaction(file))
+            file_compact_content(file);
+        release_write_lock_file(file);
+    }
+    release_read_lock_fs(fs);
+}
+
+// Move the file pathname from the disk tier back to memory, replacing other files if there isn't enough space
+// lsn is set to the record of the promotion, 0 if there is none: the promotion must be durable before the file is used
+// The tier keeps the file registered meanwhile, so it's never missing for the others
+// Returns 1 once promoted, 0 if it's not in the tier (someone else could have promoted it first, the open done next
+// tells), -1 with errno set otherwise
+static int promote_file(int sender, const char* pathname, uint64_t* lsn)
+{
+    *lsn = 0;
+    void* data;
+    size_t data_size;
+    int found = disk_tier_take(get_disk_tier(), pathname, &data, &data_size);
+    if(found <= 0)
+        return found;
+
+    file_system_t* fs = get_fs();
+
+    int error = 0;
+    linked_list_t* replaced_files = NULL;
+    file_stored_t* file = NULL;
+    acquire_write_lock_fs(fs);
+    if(is_file_count_full_fs(fs))
+        error = EMLINK;
+    else if(is_size_too_big(fs, data_size))
+        error = EFBIG;
+    else if(!reserve_with_replacement(pathname, data_size, &replaced_files))
+        error = EFBIG;
+    else if(add_file_fs(fs, pathname, file = create_file(pathname)) <= 0)
+    {
+        rollback_memory_fs(fs, data_size);
+        free_file(file);
+        error = ENOMEM;
+    }
+
+    if(error != 0)
+    {
+        release_write_lock_fs(fs);
+        on_files_replaced(sender, replaced_files != NULL, FALSE, replaced_files);
+        // the file goes back to the tier, it can still be promoted once there is room
+        segment_list_t* content = create_sl();
+        sl_replace(content, data, data_size);
+        disk_tier_demote(get_disk_tier(), pathname, content);
+        errno = error;
+        return -1;
+    }
+
+    commit_memory_fs(fs, data_size, data_size);
+    // logged as a write, which creates the file on replay
+    *lsn = wal_append(get_wal(), WAL_WRITE, pathname, data, data_size);
+    if(data_size > 0)
+        file_replace_content(file, data, data_size);
+    // the promotions waiting for the file find it in memory
+    disk_tier_drop(get_disk_tier(), pathname);
+    release_write_lock_fs(fs);
+    check_memory_pressure(fs);
+
+    on_files_replaced(sender, replaced_files != NULL, FALSE, replaced_files);
+    LOG_EVENT("OP_PROMOTE_FILE run by %d on file %s data promoted %zu [Success]", -1, sender, pathname, data_size);
+    return 1;
+}
+
+// Compress the content added to a file since its last compression, called once the response was already sent
+// The added content is copied and compressed without holding any lock, then it replaces the original only if the file
+// didn't change meanwhile, the memory saved is given back to the file system
+static void compress_file_content(const char* pathname)
+{
+    file_system_t* fs = get_fs();
+
+    acquire_read_lock_fs(fs);
+    file_stored_t* file = find_file_fs(fs, pathname);
+    if(!file)
+    {
+        release_read_lock_fs(fs);
+        return;
+    }
+
+    acquire_read_lock_file(file);
+    segment_list_t* content = file_get_content(file);
+    uint64_t stamp = sl_get_stamp(content);
+    size_t size = sl_get_unsealed_size(content);
+    char* buffer;
+    CHECK_FATAL_EQ(buffer, malloc(MAX(size, 1)), NULL, NO_MEM_FATAL);
+    sl_copy_unsealed_to(content, buffer);
+    release_read_lock_file(file);
+    release_read_lock_fs(fs);
+
+    segment_list_t* sealed = sl_seal(buffer, size);
+    free(buffer);
+
+    long saved = 0;
+    bool_t replaced = FALSE;
+    acquire_read_lock_fs(fs);
+    file = find_file_fs(fs, pathname);
+    if(file)
+    {
+        acquire_write_lock_file(file);
+        content = file_get_content(file);
+        if(sl_get_stamp(content) == stamp)
+        {
+            saved = -sl_replace_unsealed(content, sealed);
+            notify_memory_changed_fs(fs, -saved);
+            replaced = TRUE;
+        }
+        release_write_lock_file(file);
+    }
+    release_read_lock_fs(fs);
+    free_sl(sealed);
+
+    if(replaced)
+    {
+        LOG_EVENT("OP_COMPRESS_FILE on file %s data compressed %zu memory saved %ld [Success]", -1, pathname, size, saved);
+    }
+}
+
+// Open the file pathname for sender, creating it with O_CREATE and locking it with O_LOCK or O_LOCK_SHARED
+// This method fails if on O_CREATE the file already exists or viceversa
+// lsn is set to the record of the creation, the file is acknowledged once it's durable
+//
+// The status code can be: 
+// 0) if the operation was succesfull, the OP_OK is sent back once the creation is durable
+// -1) if the operation was succesfull but the lock is owned by another client, the answer is sent once the wait ends
+// OPEN_NOT_IN_MEMORY) if the file is not in memory and can_promote, it must be promoted from the disk tier first
+// >0) if the operation was not succesfull and an OP_ERROR is sent back to the client with the relative error
+#define OPEN_NOT_IN_MEMORY -2
+static int open_file(int sender, const char* pathname, int flags, bool_t can_promote, uint64_t* lsn)
+{
+    int result = 0;
+    *lsn = 0;
+
+    // O_LOCK wins over O_LOCK_SHARED if both are given
+    bool_t lock_requested = (flags & (O_LOCK | O_LOCK_SHARED)) != 0;
+    bool_t shared = !(flags & O_LOCK);
 
     file_system_t* fs = get_fs();
 
@@ -162,8 +753,9 @@ int handle_open_file_req(int sender)
             return return_response_error("OP_OPEN_FILE", pathname, sender, EMLINK);
         }
 
+        // the files demoted to the disk tier still exist
         file_stored_t* file = find_file_fs(fs, pathname);
-        if(file)
+        if(file || disk_tier_contains(get_disk_tier(), pathname))
         {
             release_write_lock_fs(fs);
             return return_response_error("OP_OPEN_FILE", pathname, sender, EEXIST);
@@ -171,280 +763,801 @@ int handle_open_file_req(int sender)
 
         file = create_file(pathname);
 
-        file_add_client(file, sender);
-        if(flags & O_LOCK)
-        {
-            file_set_lock_owner(file, sender);
-            file_set_write_enabled(file, TRUE);
-        }
-
         if(add_file_fs(fs, pathname, file) <= 0)
         {
             release_write_lock_fs(fs);
             free_file(file);
             return return_response_error("OP_OPEN_FILE", pathname, sender, ENOMEM);
         }
+
+        // nothing older than the new file can be promoted over it
+        disk_tier_drop(get_disk_tier(), pathname);
+        *lsn = wal_append(get_wal(), WAL_CREATE, pathname, NULL, 0);
+        open_file_client_fs(fs, file, sender);
+        if(lock_requested)
+            lock_file_client_fs(fs, file, sender, shared, 0);
+        if(flags & O_LOCK)
+            file_set_write_enabled(file, TRUE);
     }
     else
     {
         file_stored_t* file = find_file_fs(fs, pathname);
         if(!file)
         {
+            // the disk is read without holding the lock, then the file is opened again
             release_write_lock_fs(fs);
-            return return_response_error("OP_OPEN_FILE", pathname, sender, ENOENT);
+            return can_promote ? OPEN_NOT_IN_MEMORY : return_response_error("OP_OPEN_FILE", pathname, sender, ENOENT);
         }
 
         acquire_write_lock_file(file);
-        if(!file_is_opened_by(file, sender))
-            file_add_client(file, sender);
-
-        if(flags & O_LOCK)
+        if(lock_requested && is_lock_upgrade_blocked(file, sender, shared))
         {
-            int owner = file_get_lock_owner(file);
-            if(owner == -1)
-                file_set_lock_owner(file, sender);
-            else if(owner != sender)
-            {
-                file_enqueue_lock(file, sender);
-                result = -1;
-            }
+            release_write_lock_file(file);
+            release_write_lock_fs(fs);
+            return return_response_error("OP_OPEN_FILE", pathname, sender, EDEADLK);
         }
 
+        open_file_client_fs(fs, file, sender);
+
+        if(lock_requested)
+            result = lock_file_client_fs(fs, file, sender, shared, 0);
+
         notify_used_file(file);
         release_write_lock_file(file);
     }
 
     release_write_lock_fs(fs);
-    LOG_EVENT("OP_OPEN_FILE run by %d on file %s with flags %d [Success]", -1, sender, pathname, flags);
+    return result;
+}
 
-    // if result == 0 => lock given/file opened | result == -1 => lock enqueued, no response yet
-    if(result == 0)
+static step_t handle_open_file_req(request_t* req, int sender)
+{
+    CO_BEGIN(req->line);
+    CO_READ(req, sender, &req->flags, sizeof(int), "OP_OPEN_FILE");
+    CO_READ_PATH(req, sender, "OP_OPEN_FILE");
+    CO_ROUTE(req, sender, "OP_OPEN_FILE");
+
+    req->open_result = open_file(sender, req->pathname, req->flags, TRUE, &req->lsn);
+    while(req->open_result == OPEN_NOT_IN_MEMORY)
+    {
+        if((req->open_result = promote_file(sender, req->pathname, &req->lsn)) == -1)
+        {
+            return_response_error("OP_OPEN_FILE", req->pathname, sender, errno);
+            return STEP_DONE;
+        }
+
+        CO_WAIT_DURABLE(req, sender, D_DEFAULT);
+        if(req->durable == -1)
+        {
+            return_response_error("OP_OPEN_FILE", req->pathname, sender, EIO);
+            return STEP_DONE;
+        }
+        // the others can replace the file again before it's opened, then it's promoted once more
+        req->open_result = open_file(sender, req->pathname, req->flags, req->open_result == 1, &req->lsn);
+    }
+    if(req->open_result > 0)
+        return STEP_DONE;
+
+    // the file stays created, the client is only told its creation could be lost by a crash
+    CO_WAIT_DURABLE(req, sender, D_DEFAULT);
+    if(req->durable == -1)
+    {
+        return_response_error("OP_OPEN_FILE", req->pathname, sender, EIO);
+        return STEP_DONE;
+    }
+
+    LOG_EVENT("OP_OPEN_FILE run by %d on file %s with flags %d [Success]", -1, sender, req->pathname, req->flags);
+    // the lock given or the file opened, otherwise the lock is enqueued and there's no response yet
+    if(req->open_result == 0)
     {
         server_packet_op_t res_op = OP_OK;
-        writen(sender, &res_op, sizeof(server_packet_op_t));
+        reply(sender, &res_op, sizeof(server_packet_op_t));
     }
-    
-    return result;
+    else
+    {
+        CO_YIELD(req->line, STEP_WAIT_LOCK);
+        reply_lock_outcome(req, sender);
+    }
+    CO_END(req->line);
+    return STEP_DONE;
 }
 
-int handle_write_file_req(int sender)
+// Hand the files replaced by the change of req to the disk tier before the change waits for its record, the tier
+// registered them as demoted and their promotions wait for the content. With send_back a copy of the files is kept
+// inside req to be pushed to sender after the reply
+static void keep_replaced_files(request_t* req, int sender, linked_list_t* replaced_files)
 {
-    int read_result;
-    char pathname[MAX_PATHNAME_API_LENGTH + 1];
-    CHECK_READ_PATH(read_result, pathname, sender, "OP_WRITE_FILE");
-    bool_t send_back;
-    CHECK_READ(read_result, &send_back, sizeof(bool_t), sender, "OP_WRITE_FILE");
+    req->replaced_files = NULL;
+    NRET_IF(!replaced_files);
+    if(req->send_back)
+    {
+        req->replaced_files = ll_create();
+        FOREACH_LL(replaced_files) {
+            replaced_file_t* file = VALUE_IT_LL(replaced_file_t*);
+            size_t size = replfile_get_data_size(file);
+            void* data = NULL;
+            if(size > 0)
+            {
+                data = content_alloc(size);
+                sl_copy_to(replfile_get_content(file), data, size);
+            }
+            replaced_file_t* copy = create_replfile();
+            replfile_set_pathname(copy, replfile_get_pathname(file));
+            replfile_set_content(copy, create_sl());
+            sl_replace(replfile_get_content(copy), data, size);
+            ll_add_tail(req->replaced_files, copy);
+        }
+    }
 
-    size_t data_size;
-    CHECK_READ(read_result, &data_size, sizeof(data_size), sender, "OP_WRITE_FILE");
-    void* data = NULL;
-    if(data_size > 0)
+    on_files_replaced(sender, TRUE, FALSE, replaced_files);
+}
+
+// Reply to the change of req once its record is durable, the files it replaced are pushed to sender after the reply if
+// send_back. Its content is compressed or compacted afterwards, so the client doesn't wait for it
+static void reply_change(request_t* req, int sender, const char* action)
+{
+    linked_list_t* replaced_files = req->replaced_files;
+    req->replaced_files = NULL;
+    if(req->durable == -1)
     {
-        CHECK_FATAL_EQ(data, malloc(data_size), NULL, NO_MEM_FATAL);
-        CHECK_READ(read_result, data, data_size, sender, "OP_WRITE_FILE");
+        if(replaced_files)
+            ll_free(replaced_files, FREE_FUNC(free_replfile));
+        return_response_error(action, req->pathname, sender, EIO);
+        return;
+    }
+
+    if(req->op == OP_WRITE_FILE_AT)
+    {
+        LOG_EVENT("%s run by %d on file %s data written %zu at %zu [Success]", -1, action, sender, req->pathname, req->data_size, req->offset);
+    }
+    else
+    {
+        LOG_EVENT("%s run by %d on file %s data written %zu [Success]", -1, action, sender, req->pathname, req->data_size);
     }
-    
     server_packet_op_t res_op = OP_OK;
+    int error_write = reply(sender, &res_op, sizeof(server_packet_op_t));
+    // an empty change replaced nothing, the count of the files is still replied
+    if(error_write && req->send_back)
+        push_replaced_files(sender, replaced_files);
+    if(replaced_files)
+        ll_free(replaced_files, FREE_FUNC(free_replfile));
+    // compressing merges the segments too
+    if(req->needs_compression)
+        compress_file_content(req->pathname);
+    else if(req->needs_compaction)
+        compact_file_content(req->pathname);
+}
+
+// Free the content of a write which is not going to be stored
+static inline void free_write_content(void* data, content_entry_t* entry)
+{
+    content_free(data);
+    content_store_release(entry);
+}
+
+// Acquire the lock of the FS needed by a change, the exclusive one is needed only to replace other files
+#define ACQUIRE_LOCK_FS(fs, exclusive) if(exclusive) acquire_write_lock_fs(fs); else acquire_read_lock_fs(fs)
+
+#define RELEASE_LOCK_FS(fs, exclusive) if(exclusive) release_write_lock_fs(fs); else release_read_lock_fs(fs)
 
+// Write a file with data or, if data is NULL, with the stored content of digest, used by OP_WRITE_FILE and OP_WRITE_FILE_HASH
+// With deduplication enabled the written content is shared with the files written with the same bytes, its memory is
+// taken only when no other file of the FS is already holding it
+// If reserved > 0 the memory of the content was reserved before receiving it and the FS write lock is not needed
+// Returns 0 once the file is written, the change is acknowledged by reply_change once durable, otherwise the error replied
+static int write_file(request_t* req, int sender, const char* action, void* data, const uint8_t* digest, size_t reserved)
+{
+    const char* pathname = req->pathname;
+    size_t data_size = req->data_size;
     file_system_t* fs = get_fs();
+    content_store_t* store = get_content_store();
+    content_entry_t* entry = NULL;
+    if(data_size > 0 && store)
+    {
+        entry = content_store_find(store, digest);
+        if(!data && (!entry || content_entry_get_size(entry) != data_size))
+        {
+            content_store_release(entry);
+            return return_response_error(action, pathname, sender, ENOENT);
+        }
+    }
+    else if(!data && data_size > 0)
+    {
+        return return_response_error(action, pathname, sender, ENOENT);
+    }
 
-    acquire_write_lock_fs(fs);
+    // the files holding a shared content are counted under the FS write lock, so sharing always takes it
+    bool_t exclusive = data_size > 0 && reserved == 0;
+    ACQUIRE_LOCK_FS(fs, exclusive);
     file_stored_t* file = find_file_fs(fs, pathname);
     if(!file)
     {
-        release_write_lock_fs(fs);
-        free(data);
-        return return_response_error("OP_WRITE_FILE", pathname, sender, ENOENT);
+        RELEASE_LOCK_FS(fs, exclusive);
+        rollback_memory_fs(fs, reserved);
+        free_write_content(data, entry);
+        return return_response_error(action, pathname, sender, ENOENT);
     }
 
-    acquire_read_lock_file(file);
+    acquire_write_lock_file(file);
     if(!file_is_write_enabled(file))
     {
-        release_read_lock_file(file);
-        release_write_lock_fs(fs);
-        free(data);
-        return return_response_error("OP_WRITE_FILE", pathname, sender, EPERM);
+        release_write_lock_file(file);
+        RELEASE_LOCK_FS(fs, exclusive);
+        rollback_memory_fs(fs, reserved);
+        free_write_content(data, entry);
+        return return_response_error(action, pathname, sender, EPERM);
     }
 
     if(file_get_lock_owner(file) != sender)
     {
-        release_read_lock_file(file);
-        release_write_lock_fs(fs);
-        free(data);
-        return return_response_error("OP_WRITE_FILE", pathname, sender, EACCES);
+        release_write_lock_file(file);
+        RELEASE_LOCK_FS(fs, exclusive);
+        rollback_memory_fs(fs, reserved);
+        free_write_content(data, entry);
+        return return_response_error(action, pathname, sender, EACCES);
     }
 
-    int mem_missing = 0;
+    uint64_t lsn = 0;
     linked_list_t* replaced_files = NULL;
+    bool_t needs_compression = FALSE;
 
     if(data_size > 0)
     {
-        if(is_size_too_big(fs, data_size))
+        // a content already held by another file takes no more memory, so nothing is replaced
+        size_t mem_needed = entry && content_entry_get_files(entry) > 0 ? 0 : data_size;
+        if(exclusive)
         {
-            release_read_lock_file(file);
-            release_write_lock_fs(fs);
-            free(data);
-            return return_response_error("OP_WRITE_FILE", pathname, sender, EFBIG);
+            if(is_size_too_big(fs, data_size))
+            {
+                release_write_lock_file(file);
+                release_write_lock_fs(fs);
+                free_write_content(data, entry);
+                return return_response_error(action, pathname, sender, EFBIG);
+            }
+
+            // CACHE REPLACEMENT
+            if(mem_needed > 0 && !reserve_with_replacement(pathname, mem_needed, &replaced_files))
+            {
+                release_write_lock_file(file);
+                release_write_lock_fs(fs);
+                free_write_content(data, entry);
+                on_files_replaced(sender, replaced_files != NULL, FALSE, replaced_files);
+                return return_response_error(action, pathname, sender, EFBIG);
+            }
+            reserved = mem_needed;
         }
-        release_read_lock_file(file);
 
-        mem_missing = is_size_available(fs, data_size);
+        commit_memory_fs(fs, reserved, mem_needed);
+
+        if(store)
+        {
+            if(entry)
+                content_free(data);
+            else
+                entry = content_store_add(store, digest, data, data_size);
+            data = NULL;
+        }
+
+        // logged before the content is given to the file, the records of the file follow the order of its write lock
+        lsn = wal_append(get_wal(), WAL_WRITE, pathname, entry ? content_entry_get_data(entry) : data, data_size);
+        if(entry)
+            file_share_content(file, entry);
+        else
+            file_replace_content(file, data, data_size);
+        needs_compression = is_compression_enabled() && file_needs_compression(file);
+        notify_used_file(file);
+    }
+    RESET_FILE_WRITEMODE(file);
+    release_write_lock_file(file);
+
+    RELEASE_LOCK_FS(fs, exclusive);
+    check_memory_pressure(fs);
+
+    req->lsn = lsn;
+    keep_replaced_files(req, sender, replaced_files);
+    req->needs_compaction = FALSE;
+    req->needs_compression = needs_compression;
+    return 0;
+}
+
+// Handles the sender write request, the file is written with the payload received
+// This method fails if the file doesn't exist, if the previous sender request on this file was not an open with flags O_CREATE | O_LOCK or the data is too big
+static step_t handle_write_file_req(request_t* req, int sender)
+{
+    CO_BEGIN(req->line);
+    CO_READ_PATH(req, sender, "OP_WRITE_FILE");
+    CO_ROUTE(req, sender, "OP_WRITE_FILE");
+    CO_READ(req, sender, &req->send_back, sizeof(bool_t), "OP_WRITE_FILE");
+    CO_READ(req, sender, &req->durability, sizeof(int), "OP_WRITE_FILE");
+    CO_READ(req, sender, &req->data_size, sizeof(size_t), "OP_WRITE_FILE");
+
+    // reserved before receiving the payload, the memory of a shared content is known only once it's hashed
+    req->reserved = req->data_size > 0 && !get_content_store() && reserve_memory_fs(get_fs(), req->data_size) ? req->data_size : 0;
+    req->is_transient = FALSE;
+    if(req->data_size > 0)
+    {
+        req->data = content_alloc(req->data_size);
+        CO_READ_PAYLOAD(req, sender, "OP_WRITE_FILE");
+    }
+
+    size_t reserved;
+    void* data = take_payload(req, &reserved);
+    if(!IS_DURABILITY_VALID(req->durability))
+    {
+        rollback_memory_fs(get_fs(), reserved);
+        content_free(data);
+        return_response_error("OP_WRITE_FILE", req->pathname, sender, EINVAL);
+        return STEP_DONE;
+    }
+
+    // hashed without holding any lock, the digest is needed only to share the content
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    if(req->data_size > 0 && get_content_store())
+        sha256(data, req->data_size, digest);
+
+    // the change is acknowledged only once it's durable as requested
+    if(write_file(req, sender, "OP_WRITE_FILE", data, digest, reserved) == 0)
+    {
+        CO_WAIT_DURABLE(req, sender, req->durability);
+        reply_change(req, sender, "OP_WRITE_FILE");
+    }
+    CO_END(req->line);
+    return STEP_DONE;
+}
+
+// Handles the sender write request carrying only the SHA-256 digest and the size of the content instead of the content
+// This method fails like handle_write_file_req and with ENOENT if the content is not stored by the server, the client
+// can then send the whole content with a write request
+static step_t handle_write_file_hash_req(request_t* req, int sender)
+{
+    CO_BEGIN(req->line);
+    CO_READ_PATH(req, sender, "OP_WRITE_FILE_HASH");
+    CO_ROUTE(req, sender, "OP_WRITE_FILE_HASH");
+    CO_READ(req, sender, &req->send_back, sizeof(bool_t), "OP_WRITE_FILE_HASH");
+    CO_READ(req, sender, &req->durability, sizeof(int), "OP_WRITE_FILE_HASH");
+    CO_READ(req, sender, &req->data_size, sizeof(size_t), "OP_WRITE_FILE_HASH");
+    CO_READ(req, sender, req->digest, SHA256_DIGEST_SIZE, "OP_WRITE_FILE_HASH");
+
+    // an empty content has nothing to upload, the client never sends its digest
+    if(!IS_DURABILITY_VALID(req->durability) || req->data_size == 0)
+    {
+        return_response_error("OP_WRITE_FILE_HASH", req->pathname, sender, EINVAL);
+        return STEP_DONE;
+    }
+
+    if(write_file(req, sender, "OP_WRITE_FILE_HASH", NULL, req->digest, 0) == 0)
+    {
+        CO_WAIT_DURABLE(req, sender, req->durability);
+        reply_change(req, sender, "OP_WRITE_FILE_HASH");
+    }
+    CO_END(req->line);
+    return STEP_DONE;
+}
+
+// Append data_size bytes of data to the file pathname for sender, used by OP_APPEND_FILE once the request is read
+// A transient payload lives inside the request arena, the file copies it inside its segments
+// Returns 0 once the content is appended, the change is acknowledged by reply_change once durable, otherwise the error replied
+static int append_file(request_t* req, int sender, void* data, size_t reserved)
+{
+    const char* pathname = req->pathname;
+    size_t data_size = req->data_size;
+    bool_t is_transient = req->is_transient;
+    file_system_t* fs = get_fs();
+    if(!IS_DURABILITY_VALID(req->durability))
+    {
+        rollback_memory_fs(fs, reserved);
+        FREE_PAYLOAD(data, is_transient);
+        return return_response_error("OP_APPEND_FILE", pathname, sender, EINVAL);
+    }
+
+    bool_t exclusive = data_size > 0 && reserved == 0;
+    ACQUIRE_LOCK_FS(fs, exclusive);
+    file_stored_t* file = find_file_fs(fs, pathname);
+    if(!file)
+    {
+        RELEASE_LOCK_FS(fs, exclusive);
+        rollback_memory_fs(fs, reserved);
+        FREE_PAYLOAD(data, is_transient);
+        return return_response_error("OP_APPEND_FILE", pathname, sender, ENOENT);
+    }
+
+    acquire_write_lock_file(file);
+    if(!file_is_opened_by(file, sender))
+    {
+        release_write_lock_file(file);
+        RELEASE_LOCK_FS(fs, exclusive);
+        rollback_memory_fs(fs, reserved);
+        FREE_PAYLOAD(data, is_transient);
+        return return_response_error("OP_APPEND_FILE", pathname, sender, EPERM);
+    }
+
+    // the owners of the shared lock expect the content to stay the same
+    int lock_owner = file_get_lock_owner(file);
+    if((lock_owner != -1 && lock_owner != sender) || cs_count(file_get_lock_sharers(file)) > 0)
+    {
+        release_write_lock_file(file);
+        RELEASE_LOCK_FS(fs, exclusive);
+        rollback_memory_fs(fs, reserved);
+        FREE_PAYLOAD(data, is_transient);
+        return return_response_error("OP_APPEND_FILE", pathname, sender, EACCES);
+    }
+
+    uint64_t lsn = 0;
+    linked_list_t* replaced_files = NULL;
+    bool_t needs_compaction = FALSE;
+    bool_t needs_compression = FALSE;
 
-        // CACHE REPLACEMENT
-        if(mem_missing > 0)
+    if(data_size > 0)
+    {
+        if(exclusive)
         {
-            bool_t success = run_replacement_algorithm(pathname, mem_missing, &replaced_files);
-            if(!success)
+            if(is_size_too_big(fs, data_size))
+            {
+                release_write_lock_file(file);
+                release_write_lock_fs(fs);
+                FREE_PAYLOAD(data, is_transient);
+                return return_response_error("OP_APPEND_FILE", pathname, sender, EFBIG);
+            }
+
+            // CACHE REPLACEMENT
+            if(!reserve_with_replacement(pathname, data_size, &replaced_files))
             {
+                release_write_lock_file(file);
                 release_write_lock_fs(fs);
-                free(data);
-                return return_response_error("OP_WRITE_FILE", pathname, sender, EFBIG);
+                FREE_PAYLOAD(data, is_transient);
+                on_files_replaced(sender, replaced_files != NULL, FALSE, replaced_files);
+                return return_response_error("OP_APPEND_FILE", pathname, sender, EFBIG);
             }
+            reserved = data_size;
         }
 
-        notify_memory_changed_fs(fs, data_size);
+        commit_memory_fs(fs, reserved, data_size);
+
+        lsn = wal_append(get_wal(), WAL_APPEND, pathname, data, data_size);
+        if(is_transient)
+            file_append_content_copy(file, data, data_size);
+        else
+            file_append_content(file, data, data_size);
+        needs_compaction = file_needs_compaction(file);
+        needs_compression = is_compression_enabled() && file_needs_compression(file);
+    }
+    RESET_FILE_WRITEMODE(file);
+    notify_used_file(file);
+    release_write_lock_file(file);
+
+    RELEASE_LOCK_FS(fs, exclusive);
+    check_memory_pressure(fs);
+
+    req->lsn = lsn;
+    keep_replaced_files(req, sender, replaced_files);
+    req->needs_compaction = needs_compaction;
+    req->needs_compression = needs_compression;
+    return 0;
+}
+
+// Handles the sender append request, the payload received is added at the end of the file
+// This method fails if the file doesn't exist, if the file is not opened by the sender, if the file is owned by another client or the data to be appended is too big
+static step_t handle_append_file_req(request_t* req, int sender)
+{
+    CO_BEGIN(req->line);
+    CO_READ_PATH(req, sender, "OP_APPEND_FILE");
+    CO_ROUTE(req, sender, "OP_APPEND_FILE");
+    CO_READ(req, sender, &req->send_back, sizeof(bool_t), "OP_APPEND_FILE");
+    CO_READ(req, sender, &req->durability, sizeof(int), "OP_APPEND_FILE");
+    CO_READ(req, sender, &req->data_size, sizeof(size_t), "OP_APPEND_FILE");
+
+    // reserved before receiving the payload, an append which fits doesn't need the FS write lock
+    req->reserved = req->data_size > 0 && reserve_memory_fs(get_fs(), req->data_size) ? req->data_size : 0;
+    // Small appends are copied inside the file segments, so their payload is only transient
+    req->is_transient = req->data_size < SL_SEGMENT_SIZE;
+    if(req->data_size > 0)
+    {
+        if(req->is_transient)
+            req->data = arena_alloc(get_request_arena(), req->data_size);
+        else
+            req->data = content_alloc(req->data_size);
+        CO_READ_PAYLOAD(req, sender, "OP_APPEND_FILE");
+    }
+
+    size_t reserved;
+    void* data = take_payload(req, &reserved);
+    // the change is acknowledged only once it's durable as requested
+    if(append_file(req, sender, data, reserved) == 0)
+    {
+        CO_WAIT_DURABLE(req, sender, req->durability);
+        reply_change(req, sender, "OP_APPEND_FILE");
+    }
+    CO_END(req->line);
+    return STEP_DONE;
+}
+
+// Write data_size bytes of data at offset of the file pathname for sender, used by OP_WRITE_FILE_AT once the request is read
+// The bytes past the end of the file are appended, a write can't start past the end so the files never have holes
+// This method fails if the file doesn't exist, if the file is not opened by the sender, if the file is owned by another client,
+// if offset is past the end of the file or the data to be written is too big
+// Returns 0 once the content is written, the change is acknowledged by reply_change once durable, otherwise the error replied
+static int write_file_at(request_t* req, int sender, void* data, size_t reserved)
+{
+    const char* pathname = req->pathname;
+    size_t offset = req->offset;
+    size_t data_size = req->data_size;
+    bool_t is_transient = req->is_transient;
+    file_system_t* fs = get_fs();
+    if(!IS_DURABILITY_VALID(req->durability))
+    {
+        rollback_memory_fs(fs, reserved);
+        FREE_PAYLOAD(data, is_transient);
+        return return_response_error("OP_WRITE_FILE_AT", pathname, sender, EINVAL);
+    }
+
+    // a reserved write runs under the FS read lock as long as it only writes the blocks the file owns in private,
+    // the copies of the shared or sealed blocks and the holders of a shared content change under the FS write lock
+    bool_t exclusive = data_size > 0 && reserved == 0;
+    file_stored_t* file;
+    int error;
+    while(TRUE)
+    {
+        ACQUIRE_LOCK_FS(fs, exclusive);
+        file = find_file_fs(fs, pathname);
+        if(!file)
+        {
+            RELEASE_LOCK_FS(fs, exclusive);
+            rollback_memory_fs(fs, reserved);
+            FREE_PAYLOAD(data, is_transient);
+            return return_response_error("OP_WRITE_FILE_AT", pathname, sender, ENOENT);
+        }
 
         acquire_write_lock_file(file);
-        file_replace_content(file, data, data_size);
-        RESET_FILE_WRITEMODE(file);
-        notify_used_file(file);
+        error = 0;
+        int lock_owner = file_get_lock_owner(file);
+        if(!file_is_opened_by(file, sender))
+            error = EPERM;
+        // the owners of the shared lock expect the content to stay the same
+        else if((lock_owner != -1 && lock_owner != sender) || cs_count(file_get_lock_sharers(file)) > 0)
+            error = EACCES;
+        else if(offset > file_get_size(file))
+            error = EINVAL;
+        if(error || exclusive || data_size == 0 || !file_write_copies_blocks(file, offset))
+            break;
+
         release_write_lock_file(file);
+        release_read_lock_fs(fs);
+        rollback_memory_fs(fs, reserved);
+        reserved = 0;
+        exclusive = TRUE;
     }
-    else
+    if(error)
     {
-        release_read_lock_file(file);
-        acquire_write_lock_file(file);
-        RESET_FILE_WRITEMODE(file);
         release_write_lock_file(file);
+        RELEASE_LOCK_FS(fs, exclusive);
+        rollback_memory_fs(fs, reserved);
+        FREE_PAYLOAD(data, is_transient);
+        return return_response_error("OP_WRITE_FILE_AT", pathname, sender, error);
     }
 
-    release_write_lock_fs(fs);
+    uint64_t lsn = 0;
+    linked_list_t* replaced_files = NULL;
+    bool_t needs_compaction = FALSE;
+    bool_t needs_compression = FALSE;
 
-    LOG_EVENT("OP_WRITE_FILE run by %d on file %s data written %zu [Success]", -1, sender, pathname, data_size);
-    int error_write;
-    if((error_write = writen(sender, &res_op, sizeof(server_packet_op_t))))
+    if(data_size > 0)
     {
-        if(data_size == 0 && send_back)
-            writen(sender, &data_size, sizeof(size_t));
+        // a write on the private blocks takes at most data_size, the reserved one. The exclusive one reserves
+        // the worst case, the bytes appended plus the private copies of the blocks overwritten
+        if(exclusive)
+        {
+            size_t cost = file_write_cost_at(file, offset, data_size);
+            if(is_size_too_big(fs, cost))
+            {
+                release_write_lock_file(file);
+                release_write_lock_fs(fs);
+                FREE_PAYLOAD(data, is_transient);
+                return return_response_error("OP_WRITE_FILE_AT", pathname, sender, EFBIG);
+            }
+
+            // CACHE REPLACEMENT
+            if(!reserve_with_replacement(pathname, cost, &replaced_files))
+            {
+                release_write_lock_file(file);
+                release_write_lock_fs(fs);
+                FREE_PAYLOAD(data, is_transient);
+                on_files_replaced(sender, replaced_files != NULL, FALSE, replaced_files);
+                return return_response_error("OP_WRITE_FILE_AT", pathname, sender, EFBIG);
+            }
+            reserved = cost;
+        }
+
+        lsn = wal_append_at(get_wal(), pathname, offset, data, data_size);
+        ssize_t memory = file_write_content_at(file, offset, data, data_size);
+        // the file gives memory back once it stops counting a shared content
+        commit_memory_fs(fs, reserved, memory > 0 ? (size_t)memory : 0);
+        if(memory < 0)
+            notify_memory_changed_fs(fs, memory);
+        FREE_PAYLOAD(data, is_transient);
+        needs_compaction = file_needs_compaction(file);
+        needs_compression = is_compression_enabled() && file_needs_compression(file);
     }
-    if(data_size > 0)
-        on_files_replaced(sender, mem_missing > 0, error_write ? send_back : FALSE, replaced_files);
+    RESET_FILE_WRITEMODE(file);
+    notify_used_file(file);
+    release_write_lock_file(file);
+
+    RELEASE_LOCK_FS(fs, exclusive);
+    check_memory_pressure(fs);
+
+    req->lsn = lsn;
+    keep_replaced_files(req, sender, replaced_files);
+    req->needs_compaction = needs_compaction;
+    req->needs_compression = needs_compression;
     return 0;
 }
 
-int handle_append_file_req(int sender)
+// Handles the sender positioned write request, the payload received overwrites the file from the offset requested
+static step_t handle_write_file_at_req(request_t* req, int sender)
 {
-    int read_result;
-    char pathname[MAX_PATHNAME_API_LENGTH + 1];
-    CHECK_READ_PATH(read_result, pathname, sender, "OP_APPEND_FILE");
-    bool_t send_back;
-    CHECK_READ(read_result, &send_back, sizeof(bool_t), sender, "OP_APPEND_FILE");
-
-    size_t data_size;
-    CHECK_READ(read_result, &data_size, sizeof(data_size), sender, "OP_APPEND_FILE");
-    void* data = NULL;
-    if(data_size > 0)
+    CO_BEGIN(req->line);
+    CO_READ_PATH(req, sender, "OP_WRITE_FILE_AT");
+    CO_ROUTE(req, sender, "OP_WRITE_FILE_AT");
+    CO_READ(req, sender, &req->send_back, sizeof(bool_t), "OP_WRITE_FILE_AT");
+    CO_READ(req, sender, &req->durability, sizeof(int), "OP_WRITE_FILE_AT");
+    CO_READ(req, sender, &req->offset, sizeof(size_t), "OP_WRITE_FILE_AT");
+    CO_READ(req, sender, &req->data_size, sizeof(size_t), "OP_WRITE_FILE_AT");
+
+    req->reserved = req->data_size > 0 && reserve_memory_fs(get_fs(), req->data_size) ? req->data_size : 0;
+    // the file always copies the payload inside its segments, a small one lives only inside the arena
+    req->is_transient = req->data_size < SL_SEGMENT_SIZE;
+    if(req->data_size > 0)
     {
-        CHECK_FATAL_EQ(data, malloc(data_size), NULL, NO_MEM_FATAL);
-        CHECK_READ(read_result, data, data_size, sender, "OP_APPEND_FILE");
+        if(req->is_transient)
+            req->data = arena_alloc(get_request_arena(), req->data_size);
+        else
+            req->data = content_alloc(req->data_size);
+        CO_READ_PAYLOAD(req, sender, "OP_WRITE_FILE_AT");
     }
 
-    server_packet_op_t res_op = OP_OK;
+    size_t reserved;
+    void* data = take_payload(req, &reserved);
+    // the change is acknowledged only once it's durable as requested
+    if(write_file_at(req, sender, data, reserved) == 0)
+    {
+        CO_WAIT_DURABLE(req, sender, req->durability);
+        reply_change(req, sender, "OP_WRITE_FILE_AT");
+    }
+    CO_END(req->line);
+    return STEP_DONE;
+}
 
+// Reply the content of the file pathname to sender, op is the read requested: OP_READ_FILE_CACHE tracks sender as caching
+// the file and OP_READ_FILE_IF_MODIFIED replies OP_NOT_MODIFIED if the version of the file is still known_version
+// Both reply the version of the file before its content
+// This method fails if the file doesn't exist, if the file is not opened by the sender or if the file is owned by another client
+static int read_file(int sender, const char* pathname, server_packet_op_t op, uint64_t known_version)
+{
     file_system_t* fs = get_fs();
+    bool_t cache = op == OP_READ_FILE_CACHE;
+    const char* action = cache ? "OP_READ_FILE_CACHE" : (op == OP_READ_FILE_IF_MODIFIED ? "OP_READ_FILE_IF_MODIFIED" : "OP_READ_FILE");
 
-    acquire_write_lock_fs(fs);
+    acquire_read_lock_fs(fs);
     file_stored_t* file = find_file_fs(fs, pathname);
     if(!file)
     {
-        release_write_lock_fs(fs);
-        free(data);
-        return return_response_error("OP_APPEND_FILE", pathname, sender, ENOENT);
+        release_read_lock_fs(fs);
+        return return_response_error(action, pathname, sender, ENOENT);
     }
 
-    acquire_read_lock_file(file);
+    // a cached read tracks the client together with the version replied, no change can slip between them
+    if(cache)
+        acquire_write_lock_file(file);
+    else
+        acquire_read_lock_file(file);
     if(!file_is_opened_by(file, sender))
     {
-        release_read_lock_file(file);
-        release_write_lock_fs(fs);
-        free(data);
-        return return_response_error("OP_APPEND_FILE", pathname, sender, EPERM);
+        release_lock_file(file, cache);
+        release_read_lock_fs(fs);
+        return return_response_error(action, pathname, sender, EPERM);
     }
 
-    int lock_owner = file_get_lock_owner(file);
-    if(lock_owner != -1 && lock_owner != sender)
+    int owner = file_get_lock_owner(file);
+    if(owner != -1 && owner != sender)
     {
-        release_read_lock_file(file);
-        release_write_lock_fs(fs);
-        free(data);
-        return return_response_error("OP_APPEND_FILE", pathname, sender, EACCES);
+        release_lock_file(file, cache);
+        release_read_lock_fs(fs);
+        return return_response_error(action, pathname, sender, EACCES);
     }
 
-    int mem_missing = 0;
-    linked_list_t* replaced_files = NULL;
-
-    if(data_size > 0)
+    size_t content_size = file_get_size(file);
+    uint64_t version = file_get_version(file);
+    bool_t not_modified = op == OP_READ_FILE_IF_MODIFIED && version == known_version;
+    server_packet_op_t res_op = not_modified ? OP_NOT_MODIFIED : OP_OK;
+    if(reply(sender, &res_op, sizeof(server_packet_op_t)) && !not_modified)
     {
-        if(is_size_too_big(fs, data_size))
-        {
-            release_read_lock_file(file);
-            release_write_lock_fs(fs);
-            free(data);
-            return return_response_error("OP_APPEND_FILE", pathname, sender, EFBIG);
-        }
-        release_read_lock_file(file);
-
-        mem_missing = is_size_available(fs, data_size);
-
-        // CACHE REPLACEMENT
-        if(mem_missing > 0)
+        if((op == OP_READ_FILE || reply(sender, &version, sizeof(uint64_t)) == 1) && reply(sender, &content_size, sizeof(size_t)))
         {
-            bool_t success = run_replacement_algorithm(pathname, mem_missing, &replaced_files);
-            if(!success)
-            {
-                release_write_lock_fs(fs);
-                free(data);
-                return return_response_error("OP_APPEND_FILE", pathname, sender, EFBIG);
-            }
+            if(content_size > 0)
+                reply_content(sender, file_get_content(file));
         }
+    }
+    if(cache)
+        cache_file_client_fs(fs, file, sender);
+    if(not_modified)
+    {
+        __atomic_add_fetch(&reads_not_modified, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&reads_not_modified_bytes, content_size, __ATOMIC_RELAXED);
+    }
 
-        notify_memory_changed_fs(fs, data_size);
+    // a big content read mostly by the workers of another node is moved there, the pages are copied by the kernel
+    int target_node = -1;
+    if(is_numa_placement_enabled() && content_size >= HUGE_PAGE_SIZE)
+        target_node = file_count_node_read(file, numa_current_node());
+    if(target_node != -1)
+        sl_move_to_node(file_get_content(file), target_node);
 
-        acquire_write_lock_file(file);
-        file_append_content(file, data, data_size);
-        RESET_FILE_WRITEMODE(file);
-        notify_used_file(file);
-        release_write_lock_file(file);
-    }
-    else
+    if(!cache)
     {
         release_read_lock_file(file);
         acquire_write_lock_file(file);
-        RESET_FILE_WRITEMODE(file);
-        notify_used_file(file);
-        release_write_lock_file(file);
     }
+    notify_used_file(file);
+    release_write_lock_file(file);
+    
+    release_read_lock_fs(fs);
 
-    release_write_lock_fs(fs);
-
-    LOG_EVENT("OP_APPEND_FILE run by %d on file %s data written %zu [Success]", -1, sender, pathname, data_size);
-    int error_write;
-    if((error_write = writen(sender, &res_op, sizeof(server_packet_op_t))))
+    if(not_modified)
     {
-        if(data_size == 0 && send_back)
-            writen(sender, &data_size, sizeof(size_t));
+        LOG_EVENT("%s run by %d on file %s not modified [Success]", -1, action, sender, pathname);
+    }
+    else
+    {
+        LOG_EVENT("%s run by %d on file %s data read %zu [Success]", -1, action, sender, pathname, content_size);
+    }
+    if(target_node != -1)
+    {
+        LOG_EVENT("OP_MOVE_FILE on file %s moved to NUMA node %d [Success]", -1, pathname, target_node);
     }
-    if(data_size > 0)
-        on_files_replaced(sender, mem_missing > 0, error_write ? send_back : FALSE, replaced_files);
     return 0;
 }
 
-int handle_read_file_req(int sender)
+static step_t handle_read_file_req(request_t* req, int sender)
 {
-    int read_result;
-    char pathname[MAX_PATHNAME_API_LENGTH + 1];
-    CHECK_READ_PATH(read_result, pathname, sender, "OP_READ_FILE");
+    CO_BEGIN(req->line);
+    CO_READ_PATH(req, sender, "OP_READ_FILE");
+    CO_ROUTE(req, sender, "OP_READ_FILE");
+    CO_WAIT_WRITABLE(req, sender);
+    CO_END(req->line);
+
+    read_file(sender, req->pathname, OP_READ_FILE, 0);
+    return STEP_DONE;
+}
+
+static step_t handle_read_file_cache_req(request_t* req, int sender)
+{
+    CO_BEGIN(req->line);
+    CO_READ_PATH(req, sender, "OP_READ_FILE_CACHE");
+    CO_ROUTE(req, sender, "OP_READ_FILE_CACHE");
+    CO_WAIT_WRITABLE(req, sender);
+    CO_END(req->line);
+
+    read_file(sender, req->pathname, OP_READ_FILE_CACHE, 0);
+    return STEP_DONE;
+}
+
+static step_t handle_read_file_if_modified_req(request_t* req, int sender)
+{
+    CO_BEGIN(req->line);
+    CO_READ(req, sender, &req->version, sizeof(uint64_t), "OP_READ_FILE_IF_MODIFIED");
+    CO_READ_PATH(req, sender, "OP_READ_FILE_IF_MODIFIED");
+    CO_ROUTE(req, sender, "OP_READ_FILE_IF_MODIFIED");
+    CO_WAIT_WRITABLE(req, sender);
+    CO_END(req->line);
+
+    read_file(sender, req->pathname, OP_READ_FILE_IF_MODIFIED, req->version);
+    return STEP_DONE;
+}
 
+// Reply to sender at most length bytes of the file pathname starting at offset, the size replied is 0 past the end of the file
+// Only the segments of the range are written, only the compressed blocks overlapping it are expanded
+// This method fails if the file doesn't exist, if the file is not opened by the sender or if the file is owned by another client
+static int read_file_range(int sender, const char* pathname, size_t offset, size_t length)
+{
     file_system_t* fs = get_fs();
 
     acquire_read_lock_fs(fs);
@@ -452,7 +1565,7 @@ int handle_read_file_req(int sender)
     if(!file)
     {
         release_read_lock_fs(fs);
-        return return_response_error("OP_READ_FILE", pathname, sender, ENOENT);
+        return return_response_error("OP_READ_FILE_RANGE", pathname, sender, ENOENT);
     }
 
     acquire_read_lock_file(file);
@@ -460,7 +1573,7 @@ int handle_read_file_req(int sender)
     {
         release_read_lock_file(file);
         release_read_lock_fs(fs);
-        return return_response_error("OP_READ_FILE", pathname, sender, EPERM);
+        return return_response_error("OP_READ_FILE_RANGE", pathname, sender, EPERM);
     }
 
     int owner = file_get_lock_owner(file);
@@ -468,104 +1581,162 @@ int handle_read_file_req(int sender)
     {
         release_read_lock_file(file);
         release_read_lock_fs(fs);
-        return return_response_error("OP_READ_FILE", pathname, sender, EACCES);
+        return return_response_error("OP_READ_FILE_RANGE", pathname, sender, EACCES);
     }
 
     size_t content_size = file_get_size(file);
+    size_t range_size = offset < content_size ? MIN(length, content_size - offset) : 0;
     server_packet_op_t res_op = OP_OK;
-    if(writen(sender, &res_op, sizeof(server_packet_op_t)))
+    if(reply(sender, &res_op, sizeof(server_packet_op_t)) && reply(sender, &range_size, sizeof(size_t)))
     {
-        if(writen(sender, &content_size, sizeof(size_t)))
-        {
-            if(content_size > 0)
-                writen(sender, file_get_data(file), content_size);
-        }
+        if(range_size > 0)
+            reply_content_range(sender, file_get_content(file), offset, range_size);
     }
 
     release_read_lock_file(file);
-
     acquire_write_lock_file(file);
     notify_used_file(file);
     release_write_lock_file(file);
-    
+
     release_read_lock_fs(fs);
 
-    LOG_EVENT("OP_READ_FILE run by %d on file %s data read %zu [Success]", -1, sender, pathname, content_size);
+    LOG_EVENT("OP_READ_FILE_RANGE run by %d on file %s data read %zu at %zu [Success]", -1, sender, pathname, range_size, offset);
     return 0;
 }
 
-int handle_nread_files_req(int sender)
+static step_t handle_read_file_range_req(request_t* req, int sender)
 {
-    int read_result;
-    int n_to_read;
-    CHECK_READ(read_result, &n_to_read, sizeof(int), sender, "OP_NREAD_FILE");
-    bool_t read_all = n_to_read <= 0;
+    CO_BEGIN(req->line);
+    CO_READ_PATH(req, sender, "OP_READ_FILE_RANGE");
+    CO_ROUTE(req, sender, "OP_READ_FILE_RANGE");
+    CO_READ(req, sender, &req->offset, sizeof(size_t), "OP_READ_FILE_RANGE");
+    CO_READ(req, sender, &req->length, sizeof(size_t), "OP_READ_FILE_RANGE");
+    CO_WAIT_WRITABLE(req, sender);
+    CO_END(req->line);
+
+    read_file_range(sender, req->pathname, req->offset, req->length);
+    return STEP_DONE;
+}
 
-    server_packet_op_t res_op = OP_OK;
-    file_system_t* fs = get_fs();
+// Release the read lock of every shard, taken in order by read_n_files
+static void release_shards_read_lock()
+{
+    for(size_t i = get_shards_count(); i > 0; --i)
+        release_read_lock_fs(get_shard_fs(i - 1));
+}
 
-    acquire_read_lock_fs(fs);
-    file_stored_t** files = get_files_stored(fs);
-    size_t fs_file_count = get_file_count_fs(fs);
-    size_t files_readed = read_all ? fs_file_count : MIN(n_to_read, fs_file_count);
+// Reply to sender the count of the files read followed by n_to_read files, every file if n_to_read <= 0
+// In shard mode the files of every shard are read, the shards are locked in order and their files taken one after the other
+// The contents are pinned while the shards are locked and replied one at a time by handle_nread_files_req, so the files
+// don't need to fit inside the output buffer of the client. Returns 0 if the files can be replied, -1 if sender is gone
+// This method never fails
+static int read_n_files(request_t* req, int sender)
+{
+    bool_t read_all = req->n_to_read <= 0;
 
-    if(writen(sender, &res_op, sizeof(server_packet_op_t)) == -1)
+    server_packet_op_t res_op = OP_OK;
+    size_t shards_count = get_shards_count();
+    size_t fs_file_count = 0;
+    for(size_t s = 0; s < shards_count; ++s)
     {
-        release_read_lock_fs(fs);
-        return 0;
+        acquire_read_lock_fs(get_shard_fs(s));
+        fs_file_count += get_file_count_fs(get_shard_fs(s));
     }
-    if(writen(sender, &files_readed, sizeof(size_t)) == -1)
+
+    // a single shard already gives every file, otherwise the files of each shard are collected one after the other
+    file_stored_t** files = NULL;
+    if(shards_count == 1)
     {
-        release_read_lock_fs(fs);
-        return 0;
+        files = get_files_stored(get_shard_fs(0), get_request_arena());
     }
-
-    // match the array boundaries (example: 4 files means -> [0, 3])
-    int i = files_readed - 1;
-    int data_read = 0;
-    while(i >= 0)
+    else if(fs_file_count > 0)
     {
-        file_stored_t* curr_file = files[i];
-        acquire_read_lock_file(curr_file);
-        char* pathname = file_get_pathname(curr_file);
-        size_t pathname_len = strnlen(pathname, MAX_PATHNAME_API_LENGTH);
-        if(writen_string(sender, pathname, pathname_len) == -1)
-        {
-            release_read_lock_file(curr_file);
-            break;
-        }
-
-        size_t curr_size = file_get_size(curr_file);
-        if(writen(sender, &curr_size, sizeof(curr_size)) == -1)
+        files = arena_alloc(get_request_arena(), fs_file_count * sizeof(file_stored_t*));
+        size_t collected = 0;
+        for(size_t s = 0; s < shards_count; ++s)
         {
-            release_read_lock_file(curr_file);
-            break;
+            size_t shard_count = get_file_count_fs(get_shard_fs(s));
+            if(shard_count > 0)
+                memcpy(files + collected, get_files_stored(get_shard_fs(s), get_request_arena()), shard_count * sizeof(file_stored_t*));
+            collected += shard_count;
         }
+    }
+    size_t files_readed = read_all ? fs_file_count : MIN((size_t)req->n_to_read, fs_file_count);
 
-        if(curr_size > 0 && writen(sender, file_get_data(curr_file), curr_size) == -1)
-        {
-            release_read_lock_file(curr_file);
-            break;
-        }
+    if(reply(sender, &res_op, sizeof(server_packet_op_t)) == -1 || reply(sender, &files_readed, sizeof(size_t)) == -1)
+    {
+        release_shards_read_lock();
+        return -1;
+    }
 
+    // match the array boundaries (example: 4 files means -> [0, 3]), the last files are replied first
+    if(files_readed > 0)
+        CHECK_FATAL_EQ(req->reply_files, malloc(files_readed * sizeof(reply_file_t)), NULL, NO_MEM_FATAL);
+    for(size_t i = 0; i < files_readed; ++i)
+    {
+        file_stored_t* curr_file = files[files_readed - 1 - i];
+        acquire_read_lock_file(curr_file);
+        req->reply_files[i].pathname = strndup(file_get_pathname(curr_file), MAX_PATHNAME_API_LENGTH);
+        req->reply_files[i].content = sl_view_create(file_get_content(curr_file), 0, file_get_size(curr_file));
         release_read_lock_file(curr_file);
-
-        data_read += curr_size;
-        --i;
     }
-    release_read_lock_fs(fs);
+    req->reply_files_count = files_readed;
+    req->reply_files_next = 0;
+    req->reply_data_read = 0;
+    release_shards_read_lock();
 
-    free(files);
-    LOG_EVENT("OP_READN_FILE run by %d file readed %zu data read %d [Success]", -1, sender, files_readed, data_read);
     return 0;
 }
 
-int handle_remove_file_req(int sender)
+// Reply to sender the next file pinned by read_n_files, its pathname, size and content
+// Returns 1 on success, -1 if sender is gone
+static int reply_next_file(request_t* req, int sender)
 {
-    int read_result;
-    char pathname[MAX_PATHNAME_API_LENGTH + 1];
-    CHECK_READ_PATH(read_result, pathname, sender, "OP_REMOVE_FILE");
+    reply_file_t* file = &req->reply_files[req->reply_files_next++];
+    size_t size = sl_view_get_size(file->content);
+    int res = reply_string(sender, file->pathname, strnlen(file->pathname, MAX_PATHNAME_API_LENGTH));
+    if(res != -1)
+        res = reply(sender, &size, sizeof(size_t));
+    free(file->pathname);
+    if(res == -1 || size == 0)
+    {
+        free_sl_view(file->content);
+        return res;
+    }
+
+    req->reply_data_read += size;
+    return outbound_write_view(get_outbound(), sender, file->content);
+}
+
+static step_t handle_nread_files_req(request_t* req, int sender)
+{
+    CO_BEGIN(req->line);
+    CO_READ(req, sender, &req->n_to_read, sizeof(int), "OP_NREAD_FILE");
+    CO_WAIT_WRITABLE(req, sender);
+    if(read_n_files(req, sender) == 0)
+    {
+        // the client reads the files already replied before the next one is queued
+        while(req->reply_files_next < req->reply_files_count)
+        {
+            CO_WAIT_WRITABLE(req, sender);
+            if(reply_next_file(req, sender) == -1)
+                break;
+        }
+
+        LOG_EVENT("OP_READN_FILE run by %d file readed %zu data read %zu [Success]", -1, sender, req->reply_files_count, req->reply_data_read);
+    }
+    release_reply_files(req);
+    CO_END(req->line);
+
+    return STEP_DONE;
+}
 
+// Remove the file pathname owned by sender, req gets the record of the removal and the size of the file removed
+// This method fails if the file doesn't exist or if the file is not owned by the sender
+// The clients waiting for the lock are resumed with an EIDRM
+// Returns 0 once the file is removed, the removal is acknowledged once durable, otherwise the error replied
+static int remove_file(request_t* req, int sender, const char* pathname)
+{
     file_system_t* fs = get_fs();
 
     acquire_write_lock_fs(fs);
@@ -585,25 +1756,45 @@ int handle_remove_file_req(int sender)
         return return_response_error("OP_REMOVE_FILE", pathname, sender, EACCES);
     }
 
-    int data_size = file_get_size(file);
+    req->data_size = file_get_size(file);
     notify_file_removed_to_lockers(file_get_locks_queue(file));
     release_read_lock_file(file);
+    req->lsn = wal_append(get_wal(), WAL_REMOVE, pathname, NULL, 0);
     remove_file_fs(fs, pathname, FALSE);
+    disk_tier_drop(get_disk_tier(), pathname);
     release_write_lock_fs(fs);
-
-    LOG_EVENT("OP_REMOVE_FILE run by %d on file %s data removed %d [Success]", -1, sender, pathname, data_size);
-    server_packet_op_t res_op = OP_OK;
-    writen(sender, &res_op, sizeof(server_packet_op_t));
     return 0;
 }
 
-int handle_lock_file_req(int sender)
+static step_t handle_remove_file_req(request_t* req, int sender)
 {
-    int result = 0;
-    int read_result;
-    char pathname[MAX_PATHNAME_API_LENGTH + 1];
-    CHECK_READ_PATH(read_result, pathname, sender, "OP_LOCK_FILE");
+    CO_BEGIN(req->line);
+    CO_READ_PATH(req, sender, "OP_REMOVE_FILE");
+    CO_ROUTE(req, sender, "OP_REMOVE_FILE");
+
+    if(remove_file(req, sender, req->pathname) == 0)
+    {
+        CO_WAIT_DURABLE(req, sender, D_DEFAULT);
+        if(req->durable == -1)
+        {
+            return_response_error("OP_REMOVE_FILE", req->pathname, sender, EIO);
+            return STEP_DONE;
+        }
 
+        LOG_EVENT("OP_REMOVE_FILE run by %d on file %s data removed %zu [Success]", -1, sender, req->pathname, req->data_size);
+        server_packet_op_t res_op = OP_OK;
+        reply(sender, &res_op, sizeof(server_packet_op_t));
+    }
+    CO_END(req->line);
+    return STEP_DONE;
+}
+
+// Give the lock of pathname to sender, used by both OP_LOCK_FILE and OP_LOCK_FILE_EX
+// With L_TRY the request fails with EBUSY instead of waiting, with timeout_ms > 0 the wait expires with ETIMEDOUT
+// With L_SHARED the lock is shared with the other readers
+static int lock_file(int sender, const char* pathname, int flags, long timeout_ms, const char* action)
+{
+    int result = 0;
     file_system_t* fs = get_fs();
 
     acquire_write_lock_fs(fs);
@@ -611,7 +1802,7 @@ int handle_lock_file_req(int sender)
     if(!file)
     {
         release_write_lock_fs(fs);
-        return return_response_error("OP_LOCK_FILE", pathname, sender, ENOENT);
+        return return_response_error(action, pathname, sender, ENOENT);
     }
 
     acquire_write_lock_file(file);
@@ -619,38 +1810,80 @@ int handle_lock_file_req(int sender)
     {
         release_write_lock_file(file);
         release_write_lock_fs(fs);
-        return return_response_error("OP_LOCK_FILE", pathname, sender, EPERM);
+        return return_response_error(action, pathname, sender, EPERM);
     }
 
-    int owner = file_get_lock_owner(file);
-    if(owner == -1)
+    bool_t shared = (flags & L_SHARED) != 0;
+    if(is_lock_upgrade_blocked(file, sender, shared))
     {
-        file_set_lock_owner(file, sender);
-    } else if(owner != sender)
+        release_write_lock_file(file);
+        release_write_lock_fs(fs);
+        return return_response_error(action, pathname, sender, EDEADLK);
+    }
+
+    if((flags & L_TRY) && !file_can_acquire_lock(file, sender, shared))
     {
-        file_enqueue_lock(file, sender);
-        result = -1;
+        release_write_lock_file(file);
+        release_write_lock_fs(fs);
+        return return_response_error(action, pathname, sender, EBUSY);
     }
 
+    result = lock_file_client_fs(fs, file, sender, shared, timeout_ms);
+
     notify_used_file(file);
     release_write_lock_file(file);
     release_write_lock_fs(fs);
 
-    LOG_EVENT("OP_LOCK_FILE run by %d on file %s lock on hold %s [Success]", -1, sender, pathname, result == -1 ? "TRUE" : "FALSE");
+    LOG_EVENT("%s run by %d on file %s lock on hold %s [Success]", -1, action, sender, pathname, result == -1 ? "TRUE" : "FALSE");
     if(result == 0)
     {
         server_packet_op_t res_op = OP_OK;
-        writen(sender, &res_op, sizeof(server_packet_op_t));
+        reply(sender, &res_op, sizeof(server_packet_op_t));
     }
     return result;
 }
 
-int handle_unlock_file_req(int sender)
+// Handles the sender lock request, if the lock is owned by another client the request waits for it
+// This method fails if the file doesn't exist or if the file is not opened by the sender
+static step_t handle_lock_file_req(request_t* req, int sender)
 {
-    int read_result;
-    char pathname[MAX_PATHNAME_API_LENGTH + 1];
-    CHECK_READ_PATH(read_result, pathname, sender, "OP_UNLOCK_FILE");
+    CO_BEGIN(req->line);
+    CO_READ_PATH(req, sender, "OP_LOCK_FILE");
+    CO_ROUTE(req, sender, "OP_LOCK_FILE");
+
+    if(lock_file(sender, req->pathname, 0, 0, "OP_LOCK_FILE") == -1)
+    {
+        CO_YIELD(req->line, STEP_WAIT_LOCK);
+        reply_lock_outcome(req, sender);
+    }
+    CO_END(req->line);
+    return STEP_DONE;
+}
+
+// Handles the sender extended lock request, like handle_lock_file_req but the request carries lock flags and a timeout
+// With the flag L_TRY this method fails with EBUSY if the lock is owned by another client
+// With a timeout > 0 the client waits for the lock at most timeout milliseconds, then it's resumed with ETIMEDOUT
+static step_t handle_lock_file_ex_req(request_t* req, int sender)
+{
+    CO_BEGIN(req->line);
+    CO_READ(req, sender, &req->flags, sizeof(int), "OP_LOCK_FILE_EX");
+    CO_READ(req, sender, &req->timeout_ms, sizeof(long), "OP_LOCK_FILE_EX");
+    CO_READ_PATH(req, sender, "OP_LOCK_FILE_EX");
+    CO_ROUTE(req, sender, "OP_LOCK_FILE_EX");
+
+    if(lock_file(sender, req->pathname, req->flags, req->timeout_ms, "OP_LOCK_FILE_EX") == -1)
+    {
+        CO_YIELD(req->line, STEP_WAIT_LOCK);
+        reply_lock_outcome(req, sender);
+    }
+    CO_END(req->line);
+    return STEP_DONE;
+}
 
+// Give back the lock of pathname owned by sender, the clients waiting for it are resumed
+// This method fails if the file doesn't exist, if the file is not opened by the sender or if the sender does not own the file
+static int unlock_file(int sender, const char* pathname)
+{
     file_system_t* fs = get_fs();
 
     acquire_write_lock_fs(fs);
@@ -669,34 +1902,43 @@ int handle_unlock_file_req(int sender)
         return return_response_error("OP_UNLOCK_FILE", pathname, sender, EPERM);
     }
 
-    int owner = file_get_lock_owner(file);
-    if(owner != sender)
+    client_set_t* granted = create_cs();
+    if(unlock_file_client_fs(fs, file, sender, granted) == -1)
     {
         release_write_lock_file(file);
         release_write_lock_fs(fs);
+        free_cs(granted);
         return return_response_error("OP_UNLOCK_FILE", pathname, sender, EACCES);
     }
 
-    int new_owner = file_dequeue_lock(file);
-    file_set_lock_owner(file, new_owner);
     notify_used_file(file);
     release_write_lock_file(file);
     release_write_lock_fs(fs);
 
-    notify_given_lock(new_owner);
+    notify_granted_locks(granted);
+    free_cs(granted);
 
     LOG_EVENT("OP_UNLOCK_FILE run by %d on file %s [Success]", -1, sender, pathname);
     server_packet_op_t res_op = OP_OK;
-    writen(sender, &res_op, sizeof(server_packet_op_t));
+    reply(sender, &res_op, sizeof(server_packet_op_t));
     return 0;
 }
 
-int handle_close_file_req(int sender)
+static step_t handle_unlock_file_req(request_t* req, int sender)
 {
-    int read_result;
-    char pathname[MAX_PATHNAME_API_LENGTH + 1];
-    CHECK_READ_PATH(read_result, pathname, sender, "OP_CLOSE_FILE");
+    CO_BEGIN(req->line);
+    CO_READ_PATH(req, sender, "OP_UNLOCK_FILE");
+    CO_ROUTE(req, sender, "OP_UNLOCK_FILE");
+    CO_END(req->line);
 
+    unlock_file(sender, req->pathname);
+    return STEP_DONE;
+}
+
+// Close the file pathname for sender, if the sender owns the lock it is released and given to the next client waiting for it
+// This method fails if the file doesn't exist
+static int close_file(int sender, const char* pathname)
+{
     file_system_t* fs = get_fs();
     acquire_write_lock_fs(fs);
     file_stored_t* file = find_file_fs(fs, pathname);
@@ -706,25 +1948,396 @@ int handle_close_file_req(int sender)
         return return_response_error("OP_CLOSE_FILE", pathname, sender, ENOENT);
     }
 
+    client_set_t* granted = create_cs();
     acquire_write_lock_file(file);
-    int next_owner = -1;
-    if(file_get_lock_owner(file) == sender)
-    {
-        next_owner = file_dequeue_lock(file);
-        file_set_lock_owner(file, next_owner);
-    }
-
-    file_close_client(file, sender);
+    unlock_file_client_fs(fs, file, sender, granted);
+    close_file_client_fs(fs, file, sender);
     notify_used_file(file);
     release_write_lock_file(file);
     release_write_lock_fs(fs);
 
-    if(next_owner >= 0)
-        notify_given_lock(next_owner);
+    notify_granted_locks(granted);
+    free_cs(granted);
 
     LOG_EVENT("OP_CLOSE_FILE run by %d on file %s [Success]", -1, sender, pathname);
 
     server_packet_op_t res_op = OP_OK;
-    writen(sender, &res_op, sizeof(server_packet_op_t));
+    reply(sender, &res_op, sizeof(server_packet_op_t));
     return 0;
-}
\ No newline at end of file
+}
+
+static step_t handle_close_file_req(request_t* req, int sender)
+{
+    CO_BEGIN(req->line);
+    CO_READ_PATH(req, sender, "OP_CLOSE_FILE");
+    CO_ROUTE(req, sender, "OP_CLOSE_FILE");
+    CO_END(req->line);
+
+    close_file(sender, req->pathname);
+    return STEP_DONE;
+}
+
+// Reply the shard map to sender, always empty: the shard processes are listed by their supervisor only
+static step_t handle_shard_map_req(request_t* req, int sender)
+{
+    server_packet_op_t res_op = OP_OK;
+    size_t shards = 0;
+    reply(sender, &res_op, sizeof(server_packet_op_t));
+    reply(sender, &shards, sizeof(size_t));
+    return STEP_DONE;
+}
+
+// Run the request of client from where it stopped, its op is read first
+static step_t run_request(request_t* req, int client)
+{
+    pthread_t curr = pthread_self();
+    if(!req->op_read)
+    {
+        read_outcome_t outcome = read_request(req, client, &req->op, sizeof(server_packet_op_t));
+        RET_IF(outcome == READ_PENDING, STEP_WAIT_READ);
+        RET_IF(outcome == READ_CLOSED, STEP_CLOSED);
+        RET_IF(outcome != READ_DONE || !is_valid_op(req->op), STEP_INVALID);
+        req->op_read = TRUE;
+    }
+
+    switch(req->op)
+    {
+        case OP_OPEN_FILE:
+            PRINT_INFO_DEBUG("[W/%lu] OP_OPEN_FILE request operation.", curr);
+            return handle_open_file_req(req, client);
+
+        case OP_LOCK_FILE:
+            PRINT_INFO_DEBUG("[W/%lu] OP_LOCK_FILE request operation.", curr);
+            return handle_lock_file_req(req, client);
+
+        case OP_LOCK_FILE_EX:
+            PRINT_INFO_DEBUG("[W/%lu] OP_LOCK_FILE_EX request operation.", curr);
+            return handle_lock_file_ex_req(req, client);
+
+        case OP_UNLOCK_FILE:
+            PRINT_INFO_DEBUG("[W/%lu] OP_UNLOCK_FILE request operation.", curr);
+            return handle_unlock_file_req(req, client);
+
+        case OP_REMOVE_FILE:
+            PRINT_INFO_DEBUG("[W/%lu] OP_REMOVE_FILE request operation.", curr);
+            return handle_remove_file_req(req, client);
+
+        case OP_WRITE_FILE:
+            PRINT_INFO_DEBUG("[W/%lu] OP_WRITE_FILE request operation.", curr);
+            return handle_write_file_req(req, client);
+
+        case OP_WRITE_FILE_HASH:
+            PRINT_INFO_DEBUG("[W/%lu] OP_WRITE_FILE_HASH request operation.", curr);
+            return handle_write_file_hash_req(req, client);
+
+        case OP_APPEND_FILE:
+            PRINT_INFO_DEBUG("[W/%lu] OP_APPEND_FILE request operation.", curr);
+            return handle_append_file_req(req, client);
+
+        case OP_READ_FILE:
+            PRINT_INFO_DEBUG("[W/%lu] OP_READ_FILE request operation.", curr);
+            return handle_read_file_req(req, client);
+
+        case OP_READN_FILES:
+            PRINT_INFO_DEBUG("[W/%lu] OP_READN_FILES request operation.", curr);
+            return handle_nread_files_req(req, client);
+
+        case OP_CLOSE_FILE:
+            PRINT_INFO_DEBUG("[W/%lu] OP_CLOSE_FILE request operation.", curr);
+            return handle_close_file_req(req, client);
+
+        case OP_SHARD_MAP:
+            PRINT_INFO_DEBUG("[W/%lu] OP_SHARD_MAP request operation.", curr);
+            return handle_shard_map_req(req, client);
+
+        case OP_READ_FILE_CACHE:
+            PRINT_INFO_DEBUG("[W/%lu] OP_READ_FILE_CACHE request operation.", curr);
+            return handle_read_file_cache_req(req, client);
+
+        case OP_READ_FILE_IF_MODIFIED:
+            PRINT_INFO_DEBUG("[W/%lu] OP_READ_FILE_IF_MODIFIED request operation.", curr);
+            return handle_read_file_if_modified_req(req, client);
+
+        case OP_READ_FILE_RANGE:
+            PRINT_INFO_DEBUG("[W/%lu] OP_READ_FILE_RANGE request operation.", curr);
+            return handle_read_file_range_req(req, client);
+
+        case OP_WRITE_FILE_AT:
+            PRINT_INFO_DEBUG("[W/%lu] OP_WRITE_FILE_AT request operation.", curr);
+            return handle_write_file_at_req(req, client);
+
+        default:
+            PRINT_INFO_DEBUG("[W/%lu] Unknown request operation, skipping request.", curr);
+            return STEP_DONE;
+    }
+}
+
+// Reset req to run a new request, must be called with its mutex locked
+static inline void start_request(request_t* req)
+{
+    req->op_read = FALSE;
+    req->line = 0;
+    req->read_offset = 0;
+    req->path_len_read = FALSE;
+    req->receiving = FALSE;
+    req->next_pending = FALSE;
+    req->woken = FALSE;
+}
+
+request_status_t handle_request(int client)
+{
+    request_t* req = get_request(client);
+
+    LOCK_MUTEX(&req->mutex);
+    switch(req->state)
+    {
+        case RS_IDLE:
+            start_request(req);
+            break;
+
+        case RS_RUNNING:
+            // the reply reached the client before the worker was done with the request, it starts the next one
+            req->next_pending = TRUE;
+            UNLOCK_MUTEX(&req->mutex);
+            return REQ_NOTHING;
+
+        case RS_WAIT_READ:
+            __atomic_sub_fetch(&requests_waiting_read, 1, __ATOMIC_RELAXED);
+            break;
+
+        case RS_FORWARDED:
+            break;
+
+        default:
+            // the next request is listened to while a lock is waited for, sending it already breaks the protocol
+            // nothing else resumes a request waiting for its output to be read or for its change to be durable
+            if(!req->woken)
+            {
+                UNLOCK_MUTEX(&req->mutex);
+                return REQ_INVALID;
+            }
+            req->woken = FALSE;
+            break;
+    }
+    req->state = RS_RUNNING;
+    // a READN waiting between its files is still replying
+    bool_t resumed_reply = req->reply_files_count > 0;
+    UNLOCK_MUTEX(&req->mutex);
+
+    // the notices of the changes of the files cached by client wait until the replies are written
+    if(!resumed_reply)
+        outbound_begin_reply(get_outbound(), client);
+    step_t step;
+    while(TRUE)
+    {
+        step = run_request(req, client);
+
+        LOCK_MUTEX(&req->mutex);
+        // woken while the step was still running
+        if((step == STEP_WAIT_LOCK || step == STEP_WAIT_WRITE || step == STEP_WAIT_DURABLE) && req->woken)
+            req->woken = FALSE;
+        else if(step == STEP_DONE && req->next_pending && !req->closed)
+            start_request(req);
+        else
+            break;
+        UNLOCK_MUTEX(&req->mutex);
+    }
+
+    if(req->closed)
+    {
+        req->closed = FALSE;
+        step = STEP_CLOSED;
+    }
+
+    request_status_t status = REQ_NOTHING;
+    req->state = RS_IDLE;
+    switch(step)
+    {
+        case STEP_DONE:
+            status = req->receiving ? REQ_NOTHING : REQ_NEXT;
+            break;
+
+        case STEP_WAIT_READ:
+            req->state = RS_WAIT_READ;
+            req->waiting_since = time(NULL);
+            __atomic_add_fetch(&requests_waiting_read, 1, __ATOMIC_RELAXED);
+            status = REQ_READABLE;
+            break;
+
+        case STEP_WAIT_LOCK:
+            req->state = RS_WAIT_LOCK;
+            status = req->receiving ? REQ_NOTHING : REQ_NEXT;
+            req->receiving = TRUE;
+            break;
+
+        case STEP_WAIT_WRITE:
+            req->state = RS_WAIT_WRITE;
+            break;
+
+        case STEP_WAIT_DURABLE:
+            req->state = RS_WAIT_DURABLE;
+            break;
+
+        case STEP_FORWARD:
+            req->state = RS_FORWARDED;
+            __atomic_add_fetch(&requests_forwarded, 1, __ATOMIC_RELAXED);
+            status = REQ_FORWARDED;
+            break;
+
+        case STEP_CLOSED:
+            status = REQ_CLOSED;
+            break;
+
+        case STEP_INVALID:
+            status = REQ_INVALID;
+            break;
+    }
+    // the notices can't come between the files of a READN
+    bool_t keep_reply = step == STEP_WAIT_WRITE && req->reply_files_count > 0;
+    UNLOCK_MUTEX(&req->mutex);
+
+    // outside of the mutex of req, the flush of the notices may wake the request waiting for its output to be read
+    if(!keep_reply)
+        outbound_end_reply(get_outbound(), client);
+    return status;
+}
+
+void wake_request(int client, int error)
+{
+    request_t* req = get_request(client);
+    bool_t must_schedule = FALSE;
+
+    LOCK_MUTEX(&req->mutex);
+    if(req->state == RS_WAIT_LOCK || req->state == RS_WAIT_WRITE || req->state == RS_WAIT_DURABLE || req->state == RS_RUNNING)
+    {
+        // a running request is about to wait, its worker resumes it at once
+        must_schedule = req->state != RS_RUNNING && !req->woken;
+        req->woken = TRUE;
+        req->wake_error = error;
+    }
+    UNLOCK_MUTEX(&req->mutex);
+
+    if(must_schedule)
+        schedule_client(client);
+}
+
+bool_t close_request(int client)
+{
+    request_t* req = get_request(client);
+    bool_t can_close;
+
+    LOCK_MUTEX(&req->mutex);
+    // a forwarded request is about to run on the worker of its shard
+    can_close = req->state != RS_RUNNING && req->state != RS_FORWARDED;
+    if(!can_close)
+        req->closed = TRUE;
+    UNLOCK_MUTEX(&req->mutex);
+    return can_close;
+}
+
+void expire_requests(unsigned int timeout_s)
+{
+    time_t now = time(NULL);
+
+    LOCK_MUTEX(&requests_mutex);
+    for(size_t i = 0; i < requests_size; ++i)
+    {
+        request_t* req = requests[i];
+        if(!req)
+            continue;
+
+        // the request is resumed by the hang up and disconnects the client
+        LOCK_MUTEX(&req->mutex);
+        if(req->state == RS_WAIT_READ && now - req->waiting_since >= timeout_s)
+            outbound_shutdown(get_outbound(), i);
+        UNLOCK_MUTEX(&req->mutex);
+    }
+    UNLOCK_MUTEX(&requests_mutex);
+}
+
+size_t count_waiting_requests()
+{
+    return __atomic_load_n(&requests_waiting_read, __ATOMIC_RELAXED);
+}
+
+size_t get_request_shard(int client)
+{
+    return __atomic_load_n(&get_request(client)->shard, __ATOMIC_RELAXED);
+}
+
+size_t count_forwarded_requests()
+{
+    return __atomic_load_n(&requests_forwarded, __ATOMIC_RELAXED);
+}
+
+void invalidate_cached_file(file_stored_t* file, int client)
+{
+    // the file belongs to the FS of its shard, also when the lock of a disconnected client is given to the next one
+    const char* pathname = file_get_pathname(file);
+    uncache_file_client_fs(get_shard_fs(get_shard_of(pathname)), file, client);
+
+    // a single notice, the op followed by the pathname as written by writen_string
+    size_t len = strnlen(pathname, MAX_PATHNAME_API_LENGTH);
+    char notice[sizeof(server_packet_op_t) + sizeof(size_t) + MAX_PATHNAME_API_LENGTH];
+    server_packet_op_t op = OP_INVALIDATE_FILE;
+    memcpy(notice, &op, sizeof(server_packet_op_t));
+    memcpy(notice + sizeof(server_packet_op_t), &len, sizeof(size_t));
+    memcpy(notice + sizeof(server_packet_op_t) + sizeof(size_t), pathname, len);
+
+    outbound_notify(get_outbound(), client, notice, sizeof(server_packet_op_t) + sizeof(size_t) + len);
+    __atomic_add_fetch(&caches_invalidated, 1, __ATOMIC_RELAXED);
+}
+
+size_t count_invalidated_caches()
+{
+    return __atomic_load_n(&caches_invalidated, __ATOMIC_RELAXED);
+}
+
+size_t count_reads_not_modified(size_t* bytes_not_sent)
+{
+    *bytes_not_sent = __atomic_load_n(&reads_not_modified_bytes, __ATOMIC_RELAXED);
+    return __atomic_load_n(&reads_not_modified, __ATOMIC_RELAXED);
+}
+
+void drop_request(int client)
+{
+    request_t* req = get_request(client);
+
+    LOCK_MUTEX(&req->mutex);
+    if(req->state == RS_WAIT_READ)
+        __atomic_sub_fetch(&requests_waiting_read, 1, __ATOMIC_RELAXED);
+    // the record is still written, nobody waits for it anymore
+    if(req->state == RS_WAIT_DURABLE)
+        wal_unwatch(get_wal(), client);
+    linked_list_t* replaced_files = req->replaced_files;
+    req->replaced_files = NULL;
+    release_payload(req);
+    release_reply_files(req);
+    req->state = RS_IDLE;
+    req->closed = FALSE;
+    UNLOCK_MUTEX(&req->mutex);
+
+    // the copies kept for a change never acknowledged, the files themselves are already demoted
+    if(replaced_files)
+        ll_free(replaced_files, FREE_FUNC(free_replfile));
+}
+
+void free_requests()
+{
+    for(size_t i = 0; i < requests_size; ++i)
+    {
+        request_t* req = requests[i];
+        if(!req)
+            continue;
+
+        release_payload(req);
+        release_reply_files(req);
+        if(req->replaced_files)
+            ll_free(req->replaced_files, FREE_FUNC(free_replfile));
+        pthread_mutex_destroy(&req->mutex);
+        free(req);
+    }
+    free(requests);
+    requests = NULL;
+    requests_size = 0;
+}
@@ -0,0 +1,343 @@
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "inbound.h"
+#include "linked_list.h"
+
+// Capacity of the buffers the bytes received are copied into, while they fit the next ones are appended
+#define INBOUND_CHUNK_SIZE 4096
+
+typedef struct inbound_chunk {
+    size_t size;
+    size_t capacity;
+    char data[];
+} inbound_chunk_t;
+
+// State of the receive of the bytes of a client
+typedef enum stream_state {
+    // the bytes are received as they arrive
+    STREAM_ACTIVE,
+    // the buffer is full, the receive was cancelled and its end didn't come yet
+    STREAM_PAUSING,
+    // the buffer is full, the bytes are not received
+    STREAM_PAUSED,
+    // the buffer was read while the bytes were not received, the connection handler receives them again
+    STREAM_RESUMING,
+    // the client hung up or its connection broke
+    STREAM_ENDED
+} stream_state_t;
+
+// What the connection handler waits for
+typedef enum input_wait {
+    WAIT_NONE,
+    // the first byte of the next request
+    WAIT_NEXT,
+    // the rest of the current request
+    WAIT_REST
+} input_wait_t;
+
+typedef struct inbound_entry {
+    linked_list_t* chunks;
+    // bytes waiting to be read
+    size_t buffered;
+    // bytes of the first chunk already read
+    size_t offset;
+    stream_state_t state;
+    // once the stream ended, 0 if the client hung up or the error of the connection
+    int error;
+    input_wait_t waiting;
+    // the client was disconnected while its bytes were received, its socket is closed once the receive ends
+    bool_t detached;
+    pthread_mutex_t mutex;
+} inbound_entry_t;
+
+struct inbound {
+    size_t max_buffer_bytes;
+    // called once a client which is not received can take more bytes
+    void (*on_drained)(int client);
+    // one entry for each descriptor, created the first time it's used
+    inbound_entry_t** entries;
+    size_t entries_count;
+
+    // protects the table of the entries
+    pthread_mutex_t mutex;
+};
+
+static inbound_entry_t* get_entry(inbound_t* in, int client)
+{
+    RET_IF(!in || client < 0, NULL);
+
+    LOCK_MUTEX(&in->mutex);
+    if((size_t)client >= in->entries_count)
+    {
+        size_t count = MAX(in->entries_count * 2, (size_t)client + 1);
+        CHECK_FATAL_EQ(in->entries, realloc(in->entries, count * sizeof(inbound_entry_t*)), NULL, NO_MEM_FATAL);
+        memset(in->entries + in->entries_count, 0, (count - in->entries_count) * sizeof(inbound_entry_t*));
+        in->entries_count = count;
+    }
+
+    inbound_entry_t* entry = in->entries[client];
+    if(!entry)
+    {
+        CHECK_FATAL_EQ(entry, malloc(sizeof(inbound_entry_t)), NULL, NO_MEM_FATAL);
+        memset(entry, 0, sizeof(inbound_entry_t));
+        entry->chunks = ll_create();
+        entry->state = STREAM_ENDED;
+        INIT_MUTEX(&entry->mutex);
+        in->entries[client] = entry;
+    }
+    UNLOCK_MUTEX(&in->mutex);
+
+    return entry;
+}
+
+// Take at most size bytes of the input of entry, copied inside buf unless it's NULL. Must be called with the mutex
+// of entry acquired like the functions below. Returns the bytes taken
+static size_t take_bytes(inbound_entry_t* entry, void* buf, size_t size)
+{
+    size_t taken = 0;
+    while(taken < size && entry->buffered > 0)
+    {
+        inbound_chunk_t* chunk = ll_get_first(entry->chunks);
+        size_t available = MIN(chunk->size - entry->offset, size - taken);
+        if(buf)
+            memcpy((char*)buf + taken, chunk->data + entry->offset, available);
+        taken += available;
+        entry->offset += available;
+        entry->buffered -= available;
+        if(entry->offset == chunk->size)
+        {
+            ll_remove_first(entry->chunks, NULL);
+            free(chunk);
+            entry->offset = 0;
+        }
+    }
+    return taken;
+}
+
+static void reset_entry(inbound_entry_t* entry, stream_state_t state)
+{
+    ll_empty(entry->chunks, free);
+    entry->buffered = 0;
+    entry->offset = 0;
+    entry->state = state;
+    entry->error = 0;
+    entry->waiting = WAIT_NONE;
+    entry->detached = FALSE;
+}
+
+// The action for the input entry waited for, which arrived or won't arrive anymore
+static inbound_action_t take_waiting(inbound_entry_t* entry)
+{
+    input_wait_t waiting = entry->waiting;
+    entry->waiting = WAIT_NONE;
+    if(waiting == WAIT_NEXT && entry->buffered == 0)
+        return IN_HUNG_UP;
+    if(waiting == WAIT_NEXT)
+        take_bytes(entry, NULL, 1);
+    return waiting == WAIT_NONE ? IN_NONE : IN_SCHEDULE;
+}
+
+inbound_t* create_inbound(size_t max_buffer_bytes, void (*on_drained)(int client))
+{
+    inbound_t* in;
+    CHECK_FATAL_EQ(in, malloc(sizeof(inbound_t)), NULL, NO_MEM_FATAL);
+    memset(in, 0, sizeof(inbound_t));
+    in->max_buffer_bytes = max_buffer_bytes;
+    in->on_drained = on_drained;
+    INIT_MUTEX(&in->mutex);
+
+    return in;
+}
+
+void inbound_open(inbound_t* in, int client)
+{
+    inbound_entry_t* entry = get_entry(in, client);
+    NRET_IF(!entry);
+
+    EXEC_WITH_MUTEX(reset_entry(entry, STREAM_ACTIVE), &entry->mutex);
+}
+
+inbound_action_t inbound_wait(inbound_t* in, int client, bool_t next)
+{
+    inbound_entry_t* entry = get_entry(in, client);
+    RET_IF(!entry, IN_NONE);
+
+    LOCK_MUTEX(&entry->mutex);
+    entry->waiting = next ? WAIT_NEXT : WAIT_REST;
+    // the input is already here or won't arrive anymore
+    inbound_action_t action = entry->buffered > 0 || entry->state == STREAM_ENDED ? take_waiting(entry) : IN_NONE;
+    UNLOCK_MUTEX(&entry->mutex);
+
+    return action;
+}
+
+inbound_action_t inbound_push(inbound_t* in, int client, const void* data, size_t size, bool_t* full)
+{
+    *full = FALSE;
+    inbound_entry_t* entry = get_entry(in, client);
+    RET_IF(!entry || size == 0, IN_NONE);
+
+    LOCK_MUTEX(&entry->mutex);
+    // the bytes of a client disconnected are dropped
+    if(entry->detached || entry->state == STREAM_ENDED)
+    {
+        UNLOCK_MUTEX(&entry->mutex);
+        return IN_NONE;
+    }
+
+    inbound_chunk_t* chunk = ll_get_last(entry->chunks);
+    if(!chunk || chunk->capacity - chunk->size < size)
+    {
+        size_t capacity = MAX(size, INBOUND_CHUNK_SIZE);
+        CHECK_FATAL_EQ(chunk, malloc(sizeof(inbound_chunk_t) + capacity), NULL, NO_MEM_FATAL);
+        chunk->size = 0;
+        chunk->capacity = capacity;
+        ll_add_tail(entry->chunks, chunk);
+    }
+    memcpy(chunk->data + chunk->size, data, size);
+    chunk->size += size;
+    entry->buffered += size;
+
+    if(entry->state == STREAM_ACTIVE && entry->buffered >= in->max_buffer_bytes)
+    {
+        entry->state = STREAM_PAUSING;
+        *full = TRUE;
+    }
+    inbound_action_t action = take_waiting(entry);
+    UNLOCK_MUTEX(&entry->mutex);
+
+    return action;
+}
+
+inbound_action_t inbound_end(inbound_t* in, int client, int error)
+{
+    inbound_entry_t* entry = get_entry(in, client);
+    RET_IF(!entry, IN_NONE);
+
+    inbound_action_t action;
+    LOCK_MUTEX(&entry->mutex);
+    if(entry->detached)
+    {
+        reset_entry(entry, STREAM_ENDED);
+        action = IN_CLOSE;
+    }
+    else if(error == ECANCELED && entry->state == STREAM_PAUSING)
+    {
+        // the requests could have read most of the input meanwhile
+        bool_t drained = entry->buffered <= in->max_buffer_bytes / 2;
+        entry->state = drained ? STREAM_ACTIVE : STREAM_PAUSED;
+        action = drained ? IN_RECEIVE : IN_NONE;
+    }
+    else
+    {
+        entry->state = STREAM_ENDED;
+        entry->error = error;
+        action = take_waiting(entry);
+    }
+    UNLOCK_MUTEX(&entry->mutex);
+
+    return action;
+}
+
+inbound_action_t inbound_resume(inbound_t* in, int client)
+{
+    inbound_entry_t* entry = get_entry(in, client);
+    RET_IF(!entry, IN_NONE);
+
+    inbound_action_t action = IN_NONE;
+    LOCK_MUTEX(&entry->mutex);
+    if(entry->detached)
+    {
+        reset_entry(entry, STREAM_ENDED);
+        action = IN_CLOSE;
+    }
+    else if(entry->state == STREAM_RESUMING)
+    {
+        entry->state = STREAM_ACTIVE;
+        action = IN_RECEIVE;
+    }
+    UNLOCK_MUTEX(&entry->mutex);
+
+    return action;
+}
+
+ssize_t inbound_read(inbound_t* in, int client, void* buf, size_t size)
+{
+    inbound_entry_t* entry = get_entry(in, client);
+    RET_IF(!entry, -1);
+
+    ssize_t res;
+    LOCK_MUTEX(&entry->mutex);
+    if(entry->buffered > 0)
+        res = take_bytes(entry, buf, size);
+    else if(entry->state != STREAM_ENDED)
+    {
+        errno = EAGAIN;
+        res = -1;
+    }
+    else if(entry->error != 0)
+    {
+        errno = entry->error;
+        res = -1;
+    }
+    else
+        res = 0;
+
+    bool_t drained = entry->state == STREAM_PAUSED && entry->buffered <= in->max_buffer_bytes / 2;
+    if(drained)
+        entry->state = STREAM_RESUMING;
+    UNLOCK_MUTEX(&entry->mutex);
+
+    if(drained)
+        in->on_drained(client);
+    return res;
+}
+
+bool_t inbound_close(inbound_t* in, int client)
+{
+    inbound_entry_t* entry = get_entry(in, client);
+    RET_IF(!entry, TRUE);
+
+    bool_t closable;
+    LOCK_MUTEX(&entry->mutex);
+    // nothing refers to the socket unless its bytes are received or the connection handler is about to receive them
+    closable = entry->state == STREAM_PAUSED || entry->state == STREAM_ENDED;
+    if(closable)
+        reset_entry(entry, STREAM_ENDED);
+    else
+    {
+        ll_empty(entry->chunks, free);
+        entry->buffered = 0;
+        entry->offset = 0;
+        entry->waiting = WAIT_NONE;
+        entry->detached = TRUE;
+        // the receive ends once the socket is shut down
+        shutdown(client, SHUT_RDWR);
+    }
+    UNLOCK_MUTEX(&entry->mutex);
+
+    return closable;
+}
+
+void free_inbound(inbound_t* in)
+{
+    NRET_IF(!in);
+
+    for(size_t i = 0; i < in->entries_count; ++i)
+    {
+        inbound_entry_t* entry = in->entries[i];
+        if(!entry)
+            continue;
+
+        ll_free(entry->chunks, free);
+        pthread_mutex_destroy(&entry->mutex);
+        free(entry);
+    }
+
+    free(in->entries);
+    pthread_mutex_destroy(&in->mutex);
+    free(in);
+}
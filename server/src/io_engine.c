@@ -0,0 +1,713 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "io_engine.h"
+
+// Entries of the submission queue of io_uring, the completion queue is twice as big
+#define URING_ENTRIES 256
+// Events read by each epoll_wait
+#define EPOLL_EVENTS 64
+// Buffers of the ring the kernel fills with the bytes of the clients streamed, a power of 2, and bytes of each of them
+#define URING_BUFFERS 256
+#define URING_BUFFER_SIZE (16 * 1024)
+// Group of the buffers of the ring, the receives select their buffer from it
+#define URING_BUFFER_GROUP 0
+
+// Operation of a request, stored inside the high half of its user data and its descriptor inside the low one
+typedef enum io_op {
+    IO_OP_LISTEN = 1,
+    IO_OP_ACCEPT,
+    IO_OP_RECEIVE,
+    IO_OP_POLL,
+    IO_OP_STREAM,
+    IO_OP_CANCEL
+} io_op_t;
+
+#define IO_USER_DATA(op, fd) (((uint64_t)(op) << 32) | (uint32_t)(fd))
+#define IO_USER_DATA_OP(data) ((io_op_t)((data) >> 32))
+#define IO_USER_DATA_FD(data) ((int)(uint32_t)(data))
+
+// Rings shared with the kernel, the submission queue is written here and read by the kernel, the completion queue the opposite
+typedef struct uring {
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+    struct io_uring_sqe* sqes;
+    // tail of the entries queued, published to the kernel only by the next submission
+    unsigned int sq_local_tail;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    // the connections are accepted by a single multishot request, cleared if the kernel doesn't support it
+    bool_t multishot_accept;
+
+    // ring of the buffers given to the kernel for the streams, NULL if the kernel can't stream
+    struct io_uring_buf_ring* buf_ring;
+    size_t buf_ring_size;
+    char* buffers;
+    // tail of the buffers given, published to the kernel once they're all added
+    unsigned short buf_tail;
+    // buffers of the events returned by the last wait, given back by the next one
+    unsigned short used_buffers[URING_BUFFERS];
+    unsigned int used_count;
+    // the streams cancelled which didn't end yet, indexed by descriptor: they're not received again once the kernel ends them
+    bool_t* cancelled;
+    size_t cancelled_size;
+} uring_t;
+
+struct io_engine {
+    io_engine_type_t type;
+    // epoll instance or io_uring descriptor
+    int fd;
+    uring_t ring;
+    io_engine_metrics_t metrics;
+    // the first byte of a request carries nothing, every receive reads it here
+    char scratch;
+};
+
+#ifdef __NR_io_uring_setup
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params* params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags, void* arg, size_t arg_size)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, void* arg, unsigned int nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+#else
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params* params)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags, void* arg, size_t arg_size)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, void* arg, unsigned int nr_args)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
+
+// Map the rings of the io_uring instance just created with params
+static int uring_map(io_engine_t* engine, struct io_uring_params* params)
+{
+    uring_t* ring = &engine->ring;
+    ring->sq_ring_size = params->sq_off.array + params->sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+    // both the queues can live inside a single mapping
+    if(params->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, engine->fd, IORING_OFF_SQ_RING);
+    RET_IF(ring->sq_ring == MAP_FAILED, -1);
+    if(params->features & IORING_FEAT_SINGLE_MMAP)
+        ring->cq_ring = ring->sq_ring;
+    else
+    {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, engine->fd, IORING_OFF_CQ_RING);
+        RET_IF(ring->cq_ring == MAP_FAILED, -1);
+    }
+    ring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, engine->fd, IORING_OFF_SQES);
+    RET_IF(ring->sqes == MAP_FAILED, -1);
+
+    char* sq = ring->sq_ring;
+    ring->sq_head = (unsigned int*)(sq + params->sq_off.head);
+    ring->sq_tail = (unsigned int*)(sq + params->sq_off.tail);
+    ring->sq_mask = *(unsigned int*)(sq + params->sq_off.ring_mask);
+    ring->sq_entries = *(unsigned int*)(sq + params->sq_off.ring_entries);
+    ring->sq_local_tail = *ring->sq_tail;
+    // each slot of the queue always points to the entry with the same index
+    unsigned int* sq_array = (unsigned int*)(sq + params->sq_off.array);
+    for(unsigned int i = 0; i < ring->sq_entries; ++i)
+        sq_array[i] = i;
+
+    char* cq = ring->cq_ring;
+    ring->cq_head = (unsigned int*)(cq + params->cq_off.head);
+    ring->cq_tail = (unsigned int*)(cq + params->cq_off.tail);
+    ring->cq_mask = *(unsigned int*)(cq + params->cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params->cq_off.cqes);
+    return 0;
+}
+
+// Publish the entries queued and enter the kernel to submit them, waiting for min_complete completions
+// at most timeout_ms if not negative. Returns -1 with errno set on failure, ETIME if the timeout expired
+static int uring_enter(io_engine_t* engine, unsigned int min_complete, long timeout_ms)
+{
+    uring_t* ring = &engine->ring;
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    unsigned int to_submit = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    unsigned int flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    void* arg_ptr = NULL;
+    size_t arg_size = 0;
+    if(min_complete > 0 && timeout_ms >= 0)
+    {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        arg_ptr = &arg;
+        arg_size = sizeof(arg);
+    }
+
+    engine->metrics.syscalls += 1;
+    return sys_io_uring_enter(engine->fd, to_submit, min_complete, flags, arg_ptr, arg_size) == -1 ? -1 : 0;
+}
+
+// Queue a new request with op on fd, submitting the ones already queued if the submission queue is full
+// Returns the entry of the request to fill, NULL on failure with errno set
+static struct io_uring_sqe* uring_queue(io_engine_t* engine, io_op_t op, int fd)
+{
+    uring_t* ring = &engine->ring;
+    if(ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+    {
+        RET_IF(uring_enter(engine, 0, -1) == -1, NULL);
+    }
+
+    struct io_uring_sqe* sqe = &ring->sqes[ring->sq_local_tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->fd = fd;
+    sqe->user_data = IO_USER_DATA(op, fd);
+    ring->sq_local_tail += 1;
+    return sqe;
+}
+
+// Add the buffer bid to the ring of the buffers, the kernel can use it once the buffers added are published
+static void uring_give_buffer(uring_t* ring, unsigned short bid)
+{
+    struct io_uring_buf* buf = &ring->buf_ring->bufs[ring->buf_tail & (URING_BUFFERS - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(ring->buffers + (size_t)bid * URING_BUFFER_SIZE);
+    buf->len = URING_BUFFER_SIZE;
+    buf->bid = bid;
+    ring->buf_tail += 1;
+}
+
+static void uring_publish_buffers(uring_t* ring)
+{
+    __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+// Register the ring of the buffers of the streams with the kernel and give it all of them
+// Returns 0 on success, -1 on failure with errno set, EINVAL if the kernel doesn't support it (5.19)
+static int uring_register_buffers(io_engine_t* engine)
+{
+    uring_t* ring = &engine->ring;
+    ring->buf_ring_size = URING_BUFFERS * sizeof(struct io_uring_buf);
+    ring->buf_ring = mmap(NULL, ring->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ring->buf_ring == MAP_FAILED)
+    {
+        ring->buf_ring = NULL;
+        return -1;
+    }
+    ring->buffers = mmap(NULL, (size_t)URING_BUFFERS * URING_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(struct io_uring_buf_reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring->buf_ring;
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = URING_BUFFER_GROUP;
+    if(ring->buffers == MAP_FAILED || sys_io_uring_register(engine->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+    {
+        int error = errno;
+        if(ring->buffers != MAP_FAILED)
+            munmap(ring->buffers, (size_t)URING_BUFFERS * URING_BUFFER_SIZE);
+        munmap(ring->buf_ring, ring->buf_ring_size);
+        ring->buffers = NULL;
+        ring->buf_ring = NULL;
+        errno = error;
+        return -1;
+    }
+
+    ring->buf_tail = 0;
+    for(unsigned int i = 0; i < URING_BUFFERS; ++i)
+        uring_give_buffer(ring, i);
+    uring_publish_buffers(ring);
+    return 0;
+}
+
+static int uring_listen(io_engine_t* engine, int fd)
+{
+    struct io_uring_sqe* sqe = uring_queue(engine, IO_OP_LISTEN, fd);
+    RET_IF(!sqe, -1);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    return 0;
+}
+
+static int uring_accept(io_engine_t* engine, int server_fd)
+{
+    struct io_uring_sqe* sqe = uring_queue(engine, IO_OP_ACCEPT, server_fd);
+    RET_IF(!sqe, -1);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    if(engine->ring.multishot_accept)
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    return 0;
+}
+
+static int uring_receive(io_engine_t* engine, int client)
+{
+    struct io_uring_sqe* sqe = uring_queue(engine, IO_OP_RECEIVE, client);
+    RET_IF(!sqe, -1);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->addr = (uint64_t)(uintptr_t)&engine->scratch;
+    sqe->len = 1;
+    return 0;
+}
+
+static int uring_poll(io_engine_t* engine, int fd)
+{
+    struct io_uring_sqe* sqe = uring_queue(engine, IO_OP_POLL, fd);
+    RET_IF(!sqe, -1);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->poll32_events = POLLIN;
+    return 0;
+}
+
+static int uring_stream(io_engine_t* engine, int client)
+{
+    struct io_uring_sqe* sqe = uring_queue(engine, IO_OP_STREAM, client);
+    RET_IF(!sqe, -1);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    return 0;
+}
+
+static int uring_cancel(io_engine_t* engine, int client)
+{
+    uring_t* ring = &engine->ring;
+    if((size_t)client >= ring->cancelled_size)
+    {
+        size_t size = MAX(ring->cancelled_size * 2, (size_t)client + 1);
+        bool_t* cancelled = realloc(ring->cancelled, size * sizeof(bool_t));
+        RET_IF(!cancelled, -1);
+        memset(cancelled + ring->cancelled_size, 0, (size - ring->cancelled_size) * sizeof(bool_t));
+        ring->cancelled = cancelled;
+        ring->cancelled_size = size;
+    }
+
+    struct io_uring_sqe* sqe = uring_queue(engine, IO_OP_CANCEL, client);
+    RET_IF(!sqe, -1);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = IO_USER_DATA(IO_OP_STREAM, client);
+    ring->cancelled[client] = TRUE;
+    return 0;
+}
+
+// Check whether the kernel streams the bytes of a socket pair, the stream is ended by shutting the socket down
+// and its completions are dropped. Only called when nothing else is queued
+static bool_t uring_probe_stream(io_engine_t* engine)
+{
+    int pair[2];
+    RET_IF(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) == -1, FALSE);
+
+    uring_t* ring = &engine->ring;
+    bool_t streamed = FALSE;
+    bool_t ended = write(pair[1], "", 1) != 1 || uring_stream(engine, pair[0]) == -1;
+    while(!ended && uring_enter(engine, 1, 1000) == 0)
+    {
+        unsigned int head = *ring->cq_head;
+        unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for(; head != tail; ++head)
+        {
+            struct io_uring_cqe* cqe = &ring->cqes[head & ring->cq_mask];
+            // kernels older than 6.0 reject the multishot receive
+            if(cqe->res == 1 && (cqe->flags & IORING_CQE_F_MORE))
+                streamed = TRUE;
+            if(cqe->flags & IORING_CQE_F_BUFFER)
+                uring_give_buffer(ring, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            if(!(cqe->flags & IORING_CQE_F_MORE))
+                ended = TRUE;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        uring_publish_buffers(ring);
+        shutdown(pair[0], SHUT_RDWR);
+    }
+    close(pair[0]);
+    close(pair[1]);
+    return streamed && ended;
+}
+
+// Turn the completions into events, the multishot requests the kernel ended are queued again
+static int uring_wait(io_engine_t* engine, io_event_t* events, int max, long timeout_ms)
+{
+    uring_t* ring = &engine->ring;
+    // the events of the last wait were read, their buffers are given back before entering the kernel
+    if(ring->used_count > 0)
+    {
+        for(unsigned int i = 0; i < ring->used_count; ++i)
+            uring_give_buffer(ring, ring->used_buffers[i]);
+        uring_publish_buffers(ring);
+        ring->used_count = 0;
+    }
+
+    unsigned int head = *ring->cq_head;
+    if(__atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) == head)
+    {
+        if(uring_enter(engine, 1, timeout_ms) == -1)
+        {
+            RET_IF(errno == ETIME || errno == EINTR, 0);
+            return -1;
+        }
+    }
+    else if(ring->sq_local_tail != *ring->sq_tail)
+    {
+        RET_IF(uring_enter(engine, 0, -1) == -1, -1);
+    }
+
+    int count = 0;
+    unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    // a completion can turn into two events, the last bytes of a stream and its end
+    while(head != tail && count + 1 < max)
+    {
+        struct io_uring_cqe* cqe = &ring->cqes[head & ring->cq_mask];
+        io_op_t op = IO_USER_DATA_OP(cqe->user_data);
+        int fd = IO_USER_DATA_FD(cqe->user_data);
+        int res = cqe->res;
+        bool_t more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+        head += 1;
+
+        switch(op)
+        {
+            case IO_OP_LISTEN:
+                if(!more && res != -ECANCELED)
+                    uring_listen(engine, fd);
+                if(res > 0)
+                    events[count++] = (io_event_t){ IO_EV_READABLE, fd, res };
+                break;
+
+            case IO_OP_ACCEPT:
+                // kernels older than 5.19 reject the multishot accept, one request for each connection then
+                if(res == -EINVAL && ring->multishot_accept)
+                {
+                    ring->multishot_accept = FALSE;
+                    uring_accept(engine, fd);
+                    break;
+                }
+                if(!more && res != -ECANCELED && res != -EINVAL)
+                    uring_accept(engine, fd);
+                events[count++] = (io_event_t){ IO_EV_ACCEPTED, fd, res };
+                break;
+
+            case IO_OP_RECEIVE:
+                if(res == -EAGAIN || res == -EINTR)
+                {
+                    uring_receive(engine, fd);
+                    break;
+                }
+                events[count++] = (io_event_t){ IO_EV_RECEIVED, fd, res };
+                break;
+
+            case IO_OP_POLL:
+                if(res != -ECANCELED)
+                    events[count++] = (io_event_t){ IO_EV_READABLE, fd, res };
+                break;
+
+            case IO_OP_STREAM:
+            {
+                if(res > 0)
+                {
+                    unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                    ring->used_buffers[ring->used_count++] = bid;
+                    engine->metrics.received += res;
+                    events[count++] = (io_event_t){ IO_EV_DATA, fd, res, ring->buffers + (size_t)bid * URING_BUFFER_SIZE };
+                }
+                if(more)
+                    break;
+
+                // the kernel ends a stream once the ring has no buffers left, they're given back by the next wait
+                bool_t cancelled = (size_t)fd < ring->cancelled_size && ring->cancelled[fd];
+                bool_t interrupted = res > 0 || res == -ENOBUFS || res == -EAGAIN || res == -EINTR;
+                if(interrupted && !cancelled)
+                {
+                    uring_stream(engine, fd);
+                    break;
+                }
+                if(cancelled)
+                    ring->cancelled[fd] = FALSE;
+                events[count++] = (io_event_t){ IO_EV_DATA, fd, interrupted ? -ECANCELED : MIN(res, 0), NULL };
+                break;
+            }
+
+            case IO_OP_CANCEL:
+                // the stream ends by itself, even if it already ended
+                break;
+        }
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+static int epoll_watch(io_engine_t* engine, io_op_t op, int fd, uint32_t events)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(struct epoll_event));
+    event.events = events;
+    event.data.u64 = IO_USER_DATA(op, fd);
+
+    engine->metrics.syscalls += 1;
+    int res = epoll_ctl(engine->fd, EPOLL_CTL_MOD, fd, &event);
+    if(res == -1 && errno == ENOENT)
+    {
+        engine->metrics.syscalls += 1;
+        res = epoll_ctl(engine->fd, EPOLL_CTL_ADD, fd, &event);
+    }
+    return res;
+}
+
+// The readiness of the descriptors is turned into events by doing their operation here
+static int epoll_wait_events(io_engine_t* engine, io_event_t* events, int max, long timeout_ms)
+{
+    struct epoll_event ready[EPOLL_EVENTS];
+    engine->metrics.syscalls += 1;
+    int res = epoll_wait(engine->fd, ready, max < EPOLL_EVENTS ? max : EPOLL_EVENTS, timeout_ms);
+    if(res == -1)
+        return errno == EINTR ? 0 : -1;
+
+    int count = 0;
+    for(int i = 0; i < res; ++i)
+    {
+        int fd = IO_USER_DATA_FD(ready[i].data.u64);
+        switch(IO_USER_DATA_OP(ready[i].data.u64))
+        {
+            case IO_OP_LISTEN:
+            case IO_OP_POLL:
+                events[count++] = (io_event_t){ IO_EV_READABLE, fd, 1 };
+                break;
+
+            case IO_OP_ACCEPT:
+            {
+                engine->metrics.syscalls += 1;
+                int client = accept4(fd, NULL, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if(client == -1 && (errno == EAGAIN || errno == EINTR))
+                    break;
+                events[count++] = (io_event_t){ IO_EV_ACCEPTED, fd, client == -1 ? -errno : client };
+                break;
+            }
+
+            case IO_OP_RECEIVE:
+            {
+                engine->metrics.syscalls += 1;
+                ssize_t r = read(fd, &engine->scratch, 1);
+                if(r == -1 && (errno == EAGAIN || errno == EINTR))
+                {
+                    epoll_watch(engine, IO_OP_RECEIVE, fd, EPOLLIN | EPOLLONESHOT);
+                    break;
+                }
+                events[count++] = (io_event_t){ IO_EV_RECEIVED, fd, r == -1 ? -errno : (int)r };
+                break;
+            }
+
+            case IO_OP_STREAM:
+            case IO_OP_CANCEL:
+                // the streams are only received by io_uring
+                break;
+        }
+    }
+    return count;
+}
+
+io_engine_t* create_io_engine(io_engine_type_t type)
+{
+    io_engine_t* engine = malloc(sizeof(io_engine_t));
+    RET_IF(!engine, NULL);
+    memset(engine, 0, sizeof(io_engine_t));
+    engine->type = type;
+
+    if(type == IO_ENGINE_EPOLL)
+    {
+        engine->fd = epoll_create1(EPOLL_CLOEXEC);
+        if(engine->fd == -1)
+        {
+            free(engine);
+            return NULL;
+        }
+        return engine;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(struct io_uring_params));
+    engine->fd = sys_io_uring_setup(URING_ENTRIES, &params);
+    if(engine->fd == -1)
+    {
+        free(engine);
+        return NULL;
+    }
+    engine->ring.multishot_accept = TRUE;
+    engine->ring.buf_ring = NULL;
+    engine->ring.sq_ring = MAP_FAILED;
+    engine->ring.cq_ring = MAP_FAILED;
+    engine->ring.sqes = MAP_FAILED;
+
+    // the waits with a timeout need the extended arguments of io_uring_enter (5.11)
+    if(!(params.features & IORING_FEAT_EXT_ARG))
+    {
+        free_io_engine(engine);
+        errno = ENOSYS;
+        return NULL;
+    }
+    if(uring_map(engine, &params) == -1)
+    {
+        int error = errno;
+        free_io_engine(engine);
+        errno = error;
+        return NULL;
+    }
+    // without the streams the clients are polled and only the first byte of each request goes through the ring
+    if(uring_register_buffers(engine) == 0 && !uring_probe_stream(engine))
+    {
+        munmap(engine->ring.buffers, (size_t)URING_BUFFERS * URING_BUFFER_SIZE);
+        munmap(engine->ring.buf_ring, engine->ring.buf_ring_size);
+        engine->ring.buffers = NULL;
+        engine->ring.buf_ring = NULL;
+    }
+
+    return engine;
+}
+
+io_engine_type_t io_engine_get_type(io_engine_t* engine)
+{
+    return engine->type;
+}
+
+int io_engine_listen(io_engine_t* engine, int fd)
+{
+    if(engine->type == IO_ENGINE_URING)
+        return uring_listen(engine, fd);
+    return epoll_watch(engine, IO_OP_LISTEN, fd, EPOLLIN);
+}
+
+int io_engine_accept(io_engine_t* engine, int server_fd)
+{
+    if(engine->type == IO_ENGINE_URING)
+        return uring_accept(engine, server_fd);
+    return epoll_watch(engine, IO_OP_ACCEPT, server_fd, EPOLLIN);
+}
+
+int io_engine_receive(io_engine_t* engine, int client)
+{
+    if(engine->type == IO_ENGINE_URING)
+        return uring_receive(engine, client);
+    return epoll_watch(engine, IO_OP_RECEIVE, client, EPOLLIN | EPOLLONESHOT);
+}
+
+bool_t io_engine_can_stream(io_engine_t* engine)
+{
+    return engine->type == IO_ENGINE_URING && engine->ring.buf_ring != NULL;
+}
+
+int io_engine_stream(io_engine_t* engine, int client)
+{
+    if(!io_engine_can_stream(engine))
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+    return uring_stream(engine, client);
+}
+
+int io_engine_cancel(io_engine_t* engine, int client)
+{
+    if(!io_engine_can_stream(engine))
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+    return uring_cancel(engine, client);
+}
+
+int io_engine_poll(io_engine_t* engine, int fd)
+{
+    if(engine->type == IO_ENGINE_URING)
+        return uring_poll(engine, fd);
+    return epoll_watch(engine, IO_OP_POLL, fd, EPOLLIN | EPOLLONESHOT);
+}
+
+int io_engine_wait(io_engine_t* engine, io_event_t* events, int max, long timeout_ms)
+{
+    int count = engine->type == IO_ENGINE_URING ? uring_wait(engine, events, max, timeout_ms)
+                                                : epoll_wait_events(engine, events, max, timeout_ms);
+    if(count > 0)
+        engine->metrics.operations += count;
+    return count;
+}
+
+io_engine_metrics_t io_engine_get_metrics(io_engine_t* engine)
+{
+    if(!engine)
+    {
+        io_engine_metrics_t empty = { 0 };
+        return empty;
+    }
+    return engine->metrics;
+}
+
+void free_io_engine(io_engine_t* engine)
+{
+    NRET_IF(!engine);
+
+    if(engine->type == IO_ENGINE_URING)
+    {
+        uring_t* ring = &engine->ring;
+        if(ring->sqes != MAP_FAILED)
+            munmap(ring->sqes, ring->sqes_size);
+        if(ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        if(ring->sq_ring != MAP_FAILED)
+            munmap(ring->sq_ring, ring->sq_ring_size);
+        if(ring->buf_ring)
+        {
+            munmap(ring->buffers, (size_t)URING_BUFFERS * URING_BUFFER_SIZE);
+            munmap(ring->buf_ring, ring->buf_ring_size);
+        }
+        free(ring->cancelled);
+    }
+    close(engine->fd);
+    free(engine);
+}
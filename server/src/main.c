@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "server.h"
+#include "supervisor.h"
 
 int main(int argc, char* argv[])
 {
@@ -18,6 +19,14 @@ int main(int argc, char* argv[])
     printf("Server config loaded succesfully!\n");
     print_config_params(config);
 
+    // each shard process runs a whole server of its own
+    if(config_get_shard_processes(config) > 1)
+    {
+        int res = run_shard_supervisor(config);
+        free_config(config);
+        return res == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     // Init the server
     int status = init_server(config);
     if(status != SERVER_OK)
@@ -0,0 +1,724 @@
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "outbound.h"
+#include "linked_list.h"
+#include "page_alloc.h"
+#include "server_api_utils.h"
+
+// Capacity of the buffers the small writes are copied into, bigger writes get their own buffer
+#define OUTBOUND_CHUNK_SIZE 4096
+// Once a client has this many bytes waiting they are written at once instead of waiting for the flush
+#define OUTBOUND_FLUSH_SIZE (64 * 1024)
+// Buffers written by a single sendmsg
+#define OUTBOUND_IOV_MAX 64
+// A client waiting for its output to be read can take more once it has less than this many bytes waiting
+#define OUTBOUND_WRITABLE_SIZE (4 * OUTBOUND_FLUSH_SIZE)
+// Clients flushed for each wait on the descriptor of the buffers
+#define OUTBOUND_EVENTS 64
+// Bytes written before the data of a pushed file: op, length of the pathname, pathname and size of the data
+#define PUSH_HEADER_SIZE(pathname_len) (sizeof(server_packet_op_t) + sizeof(size_t) + (pathname_len) + sizeof(size_t))
+
+typedef struct outbound_msg {
+    char* data;
+    size_t size;
+    // bytes allocated for data, the small writes are copied after size while they fit
+    size_t capacity;
+    // data of a pushed file, counted against the limit of the pushed files
+    bool_t is_push;
+    // content of a file written from its segments instead of data, no copy is made
+    sl_view_t* view;
+} outbound_msg_t;
+
+typedef struct outbound_entry {
+    linked_list_t* msgs;
+    // bytes waiting to be written
+    size_t buffered;
+    // bytes of the pushed files among them
+    size_t pushed;
+    // bytes of the contents written from their segments among them, not counted against the limit of the buffer
+    size_t streamed;
+    // bytes of the first message already written
+    size_t offset;
+    // the socket is inside the epoll instance of the buffers, waiting to be writable
+    bool_t armed;
+    // the client was disconnected, its writes are discarded until it's dropped
+    bool_t broken;
+    // the request of the client waits for the output to be read before writing more
+    bool_t wants_writable;
+    // last time some output was written or started waiting
+    time_t last_progress;
+    // replies being written, the notices are kept aside until they end so that they don't split them
+    size_t replying;
+    char* notices;
+    size_t notices_size;
+    size_t notices_capacity;
+    pthread_mutex_t mutex;
+} outbound_entry_t;
+
+struct outbound {
+    size_t max_buffer_bytes;
+    size_t max_push_bytes;
+    // called once a client waiting for its output to be read can take more
+    void (*on_writable)(int client);
+    // epoll instance of the sockets with some output waiting
+    int epfd;
+    // clients inside epfd, changed atomically
+    size_t waiting;
+    // one entry for each descriptor, created the first time it's used
+    outbound_entry_t** entries;
+    size_t entries_count;
+    outbound_metrics_t metrics;
+
+    // protects the table of the entries and the metrics
+    pthread_mutex_t mutex;
+};
+
+static time_t now_seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+static void free_msg(void* ptr)
+{
+    outbound_msg_t* msg = ptr;
+    if(msg->view)
+        free_sl_view(msg->view);
+    else
+        content_free(msg->data);
+    free(msg);
+}
+
+static outbound_entry_t* get_entry(outbound_t* out, int client, bool_t create)
+{
+    RET_IF(!out || client < 0, NULL);
+
+    LOCK_MUTEX(&out->mutex);
+    if((size_t)client >= out->entries_count)
+    {
+        if(!create)
+        {
+            UNLOCK_MUTEX(&out->mutex);
+            return NULL;
+        }
+
+        size_t count = MAX(out->entries_count * 2, (size_t)client + 1);
+        CHECK_FATAL_EQ(out->entries, realloc(out->entries, count * sizeof(outbound_entry_t*)), NULL, NO_MEM_FATAL);
+        memset(out->entries + out->entries_count, 0, (count - out->entries_count) * sizeof(outbound_entry_t*));
+        out->entries_count = count;
+    }
+
+    outbound_entry_t* entry = out->entries[client];
+    if(!entry && create)
+    {
+        CHECK_FATAL_EQ(entry, malloc(sizeof(outbound_entry_t)), NULL, NO_MEM_FATAL);
+        memset(entry, 0, sizeof(outbound_entry_t));
+        entry->msgs = ll_create();
+        INIT_MUTEX(&entry->mutex);
+        out->entries[client] = entry;
+    }
+    UNLOCK_MUTEX(&out->mutex);
+
+    return entry;
+}
+
+// Wait for the socket of client to be writable, must be called with the mutex of entry acquired like the functions below
+static void arm_entry(outbound_t* out, outbound_entry_t* entry, int client)
+{
+    NRET_IF(entry->armed);
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(struct epoll_event));
+    event.events = EPOLLOUT;
+    event.data.fd = client;
+    NRET_IF(epoll_ctl(out->epfd, EPOLL_CTL_ADD, client, &event) == -1);
+
+    entry->armed = TRUE;
+    entry->last_progress = now_seconds();
+    __atomic_add_fetch(&out->waiting, 1, __ATOMIC_RELAXED);
+}
+
+static void disarm_entry(outbound_t* out, outbound_entry_t* entry, int client)
+{
+    NRET_IF(!entry->armed);
+
+    epoll_ctl(out->epfd, EPOLL_CTL_DEL, client, NULL);
+    entry->armed = FALSE;
+    __atomic_sub_fetch(&out->waiting, 1, __ATOMIC_RELAXED);
+}
+
+static void drop_entry(outbound_t* out, outbound_entry_t* entry, int client)
+{
+    ll_empty(entry->msgs, free_msg);
+    entry->notices_size = 0;
+    entry->buffered = 0;
+    entry->pushed = 0;
+    entry->streamed = 0;
+    entry->offset = 0;
+    disarm_entry(out, entry, client);
+}
+
+// Returns TRUE if client was connected until now
+static bool_t shutdown_entry(outbound_t* out, outbound_entry_t* entry, int client)
+{
+    RET_IF(entry->broken, FALSE);
+
+    drop_entry(out, entry, client);
+    entry->broken = TRUE;
+    shutdown(client, SHUT_RDWR);
+    return TRUE;
+}
+
+// Get a buffer at the end of the output of client where size bytes can be copied
+static char* append_space(outbound_entry_t* entry, size_t size)
+{
+    outbound_msg_t* msg = ll_get_last(entry->msgs);
+    if(msg && !msg->is_push && !msg->view && msg->capacity - msg->size >= size)
+    {
+        char* space = msg->data + msg->size;
+        msg->size += size;
+        entry->buffered += size;
+        return space;
+    }
+
+    CHECK_FATAL_EQ(msg, malloc(sizeof(outbound_msg_t)), NULL, NO_MEM_FATAL);
+    msg->capacity = MAX(size, OUTBOUND_CHUNK_SIZE);
+    if(msg->capacity == OUTBOUND_CHUNK_SIZE)
+    {
+        CHECK_FATAL_EQ(msg->data, malloc(OUTBOUND_CHUNK_SIZE), NULL, NO_MEM_FATAL);
+    }
+    else
+    {
+        msg->data = content_alloc(msg->capacity);
+    }
+    msg->size = size;
+    msg->is_push = FALSE;
+    msg->view = NULL;
+    ll_add_tail(entry->msgs, msg);
+    entry->buffered += size;
+
+    return msg->data;
+}
+
+// Write as much output of client as its socket takes
+// Returns 1 if some output is still waiting, 0 if the buffer is empty, -1 if the client was disconnected
+static int flush_entry(outbound_t* out, outbound_entry_t* entry, int client)
+{
+    RET_IF(entry->broken, -1);
+
+    while(ll_count(entry->msgs) > 0)
+    {
+        struct iovec iov[OUTBOUND_IOV_MAX];
+        int iovcnt = 0;
+        size_t skip = entry->offset;
+        for(node_t* node = ll_get_head_node(entry->msgs); node && iovcnt < OUTBOUND_IOV_MAX; node = node_get_next(node))
+        {
+            outbound_msg_t* msg = node_get_value(node);
+            if(!msg->view)
+            {
+                iov[iovcnt].iov_base = msg->data + skip;
+                iov[iovcnt++].iov_len = msg->size - skip;
+                skip = 0;
+                continue;
+            }
+
+            int filled = sl_view_get_iov(msg->view, skip, iov + iovcnt, OUTBOUND_IOV_MAX - iovcnt);
+            size_t covered = 0;
+            for(int i = iovcnt; i < iovcnt + filled; ++i)
+                covered += iov[i].iov_len;
+            iovcnt += filled;
+            // the rest of the view comes with the next sendmsg, the messages after it must wait for it
+            if(covered < msg->size - skip)
+                break;
+            skip = 0;
+        }
+
+        struct msghdr hdr;
+        memset(&hdr, 0, sizeof(struct msghdr));
+        hdr.msg_iov = iov;
+        hdr.msg_iovlen = iovcnt;
+        ssize_t r = sendmsg(client, &hdr, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if(r == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            shutdown_entry(out, entry, client);
+            return -1;
+        }
+
+        entry->last_progress = now_seconds();
+        while(r > 0)
+        {
+            outbound_msg_t* msg = ll_get_first(entry->msgs);
+            size_t left = msg->size - entry->offset;
+            if((size_t)r < left)
+            {
+                entry->offset += r;
+                break;
+            }
+
+            r -= left;
+            ll_remove_first(entry->msgs, NULL);
+            entry->buffered -= msg->size;
+            if(msg->is_push)
+                entry->pushed -= msg->size;
+            if(msg->view)
+                entry->streamed -= msg->size;
+            entry->offset = 0;
+            free_msg(msg);
+        }
+    }
+
+    if(ll_count(entry->msgs) > 0)
+    {
+        arm_entry(out, entry, client);
+        return 1;
+    }
+
+    disarm_entry(out, entry, client);
+    return 0;
+}
+
+// Check whether the client of entry waited for its output to be read and can now take more, or was disconnected
+// meanwhile. The wait is over, on_writable is called once the mutex of entry is released
+static bool_t is_writable_again(outbound_entry_t* entry)
+{
+    RET_IF(!entry->wants_writable || (!entry->broken && entry->buffered >= OUTBOUND_WRITABLE_SIZE), FALSE);
+    entry->wants_writable = FALSE;
+    return TRUE;
+}
+
+static void update_max_retained(outbound_t* out, size_t retained)
+{
+    LOCK_MUTEX(&out->mutex);
+    out->metrics.max_retained = MAX(out->metrics.max_retained, retained);
+    UNLOCK_MUTEX(&out->mutex);
+}
+
+outbound_t* create_outbound(size_t max_buffer_bytes, size_t max_push_bytes, void (*on_writable)(int client))
+{
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    RET_IF(epfd == -1, NULL);
+
+    outbound_t* out;
+    CHECK_FATAL_EQ(out, malloc(sizeof(outbound_t)), NULL, NO_MEM_FATAL);
+    memset(out, 0, sizeof(outbound_t));
+    out->max_buffer_bytes = max_buffer_bytes;
+    out->max_push_bytes = max_push_bytes;
+    out->on_writable = on_writable;
+    out->epfd = epfd;
+    INIT_MUTEX(&out->mutex);
+
+    return out;
+}
+
+int outbound_get_fd(outbound_t* out)
+{
+    RET_IF(!out, -1);
+    return out->epfd;
+}
+
+// Queue a reply for client, size bytes of buf or if view is given the bytes read by it, these buffers become its owner
+// The replies are asked by the client, so they're never limited
+static int queue_reply(outbound_t* out, int client, const void* buf, sl_view_t* view, size_t size)
+{
+    outbound_entry_t* entry = get_entry(out, client, TRUE);
+    if(!entry)
+    {
+        free_sl_view(view);
+        return -1;
+    }
+
+    int res = 1;
+    if(view)
+        size = sl_view_get_size(view);
+    LOCK_MUTEX(&entry->mutex);
+    if(entry->broken)
+    {
+        res = -1;
+    }
+    else if(size > 0)
+    {
+        if(view)
+        {
+            outbound_msg_t* msg;
+            CHECK_FATAL_EQ(msg, malloc(sizeof(outbound_msg_t)), NULL, NO_MEM_FATAL);
+            msg->view = view;
+            view = NULL;
+            msg->data = NULL;
+            msg->size = size;
+            msg->capacity = size;
+            msg->is_push = FALSE;
+            ll_add_tail(entry->msgs, msg);
+            entry->buffered += msg->size;
+            entry->streamed += msg->size;
+        }
+        else
+        {
+            memcpy(append_space(entry, size), buf, size);
+        }
+        if(entry->buffered >= OUTBOUND_FLUSH_SIZE)
+            res = flush_entry(out, entry, client) == -1 ? -1 : 1;
+    }
+    size_t retained = entry->buffered;
+    bool_t writable = is_writable_again(entry);
+    UNLOCK_MUTEX(&entry->mutex);
+
+    // not queued, the client is gone or there was nothing to read
+    free_sl_view(view);
+    update_max_retained(out, retained);
+    if(writable)
+        out->on_writable(client);
+
+    return res;
+}
+
+int outbound_write(outbound_t* out, int client, const void* buf, size_t size)
+{
+    return queue_reply(out, client, buf, NULL, size);
+}
+
+int outbound_notify(outbound_t* out, int client, const void* buf, size_t size)
+{
+    outbound_entry_t* entry = get_entry(out, client, TRUE);
+    RET_IF(!entry, -1);
+
+    int res = 1;
+    bool_t disconnected = FALSE;
+    LOCK_MUTEX(&entry->mutex);
+    if(entry->broken)
+    {
+        res = -1;
+    }
+    else if(entry->buffered - entry->streamed + entry->notices_size + size > out->max_buffer_bytes)
+    {
+        disconnected = shutdown_entry(out, entry, client);
+        res = -1;
+    }
+    else if(entry->replying > 0)
+    {
+        if(entry->notices_size + size > entry->notices_capacity)
+        {
+            entry->notices_capacity = MAX(entry->notices_size + size, entry->notices_capacity * 2);
+            CHECK_FATAL_EQ(entry->notices, realloc(entry->notices, entry->notices_capacity), NULL, NO_MEM_FATAL);
+        }
+        memcpy(entry->notices + entry->notices_size, buf, size);
+        entry->notices_size += size;
+    }
+    else
+    {
+        // the client is idle, it gets the notice at once
+        memcpy(append_space(entry, size), buf, size);
+        res = flush_entry(out, entry, client) == -1 ? -1 : 1;
+    }
+    size_t retained = entry->buffered;
+    bool_t writable = is_writable_again(entry);
+    UNLOCK_MUTEX(&entry->mutex);
+
+    update_max_retained(out, retained);
+    if(disconnected)
+    {
+        EXEC_WITH_MUTEX(++out->metrics.disconnected, &out->mutex);
+    }
+    if(writable)
+        out->on_writable(client);
+
+    return res;
+}
+
+void outbound_begin_reply(outbound_t* out, int client)
+{
+    outbound_entry_t* entry = get_entry(out, client, TRUE);
+    NRET_IF(!entry);
+
+    EXEC_WITH_MUTEX(++entry->replying, &entry->mutex);
+}
+
+void outbound_end_reply(outbound_t* out, int client)
+{
+    outbound_entry_t* entry = get_entry(out, client, FALSE);
+    NRET_IF(!entry);
+
+    LOCK_MUTEX(&entry->mutex);
+    if(entry->replying > 0)
+        --entry->replying;
+    // written together with the end of the replies, the client gets them before its next request
+    if(entry->replying == 0 && entry->notices_size > 0)
+    {
+        if(!entry->broken)
+        {
+            memcpy(append_space(entry, entry->notices_size), entry->notices, entry->notices_size);
+            flush_entry(out, entry, client);
+        }
+        entry->notices_size = 0;
+    }
+    bool_t writable = is_writable_again(entry);
+    UNLOCK_MUTEX(&entry->mutex);
+
+    if(writable)
+        out->on_writable(client);
+}
+
+int outbound_write_string(outbound_t* out, int client, const char* str, size_t len)
+{
+    RET_IF(outbound_write(out, client, &len, sizeof(size_t)) == -1, -1);
+    return outbound_write(out, client, str, len);
+}
+
+int outbound_write_sl(outbound_t* out, int client, const segment_list_t* content)
+{
+    return outbound_write_sl_range(out, client, content, 0, sl_get_size(content));
+}
+
+int outbound_write_sl_range(outbound_t* out, int client, const segment_list_t* content, size_t offset, size_t size)
+{
+    sl_view_t* view = sl_view_create(content, offset, size);
+    RET_IF(!view, -1);
+    return queue_reply(out, client, NULL, view, 0);
+}
+
+int outbound_write_view(outbound_t* out, int client, sl_view_t* view)
+{
+    RET_IF(!view, -1);
+    return queue_reply(out, client, NULL, view, 0);
+}
+
+// Queue the file pathname with size bytes of data, these buffers become the owner of data
+static void push_entry(outbound_entry_t* entry, const char* pathname, void* data, size_t size)
+{
+    size_t len = strnlen(pathname, MAX_PATHNAME_API_LENGTH);
+    server_packet_op_t op = OP_PUSH_FILE;
+    char* p = append_space(entry, PUSH_HEADER_SIZE(len));
+    memcpy(p, &op, sizeof(server_packet_op_t));
+    p += sizeof(server_packet_op_t);
+    memcpy(p, &len, sizeof(size_t));
+    p += sizeof(size_t);
+    memcpy(p, pathname, len);
+    p += len;
+    memcpy(p, &size, sizeof(size_t));
+
+    if(size == 0)
+    {
+        content_free(data);
+        return;
+    }
+
+    outbound_msg_t* msg;
+    CHECK_FATAL_EQ(msg, malloc(sizeof(outbound_msg_t)), NULL, NO_MEM_FATAL);
+    msg->data = data;
+    msg->size = size;
+    msg->capacity = size;
+    msg->is_push = TRUE;
+    msg->view = NULL;
+    ll_add_tail(entry->msgs, msg);
+    entry->buffered += size;
+    entry->pushed += size;
+}
+
+size_t outbound_push_files(outbound_t* out, int client, outbound_file_t* files, size_t count)
+{
+    outbound_entry_t* entry = get_entry(out, client, TRUE);
+    size_t pushed = 0;
+    size_t pushed_bytes = 0;
+    size_t retained = 0;
+    if(entry)
+    {
+        LOCK_MUTEX(&entry->mutex);
+        // the files are taken in order while they fit, the count written first must match the files following it
+        size_t buffered = entry->buffered - entry->streamed + sizeof(size_t);
+        size_t push_bytes = entry->pushed;
+        for(size_t i = 0; i < count && !entry->broken; ++i)
+        {
+            size_t size = files[i].size;
+            size_t needed = PUSH_HEADER_SIZE(strnlen(files[i].pathname, MAX_PATHNAME_API_LENGTH)) + size;
+            if(push_bytes + size > out->max_push_bytes || buffered + needed > out->max_buffer_bytes)
+                break;
+
+            buffered += needed;
+            push_bytes += size;
+            ++pushed;
+        }
+
+        if(!entry->broken)
+        {
+            memcpy(append_space(entry, sizeof(size_t)), &pushed, sizeof(size_t));
+            for(size_t i = 0; i < pushed; ++i)
+            {
+                push_entry(entry, files[i].pathname, files[i].data, files[i].size);
+                pushed_bytes += files[i].size;
+            }
+        }
+        else
+        {
+            pushed = 0;
+        }
+        retained = entry->buffered;
+        UNLOCK_MUTEX(&entry->mutex);
+    }
+
+    for(size_t i = pushed; i < count; ++i)
+        content_free(files[i].data);
+
+    LOCK_MUTEX(&out->mutex);
+    out->metrics.pushed += pushed;
+    out->metrics.pushed_bytes += pushed_bytes;
+    out->metrics.dropped += count - pushed;
+    out->metrics.max_retained = MAX(out->metrics.max_retained, retained);
+    UNLOCK_MUTEX(&out->mutex);
+
+    return pushed;
+}
+
+int outbound_flush(outbound_t* out, int client)
+{
+    outbound_entry_t* entry = get_entry(out, client, FALSE);
+    RET_IF(!entry, 0);
+
+    LOCK_MUTEX(&entry->mutex);
+    int res = flush_entry(out, entry, client);
+    bool_t writable = is_writable_again(entry);
+    UNLOCK_MUTEX(&entry->mutex);
+
+    if(writable)
+        out->on_writable(client);
+    return res;
+}
+
+int outbound_wait_writable(outbound_t* out, int client)
+{
+    outbound_entry_t* entry = get_entry(out, client, FALSE);
+    RET_IF(!entry, 0);
+
+    int res = 0;
+    LOCK_MUTEX(&entry->mutex);
+    if(flush_entry(out, entry, client) == 1 && entry->buffered >= OUTBOUND_WRITABLE_SIZE)
+    {
+        entry->wants_writable = TRUE;
+        res = 1;
+    }
+    UNLOCK_MUTEX(&entry->mutex);
+
+    return res;
+}
+
+void outbound_flush_ready(outbound_t* out)
+{
+    NRET_IF(!out);
+
+    // until every socket ready was flushed, the descriptor may not become readable again for the ones left
+    struct epoll_event events[OUTBOUND_EVENTS];
+    int n;
+    do
+    {
+        n = epoll_wait(out->epfd, events, OUTBOUND_EVENTS, 0);
+        for(int i = 0; i < n; ++i)
+            outbound_flush(out, events[i].data.fd);
+    } while(n == OUTBOUND_EVENTS);
+}
+
+size_t outbound_count_waiting(outbound_t* out)
+{
+    RET_IF(!out, 0);
+    return __atomic_load_n(&out->waiting, __ATOMIC_RELAXED);
+}
+
+void outbound_expire(outbound_t* out, unsigned int timeout_s)
+{
+    NRET_IF(!out || timeout_s == 0 || outbound_count_waiting(out) == 0);
+
+    time_t now = now_seconds();
+    size_t count;
+    GET_VAR_MUTEX(out->entries_count, count, &out->mutex);
+    for(size_t i = 0; i < count; ++i)
+    {
+        outbound_entry_t* entry = get_entry(out, i, FALSE);
+        if(!entry)
+            continue;
+
+        bool_t disconnected = FALSE;
+        LOCK_MUTEX(&entry->mutex);
+        if(entry->armed && now - entry->last_progress >= timeout_s)
+            disconnected = shutdown_entry(out, entry, i);
+        bool_t writable = is_writable_again(entry);
+        UNLOCK_MUTEX(&entry->mutex);
+
+        if(disconnected)
+        {
+            EXEC_WITH_MUTEX(++out->metrics.disconnected, &out->mutex);
+        }
+        if(writable)
+            out->on_writable(i);
+    }
+}
+
+void outbound_shutdown(outbound_t* out, int client)
+{
+    outbound_entry_t* entry = get_entry(out, client, TRUE);
+    NRET_IF(!entry);
+
+    LOCK_MUTEX(&entry->mutex);
+    bool_t disconnected = shutdown_entry(out, entry, client);
+    bool_t writable = is_writable_again(entry);
+    UNLOCK_MUTEX(&entry->mutex);
+
+    if(disconnected)
+    {
+        EXEC_WITH_MUTEX(++out->metrics.disconnected, &out->mutex);
+    }
+    if(writable)
+        out->on_writable(client);
+}
+
+void outbound_drop(outbound_t* out, int client)
+{
+    outbound_entry_t* entry = get_entry(out, client, FALSE);
+    NRET_IF(!entry);
+
+    LOCK_MUTEX(&entry->mutex);
+    drop_entry(out, entry, client);
+    entry->broken = FALSE;
+    entry->wants_writable = FALSE;
+    entry->replying = 0;
+    UNLOCK_MUTEX(&entry->mutex);
+}
+
+outbound_metrics_t outbound_get_metrics(outbound_t* out)
+{
+    outbound_metrics_t metrics;
+    memset(&metrics, 0, sizeof(outbound_metrics_t));
+    RET_IF(!out, metrics);
+
+    EXEC_WITH_MUTEX(metrics = out->metrics, &out->mutex);
+    return metrics;
+}
+
+void free_outbound(outbound_t* out)
+{
+    NRET_IF(!out);
+
+    for(size_t i = 0; i < out->entries_count; ++i)
+    {
+        outbound_entry_t* entry = out->entries[i];
+        if(!entry)
+            continue;
+
+        ll_free(entry->msgs, free_msg);
+        free(entry->notices);
+        pthread_mutex_destroy(&entry->mutex);
+        free(entry);
+    }
+
+    close(out->epfd);
+    free(out->entries);
+    pthread_mutex_destroy(&out->mutex);
+    free(out);
+}
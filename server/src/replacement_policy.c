@@ -6,59 +6,69 @@
 bool_t run_replacement_algorithm(const char* skip_file, size_t mem_needed, linked_list_t** output)
 {
     file_system_t* fs = get_fs();
-    linked_list_t* freed = ll_create();
+    arena_t* arena = get_request_arena();
 
-    file_stored_t** all_files = get_files_stored(fs);
     size_t files_count = get_file_count_fs(fs);
+    file_stored_t** all_files = get_files_stored(fs, arena);
+    file_stored_t** victims = arena_alloc(arena, sizeof(file_stored_t*) * files_count);
     qsort(all_files, files_count, sizeof(file_stored_t*), fs_policy);
 
     size_t mem_freed = 0;
+    size_t victims_count = 0;
     int i = 0;
     // run simulation, to avoid deleting everything without even adding the actual file
     while(mem_freed < mem_needed && i < files_count)
     {
         file_stored_t* curr = all_files[i];
-        char* curr_pathname = file_get_pathname(curr);
-        if(strncmp(curr_pathname, skip_file, MAX_PATHNAME_API_LENGTH) == 0)
-        {
-            ++i;
+        ++i;
+        if(strncmp(file_get_pathname(curr), skip_file, MAX_PATHNAME_API_LENGTH) == 0)
+            continue;
+        // an empty file frees nothing, it's probably just been created and is about to be written
+        if(file_get_size(curr) == 0)
             continue;
-        }
-        
-        size_t curr_size = file_get_size(curr);
-        queue_t* locks_queue = file_get_locks_queue(curr);
-        void* data = file_get_data(curr);
-
-        replaced_file_t* entry = create_replfile();
-        replfile_set_pathname(entry, curr_pathname);
-        replfile_set_data(entry, data, curr_size);
-        replfile_set_locks_queue(entry, locks_queue);
 
-        ll_add_tail(freed, entry);
-        mem_freed += curr_size;
-        ++i;
+        victims[victims_count++] = curr;
+        // a shared content is freed only once every file holding it is a victim
+        content_entry_t* shared = file_get_shared_content(curr);
+        mem_freed += sl_get_memory_size(file_get_content(curr));
+        if(shared && content_entry_add_victim(shared) == content_entry_get_files(shared))
+            mem_freed += content_entry_get_size(shared);
     }
 
+    for(i = 0; i < victims_count; ++i)
+        content_entry_clear_victims(file_get_shared_content(victims[i]));
+
     if(mem_freed < mem_needed)
     {
         if(output)
             *output = NULL;
-        free(all_files);
-        ll_free(freed, free);
         return FALSE;
     }
 
-    node_t* removing_node = ll_get_head_node(freed);
-    while(removing_node)
+    linked_list_t* freed = ll_create();
+    for(i = 0; i < victims_count; ++i)
     {
-        replaced_file_t* entry = node_get_value(removing_node);
+        file_stored_t* curr = victims[i];
+
+        // the content and the lock queue are moved to the entry, the file is only partially freed
+        replaced_file_t* entry = create_replfile();
+        replfile_set_pathname(entry, file_get_pathname(curr));
+        replfile_set_content(entry, file_get_content(curr));
+        replfile_set_locks_queue(entry, file_get_locks_queue(curr));
+        ll_add_tail(freed, entry);
+
+        // the record of the write causing the replacement follows this one, both are synced together
+        wal_append(get_wal(), WAL_REMOVE, replfile_get_pathname(entry), NULL, 0);
+        // the content is demoted once the lock is released, until then the file is already found in the disk tier
+        if(output)
+            disk_tier_reserve(get_disk_tier(), replfile_get_pathname(entry));
         remove_file_fs(fs, replfile_get_pathname(entry), TRUE);
-        removing_node = node_get_next(removing_node);
     }
 
-    free(all_files);
     if(output)
         *output = freed;
+    else
+        ll_free(freed, FREE_FUNC(free_replfile));
     return TRUE;
 }
 
@@ -73,7 +83,10 @@ static int cmp_time(struct timespec* t1, struct timespec* t2)
 
 static int replacement_cmp_size(file_stored_t* f1, file_stored_t* f2)
 {
-    return file_get_size(f1) - file_get_size(f2);
+    // the sizes don't fit an int, their difference can't be returned
+    size_t s1 = file_get_size(f1);
+    size_t s2 = file_get_size(f2);
+    return (s1 > s2) - (s1 < s2);
 }
 
 int replacement_policy_fifo(const void* f1_ptr, const void* f2_ptr)
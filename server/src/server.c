@@ -1,17 +1,29 @@
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
 #include "server.h"
 #include "server_api_utils.h"
 #include "handle_client.h"
+#include "snapshot.h"
+#include "wal.h"
+#include "page_alloc.h"
+#include "numa.h"
+#include "io_engine.h"
+#include "mailbox.h"
 
 // Enum used to notify the connection handler for an upcoming event
 typedef enum {
     R_ADD_CLIENT,
+    R_POLL_CLIENT,
+    R_RECEIVE_CLIENT,
     R_CHECK_FLAG
 } notification_t;
 
@@ -35,12 +47,17 @@ static pthread_mutex_t clients_pending_mutex = PTHREAD_MUTEX_INITIALIZER;
 // Queue of clients to be handled by workers
 static queue_t* clients_pending = NULL;
 
-// Main fd_set used by the connection handler, listens to the socket, pipe and clients
-static fd_set clients_set_connected;
-// Max fd for clients_set_connected 
-static int clients_set_max_id = -1;
-// clients_set_connected associated mutex
-static pthread_mutex_t clients_set_connected_mutex = PTHREAD_MUTEX_INITIALIZER;
+// I/O engine of the connection handler, accepts the clients and listens to the pipe, output buffers and clients
+// A client is not listened to while a worker handles its request, even when its bytes are streamed into its input
+static io_engine_t* io_engine = NULL;
+// Backend asked for the engine, epoll is used if io_uring is not available
+static io_engine_type_t io_engine_type = IO_ENGINE_EPOLL;
+// Events read by each wait of the connection handler
+#define CONNECTION_EVENTS 64
+// Input buffers of the clients when the engine streams their bytes, NULL if the workers read the requests from the sockets
+static inbound_t* inbound = NULL;
+// Bytes of a client streamed and waiting for its requests to read them, over them it's not received until they're read
+#define INPUT_BUFFER_MAX_BYTES (4 * 1024 * 1024)
 
 // clients_count associated mutex
 static pthread_mutex_t clients_count_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -49,10 +66,64 @@ static unsigned int clients_count = 0;
 
 // Logger
 static logging_t* logging = NULL;
-// File system
+// File system shared by the workers, in shard mode only used to load the files of the last run then split among the shards
 static file_system_t* fs = NULL;
+// Shards of the files split by pathname, each one owned by the worker pinned to its own core. A single shard (fs) if disabled
+static file_system_t** shards = NULL;
+static size_t shards_count = 1;
+// Mailbox of the clients to be handled by the worker of each shard, NULL if the workers share clients_pending
+static mailbox_t** shard_mailboxes = NULL;
+// Server processes the files are split into and the index of this one, a single process owns every file
+static unsigned int shard_processes = 1;
+static unsigned int shard_process_index = 0;
+// Shard of the current worker, the other threads set it while working on a shard
+static __thread size_t thread_shard = 0;
+static __thread file_system_t* thread_fs = NULL;
 // Pipe connection used to notify the connection handler for any events
 static int pipe_connections_handler[2];
+// Snapshot loaded on startup, the contents of the files loaded live inside its mapping
+static snapshot_t* loaded_snapshot = NULL;
+// Write-ahead log of the changes, NULL if disabled
+static wal_t* wal = NULL;
+// Disk tier of the evicted files, NULL if disabled
+static disk_tier_t* disk_tier = NULL;
+// Are the contents of the files compressed
+static bool_t compression_enabled = FALSE;
+// Contents shared by the files written with the same bytes, one store for each shard so the files holding a content are
+// counted under the lock of their shard. NULL if disabled
+static content_store_t** content_stores = NULL;
+// Store of fs, in shard mode only used to load the files of the last run then split among the stores of the shards
+static content_store_t* content_store = NULL;
+// NUMA nodes the workers are pinned to, 0 if the contents are not placed on the nodes reading them
+static int numa_nodes = 0;
+// Are the big contents allocated on huge pages
+static bool_t huge_pages_enabled = FALSE;
+// Condition used to wake the snapshotter when the server is closing
+static pthread_cond_t snapshotter_cond = PTHREAD_COND_INITIALIZER;
+// snapshotter_cond associated mutex
+static pthread_mutex_t snapshotter_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Condition used to wake the reclaimer when the memory used goes over the high watermark or the server is closing
+static pthread_cond_t reclaimer_cond = PTHREAD_COND_INITIALIZER;
+// reclaimer_cond associated mutex, protects reclaim_requested too
+static pthread_mutex_t reclaimer_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Set by the writes waking the reclaimer, reset once it's awake
+static bool_t reclaim_requested = FALSE;
+// Are the files evicted in background
+static bool_t reclaimer_enabled = FALSE;
+// Files evicted by the reclaimer and times it evicted some, only touched by its thread
+static size_t reclaimer_evicted = 0;
+static size_t reclaimer_runs = 0;
+
+// Output buffers of the clients
+static outbound_t* outbound = NULL;
+// Default max bytes of the evicted files waiting to be pushed to each client
+#define DEFAULT_SEND_BACK_MAX_BYTES (64 * 1024 * 1024)
+// Default max bytes of the pushed files and notices waiting for each client, a client going over it is disconnected
+#define DEFAULT_OUTPUT_BUFFER_MAX_BYTES (256 * 1024 * 1024)
+// Default seconds a client can leave its output or a request half read before being disconnected
+#define DEFAULT_SLOW_CLIENT_TIMEOUT 30
+// Seconds a client can leave its output or a request half read before being disconnected
+static unsigned int slow_client_timeout = DEFAULT_SLOW_CLIENT_TIMEOUT;
 
 // Is server socket initialized
 static bool_t socket_initialized = FALSE;
@@ -62,11 +133,22 @@ static bool_t workers_initialized = FALSE;
 static bool_t signals_initialized = FALSE;
 // Is connection handler initialized
 static bool_t connections_handler_initialized = FALSE;
+// Is snapshotter initialized
+static bool_t snapshotter_initialized = FALSE;
+// Is reclaimer initialized
+static bool_t reclaimer_initialized = FALSE;
 
 // Array of pids of workers
 static pthread_t* thread_workers_ids;
 // pid of connection handler
 static pthread_t thread_connections_id;
+// pid of snapshotter
+static pthread_t thread_snapshotter_id;
+// pid of reclaimer
+static pthread_t thread_reclaimer_id;
+
+// Arena of each worker, reset after every request handled
+static __thread arena_t* request_arena = NULL;
 
 // Current workers count
 static unsigned int workers_count = 0;
@@ -120,7 +202,70 @@ quit_signal_t get_quit_signal()
 
 file_system_t* get_fs()
 {
-    return fs;
+    return thread_fs ? thread_fs : fs;
+}
+
+size_t get_shards_count()
+{
+    return shards_count;
+}
+
+file_system_t* get_shard_fs(size_t shard)
+{
+    return shard < shards_count ? shards[shard] : NULL;
+}
+
+size_t get_current_shard()
+{
+    return thread_shard;
+}
+
+size_t get_shard_of(const char* pathname)
+{
+    RET_IF(shards_count <= 1, 0);
+
+    // the remainder picked the shard process, the quotient spreads its files over all of its shards
+    return hash_pathname(pathname) / shard_processes % shards_count;
+}
+
+bool_t is_pathname_owned(const char* pathname)
+{
+    return shard_processes <= 1 || hash_pathname(pathname) % shard_processes == shard_process_index;
+}
+
+wal_t* get_wal()
+{
+    return wal;
+}
+
+disk_tier_t* get_disk_tier()
+{
+    return disk_tier;
+}
+
+bool_t is_compression_enabled()
+{
+    return compression_enabled;
+}
+
+content_store_t* get_content_store()
+{
+    return content_stores ? content_stores[thread_shard] : NULL;
+}
+
+outbound_t* get_outbound()
+{
+    return outbound;
+}
+
+inbound_t* get_inbound()
+{
+    return inbound;
+}
+
+bool_t is_numa_placement_enabled()
+{
+    return numa_nodes > 0;
 }
 
 logging_t* get_log()
@@ -128,6 +273,15 @@ logging_t* get_log()
     return logging;
 }
 
+arena_t* get_request_arena()
+{
+    // threads which are not workers get their arena on first use
+    if(!request_arena)
+        request_arena = create_arena(0);
+
+    return request_arena;
+}
+
 static void on_client_disconnected(int client, bool_t intentional, int* clients_count_ptr)
 {
     if(!clients_count_ptr)
@@ -139,9 +293,16 @@ static void on_client_disconnected(int client, bool_t intentional, int* clients_
         *clients_count_ptr = *clients_count_ptr - 1;
     }
 
-    acquire_write_lock_fs(fs);
-    notify_client_disconnected_fs(fs, client);
-    release_write_lock_fs(fs);
+    // only the files used by the client are touched, each one under its own lock, in shard mode they can be in any shard
+    for(size_t i = 0; i < shards_count; ++i)
+    {
+        acquire_read_lock_fs(shards[i]);
+        notify_client_disconnected_fs(shards[i], client);
+        release_read_lock_fs(shards[i]);
+    }
+    outbound_drop(outbound, client);
+    drop_request(client);
+    arena_reset(get_request_arena());
     
     if(intentional)
     {
@@ -150,116 +311,106 @@ static void on_client_disconnected(int client, bool_t intentional, int* clients_
     else
     {
         LOG_EVENT("OP_CLOSE_CONN client disconnected with id %d for an invalid operation", -1, client);
+    }
+    // closing the socket removes it from the epoll instances too, a socket whose bytes are streamed is closed once the stream ends
+    if(!inbound || inbound_close(inbound, client))
         close(client);
+}
+
+// Wait for the next client to be handled by the current worker, from the mailbox of its shard in shard mode
+// Returns -1 once the worker must quit
+static int take_client_pending()
+{
+    int client = -1;
+    if(shard_mailboxes)
+    {
+        // interrupted only once the server is closing
+        while(!mailbox_take(shard_mailboxes[thread_shard], &client))
+        {
+            if(threads_must_close())
+                return -1;
+        }
+        return client;
     }
+
+    bool_t must_close = FALSE;
+    LOCK_MUTEX(&clients_pending_mutex);
+    while(count_q(clients_pending) == 0)
+    {
+        COND_WAIT(&clients_pending_cond, &clients_pending_mutex);
+        BREAK_ON_CLOSE_CONDITION_MUTEX(must_close, &clients_pending_mutex);
+    }
+
+    // quit worker loop if signal
+    if(must_close)
+        return -1;
+
+    client = PTR_TO_INT(dequeue(clients_pending));
+    UNLOCK_MUTEX(&clients_pending_mutex);
+    return client;
+}
+
+// Notify the connection handler about client, with a single write so that the notifications of the threads don't mix
+static void notify_connection_handler(notification_t type, int client)
+{
+    char msg[sizeof(notification_t) + sizeof(int)];
+    memcpy(msg, &type, sizeof(notification_t));
+    memcpy(msg + sizeof(notification_t), &client, sizeof(int));
+    write(pipe_connections_handler[1], msg, sizeof(msg));
 }
 
 // Routine executed by each worker, reads a client fd from a shared queue and handles the request.
+// In shard mode data is the shard owned by the worker, the clients come from its mailbox
 // Stops once the quit signal is S_FAST or S_SOFT with no clients connected
 void* handle_client_requests(void* data)
 {
     pthread_t curr = pthread_self();
 
     PRINT_INFO_DEBUG("Running worker thread %lu.", curr);
-    notification_t type = R_ADD_CLIENT;
-    char msg_add_client[sizeof(notification_t) + sizeof(int)];
-    memcpy(msg_add_client, &type, sizeof(notification_t));
+    request_arena = create_arena(0);
+    if(shard_mailboxes)
+    {
+        thread_shard = PTR_TO_INT(data);
+        thread_fs = shards[thread_shard];
+    }
 
-    bool_t must_close = FALSE;
     while(!threads_must_close())
     {
-        LOCK_MUTEX(&clients_pending_mutex);
-        while(count_q(clients_pending) == 0)
-        {
-            COND_WAIT(&clients_pending_cond, &clients_pending_mutex);
-            BREAK_ON_CLOSE_CONDITION_MUTEX(must_close, &clients_pending_mutex);
-        }
-
-        // quit worker loop if signal
-        if(must_close)
-            break;
-
-        int* client_pending_ptr = (int*)dequeue(clients_pending);
-        UNLOCK_MUTEX(&clients_pending_mutex);
-
-        int client_pending = *client_pending_ptr;
-        free(client_pending_ptr);
-
+        int client_pending = take_client_pending();
         if(client_pending == -1)
             break;
 
-        server_packet_op_t request_op = OP_UNKNOWN;
-        bool_t clients_disconnected = readn(client_pending, &request_op, sizeof(server_packet_op_t)) == 0;
-        bool_t clients_invalid_req = !is_valid_op(request_op);
-        if(clients_disconnected || clients_invalid_req)
-        {
-            on_client_disconnected(client_pending, clients_disconnected, NULL);
-            continue;
-        }
-
         PRINT_INFO_DEBUG("[W/%lu] Handling client with id %d.", curr, client_pending);
 
-        // Handle the message
-        switch(request_op)
+        request_status_t status = handle_request(client_pending);
+        if(status == REQ_CLOSED || status == REQ_INVALID)
         {
-            case OP_OPEN_FILE:
-                PRINT_INFO_DEBUG("[W/%lu] OP_OPEN_FILE request operation.", curr);
-                handle_open_file_req(client_pending);
-                break;
-
-            case OP_LOCK_FILE:
-                PRINT_INFO_DEBUG("[W/%lu] OP_LOCK_FILE request operation.", curr);
-                handle_lock_file_req(client_pending);
-                break;
-
-            case OP_UNLOCK_FILE:
-                PRINT_INFO_DEBUG("[W/%lu] OP_UNLOCK_FILE request operation.", curr);
-                handle_unlock_file_req(client_pending);
-                break;
-
-            case OP_REMOVE_FILE:
-                PRINT_INFO_DEBUG("[W/%lu] OP_REMOVE_FILE request operation.", curr);
-                handle_remove_file_req(client_pending);
-                break;
-
-            case OP_WRITE_FILE:
-                PRINT_INFO_DEBUG("[W/%lu] OP_WRITE_FILE request operation.", curr);
-                handle_write_file_req(client_pending);
-                break;
-
-            case OP_APPEND_FILE:
-                PRINT_INFO_DEBUG("[W/%lu] OP_APPEND_FILE request operation.", curr);
-                handle_append_file_req(client_pending);
-                break;
-            
-            case OP_READ_FILE:
-                PRINT_INFO_DEBUG("[W/%lu] OP_READ_FILE request operation.", curr);
-                handle_read_file_req(client_pending);
-                break;
-
-            case OP_READN_FILES:
-                PRINT_INFO_DEBUG("[W/%lu] OP_READN_FILES request operation.", curr);
-                handle_nread_files_req(client_pending);
-                break;
-
-            case OP_CLOSE_FILE:
-                PRINT_INFO_DEBUG("[W/%lu] OP_CLOSE_FILE request operation.", curr);
-                handle_close_file_req(client_pending);
-                break;
-
-            default:
-                PRINT_INFO_DEBUG("[W/%lu] Unknown request operation, skipping request.", curr);
-                break;
+            on_client_disconnected(client_pending, status == REQ_CLOSED, NULL);
+            continue;
         }
 
+        // the reply is written without blocking, what the socket doesn't take is written by the connection handler
+        outbound_flush(outbound, client_pending);
         notify_worker_handled_req_fs(get_fs(), curr);
+        arena_reset(request_arena);
         PRINT_INFO_DEBUG("[W/%lu] Finished handling.", curr);
 
-        memcpy(msg_add_client + sizeof(notification_t), &client_pending, sizeof(int));
-        write(pipe_connections_handler[1], msg_add_client, sizeof(msg_add_client));
+        // a request waiting for a lock or for the output to be read is resumed by wake_request
+        if(status == REQ_NOTHING)
+            continue;
+        // the worker of the shard owning the file resumes it
+        if(status == REQ_FORWARDED)
+        {
+            schedule_client(client_pending);
+            continue;
+        }
+
+        notify_connection_handler(status == REQ_NEXT ? R_ADD_CLIENT : R_POLL_CLIENT, client_pending);
     }
 
     // on close
+    free_arena(request_arena);
+    request_arena = NULL;
     PRINT_INFO_DEBUG("Quitting worker.");
     LOG_EVENT("Quitting thread worker PID: %lu", -1, curr);
     return NULL;
@@ -333,152 +484,330 @@ quit_signal_t server_wait_end_signal()
     return shared_quit_signal;
 }
 
-// Initialized the workers by creating and execute each of them
+// Pin the ith worker to the ith core the server can run on, the shards are spread over the cores
+static void pin_worker_to_core(int i)
+{
+    cpu_set_t allowed;
+    if(sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == -1 || CPU_COUNT(&allowed) == 0)
+    {
+        PRINT_WARNING(errno, "Cannot get the cores of the server, the %dth worker is not pinned!", i);
+        return;
+    }
+
+    int target = i % CPU_COUNT(&allowed);
+    for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if(!CPU_ISSET(cpu, &allowed) || target-- > 0)
+            continue;
+
+        cpu_set_t core;
+        CPU_ZERO(&core);
+        CPU_SET(cpu, &core);
+        if(pthread_setaffinity_np(thread_workers_ids[i], sizeof(cpu_set_t), &core) != 0)
+            PRINT_WARNING(errno, "Cannot pin the %dth worker to core %d!", i, cpu);
+        return;
+    }
+}
+
+// Initialized the workers by creating and execute each of them, one for each shard in shard mode
 int initialize_workers()
 {
-    CHECK_FATAL_EQ(thread_workers_ids, malloc(config_get_num_workers(current_config) * (sizeof(pthread_t))), NULL, NO_MEM_FATAL);
+    int count = shard_mailboxes ? shards_count : config_get_num_workers(current_config);
+    CHECK_FATAL_EQ(thread_workers_ids, malloc(count * (sizeof(pthread_t))), NULL, NO_MEM_FATAL);
 
     int error;
-    for(int i = 0; i < config_get_num_workers(current_config); ++i)
+    for(int i = 0; i < count; ++i)
     {
-        CHECK_ERROR_NEQ(error, pthread_create(&thread_workers_ids[i], NULL, &handle_client_requests, NULL), 0,
+        CHECK_ERROR_NEQ(error, pthread_create(&thread_workers_ids[i], NULL, &handle_client_requests, INT_TO_PTR(i)), 0,
                  ERR_SOCKET_INIT_WORKERS, "Coudln't create the %dth thread!", i);
         LOG_EVENT("Created new thread worker! PID: %lu", -1, thread_workers_ids[i]);
         workers_count += 1;
+
+        // the owner of a shard is the only worker running on its core
+        if(shard_mailboxes)
+        {
+            pin_worker_to_core(i);
+            continue;
+        }
+
+        // the workers are spread over the nodes, each one allocates and reads from its own node
+        cpu_set_t cpus;
+        if(numa_nodes > 0 && numa_get_node_cpus(i % numa_nodes, &cpus) == 0)
+        {
+            if(pthread_setaffinity_np(thread_workers_ids[i], sizeof(cpu_set_t), &cpus) != 0)
+                PRINT_WARNING(errno, "Cannot pin the %dth worker to NUMA node %d!", i, i % numa_nodes);
+        }
     }
 
     workers_initialized = TRUE;
     return SERVER_OK;
 }
 
-// Routine executed by the connection handler thread, manages the incoming connections and notify the workers about upcoming data
-void* handle_connections(void* params)
+void schedule_client(int client)
 {
-    FD_ZERO(&clients_set_connected);
-    FD_SET(server_socket_id, &clients_set_connected);
-    FD_SET(pipe_connections_handler[0], &clients_set_connected);
-    clients_set_max_id = MAX(server_socket_id, pipe_connections_handler[0]);
+    // in shard mode the requests of client run on the worker of its shard
+    if(shard_mailboxes)
+    {
+        mailbox_post(shard_mailboxes[get_request_shard(client)], client);
+        return;
+    }
 
-    char buffer_check_disconnect[1];
-    bool_t soft_close_in_progress = FALSE;
-    while(!threads_must_close())
+    LOCK_MUTEX(&clients_pending_mutex);
+    enqueue(clients_pending, INT_TO_PTR(client));
+    if(count_q(clients_pending) == 1)
+        COND_SIGNAL(&clients_pending_cond);
+    UNLOCK_MUTEX(&clients_pending_mutex);
+}
+
+// Called by the output buffers once client read most of its output, its request can reply the content of the files
+static void on_client_writable(int client)
+{
+    wake_request(client, 0);
+}
+
+// Called by the connection handler for each lock wait whose timeout expired, on the shard of the timers advanced
+static void on_lock_wait_expired(int client, uint64_t wait_id, void* file)
+{
+    file_system_t* shard = get_fs();
+    acquire_read_lock_fs(shard);
+    client_set_t* granted = create_cs();
+    int expired = expire_lock_wait_fs(shard, client, wait_id, file, granted);
+    release_read_lock_fs(shard);
+
+    if(expired)
     {
-        fd_set current_set;
-        int max_fds;
+        wake_request(client, ETIMEDOUT);
+        LOG_EVENT("OP_LOCK_FILE_EX lock wait of %d expired [%s]", -1, client, strerror(ETIMEDOUT));
+    }
 
-        LOCK_MUTEX(&clients_set_connected_mutex);
-        current_set = clients_set_connected;
-        max_fds = clients_set_max_id;
-        UNLOCK_MUTEX(&clients_set_connected_mutex);
+    // an expired writer may unblock the readers waiting behind it
+    FOREACH_CS(granted, new_owner)
+    {
+        wake_request(new_owner, 0);
+    }
+    free_cs(granted);
+}
 
-        int res = select(max_fds + 1, &current_set, NULL, NULL, NULL);
-        if(res <= 0)
-            continue;
-        if(FD_ISSET(pipe_connections_handler[0], &current_set))
-        {
-            notification_t type;
-            read(pipe_connections_handler[0], &type, sizeof(notification_t));
+// Get the milliseconds until the next lock wait of any shard expires, -1 if there are no lock waits with a timeout
+static long next_lock_timeout_ms()
+{
+    long timeout_ms = -1;
+    for(size_t i = 0; i < shards_count; ++i)
+    {
+        long shard_timeout_ms = tw_next_timeout_ms(get_lock_timers_fs(shards[i]));
+        if(shard_timeout_ms >= 0 && (timeout_ms < 0 || shard_timeout_ms < timeout_ms))
+            timeout_ms = shard_timeout_ms;
+    }
+    return timeout_ms;
+}
 
-            if(type == R_CHECK_FLAG)
-            {
-                quit_signal_t sgn;
-                read(pipe_connections_handler[0], &sgn, sizeof(quit_signal_t));
-                if(sgn == S_FAST)
-                    break;
-                else if(sgn == S_SOFT)
-                {
-                    soft_close_in_progress = TRUE;
-                }
-            }
-            else if(type == R_ADD_CLIENT)
-            {
-                int fd;
-                read(pipe_connections_handler[0], &fd, sizeof(int));
-                LOCK_MUTEX(&clients_set_connected_mutex);
-                FD_SET(fd, &clients_set_connected);
-                clients_set_max_id = MAX(fd, clients_set_max_id);
-                UNLOCK_MUTEX(&clients_set_connected_mutex);
-            }
+// Expire the lock waits of every shard whose timeout passed
+static void expire_lock_waits()
+{
+    for(size_t i = 0; i < shards_count; ++i)
+    {
+        thread_fs = shards[i];
+        tw_advance(get_lock_timers_fs(shards[i]), on_lock_wait_expired);
+    }
+    thread_fs = NULL;
+}
 
-            --res;
-            if(res == 0)
-                continue;
+// Seconds elapsed since start
+static double elapsed_seconds(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Called by the input buffers once the requests of client read most of its input, its bytes are streamed again
+static void on_client_drained(int client)
+{
+    notify_connection_handler(R_RECEIVE_CLIENT, client);
+}
+
+// Disconnect client which hung up while its next request was listened to, unless a worker is running its request
+// n_clients is the count of the clients of the connection handler, loaded from clients_count into n_clients_start if it's -1
+static void on_client_hung_up(int client, int* n_clients, int* n_clients_start)
+{
+    // a worker running the request of the client disconnects it once done
+    NRET_IF(!close_request(client));
+
+    if(*n_clients == -1)
+    {
+        GET_VAR_MUTEX(clients_count, *n_clients_start, &clients_count_mutex);
+        *n_clients = *n_clients_start;
+    }
+    // update the clients count based on this local variable not the global one
+    // the count will be set globally at the end
+    on_client_disconnected(client, TRUE, n_clients);
+}
+
+// Act on a change of the input of client streamed by the engine
+static void on_input_changed(int client, inbound_action_t action, int* n_clients, int* n_clients_start)
+{
+    switch(action)
+    {
+        case IN_SCHEDULE:
+            schedule_client(client);
+            break;
+
+        case IN_HUNG_UP:
+            on_client_hung_up(client, n_clients, n_clients_start);
+            break;
+
+        case IN_RECEIVE:
+            if(io_engine_stream(io_engine, client) == -1)
+                PRINT_WARNING(errno, "Cannot receive client %d!", client);
+            break;
+
+        case IN_CLOSE:
+            close(client);
+            break;
+
+        case IN_NONE:
+            break;
+    }
+}
+
+// Listen to the next request of client if next, otherwise to the rest of the current one
+// The client is not listened to again until the request is handled
+static void watch_client(int client, bool_t next, int* n_clients, int* n_clients_start)
+{
+    if(inbound)
+    {
+        on_input_changed(client, inbound_wait(inbound, client, next), n_clients, n_clients_start);
+        return;
+    }
+
+    if((next ? io_engine_receive(io_engine, client) : io_engine_poll(io_engine, client)) == -1)
+        PRINT_WARNING(errno, "Cannot listen to client %d!", client);
+}
+
+// Routine executed by the connection handler thread, manages the incoming connections and notify the workers about upcoming data
+// The output waiting for the clients is written here too, once their sockets can take it
+void* handle_connections(void* params)
+{
+    io_event_t events[CONNECTION_EVENTS];
+    bool_t soft_close_in_progress = FALSE;
+    struct timespec last_expire;
+    clock_gettime(CLOCK_MONOTONIC, &last_expire);
+    while(!threads_must_close())
+    {
+        // wake up in time for the next lock wait to expire, a new timer is always followed by the R_ADD_CLIENT of its request
+        long timeout_ms = next_lock_timeout_ms();
+        // and check every second the clients whose output or request is waiting
+        bool_t clients_waiting = outbound_count_waiting(outbound) > 0 || count_waiting_requests() > 0;
+        if(slow_client_timeout > 0 && clients_waiting && (timeout_ms < 0 || timeout_ms > 1000))
+            timeout_ms = 1000;
+
+        int res = io_engine_wait(io_engine, events, CONNECTION_EVENTS, timeout_ms);
+        expire_lock_waits();
+        if(slow_client_timeout > 0 && elapsed_seconds(&last_expire) >= 1)
+        {
+            outbound_expire(outbound, slow_client_timeout);
+            expire_requests(slow_client_timeout);
+            clock_gettime(CLOCK_MONOTONIC, &last_expire);
         }
+        if(res <= 0)
+            continue;
 
         // Copy of clients_count value, is not initialized yet because of the overhead at every message received
         // It's initialized or inside an incoming connection or inside a disconnection lazily
         int n_clients = -1;
         int n_clients_start = -1;
+        bool_t must_break = FALSE;
 
-        if(res > 0 && FD_ISSET(server_socket_id, &current_set))
+        for(int i = 0; i < res; ++i)
         {
-            int new_id = accept(server_socket_id, NULL, 0);
-            if(new_id != -1)
+            int fd = events[i].fd;
+            if(events[i].type == IO_EV_READABLE && fd == pipe_connections_handler[0])
             {
-                if(soft_close_in_progress)
-                {
-                    close(new_id);
-                }
-                else
+                // each notification is written at once, with io_uring a single event can stand for many of them
+                notification_t type;
+                while(read(pipe_connections_handler[0], &type, sizeof(notification_t)) == sizeof(notification_t))
                 {
-                    LOCK_MUTEX(&clients_set_connected_mutex);
-                    FD_SET(new_id, &clients_set_connected);
-                    clients_set_max_id = MAX(new_id, clients_set_max_id);
-                    UNLOCK_MUTEX(&clients_set_connected_mutex);
-
-                    LOG_EVENT("OP_CONN client connected with id %d!", -1, new_id);
-
-                    GET_VAR_MUTEX(clients_count, n_clients_start, &clients_count_mutex);
-                    n_clients = n_clients_start + 1;
+                    if(type == R_CHECK_FLAG)
+                    {
+                        quit_signal_t sgn;
+                        read(pipe_connections_handler[0], &sgn, sizeof(quit_signal_t));
+                        if(sgn == S_FAST)
+                            must_break = TRUE;
+                        else if(sgn == S_SOFT)
+                        {
+                            soft_close_in_progress = TRUE;
+                        }
+                    }
+                    else if(type == R_ADD_CLIENT || type == R_POLL_CLIENT)
+                    {
+                        int client;
+                        read(pipe_connections_handler[0], &client, sizeof(int));
+                        watch_client(client, type == R_ADD_CLIENT, &n_clients, &n_clients_start);
+                    }
+                    else if(type == R_RECEIVE_CLIENT)
+                    {
+                        int client;
+                        read(pipe_connections_handler[0], &client, sizeof(int));
+                        on_input_changed(client, inbound_resume(inbound, client), &n_clients, &n_clients_start);
+                    }
                 }
             }
-            --res;
-        }
-        
-        while(res > 0 && max_fds >= 0)
-        {
-            if(max_fds == server_socket_id || max_fds == pipe_connections_handler[0])
+            else if(events[i].type == IO_EV_READABLE && fd == outbound_get_fd(outbound))
             {
-                --max_fds;
-                continue;
+                outbound_flush_ready(outbound);
             }
-
-            if(FD_ISSET(max_fds, &current_set))
+            else if(events[i].type == IO_EV_READABLE)
+            {
+                // the rest of a request arrived
+                schedule_client(fd);
+            }
+            else if(events[i].type == IO_EV_DATA)
+            {
+                // the bytes of a client streamed, copied into its input until its requests read them
+                bool_t full = FALSE;
+                inbound_action_t action = events[i].res > 0 ? inbound_push(inbound, fd, events[i].data, events[i].res, &full)
+                                                            : inbound_end(inbound, fd, -events[i].res);
+                if(full && io_engine_cancel(io_engine, fd) == -1)
+                    PRINT_WARNING(errno, "Cannot stop receiving client %d!", fd);
+                on_input_changed(fd, action, &n_clients, &n_clients_start);
+            }
+            else if(events[i].type == IO_EV_ACCEPTED)
             {
-                EXEC_WITH_MUTEX(FD_CLR(max_fds, &clients_set_connected), &clients_set_connected_mutex);
+                int new_id = events[i].res;
+                if(new_id < 0)
+                    continue;
 
-                // Read the first unused byte from the client, used to detect whether the client is still connected
-                if(read(max_fds, &buffer_check_disconnect, 1) <= 0)
+                if(soft_close_in_progress)
                 {
-                    // If the n_clients value was not loaded previously load it
-                    if(n_clients == -1)
-                    {
-                        GET_VAR_MUTEX(clients_count, n_clients_start, &clients_count_mutex);
-                        n_clients = n_clients_start;
-                    }
-                    // update the clients count based on this local variable not the global one
-                    // the count will be set globally at the end
-                    on_client_disconnected(max_fds, TRUE, &n_clients);
-                    --res;
+                    close(new_id);
                     continue;
                 }
 
-                int* new_client;
-                MAKE_COPY(new_client, int, max_fds);
-
-                int num_reqs = 0;
-
-                LOCK_MUTEX(&clients_pending_mutex);
-                enqueue(clients_pending, new_client);
-                num_reqs = count_q(clients_pending);
+                // the bytes of the client are streamed from now on, the workers read them from its input
+                if(inbound)
+                {
+                    inbound_open(inbound, new_id);
+                    if(io_engine_stream(io_engine, new_id) == -1)
+                        PRINT_WARNING(errno, "Cannot receive client %d!", new_id);
+                }
+                watch_client(new_id, TRUE, &n_clients, &n_clients_start);
+                LOG_EVENT("OP_CONN client connected with id %d!", -1, new_id);
 
-                if(num_reqs == 1)
-                    COND_SIGNAL(&clients_pending_cond);
-                UNLOCK_MUTEX(&clients_pending_mutex);
-                --res;
+                if(n_clients == -1)
+                {
+                    GET_VAR_MUTEX(clients_count, n_clients_start, &clients_count_mutex);
+                    n_clients = n_clients_start;
+                }
+                ++n_clients;
+            }
+            else
+            {
+                // The first unused byte of the request was read by the engine, used to detect whether the client is still connected
+                if(events[i].res <= 0)
+                    on_client_hung_up(fd, &n_clients, &n_clients_start);
+                else
+                    schedule_client(fd);
             }
-
-            --max_fds;
         }
 
         // if n_clients was changed by a connection or disconnection
@@ -500,6 +829,9 @@ void* handle_connections(void* params)
             if(n_clients > max_client_alltogether)
                 max_client_alltogether = n_clients;
         }
+
+        if(must_break)
+            break;
     }
 
     LOG_EVENT("Quitting thread accepter! PID: %lu", -1, pthread_self());
@@ -511,6 +843,34 @@ static int initialize_connection_handler()
 {
     int error;
     CHECK_ERROR_NEQ(error, pipe(pipe_connections_handler), 0, ERR_SOCKET_INIT_ACCEPTER, "Cannot initialize pipe!");
+    // the notifications are read until the pipe is empty, the workers still block writing to a full one
+    CHECK_ERROR_EQ(error, fcntl(pipe_connections_handler[0], F_SETFL, O_NONBLOCK), -1, ERR_SOCKET_INIT_ACCEPTER, "Cannot initialize pipe!");
+    io_engine = create_io_engine(io_engine_type);
+    if(!io_engine && io_engine_type == IO_ENGINE_URING)
+    {
+        PRINT_WARNING(errno, "io_uring not available, the connections are handled with epoll!");
+        io_engine = create_io_engine(IO_ENGINE_EPOLL);
+    }
+    if(!io_engine)
+    {
+        PRINT_ERROR(errno, "Cannot initialize the I/O engine!");
+        return ERR_SOCKET_INIT_ACCEPTER;
+    }
+    // io_uring receives the requests itself unless the kernel can't stream them, then it only reads their first byte
+    if(io_engine_can_stream(io_engine))
+        inbound = create_inbound(INPUT_BUFFER_MAX_BYTES, on_client_drained);
+    else if(io_engine_type == IO_ENGINE_URING)
+        PRINT_WARNING(ENOTSUP, "io_uring can't receive the requests, only their first byte goes through it!");
+
+    // the listening socket, the pipe and the output buffers are always listened to
+    CHECK_ERROR_EQ(error, io_engine_accept(io_engine, server_socket_id), -1, ERR_SOCKET_INIT_ACCEPTER, "Cannot accept the clients!");
+    int always_listened[] = { pipe_connections_handler[0], outbound_get_fd(outbound) };
+    for(int i = 0; i < sizeof(always_listened) / sizeof(int); ++i)
+    {
+        CHECK_ERROR_EQ(error, io_engine_listen(io_engine, always_listened[i]), -1,
+                        ERR_SOCKET_INIT_ACCEPTER, "Cannot listen to descriptor %d!", always_listened[i]);
+    }
+
     CHECK_ERROR_NEQ(error, pthread_create(&thread_connections_id, NULL, &handle_connections, NULL), 0, ERR_SOCKET_INIT_ACCEPTER, THREAD_CREATE_FATAL);
 
     LOG_EVENT("Created new thread accepter! PID: %lu", -1, thread_connections_id);
@@ -518,6 +878,203 @@ static int initialize_connection_handler()
     return SERVER_OK;
 }
 
+// Write a snapshot of the files from a forked child, the workers are stopped only while forking
+// The write-ahead log starts a new generation under the same lock, the older ones are deleted once the snapshot is on disk
+static void take_snapshot(const char* path)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for(size_t i = 0; i < shards_count; ++i)
+        acquire_write_lock_fs(shards[i]);
+    uint64_t generation = wal_rotate(wal);
+    pid_t pid = fork_snapshot_fs(shards, shards_count, path, generation);
+    for(size_t i = shards_count; i > 0; --i)
+        release_write_lock_fs(shards[i - 1]);
+    if(pid == -1)
+    {
+        LOG_EVENT("Snapshot to %s failed! [%s]", -1, path, strerror(errno));
+        return;
+    }
+
+    int status;
+    while(waitpid(pid, &status, 0) == -1 && errno == EINTR);
+    if(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS)
+    {
+        wal_truncate(wal, generation);
+        LOG_EVENT("Snapshot written to %s in %.3fs", -1, path, elapsed_seconds(&start));
+    }
+    else
+    {
+        LOG_EVENT("Snapshot to %s failed!", -1, path);
+    }
+}
+
+// Routine executed by the snapshotter thread, writes a snapshot every SNAPSHOT_INTERVAL seconds
+void* handle_snapshots(void* params)
+{
+    char path[MAX_PATHNAME_API_LENGTH + 1];
+    config_get_snapshot_path(current_config, path);
+    unsigned int interval = config_get_snapshot_interval(current_config);
+
+    while(TRUE)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += interval;
+
+        bool_t must_close = FALSE;
+        LOCK_MUTEX(&snapshotter_mutex);
+        while(!(must_close = threads_must_close()))
+        {
+            if(pthread_cond_timedwait(&snapshotter_cond, &snapshotter_mutex, &deadline) == ETIMEDOUT)
+                break;
+        }
+        UNLOCK_MUTEX(&snapshotter_mutex);
+
+        if(must_close)
+            break;
+        take_snapshot(path);
+    }
+
+    LOG_EVENT("Quitting thread snapshotter! PID: %lu", -1, pthread_self());
+    return NULL;
+}
+
+// Initialize the snapshotter by executing it's dedicated thread, only if the periodic snapshots are enabled
+static int initialize_snapshotter()
+{
+    char path[MAX_PATHNAME_API_LENGTH + 1];
+    config_get_snapshot_path(current_config, path);
+    if(path[0] == '\0' || config_get_snapshot_interval(current_config) == 0)
+        return SERVER_OK;
+
+    int error;
+    CHECK_ERROR_NEQ(error, pthread_create(&thread_snapshotter_id, NULL, &handle_snapshots, NULL), 0, ERR_SERVER_SNAPSHOTTER, THREAD_CREATE_FATAL);
+
+    LOG_EVENT("Created new thread snapshotter! PID: %lu", -1, thread_snapshotter_id);
+    snapshotter_initialized = TRUE;
+    return SERVER_OK;
+}
+
+void wake_reclaimer()
+{
+    NRET_IF(!reclaimer_enabled || __atomic_load_n(&reclaim_requested, __ATOMIC_RELAXED));
+
+    LOCK_MUTEX(&reclaimer_mutex);
+    reclaim_requested = TRUE;
+    COND_SIGNAL(&reclaimer_cond);
+    UNLOCK_MUTEX(&reclaimer_mutex);
+}
+
+// Routine executed by the reclaimer thread, once woken up evicts the files until the memory used is down to the low watermark
+void* handle_reclaims(void* params)
+{
+    while(TRUE)
+    {
+        bool_t must_close = FALSE;
+        LOCK_MUTEX(&reclaimer_mutex);
+        while(!(must_close = threads_must_close()) && !reclaim_requested)
+            COND_WAIT(&reclaimer_cond, &reclaimer_mutex);
+        reclaim_requested = FALSE;
+        UNLOCK_MUTEX(&reclaimer_mutex);
+
+        if(must_close)
+            break;
+
+        // each shard is evicted down to its own watermark
+        size_t evicted = 0;
+        for(size_t i = 0; i < shards_count; ++i)
+        {
+            thread_fs = shards[i];
+            evicted += reclaim_files();
+        }
+        thread_fs = NULL;
+        if(evicted > 0)
+        {
+            reclaimer_evicted += evicted;
+            ++reclaimer_runs;
+        }
+    }
+
+    free_arena(request_arena);
+    request_arena = NULL;
+    LOG_EVENT("Quitting thread reclaimer! PID: %lu", -1, pthread_self());
+    return NULL;
+}
+
+// Initialize the reclaimer by executing it's dedicated thread, only if the eviction watermarks are set
+static int initialize_reclaimer()
+{
+    if(!reclaimer_enabled)
+        return SERVER_OK;
+
+    int error;
+    CHECK_ERROR_NEQ(error, pthread_create(&thread_reclaimer_id, NULL, &handle_reclaims, NULL), 0, ERR_SERVER_RECLAIMER, THREAD_CREATE_FATAL);
+
+    LOG_EVENT("Created new thread reclaimer! PID: %lu", -1, thread_reclaimer_id);
+    reclaimer_initialized = TRUE;
+    return SERVER_OK;
+}
+
+// Load the snapshot written by the last run, if any
+static void load_initial_snapshot(const char* path)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    loaded_snapshot = load_snapshot_fs(fs, path);
+    if(!loaded_snapshot)
+    {
+        if(errno != ENOENT)
+            PRINT_WARNING(errno, "Cannot load snapshot %s!", path);
+        return;
+    }
+
+    LOG_EVENT("Snapshot %s loaded, %zu files (%zu skipped) in %.3fs", -1, path,
+                snapshot_get_files_count(loaded_snapshot), snapshot_get_files_skipped(loaded_snapshot), elapsed_seconds(&start));
+}
+
+// Get the durability of the writes from its name, SYNC if the name is unknown
+static server_durability_t get_durability_from_name(const char* name)
+{
+    if(strcmp(name, "ASYNC") == 0)
+        return D_ASYNC;
+    if(strcmp(name, "WRITTEN") == 0)
+        return D_WRITTEN;
+    if(strcmp(name, "SYNC") != 0)
+        PRINT_WARNING(EINVAL, "Unknown durability %s, SYNC is used!", name);
+    return D_SYNC;
+}
+
+// Called by the writer of the write-ahead log once the record a change of client waits for is durable, its request replies
+static void on_change_durable(int client)
+{
+    wake_request(client, 0);
+}
+
+// Replay the changes logged after the loaded snapshot then open the write-ahead log to continue logging
+static int initialize_wal(const char* path)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    uint64_t generation = 0, last_lsn = 0;
+    size_t replayed = replay_wal_fs(fs, content_store, path, snapshot_get_wal_generation(loaded_snapshot), &generation, &last_lsn);
+    LOG_EVENT("Write-ahead log %s replayed, %zu changes in %.3fs", -1, path, replayed, elapsed_seconds(&start));
+
+    char durability[MAX_POLICY_LENGTH + 1];
+    config_get_wal_durability_name(current_config, durability);
+    wal = create_wal(path, generation, last_lsn, get_durability_from_name(durability), on_change_durable);
+    if(!wal)
+    {
+        PRINT_ERROR(errno, "Cannot open write-ahead log %s!", path);
+        return ERR_SERVER_WAL;
+    }
+
+    return SERVER_OK;
+}
+
 // Called after receiving a S_SOFT or S_FAST from server_wait_end_signal() method
 static int server_join_threads()
 {
@@ -536,6 +1093,8 @@ static int server_join_threads()
     pthread_join(thread_connections_id, NULL);
 
     COND_BROADCAST(&clients_pending_cond);
+    for(size_t i = 0; shard_mailboxes && i < shards_count; ++i)
+        mailbox_interrupt(shard_mailboxes[i]);
 
     PRINT_INFO_DEBUG("Joining workers thread.");
     for(int i = 0; i < workers_count; ++i)
@@ -543,12 +1102,122 @@ static int server_join_threads()
         pthread_join(thread_workers_ids[i], NULL);
     }
 
+    if(snapshotter_initialized)
+    {
+        EXEC_WITH_MUTEX(COND_BROADCAST(&snapshotter_cond), &snapshotter_mutex);
+        pthread_join(thread_snapshotter_id, NULL);
+    }
+
+    if(reclaimer_initialized)
+    {
+        EXEC_WITH_MUTEX(COND_BROADCAST(&reclaimer_cond), &reclaimer_mutex);
+        pthread_join(thread_reclaimer_id, NULL);
+    }
+
+    // nobody else uses the files anymore, the last snapshot is written directly
+    char snapshot_path[MAX_PATHNAME_API_LENGTH + 1];
+    config_get_snapshot_path(current_config, snapshot_path);
+    if(snapshot_path[0] != '\0')
+    {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        uint64_t generation = wal_rotate(wal);
+        if(write_snapshot_fs(shards, shards_count, snapshot_path, generation) == 0)
+        {
+            wal_truncate(wal, generation);
+            LOG_EVENT("Snapshot written to %s in %.3fs", -1, snapshot_path, elapsed_seconds(&start));
+        }
+        else
+        {
+            LOG_EVENT("Snapshot to %s failed! [%s]", -1, snapshot_path, strerror(errno));
+        }
+    }
+
     close(server_socket_id);
     // log max clients simultaniously (max_clients_alltoghether)
     LOG_EVENT("FINAL_METRICS Max clients connected alltogether %u!", -1, max_client_alltogether);
+    if(wal)
+    {
+        wal_metrics_t wal_metrics = wal_get_metrics(wal);
+        LOG_EVENT("FINAL_METRICS Write-ahead log %zu records, %zu bytes, %zu writes, %zu syncs (%.2f records per sync)!", -1,
+                    wal_metrics.records, wal_metrics.bytes, wal_metrics.writes, wal_metrics.syncs,
+                    wal_metrics.syncs > 0 ? (double)wal_metrics.records / wal_metrics.syncs : 0.0);
+    }
+    if(disk_tier)
+    {
+        disk_tier_metrics_t tier_metrics = disk_tier_get_metrics(disk_tier);
+        size_t lookups = tier_metrics.promoted + tier_metrics.misses;
+        LOG_EVENT("FINAL_METRICS Disk tier %zu demoted, %zu promoted, %zu misses (%.2f%% hit ratio), %zu dropped, max size %zu!", -1,
+                    tier_metrics.demoted, tier_metrics.promoted, tier_metrics.misses,
+                    lookups > 0 ? tier_metrics.promoted * 100.0 / lookups : 0.0, tier_metrics.dropped, tier_metrics.max_size);
+    }
+    if(huge_pages_enabled)
+    {
+        page_alloc_metrics_t alloc_metrics = page_alloc_get_metrics();
+        LOG_EVENT("FINAL_METRICS Huge pages %zu buffers mapped (%zu from the reserved pool), %zu moved between nodes, max mapped %zu bytes!", -1,
+                    alloc_metrics.huge_buffers, alloc_metrics.hugetlb_buffers, alloc_metrics.moved_buffers, alloc_metrics.max_mapped_bytes);
+    }
+    if(reclaimer_initialized)
+    {
+        LOG_EVENT("FINAL_METRICS Reclaimer evicted %zu files in %zu runs!", -1, reclaimer_evicted, reclaimer_runs);
+    }
+    outbound_metrics_t outbound_metrics = outbound_get_metrics(outbound);
+    if(outbound_metrics.pushed > 0 || outbound_metrics.dropped > 0)
+    {
+        LOG_EVENT("FINAL_METRICS Pushed %zu evicted files (%zu bytes) to the clients, %zu not pushed!", -1,
+                    outbound_metrics.pushed, outbound_metrics.pushed_bytes, outbound_metrics.dropped);
+    }
+    LOG_EVENT("FINAL_METRICS Output buffers max %zu bytes waiting for a client, %zu slow clients disconnected!", -1,
+                outbound_metrics.max_retained, outbound_metrics.disconnected);
+    if(count_invalidated_caches() > 0)
+    {
+        LOG_EVENT("FINAL_METRICS %zu copies of the files cached by the clients invalidated!", -1, count_invalidated_caches());
+    }
+    size_t bytes_not_sent;
+    size_t not_modified = count_reads_not_modified(&bytes_not_sent);
+    if(not_modified > 0)
+    {
+        LOG_EVENT("FINAL_METRICS %zu conditional reads not modified, %zu bytes not sent!", -1, not_modified, bytes_not_sent);
+    }
+    io_engine_metrics_t engine_metrics = io_engine_get_metrics(io_engine);
+    LOG_EVENT("FINAL_METRICS I/O engine %s, %zu events in %zu syscalls!", -1,
+                io_engine && io_engine_get_type(io_engine) == IO_ENGINE_URING ? "io_uring" : "epoll",
+                engine_metrics.operations, engine_metrics.syscalls);
+    if(inbound)
+    {
+        LOG_EVENT("FINAL_METRICS I/O engine received %zu bytes of the requests!", -1, engine_metrics.received);
+    }
+    if(content_stores)
+    {
+        content_store_metrics_t store_metrics;
+        memset(&store_metrics, 0, sizeof(content_store_metrics_t));
+        for(size_t i = 0; i < shards_count; ++i)
+        {
+            content_store_metrics_t shard_metrics = content_store_get_metrics(content_stores[i]);
+            store_metrics.stored += shard_metrics.stored;
+            store_metrics.hits += shard_metrics.hits;
+            store_metrics.saved_bytes += shard_metrics.saved_bytes;
+            store_metrics.max_entries += shard_metrics.max_entries;
+        }
+        LOG_EVENT("FINAL_METRICS Content store %zu contents stored, %zu deduplicated writes, %zu bytes saved, max contents %zu!", -1,
+                    store_metrics.stored, store_metrics.hits, store_metrics.saved_bytes, store_metrics.max_entries);
+    }
+
+    if(shard_mailboxes)
+    {
+        LOG_EVENT("FINAL_METRICS Shards %zu, %zu requests forwarded to the worker of another shard!", -1,
+                    shards_count, count_forwarded_requests());
+    }
 
     // log fs metrics
-    shutdown_fs(fs);
+    for(size_t i = 0; i < shards_count; ++i)
+    {
+        if(shard_mailboxes)
+        {
+            LOG_EVENT("FINAL_METRICS Shard %zu:", -1, i);
+        }
+        shutdown_fs(shards[i]);
+    }
     stop_log(logging);
     return SERVER_OK;
 }
@@ -560,22 +1229,47 @@ int server_cleanup()
 
     close(pipe_connections_handler[0]);
     close(pipe_connections_handler[1]);
-
-    free_fs(fs);
+    free_io_engine(io_engine);
+    free_inbound(inbound);
+
+    // the changes still waiting for their records are resumed by the log before their requests are freed
+    free_wal(wal);
+    // the payloads still arriving give back the memory reserved
+    free_requests();
+    for(size_t i = 0; i < shards_count; ++i)
+    {
+        free_fs(shards[i]);
+        if(shard_mailboxes)
+            free_mailbox(shard_mailboxes[i]);
+    }
+    free(shards);
+    free(shard_mailboxes);
+    // the demoter can still be reading the mapped contents of the snapshot
+    free_disk_tier(disk_tier);
+    // the replies still waiting read the segments of the contents
+    free_outbound(outbound);
+    // every list sharing a content was freed with the files, the tier and the replies
+    for(size_t i = 0; content_stores && i < shards_count; ++i)
+        free_content_store(content_stores[i]);
+    free(content_stores);
+    free_snapshot(loaded_snapshot);
     free_log(logging);
-    free_q(clients_pending, free);
+    free_q(clients_pending, ll_no_free);
     free(thread_workers_ids);
 
     PRINT_INFO("Closing socket and removing it.");
 
     pthread_mutex_destroy(&config_mutex);
     pthread_mutex_destroy(&quit_signal_mutex);
-    pthread_mutex_destroy(&clients_set_connected_mutex);
     pthread_mutex_destroy(&clients_count_mutex);
     pthread_mutex_destroy(&clients_pending_mutex);
     pthread_cond_destroy(&clients_pending_cond);
+    pthread_mutex_destroy(&snapshotter_mutex);
+    pthread_cond_destroy(&snapshotter_cond);
+    pthread_mutex_destroy(&reclaimer_mutex);
+    pthread_cond_destroy(&reclaimer_cond);
 
-    char socket_name[MAX_PATHNAME_API_LENGTH];
+    char socket_name[MAX_PATHNAME_API_LENGTH + 1];
     config_get_socket_name(current_config, socket_name);
     remove(socket_name);
 
@@ -591,9 +1285,21 @@ int start_server()
     INITIALIZE_SERVER_FUNCTIONALITY(initialize_workers, lastest_status);
     // Initialize and run connections
     INITIALIZE_SERVER_FUNCTIONALITY(initialize_connection_handler, lastest_status);
+    // Initialize and run periodic snapshots
+    INITIALIZE_SERVER_FUNCTIONALITY(initialize_snapshotter, lastest_status);
+    // Initialize and run the background eviction, a wake up sent before is kept by reclaim_requested
+    INITIALIZE_SERVER_FUNCTIONALITY(initialize_reclaimer, lastest_status);
 
-    // needed for threads metrics
-    set_workers_fs(fs, thread_workers_ids, workers_count);
+    // needed for threads metrics, in shard mode each shard is handled by its own worker
+    if(shard_mailboxes)
+    {
+        for(size_t i = 0; i < shards_count; ++i)
+            set_workers_fs(shards[i], &thread_workers_ids[i], 1);
+    }
+    else
+    {
+        set_workers_fs(fs, thread_workers_ids, workers_count);
+    }
 
     PRINT_INFO("Server started with PID:%d.", getpid());
     LOG_EVENT("Server started succesfully! PID: %d", -1, getpid());
@@ -608,12 +1314,33 @@ int start_server()
 int init_server(const configuration_params_t* config)
 {
     current_config = (configuration_params_t*)config;
+    if(config_get_shard_processes(config) > 1)
+    {
+        shard_processes = config_get_shard_processes(config);
+        shard_process_index = config_get_shard_process_index(config);
+    }
 
     clients_pending = create_q();
 
     fs = create_fs(config_get_max_server_size(config),
                                      config_get_max_files_count(config));
 
+    // in shard mode each shard gets its slice of the capacity, the files of the last run are loaded in fs first
+    if(config_get_shards_count(config) > 1)
+        shards_count = config_get_shards_count(config);
+    CHECK_FATAL_EQ(shards, malloc(shards_count * sizeof(file_system_t*)), NULL, NO_MEM_FATAL);
+    shards[0] = fs;
+    if(shards_count > 1)
+    {
+        CHECK_FATAL_EQ(shard_mailboxes, malloc(shards_count * sizeof(mailbox_t*)), NULL, NO_MEM_FATAL);
+        for(size_t i = 0; i < shards_count; ++i)
+        {
+            shards[i] = create_fs(config_get_max_server_size(config) / shards_count,
+                                    (config_get_max_files_count(config) + shards_count - 1) / shards_count);
+            shard_mailboxes[i] = create_mailbox();
+        }
+    }
+
     logging = create_log();
     
     char log_name[MAX_PATHNAME_API_LENGTH + 1];
@@ -625,8 +1352,113 @@ int init_server(const configuration_params_t* config)
     }
 
     char policy[MAX_POLICY_LENGTH + 1];
-    config_get_log_name(config, policy);
+    config_get_policy_name(config, policy);
     set_policy_fs(fs, policy);
+    config_get_lock_policy_name(config, policy);
+    set_lock_policy_fs(fs, policy);
+    // the clients caching a file are told once their copy is stale
+    file_set_cache_invalidation(invalidate_cached_file);
+    config_get_compression_name(config, policy);
+    compression_enabled = strcmp(policy, "LZ") == 0;
+    if(!compression_enabled && strcmp(policy, "NONE") != 0)
+        PRINT_WARNING(EINVAL, "Unknown compression %s, the contents are not compressed!", policy);
+    config_get_deduplication_name(config, policy);
+    if(strcmp(policy, "SHA256") == 0)
+    {
+        CHECK_FATAL_EQ(content_stores, malloc(shards_count * sizeof(content_store_t*)), NULL, NO_MEM_FATAL);
+        for(size_t i = 0; i < shards_count; ++i)
+            content_stores[i] = create_content_store();
+        content_store = shard_mailboxes ? create_content_store() : content_stores[0];
+    }
+    else if(strcmp(policy, "NONE") != 0)
+        PRINT_WARNING(EINVAL, "Unknown deduplication %s, the contents are not deduplicated!", policy);
+    config_get_huge_pages_name(config, policy);
+    huge_pages_enabled = strcmp(policy, "MADVISE") == 0 || strcmp(policy, "HUGETLB") == 0;
+    page_alloc_set_mode(!huge_pages_enabled ? HUGE_PAGES_NONE : strcmp(policy, "HUGETLB") == 0 ? HUGE_PAGES_HUGETLB : HUGE_PAGES_MADVISE);
+    if(!huge_pages_enabled && strcmp(policy, "NONE") != 0)
+        PRINT_WARNING(EINVAL, "Unknown huge pages mode %s, the contents use the normal pages!", policy);
+    config_get_numa_placement_name(config, policy);
+    if(strcmp(policy, "AUTO") == 0)
+    {
+        // a single node has nothing to place
+        numa_nodes = numa_count_nodes() > 1 ? numa_count_nodes() : 0;
+        if(numa_nodes == 0)
+            PRINT_INFO("Single NUMA node, the contents are not placed.");
+    }
+    else if(strcmp(policy, "NONE") != 0)
+    {
+        PRINT_WARNING(EINVAL, "Unknown NUMA placement %s, the contents are not placed!", policy);
+    }
+
+    unsigned int high_watermark = config_get_eviction_high_watermark(config);
+    unsigned int low_watermark = config_get_eviction_low_watermark(config);
+    if(high_watermark > 100 || (high_watermark > 0 && low_watermark >= high_watermark))
+    {
+        PRINT_WARNING(EINVAL, "Invalid eviction watermarks low %u high %u, the files are evicted only by the writes!", low_watermark, high_watermark);
+    }
+    else if(high_watermark > 0)
+    {
+        size_t capacity = config_get_max_server_size(config) / shards_count;
+        for(size_t i = 0; i < shards_count; ++i)
+            set_watermarks_fs(shards[i], capacity / 100 * low_watermark, capacity / 100 * high_watermark);
+        reclaimer_enabled = TRUE;
+    }
+
+    size_t send_back_max_bytes = config_get_send_back_max_bytes(config);
+    size_t output_buffer_max_bytes = config_get_output_buffer_max_bytes(config);
+    outbound = create_outbound(output_buffer_max_bytes > 0 ? output_buffer_max_bytes : DEFAULT_OUTPUT_BUFFER_MAX_BYTES,
+                                send_back_max_bytes > 0 ? send_back_max_bytes : DEFAULT_SEND_BACK_MAX_BYTES,
+                                on_client_writable);
+    if(!outbound)
+    {
+        PRINT_ERROR(errno, "Cannot create the output buffers of the clients!");
+        return ERR_SOCKET_INIT_ACCEPTER;
+    }
+    if(config_get_slow_client_timeout(config) > 0)
+        slow_client_timeout = config_get_slow_client_timeout(config);
+    config_get_io_engine_name(config, policy);
+    if(strcmp(policy, "IO_URING") == 0)
+        io_engine_type = IO_ENGINE_URING;
+    else if(strcmp(policy, "EPOLL") != 0)
+        PRINT_WARNING(EINVAL, "Unknown I/O engine %s, the connections are handled with epoll!", policy);
+
+    // the files of the last run are loaded before accepting clients
+    char snapshot_path[MAX_PATHNAME_API_LENGTH + 1];
+    config_get_snapshot_path(config, snapshot_path);
+    if(snapshot_path[0] != '\0')
+        load_initial_snapshot(snapshot_path);
+
+    // then the changes made after the snapshot are replayed from the write-ahead log
+    char wal_path[MAX_PATHNAME_API_LENGTH + 1];
+    config_get_wal_path(config, wal_path);
+    if(wal_path[0] != '\0')
+    {
+        int status = initialize_wal(wal_path);
+        RET_IF(status != SERVER_OK, status);
+    }
+
+    // every file moves to the shard owning its pathname
+    if(shard_mailboxes)
+    {
+        split_fs(fs, shards, content_stores, get_shard_of);
+        free_fs(fs);
+        fs = NULL;
+        if(content_store)
+            free_content_store(content_store);
+        content_store = NULL;
+    }
+
+    char disk_tier_path[MAX_PATHNAME_API_LENGTH + 1];
+    config_get_disk_tier_path(config, disk_tier_path);
+    if(disk_tier_path[0] != '\0' && config_get_disk_tier_capacity(config) > 0)
+    {
+        disk_tier = create_disk_tier(disk_tier_path, config_get_disk_tier_capacity(config));
+        if(!disk_tier)
+        {
+            PRINT_ERROR(errno, "Cannot open disk tier %s!", disk_tier_path);
+            return ERR_SERVER_DISK_TIER;
+        }
+    }
 
     CHECK_ERROR_EQ(server_socket_id, socket(AF_UNIX, SOCK_STREAM, 0), -1, ERR_SOCKET_FAILED, "Couldn't initialize socket!");
 
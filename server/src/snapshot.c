@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+
+// Size of the buffer used to batch the small writes of the records
+#define SNAPSHOT_BUFFER_SIZE (64 * 1024)
+// Every record starts at a multiple of this alignment, so the mapped records can be read in place
+#define SNAPSHOT_ALIGNMENT 8
+#define SNAPSHOT_ALIGN(size) (((size) + SNAPSHOT_ALIGNMENT - 1) & ~((size_t)SNAPSHOT_ALIGNMENT - 1))
+
+// Image layout: header, then a record for each file followed by its pathname and its content
+typedef struct snapshot_header {
+    char magic[8];
+    uint64_t files_count;
+    uint64_t wal_generation;
+} snapshot_header_t;
+
+typedef struct snapshot_record {
+    int64_t creation_sec;
+    int64_t creation_nsec;
+    int64_t last_use_sec;
+    int64_t last_use_nsec;
+    uint64_t size;
+    uint32_t use_frequency;
+    uint32_t pathname_length;
+} snapshot_record_t;
+
+struct snapshot {
+    void* map;
+    size_t map_size;
+    size_t files_count;
+    size_t files_skipped;
+    uint64_t wal_generation;
+};
+
+// Buffered writer of the image, the contents bigger than the free space are written directly
+typedef struct snapshot_writer {
+    int fd;
+    size_t used;
+    char buffer[SNAPSHOT_BUFFER_SIZE];
+} snapshot_writer_t;
+
+static int writer_flush(snapshot_writer_t* writer)
+{
+    if(writer->used == 0)
+        return 1;
+
+    int res = writen(writer->fd, writer->buffer, writer->used);
+    writer->used = 0;
+    return res;
+}
+
+static int writer_put(snapshot_writer_t* writer, const void* data, size_t size)
+{
+    if(writer->used + size > SNAPSHOT_BUFFER_SIZE)
+    {
+        RET_IF(writer_flush(writer) <= 0, -1);
+        if(size > SNAPSHOT_BUFFER_SIZE)
+            return writen(writer->fd, (void*)data, size);
+    }
+
+    memcpy(writer->buffer + writer->used, data, size);
+    writer->used += size;
+    return 1;
+}
+
+static int writer_put_file(snapshot_writer_t* writer, file_stored_t* file)
+{
+    const char* pathname = file_get_pathname(file);
+    segment_list_t* content = file_get_content(file);
+    snapshot_record_t record;
+    memset(&record, 0, sizeof(snapshot_record_t));
+    record.creation_sec = file_get_creation_time(file)->tv_sec;
+    record.creation_nsec = file_get_creation_time(file)->tv_nsec;
+    record.last_use_sec = file_get_last_use_time(file)->tv_sec;
+    record.last_use_nsec = file_get_last_use_time(file)->tv_nsec;
+    record.size = sl_get_size(content);
+    record.use_frequency = file_get_use_frequency(file);
+    record.pathname_length = strnlen(pathname, MAX_PATHNAME_API_LENGTH);
+
+    RET_IF(writer_put(writer, &record, sizeof(snapshot_record_t)) <= 0, -1);
+    RET_IF(writer_put(writer, pathname, record.pathname_length) <= 0, -1);
+    if(writer->used + record.size <= SNAPSHOT_BUFFER_SIZE)
+    {
+        writer->used += sl_copy_to(content, writer->buffer + writer->used, record.size);
+    }
+    else
+    {
+        RET_IF(writer_flush(writer) <= 0, -1);
+        RET_IF(sl_writen(writer->fd, content) <= 0, -1);
+    }
+
+    static const char padding[SNAPSHOT_ALIGNMENT] = { 0 };
+    size_t written = sizeof(snapshot_record_t) + record.pathname_length + record.size;
+    return writer_put(writer, padding, SNAPSHOT_ALIGN(written) - written);
+}
+
+// Make the directory entry of path durable, so the image renamed there survives a crash
+// Returns 0 on success, -1 on failure with errno set
+static int sync_parent_dir(const char* path)
+{
+    char dir_path[MAX_PATHNAME_API_LENGTH + 1];
+    strncpy(dir_path, path, MAX_PATHNAME_API_LENGTH);
+    dir_path[MAX_PATHNAME_API_LENGTH] = '\0';
+    int dir_fd = open(dirname(dir_path), O_RDONLY);
+    RET_IF(dir_fd == -1, -1);
+
+    int res = fsync(dir_fd);
+    int error = errno;
+    close(dir_fd);
+    errno = error;
+    return res;
+}
+
+int write_snapshot_fs(file_system_t** shards, size_t shards_count, const char* path, uint64_t wal_generation)
+{
+    RET_IF(!shards || shards_count == 0 || !path, -1);
+
+    char tmp_path[MAX_PATHNAME_API_LENGTH + sizeof(".tmp")];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    snapshot_writer_t* writer;
+    CHECK_FATAL_EQ(writer, malloc(sizeof(snapshot_writer_t)), NULL, NO_MEM_FATAL);
+    writer->used = 0;
+    writer->fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(writer->fd == -1)
+    {
+        free(writer);
+        return -1;
+    }
+
+    arena_t* arena = create_arena(0);
+    size_t files_count = 0;
+    for(size_t s = 0; s < shards_count; ++s)
+        files_count += get_file_count_fs(shards[s]);
+
+    snapshot_header_t header;
+    memset(&header, 0, sizeof(snapshot_header_t));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.files_count = files_count;
+    header.wal_generation = wal_generation;
+
+    // the oldest files of each shard are written first, so loading them restores the same order
+    int res = writer_put(writer, &header, sizeof(snapshot_header_t)) > 0 ? 0 : -1;
+    for(size_t s = 0; s < shards_count && res == 0; ++s)
+    {
+        file_stored_t** files = get_files_stored(shards[s], arena);
+        for(size_t i = get_file_count_fs(shards[s]); i > 0 && res == 0; --i)
+            res = writer_put_file(writer, files[i - 1]) > 0 ? 0 : -1;
+    }
+
+    if(res == 0 && (writer_flush(writer) <= 0 || fsync(writer->fd) == -1))
+        res = -1;
+
+    int error = errno;
+    close(writer->fd);
+    free(writer);
+    free_arena(arena);
+
+    if(res == 0 && rename(tmp_path, path) == -1)
+    {
+        res = -1;
+        error = errno;
+    }
+    if(res == -1)
+        unlink(tmp_path);
+    // until the rename is durable a crash can bring back the previous image, which needs the log generations it replaces
+    else if(sync_parent_dir(path) == -1)
+    {
+        res = -1;
+        error = errno;
+    }
+
+    errno = error;
+    return res;
+}
+
+pid_t fork_snapshot_fs(file_system_t** shards, size_t shards_count, const char* path, uint64_t wal_generation)
+{
+    RET_IF(!shards || shards_count == 0 || !path, -1);
+
+    // the write locks held by the caller wait for the requests in progress, the child sees a consistent copy of every file
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        // only the forking thread exists in the child, no lock of the copy can be touched
+        int res = write_snapshot_fs(shards, shards_count, path, wal_generation);
+        _exit(res == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    return pid;
+}
+
+// Check whether the record at offset and its data are inside the mapping
+static bool_t is_record_valid(size_t map_size, size_t offset, const snapshot_record_t* record)
+{
+    RET_IF(offset + sizeof(snapshot_record_t) > map_size, FALSE);
+
+    size_t left = map_size - offset - sizeof(snapshot_record_t);
+    RET_IF(record->pathname_length == 0 || record->pathname_length > MAX_PATHNAME_API_LENGTH, FALSE);
+    RET_IF(record->pathname_length > left, FALSE);
+    return record->size <= left - record->pathname_length;
+}
+
+snapshot_t* load_snapshot_fs(file_system_t* fs, const char* path)
+{
+    RET_IF(!fs || !path, NULL);
+
+    int fd = open(path, O_RDONLY);
+    RET_IF(fd == -1, NULL);
+
+    struct stat st;
+    if(fstat(fd, &st) == -1 || st.st_size < sizeof(snapshot_header_t))
+    {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    size_t map_size = st.st_size;
+    void* map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    RET_IF(map == MAP_FAILED, NULL);
+
+    const snapshot_header_t* header = map;
+    if(memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0)
+    {
+        munmap(map, map_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    snapshot_t* snapshot;
+    CHECK_FATAL_EQ(snapshot, malloc(sizeof(snapshot_t)), NULL, NO_MEM_FATAL);
+    snapshot->map = map;
+    snapshot->map_size = map_size;
+    snapshot->files_count = 0;
+    snapshot->files_skipped = 0;
+    snapshot->wal_generation = header->wal_generation;
+
+    // only the records are read here, the pages of the contents are faulted in by the first reads
+    size_t offset = sizeof(snapshot_header_t);
+    for(uint64_t i = 0; i < header->files_count; ++i)
+    {
+        const snapshot_record_t* record = (const snapshot_record_t*)((char*)map + offset);
+        if(!is_record_valid(map_size, offset, record))
+        {
+            PRINT_WARNING(EINVAL, "Snapshot %s is corrupted, %lu files were not loaded!", path, (unsigned long)(header->files_count - i));
+            break;
+        }
+
+        char pathname[MAX_PATHNAME_API_LENGTH + 1];
+        const char* record_pathname = (const char*)(record + 1);
+        memcpy(pathname, record_pathname, record->pathname_length);
+        pathname[record->pathname_length] = '\0';
+        const char* content = record_pathname + record->pathname_length;
+        offset += SNAPSHOT_ALIGN(sizeof(snapshot_record_t) + record->pathname_length + record->size);
+
+        if(is_file_count_full_fs(fs) || is_size_available(fs, record->size) > 0 || find_file_fs(fs, pathname))
+        {
+            ++snapshot->files_skipped;
+            continue;
+        }
+
+        file_stored_t* file = create_file(pathname);
+        sl_append_mapped(file_get_content(file), content, record->size);
+        file_set_creation_time(file, (struct timespec){ record->creation_sec, record->creation_nsec });
+        file_set_last_use_time(file, (struct timespec){ record->last_use_sec, record->last_use_nsec });
+        file_set_use_frequency(file, record->use_frequency);
+        add_file_fs(fs, pathname, file);
+        ++snapshot->files_count;
+    }
+
+    return snapshot;
+}
+
+size_t snapshot_get_files_count(const snapshot_t* snapshot)
+{
+    RET_IF(!snapshot, 0);
+    return snapshot->files_count;
+}
+
+uint64_t snapshot_get_wal_generation(const snapshot_t* snapshot)
+{
+    RET_IF(!snapshot, 0);
+    return snapshot->wal_generation;
+}
+
+size_t snapshot_get_files_skipped(const snapshot_t* snapshot)
+{
+    RET_IF(!snapshot, 0);
+    return snapshot->files_skipped;
+}
+
+void free_snapshot(snapshot_t* snapshot)
+{
+    NRET_IF(!snapshot);
+
+    munmap(snapshot->map, snapshot->map_size);
+    free(snapshot);
+}
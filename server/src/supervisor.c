@@ -0,0 +1,367 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+#include <signal.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+
+#include "supervisor.h"
+#include "server.h"
+
+// A shard process crashing sooner than this after being started is not restarted, it would crash again
+#define SHARD_RESTART_MIN_SECONDS 5
+// Milliseconds a client has to send its shard map request
+#define SHARD_MAP_TIMEOUT_MS 1000
+// Clients whose shard map request is read at once, the next ones wait to be accepted
+#define SHARD_MAP_MAX_CLIENTS 64
+
+// A shard process and its config, pid is -1 once it quit
+typedef struct shard_process {
+    configuration_params_t* config;
+    char socket_name[MAX_PATHNAME_API_LENGTH + 1];
+    pid_t pid;
+    time_t started;
+} shard_process_t;
+
+static shard_process_t* processes = NULL;
+static unsigned int processes_count = 0;
+// Listening socket of the supervisor and descriptor of the signals it waits for, closed by the shard processes
+static int supervisor_socket = -1;
+static int signal_fd = -1;
+// Signal mask before the supervisor blocked its signals, given back to the shard processes
+static sigset_t original_mask;
+
+// A client asking the shard map, its request is read without blocking as it arrives
+typedef struct map_client {
+    int fd;
+    // first byte and op of the request
+    char request[sizeof(char) + sizeof(server_packet_op_t)];
+    size_t received;
+    // the client is closed if its request didn't arrive yet
+    long deadline_ms;
+} map_client_t;
+
+static map_client_t map_clients[SHARD_MAP_MAX_CLIENTS];
+static unsigned int map_clients_count = 0;
+
+// Fork the shard process index, which runs a whole server with its own config
+static pid_t spawn_shard_process(unsigned int index)
+{
+    shard_process_t* process = &processes[index];
+    process->started = time(NULL);
+    process->pid = fork();
+    if(process->pid != 0)
+    {
+        if(process->pid == -1)
+            PRINT_WARNING(errno, "Cannot start shard process %u!", index);
+        return process->pid;
+    }
+
+    close(supervisor_socket);
+    close(signal_fd);
+    for(unsigned int i = 0; i < map_clients_count; ++i)
+        close(map_clients[i].fd);
+    sigprocmask(SIG_SETMASK, &original_mask, NULL);
+
+    int status = init_server(process->config);
+    if(status == SERVER_OK)
+        status = start_server();
+    _exit(status == SERVER_OK ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+// Milliseconds since an arbitrary point, used by the deadlines of the clients
+static long monotonic_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Reply the sockets of the shard processes to client, once it asked them with OP_SHARD_MAP
+// The reply is written at once without waiting, it's far smaller than the buffer of a new socket
+static void reply_shard_map(int client)
+{
+    server_packet_op_t res_op = OP_OK;
+    size_t count = processes_count;
+    size_t size = sizeof(server_packet_op_t) + sizeof(size_t);
+    for(unsigned int i = 0; i < processes_count; ++i)
+        size += sizeof(size_t) + strnlen(processes[i].socket_name, MAX_PATHNAME_API_LENGTH);
+
+    char* reply;
+    CHECK_FATAL_EQ(reply, malloc(size), NULL, NO_MEM_FATAL);
+    char* next = reply;
+    memcpy(next, &res_op, sizeof(server_packet_op_t));
+    next += sizeof(server_packet_op_t);
+    memcpy(next, &count, sizeof(size_t));
+    next += sizeof(size_t);
+    for(unsigned int i = 0; i < processes_count; ++i)
+    {
+        // each name is sent as writen_string does
+        size_t len = strnlen(processes[i].socket_name, MAX_PATHNAME_API_LENGTH);
+        memcpy(next, &len, sizeof(size_t));
+        next += sizeof(size_t);
+        memcpy(next, processes[i].socket_name, len);
+        next += len;
+    }
+
+    if(send(client, reply, size, MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t)size)
+    {
+        PRINT_WARNING(errno, "Cannot reply the shard map to a client!");
+    }
+    free(reply);
+}
+
+// Read the request of client as it arrives, it's replied once complete
+// Returns TRUE if the request is still arriving, FALSE once client can be closed
+static bool_t read_map_client(map_client_t* client)
+{
+    ssize_t res = 0;
+    size_t request_size = sizeof(client->request);
+    while(client->received < request_size && (res = read(client->fd, client->request + client->received, request_size - client->received)) > 0)
+        client->received += res;
+
+    if(client->received < request_size)
+    {
+        if(res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            return TRUE;
+        PRINT_WARNING(res == -1 ? errno : EBADMSG, "Client left before asking the shard map!");
+        return FALSE;
+    }
+
+    server_packet_op_t op;
+    memcpy(&op, client->request + sizeof(char), sizeof(server_packet_op_t));
+    if(op != OP_SHARD_MAP)
+    {
+        PRINT_WARNING(EBADMSG, "Client didn't ask the shard map, only the shard processes handle the requests!");
+    }
+    else
+        reply_shard_map(client->fd);
+    return FALSE;
+}
+
+// Close the client index, the last one takes its place
+static void remove_map_client(unsigned int index)
+{
+    close(map_clients[index].fd);
+    map_clients[index] = map_clients[--map_clients_count];
+}
+
+// Accept the clients waiting to ask the shard map while there's room for them
+static void accept_map_clients(void)
+{
+    while(map_clients_count < SHARD_MAP_MAX_CLIENTS)
+    {
+        int fd = accept4(supervisor_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd == -1)
+        {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+            {
+                PRINT_WARNING(errno, "Supervisor cannot accept a client!");
+            }
+            return;
+        }
+
+        map_client_t* client = &map_clients[map_clients_count++];
+        client->fd = fd;
+        client->received = 0;
+        client->deadline_ms = monotonic_ms() + SHARD_MAP_TIMEOUT_MS;
+    }
+}
+
+// Reap the shard processes which quit, a crashed one is restarted unless the supervisor is closing
+// Returns the count of the shard processes still running
+static unsigned int reap_shard_processes(bool_t closing, unsigned int running)
+{
+    int status;
+    pid_t pid;
+    while((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        for(unsigned int i = 0; i < processes_count; ++i)
+        {
+            if(processes[i].pid != pid)
+                continue;
+
+            processes[i].pid = -1;
+            --running;
+            if(!WIFSIGNALED(status))
+            {
+                if(!closing)
+                    PRINT_WARNING(0, "Shard process %u quit with status %d!", i, WEXITSTATUS(status));
+                break;
+            }
+
+            // the other shards keep running meanwhile
+            PRINT_WARNING(0, "Shard process %u crashed with signal %d!", i, WTERMSIG(status));
+            if(closing || time(NULL) - processes[i].started < SHARD_RESTART_MIN_SECONDS)
+                break;
+            if(spawn_shard_process(i) != -1)
+            {
+                PRINT_INFO("Shard process %u restarted with PID %d.", i, processes[i].pid);
+                ++running;
+            }
+            break;
+        }
+    }
+
+    return running;
+}
+
+// Listen to socket_name, returns the socket or -1 on failure
+static int listen_supervisor_socket(const char* socket_name, int backlog)
+{
+    int fd;
+    // the clients are accepted inside the loop of the supervisor, which never blocks on them
+    CHECK_ERROR_EQ(fd, socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0), -1, -1, "Couldn't initialize socket!");
+
+    struct sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    strncpy(sa.sun_path, socket_name, MAX_PATHNAME_API_LENGTH);
+    sa.sun_family = AF_UNIX;
+    remove(socket_name);
+
+    if(bind(fd, (struct sockaddr*)&sa, sizeof(sa)) == -1 || listen(fd, backlog) == -1)
+    {
+        PRINT_ERROR(errno, "Couldn't listen to socket %s!", socket_name);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int run_shard_supervisor(const configuration_params_t* config)
+{
+    processes_count = config_get_shard_processes(config);
+    CHECK_FATAL_EQ(processes, calloc(processes_count, sizeof(shard_process_t)), NULL, NO_MEM_FATAL);
+    for(unsigned int i = 0; i < processes_count; ++i)
+    {
+        processes[i].pid = -1;
+        processes[i].config = config_for_shard_process(config, i);
+        if(!processes[i].config)
+        {
+            PRINT_ERROR(errno, "Cannot configure shard process %u!", i);
+            for(unsigned int j = 0; j < i; ++j)
+                free_config(processes[j].config);
+            free(processes);
+            return -1;
+        }
+        config_get_socket_name(processes[i].config, processes[i].socket_name);
+    }
+
+    // the signals are read from a descriptor, together with the clients asking the shard map
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGQUIT);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &signals, &original_mask);
+    signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+
+    char socket_name[MAX_PATHNAME_API_LENGTH + 1];
+    config_get_socket_name(config, socket_name);
+    supervisor_socket = listen_supervisor_socket(socket_name, config_get_backlog_sockets_num(config));
+
+    unsigned int running = 0;
+    for(unsigned int i = 0; i < processes_count && supervisor_socket != -1 && signal_fd != -1; ++i)
+    {
+        if(spawn_shard_process(i) != -1)
+            ++running;
+    }
+    PRINT_INFO("Supervisor started %u shard processes, shard map on %s.", running, socket_name);
+    int result = running > 0 ? 0 : -1;
+
+    bool_t closing = FALSE;
+    // the signals, the listening socket and the clients asking the shard map
+    struct pollfd fds[2 + SHARD_MAP_MAX_CLIENTS];
+    while(running > 0)
+    {
+        // no client is accepted while there's no room for it
+        fds[0] = (struct pollfd){ signal_fd, POLLIN, 0 };
+        fds[1] = (struct pollfd){ !closing && map_clients_count < SHARD_MAP_MAX_CLIENTS ? supervisor_socket : -1, POLLIN, 0 };
+        // wake up in time for the deadline of the oldest client
+        long timeout_ms = -1;
+        long now = monotonic_ms();
+        for(unsigned int i = 0; i < map_clients_count; ++i)
+        {
+            fds[2 + i] = (struct pollfd){ map_clients[i].fd, POLLIN, 0 };
+            long remaining = MAX(map_clients[i].deadline_ms - now, 0);
+            if(timeout_ms < 0 || remaining < timeout_ms)
+                timeout_ms = remaining;
+        }
+
+        int res = poll(fds, 2 + map_clients_count, (int)timeout_ms);
+        if(res == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            PRINT_ERROR(errno, "Supervisor cannot wait for its events!");
+            break;
+        }
+
+        struct signalfd_siginfo info;
+        if((fds[0].revents & POLLIN) && read(signal_fd, &info, sizeof(info)) == sizeof(info))
+        {
+            if(info.ssi_signo == SIGCHLD)
+            {
+                running = reap_shard_processes(closing, running);
+            }
+            else
+            {
+                // each shard process closes as asked, the supervisor waits for all of them
+                closing = TRUE;
+                for(unsigned int i = 0; i < processes_count; ++i)
+                {
+                    if(processes[i].pid != -1)
+                        kill(processes[i].pid, info.ssi_signo);
+                }
+            }
+        }
+
+        // backwards, a client removed takes the place of one already handled
+        now = monotonic_ms();
+        for(unsigned int i = map_clients_count; i-- > 0;)
+        {
+            bool_t waiting;
+            if(fds[2 + i].revents != 0)
+                waiting = read_map_client(&map_clients[i]);
+            else
+            {
+                waiting = now < map_clients[i].deadline_ms;
+                if(!waiting)
+                {
+                    PRINT_WARNING(ETIMEDOUT, "Client didn't ask the shard map in time!");
+                }
+            }
+
+            if(!waiting)
+                remove_map_client(i);
+        }
+
+        if(!closing && (fds[1].revents & POLLIN))
+            accept_map_clients();
+    }
+
+    while(map_clients_count > 0)
+        remove_map_client(map_clients_count - 1);
+    // a failure above leaves the shard processes running, they're closed as the supervisor would be
+    for(unsigned int i = 0; i < processes_count; ++i)
+    {
+        if(processes[i].pid != -1)
+        {
+            kill(processes[i].pid, SIGINT);
+            waitpid(processes[i].pid, NULL, 0);
+        }
+        free_config(processes[i].config);
+    }
+    free(processes);
+    close(supervisor_socket);
+    close(signal_fd);
+    remove(socket_name);
+    sigprocmask(SIG_SETMASK, &original_mask, NULL);
+    return result;
+}
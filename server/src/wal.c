@@ -0,0 +1,635 @@
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "wal.h"
+#include "page_alloc.h"
+
+// Initial capacity of the buffers of the pending records
+#define WAL_BUFFER_SIZE (256 * 1024)
+// Max length of the pathname of a generation
+#define WAL_PATH_LENGTH (MAX_PATHNAME_API_LENGTH + 24)
+
+// A change waiting for its record to be durable, synced tells whether it waits for the sync or only for the write
+typedef struct wal_waiter {
+    int waiter;
+    uint64_t lsn;
+    bool_t synced;
+} wal_waiter_t;
+
+// Header of each record, followed by the pathname and the data of the change
+// The checksum covers everything after itself, so a torn record at the end of a generation is detected
+typedef struct wal_record {
+    uint32_t checksum;
+    uint32_t type;
+    uint64_t lsn;
+    uint64_t size;
+    uint32_t pathname_length;
+    uint32_t reserved;
+} wal_record_t;
+
+struct wal {
+    char path[MAX_PATHNAME_API_LENGTH + 1];
+    uint64_t generation;
+    int fd;
+
+    // records appended and not yet taken by the writer
+    char* buffer;
+    size_t buffer_used;
+    size_t buffer_capacity;
+    // records being written by the writer
+    char* flush_buffer;
+    size_t flush_capacity;
+
+    uint64_t last_lsn;
+    uint64_t written_lsn;
+    uint64_t synced_lsn;
+    server_durability_t default_level;
+    bool_t failed;
+    bool_t closing;
+    wal_metrics_t metrics;
+    // changes waiting for their records, given to on_durable once the records are durable
+    void (*on_durable)(int waiter);
+    wal_waiter_t* waiters;
+    size_t waiters_count;
+    size_t waiters_capacity;
+
+    // protects everything above, the writer waits on work_cond
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+    // held while writing to fd, so a rotation never closes it under the writer
+    pthread_mutex_t io_mutex;
+    pthread_t writer;
+};
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void init_crc_table()
+{
+    for(uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t crc = i;
+        for(int bit = 0; bit < 8; ++bit)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        crc_table[i] = crc;
+    }
+}
+
+// CRC-32 (IEEE) of data, continuing from crc (0 at the start)
+static uint32_t crc32_update(uint32_t crc, const void* data, size_t size)
+{
+    const unsigned char* bytes = data;
+    crc = ~crc;
+    for(size_t i = 0; i < size; ++i)
+        crc = crc_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// The data of a record can be given in two parts, head_size bytes of head followed by the rest inside data
+static uint32_t record_checksum(const wal_record_t* record, const char* pathname, const void* head, size_t head_size, const void* data)
+{
+    uint32_t crc = crc32_update(0, &record->type, sizeof(wal_record_t) - offsetof(wal_record_t, type));
+    crc = crc32_update(crc, pathname, record->pathname_length);
+    crc = crc32_update(crc, head, head_size);
+    return crc32_update(crc, data, record->size - head_size);
+}
+
+static void get_generation_path(const char* path, uint64_t generation, char output[WAL_PATH_LENGTH])
+{
+    snprintf(output, WAL_PATH_LENGTH, "%s.%lu", path, (unsigned long)generation);
+}
+
+// Open a generation for appending and make its directory entry durable
+static int open_generation(const char* path, uint64_t generation)
+{
+    char generation_path[WAL_PATH_LENGTH];
+    get_generation_path(path, generation, generation_path);
+    int fd = open(generation_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    RET_IF(fd == -1, -1);
+
+    char dir_path[MAX_PATHNAME_API_LENGTH + 1];
+    strncpy(dir_path, path, MAX_PATHNAME_API_LENGTH);
+    dir_path[MAX_PATHNAME_API_LENGTH] = '\0';
+    int dir_fd = open(dirname(dir_path), O_RDONLY);
+    if(dir_fd != -1)
+    {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    return fd;
+}
+
+// Find the oldest and the newest generations of the log at path, returns FALSE if there are none
+static bool_t find_generations(const char* path, uint64_t* oldest, uint64_t* newest)
+{
+    char dir_path[MAX_PATHNAME_API_LENGTH + 1];
+    char base_path[MAX_PATHNAME_API_LENGTH + 1];
+    strncpy(dir_path, path, MAX_PATHNAME_API_LENGTH);
+    strncpy(base_path, path, MAX_PATHNAME_API_LENGTH);
+    dir_path[MAX_PATHNAME_API_LENGTH] = base_path[MAX_PATHNAME_API_LENGTH] = '\0';
+    char* base = basename(base_path);
+    size_t base_length = strlen(base);
+
+    DIR* dir = opendir(dirname(dir_path));
+    RET_IF(!dir, FALSE);
+
+    bool_t found = FALSE;
+    struct dirent* entry;
+    while((entry = readdir(dir)) != NULL)
+    {
+        if(strncmp(entry->d_name, base, base_length) != 0 || entry->d_name[base_length] != '.')
+            continue;
+
+        char* digits = entry->d_name + base_length + 1;
+        char* end;
+        uint64_t generation = strtoull(digits, &end, 10);
+        if(*digits == '\0' || *end != '\0')
+            continue;
+
+        *oldest = found ? MIN(*oldest, generation) : generation;
+        *newest = found ? MAX(*newest, generation) : generation;
+        found = TRUE;
+    }
+
+    closedir(dir);
+    return found;
+}
+
+// Mark this log as failed, the changes waiting for durability get an error once resumed
+// Must be called with the log mutex acquired
+static void wal_fail(wal_t* wal, const char* reason)
+{
+    PRINT_ERROR(errno, "Write-ahead log %s: %s", wal->path, reason);
+    wal->failed = TRUE;
+}
+
+// Get the log sequence number reached by the records durable as level requests
+// Must be called with the log mutex acquired
+static uint64_t get_durable_lsn(wal_t* wal, server_durability_t level)
+{
+    return level == D_WRITTEN ? wal->written_lsn : wal->synced_lsn;
+}
+
+// Take the waiters whose record is durable as they asked, every one once the log failed, count is set to how many
+// Returns NULL if there are none. Must be called with the log mutex acquired, the waiters are resumed after releasing it
+static int* take_durable_waiters(wal_t* wal, size_t* count)
+{
+    int* durable = NULL;
+    *count = 0;
+    for(size_t i = wal->waiters_count; i > 0; --i)
+    {
+        wal_waiter_t* waiter = &wal->waiters[i - 1];
+        if(!wal->failed && get_durable_lsn(wal, waiter->synced ? D_SYNC : D_WRITTEN) < waiter->lsn)
+            continue;
+
+        if(!durable)
+            CHECK_FATAL_EQ(durable, malloc(wal->waiters_count * sizeof(int)), NULL, NO_MEM_FATAL);
+        durable[(*count)++] = waiter->waiter;
+        *waiter = wal->waiters[--wal->waiters_count];
+    }
+    return durable;
+}
+
+// Resume the waiters taken by take_durable_waiters and free them
+static void resume_waiters(wal_t* wal, int* durable, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+        wal->on_durable(durable[i]);
+    free(durable);
+}
+
+// Take the pending records, the buffers are swapped so the appends continue while the batch is written
+// Must be called with the log mutex acquired
+static char* take_pending_records(wal_t* wal, size_t* batch_size)
+{
+    char* batch = wal->buffer;
+    size_t batch_capacity = wal->buffer_capacity;
+    *batch_size = wal->buffer_used;
+    wal->buffer = wal->flush_buffer;
+    wal->buffer_capacity = wal->flush_capacity;
+    wal->flush_buffer = batch;
+    wal->flush_capacity = batch_capacity;
+    wal->buffer_used = 0;
+    return batch;
+}
+
+// Routine of the writer thread, each batch of records shares a single write and a single sync
+static void* wal_writer(void* params)
+{
+    wal_t* wal = params;
+    while(TRUE)
+    {
+        LOCK_MUTEX(&wal->mutex);
+        while(wal->buffer_used == 0 && !wal->closing)
+            COND_WAIT(&wal->work_cond, &wal->mutex);
+        bool_t must_close = wal->buffer_used == 0 && wal->closing;
+        UNLOCK_MUTEX(&wal->mutex);
+        if(must_close)
+            break;
+
+        LOCK_MUTEX(&wal->io_mutex);
+        LOCK_MUTEX(&wal->mutex);
+        // the records appended while the previous batch was being synced are taken together
+        size_t batch_size;
+        uint64_t batch_lsn = wal->last_lsn;
+        char* batch = take_pending_records(wal, &batch_size);
+        UNLOCK_MUTEX(&wal->mutex);
+
+        if(batch_size > 0)
+        {
+            size_t count;
+            int res = writen(wal->fd, batch, batch_size);
+            LOCK_MUTEX(&wal->mutex);
+            ++wal->metrics.writes;
+            if(res <= 0)
+                wal_fail(wal, "write failed");
+            else
+                wal->written_lsn = batch_lsn;
+            int* durable = take_durable_waiters(wal, &count);
+            UNLOCK_MUTEX(&wal->mutex);
+            resume_waiters(wal, durable, count);
+
+            res = fdatasync(wal->fd);
+            LOCK_MUTEX(&wal->mutex);
+            ++wal->metrics.syncs;
+            if(res == -1)
+                wal_fail(wal, "sync failed");
+            else if(!wal->failed)
+                wal->synced_lsn = batch_lsn;
+            durable = take_durable_waiters(wal, &count);
+            UNLOCK_MUTEX(&wal->mutex);
+            resume_waiters(wal, durable, count);
+        }
+        UNLOCK_MUTEX(&wal->io_mutex);
+    }
+
+    return NULL;
+}
+
+wal_t* create_wal(const char* path, uint64_t generation, uint64_t last_lsn, server_durability_t default_level, void (*on_durable)(int waiter))
+{
+    RET_IF(!path || !on_durable, NULL);
+
+    int fd = open_generation(path, generation);
+    RET_IF(fd == -1, NULL);
+
+    pthread_once(&crc_once, init_crc_table);
+    wal_t* wal;
+    CHECK_FATAL_EQ(wal, malloc(sizeof(wal_t)), NULL, NO_MEM_FATAL);
+    memset(wal, 0, sizeof(wal_t));
+    strncpy(wal->path, path, MAX_PATHNAME_API_LENGTH);
+    wal->generation = generation;
+    wal->fd = fd;
+    wal->last_lsn = wal->written_lsn = wal->synced_lsn = last_lsn;
+    wal->default_level = default_level;
+    wal->on_durable = on_durable;
+    wal->buffer_capacity = wal->flush_capacity = WAL_BUFFER_SIZE;
+    CHECK_FATAL_EQ(wal->buffer, malloc(wal->buffer_capacity), NULL, NO_MEM_FATAL);
+    CHECK_FATAL_EQ(wal->flush_buffer, malloc(wal->flush_capacity), NULL, NO_MEM_FATAL);
+
+    INIT_MUTEX(&wal->mutex);
+    INIT_MUTEX(&wal->io_mutex);
+    INIT_COND(&wal->work_cond);
+    CHECK_FATAL_EVAL(pthread_create(&wal->writer, NULL, wal_writer, wal) != 0, THREAD_CREATE_FATAL);
+
+    return wal;
+}
+
+// Append a record whose data is head_size bytes of head followed by size bytes of data
+static uint64_t append_record(wal_t* wal, wal_record_type_t type, const char* pathname, const void* head, size_t head_size, const void* data, size_t size)
+{
+    RET_IF(!wal || !pathname, 0);
+
+    wal_record_t record;
+    memset(&record, 0, sizeof(wal_record_t));
+    record.type = type;
+    record.size = head_size + size;
+    record.pathname_length = strnlen(pathname, MAX_PATHNAME_API_LENGTH);
+    size_t record_size = sizeof(wal_record_t) + record.pathname_length + record.size;
+
+    LOCK_MUTEX(&wal->mutex);
+    if(wal->buffer_used + record_size > wal->buffer_capacity)
+    {
+        size_t new_capacity = MAX(wal->buffer_capacity * 2, wal->buffer_used + record_size);
+        CHECK_FATAL_EQ(wal->buffer, realloc(wal->buffer, new_capacity), NULL, NO_MEM_FATAL);
+        wal->buffer_capacity = new_capacity;
+    }
+
+    record.lsn = ++wal->last_lsn;
+    record.checksum = record_checksum(&record, pathname, head, head_size, data);
+    char* dest = wal->buffer + wal->buffer_used + sizeof(wal_record_t);
+    memcpy(dest - sizeof(wal_record_t), &record, sizeof(wal_record_t));
+    memcpy(dest, pathname, record.pathname_length);
+    dest += record.pathname_length;
+    if(head_size > 0)
+        memcpy(dest, head, head_size);
+    if(size > 0)
+        memcpy(dest + head_size, data, size);
+
+    if(wal->buffer_used == 0)
+        COND_SIGNAL(&wal->work_cond);
+    wal->buffer_used += record_size;
+    ++wal->metrics.records;
+    wal->metrics.bytes += record_size;
+    uint64_t lsn = record.lsn;
+    UNLOCK_MUTEX(&wal->mutex);
+
+    return lsn;
+}
+
+uint64_t wal_append(wal_t* wal, wal_record_type_t type, const char* pathname, const void* data, size_t size)
+{
+    return append_record(wal, type, pathname, NULL, 0, data, size);
+}
+
+uint64_t wal_append_at(wal_t* wal, const char* pathname, size_t offset, const void* data, size_t size)
+{
+    uint64_t record_offset = offset;
+    return append_record(wal, WAL_WRITE_AT, pathname, &record_offset, sizeof(uint64_t), data, size);
+}
+
+int wal_watch(wal_t* wal, uint64_t lsn, server_durability_t level, int waiter)
+{
+    RET_IF(!wal, 1);
+    if(level == D_DEFAULT)
+        level = wal->default_level;
+    RET_IF(level == D_ASYNC, 1);
+
+    int res = 1;
+    LOCK_MUTEX(&wal->mutex);
+    if(get_durable_lsn(wal, level) < lsn && wal->failed)
+    {
+        res = -1;
+        errno = EIO;
+    }
+    else if(get_durable_lsn(wal, level) < lsn)
+    {
+        if(wal->waiters_count == wal->waiters_capacity)
+        {
+            wal->waiters_capacity = MAX(wal->waiters_capacity * 2, 16);
+            CHECK_FATAL_EQ(wal->waiters, realloc(wal->waiters, wal->waiters_capacity * sizeof(wal_waiter_t)), NULL, NO_MEM_FATAL);
+        }
+        wal_waiter_t* entry = &wal->waiters[wal->waiters_count++];
+        entry->waiter = waiter;
+        entry->lsn = lsn;
+        entry->synced = level == D_SYNC;
+        res = 0;
+    }
+    UNLOCK_MUTEX(&wal->mutex);
+
+    return res;
+}
+
+void wal_unwatch(wal_t* wal, int waiter)
+{
+    NRET_IF(!wal);
+
+    LOCK_MUTEX(&wal->mutex);
+    for(size_t i = wal->waiters_count; i > 0; --i)
+    {
+        if(wal->waiters[i - 1].waiter == waiter)
+            wal->waiters[i - 1] = wal->waiters[--wal->waiters_count];
+    }
+    UNLOCK_MUTEX(&wal->mutex);
+}
+
+uint64_t wal_rotate(wal_t* wal)
+{
+    RET_IF(!wal, 0);
+
+    LOCK_MUTEX(&wal->io_mutex);
+    LOCK_MUTEX(&wal->mutex);
+    size_t batch_size;
+    uint64_t batch_lsn = wal->last_lsn;
+    char* batch = take_pending_records(wal, &batch_size);
+    UNLOCK_MUTEX(&wal->mutex);
+
+    // the writer is idle, every batch it took is already synced
+    bool_t synced = (batch_size == 0 || writen(wal->fd, batch, batch_size) > 0) && fdatasync(wal->fd) == 0;
+    close(wal->fd);
+    int fd = open_generation(wal->path, wal->generation + 1);
+
+    LOCK_MUTEX(&wal->mutex);
+    if(!synced)
+        wal_fail(wal, "write failed while rotating");
+    if(fd == -1)
+        wal_fail(wal, "cannot open a new generation");
+    wal->fd = fd;
+    ++wal->generation;
+    if(synced)
+        wal->written_lsn = wal->synced_lsn = batch_lsn;
+    if(batch_size > 0)
+    {
+        ++wal->metrics.writes;
+        ++wal->metrics.syncs;
+    }
+    size_t count;
+    int* durable = take_durable_waiters(wal, &count);
+    uint64_t generation = wal->generation;
+    UNLOCK_MUTEX(&wal->mutex);
+    UNLOCK_MUTEX(&wal->io_mutex);
+    resume_waiters(wal, durable, count);
+
+    return generation;
+}
+
+void wal_truncate(wal_t* wal, uint64_t generation)
+{
+    NRET_IF(!wal);
+
+    uint64_t oldest, newest;
+    NRET_IF(!find_generations(wal->path, &oldest, &newest));
+
+    char generation_path[WAL_PATH_LENGTH];
+    for(uint64_t i = oldest; i < generation; ++i)
+    {
+        get_generation_path(wal->path, i, generation_path);
+        unlink(generation_path);
+    }
+}
+
+wal_metrics_t wal_get_metrics(wal_t* wal)
+{
+    wal_metrics_t metrics;
+    memset(&metrics, 0, sizeof(wal_metrics_t));
+    RET_IF(!wal, metrics);
+
+    LOCK_MUTEX(&wal->mutex);
+    metrics = wal->metrics;
+    UNLOCK_MUTEX(&wal->mutex);
+    return metrics;
+}
+
+void free_wal(wal_t* wal)
+{
+    NRET_IF(!wal);
+
+    // the writer drains the pending records before quitting
+    LOCK_MUTEX(&wal->mutex);
+    wal->closing = TRUE;
+    COND_SIGNAL(&wal->work_cond);
+    UNLOCK_MUTEX(&wal->mutex);
+    pthread_join(wal->writer, NULL);
+
+    if(wal->fd != -1)
+        close(wal->fd);
+    free(wal->buffer);
+    free(wal->flush_buffer);
+    free(wal->waiters);
+    pthread_mutex_destroy(&wal->mutex);
+    pthread_mutex_destroy(&wal->io_mutex);
+    pthread_cond_destroy(&wal->work_cond);
+    free(wal);
+}
+
+// Apply a record to fs, the records were appended in the same order of the changes so they are always valid
+// The written contents are shared through store when it's not NULL, like the writes which made the records
+static void replay_record(file_system_t* fs, content_store_t* store, const wal_record_t* record, const char* pathname, const void* data)
+{
+    file_stored_t* file = find_file_fs(fs, pathname);
+    if(record->type == WAL_REMOVE)
+    {
+        if(file)
+            remove_file_fs(fs, pathname, FALSE);
+        return;
+    }
+
+    if(!file)
+    {
+        file = create_file(pathname);
+        add_file_fs(fs, pathname, file);
+    }
+
+    if(record->type == WAL_WRITE && store && record->size > 0)
+    {
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        sha256(data, record->size, digest);
+        content_entry_t* entry = content_store_find(store, digest);
+        if(!entry)
+        {
+            void* content = content_alloc(record->size);
+            memcpy(content, data, record->size);
+            entry = content_store_add(store, digest, content, record->size);
+        }
+
+        // the old content is dropped first, it may be the same shared one
+        notify_memory_changed_fs(fs, -(ssize_t)file_get_memory_size(file));
+        file_replace_content(file, NULL, 0);
+        notify_memory_changed_fs(fs, content_entry_get_files(entry) > 0 ? 0 : record->size);
+        file_share_content(file, entry);
+    }
+    else if(record->type == WAL_WRITE)
+    {
+        size_t old_size = file_get_memory_size(file);
+        void* content = NULL;
+        if(record->size > 0)
+        {
+            content = content_alloc(record->size);
+            memcpy(content, data, record->size);
+        }
+        file_replace_content(file, content, record->size);
+        notify_memory_changed_fs(fs, (ssize_t)record->size - (ssize_t)old_size);
+    }
+    else if(record->type == WAL_APPEND && record->size > 0)
+    {
+        file_append_content_copy(file, data, record->size);
+        notify_memory_changed_fs(fs, record->size);
+    }
+    else if(record->type == WAL_WRITE_AT && record->size > sizeof(uint64_t))
+    {
+        uint64_t offset;
+        memcpy(&offset, data, sizeof(uint64_t));
+        if(offset <= file_get_size(file))
+        {
+            size_t size = record->size - sizeof(uint64_t);
+            notify_memory_changed_fs(fs, file_write_content_at(file, offset, (const char*)data + sizeof(uint64_t), size));
+        }
+    }
+}
+
+// Replay the records of a single generation, returns the number of records replayed
+static size_t replay_generation(file_system_t* fs, content_store_t* store, const char* generation_path, uint64_t* last_lsn)
+{
+    int fd = open(generation_path, O_RDONLY);
+    RET_IF(fd == -1, 0);
+
+    struct stat st;
+    if(fstat(fd, &st) == -1 || st.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    size_t map_size = st.st_size;
+    char* map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    RET_IF(map == MAP_FAILED, 0);
+    madvise(map, map_size, MADV_SEQUENTIAL);
+
+    size_t replayed = 0;
+    size_t offset = 0;
+    while(offset + sizeof(wal_record_t) <= map_size)
+    {
+        wal_record_t record;
+        memcpy(&record, map + offset, sizeof(wal_record_t));
+        size_t left = map_size - offset - sizeof(wal_record_t);
+        if(record.pathname_length == 0 || record.pathname_length > MAX_PATHNAME_API_LENGTH
+            || record.pathname_length > left || record.size > left - record.pathname_length)
+            break;
+
+        const char* record_pathname = map + offset + sizeof(wal_record_t);
+        const char* data = record_pathname + record.pathname_length;
+        if(record_checksum(&record, record_pathname, NULL, 0, data) != record.checksum)
+            break;
+
+        char pathname[MAX_PATHNAME_API_LENGTH + 1];
+        memcpy(pathname, record_pathname, record.pathname_length);
+        pathname[record.pathname_length] = '\0';
+        replay_record(fs, store, &record, pathname, data);
+
+        *last_lsn = MAX(*last_lsn, record.lsn);
+        offset += sizeof(wal_record_t) + record.pathname_length + record.size;
+        ++replayed;
+    }
+
+    if(offset < map_size)
+    {
+        PRINT_WARNING(EILSEQ, "Write-ahead log %s ends with %zu bytes not valid, ignored!", generation_path, map_size - offset);
+    }
+
+    munmap(map, map_size);
+    return replayed;
+}
+
+size_t replay_wal_fs(file_system_t* fs, content_store_t* store, const char* path, uint64_t generation, uint64_t* next_generation, uint64_t* last_lsn)
+{
+    RET_IF(!fs || !path, 0);
+
+    pthread_once(&crc_once, init_crc_table);
+    *next_generation = generation;
+    *last_lsn = 0;
+
+    uint64_t oldest, newest;
+    RET_IF(!find_generations(path, &oldest, &newest), 0);
+
+    size_t replayed = 0;
+    char generation_path[WAL_PATH_LENGTH];
+    for(uint64_t i = MAX(oldest, generation); i <= newest; ++i)
+    {
+        get_generation_path(path, i, generation_path);
+        replayed += replay_generation(fs, store, generation_path, last_lsn);
+    }
+
+    // the last generation may end with a torn record, the new records go to a new one
+    *next_generation = MAX(newest + 1, generation);
+    return replayed;
+}
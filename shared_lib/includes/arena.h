@@ -0,0 +1,24 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stdlib.h>
+
+// Default size of each chunk requested by an arena
+#define ARENA_CHUNK_SIZE (16 * 1024)
+
+typedef struct arena arena_t;
+
+// Create a new arena which requests memory in chunks of chunk_size bytes (0 means ARENA_CHUNK_SIZE)
+arena_t* create_arena(size_t chunk_size);
+
+// Get size bytes from this arena, the memory is valid until the next arena_reset(arena)
+// NOT thread safe, an arena must be used by a single thread
+void* arena_alloc(arena_t* arena, size_t size);
+
+// Release all the memory given by this arena at once, the first chunk is kept to be reused
+void arena_reset(arena_t* arena);
+
+// Free this arena and all of its chunks
+void free_arena(arena_t* arena);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef _CLIENT_SET_H_
+#define _CLIENT_SET_H_
+
+#include <stdlib.h>
+
+#include "utils.h"
+
+// Number of clients stored inline before the set spills into a bitmap indexed by fd
+#define CS_INLINE_CAPACITY 4
+
+typedef struct client_set client_set_t;
+
+// Create a new empty client set
+client_set_t* create_cs();
+
+// Get the number of clients inside this client set
+size_t cs_count(const client_set_t* set);
+
+// Add a client to this client set
+// Returns 1 if the client was added, 0 if it was already inside the set and -1 if client is not valid
+int cs_add(client_set_t* set, int client);
+
+// Check whether the client is inside this client set
+bool_t cs_contains(const client_set_t* set, int client);
+
+// Remove a client from this client set
+// Returns 1 if the client was removed, 0 if it was not inside the set
+int cs_remove(client_set_t* set, int client);
+
+// Get the next client of this client set starting from cursor (which must be 0 at the first call)
+// Returns -1 once there are no more clients, the set must not be modified while iterating
+int cs_next(const client_set_t* set, int* cursor);
+
+// Free this client set
+void free_cs(client_set_t* set);
+
+// Helper macro to cycle through the clients of a set
+#define FOREACH_CS(cs, client) for(int local_cursor = 0, client = cs_next(cs, &local_cursor); client != -1; client = cs_next(cs, &local_cursor))
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef _COROUTINE_H_
+#define _COROUTINE_H_
+
+// Stackless coroutines: the body of the function is a switch over the line it must resume from, stored inside an int
+// the caller keeps between the calls. A yield stores its own line and returns, the next call jumps back right after it
+// The locals don't survive a yield, whatever is needed after it must live next to the line. The yields can't be
+// inside a switch of the body, a return outside of them leaves the line as it is so the caller resets it to 0
+
+// Start the body of a coroutine resuming from line, 0 starts from the top
+#define CO_BEGIN(line) switch(line) { case 0:
+
+// Return value, the next call resumes right after this yield
+#define CO_YIELD(line, value) do { (line) = __LINE__; return (value); case __LINE__:; } while(0)
+
+// The next call resumes from here, used to retry an operation which returned before completing
+#define CO_LABEL(line) (line) = __LINE__; case __LINE__:
+
+// End the body of a coroutine, the next call starts from the top
+#define CO_END(line) } (line) = 0
+
+#endif
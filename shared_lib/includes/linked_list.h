@@ -36,9 +36,10 @@ node_t* ll_get_head_node(linked_list_t* ll);
 // Remove a node inside this linked list, does NOT free data pointer by it
 int ll_remove_node(linked_list_t* ll, node_t* node);
 
-// Remove a string from this linked list
+// Remove a string from this linked list, the string will be freed with the third argument
+// If free_func is NULL the string will not be freed
 // Assumes the nodes contains strings
-void ll_remove_str(linked_list_t* ll, char* str);
+void ll_remove_str(linked_list_t* ll, char* str, void (*free_func)(void*));
 
 // Remove all nodes inside this linked list and count to zero, the data pointed by nodes will be free with the second argument
 // If free_func is NULL the data will not be freed
@@ -48,6 +49,9 @@ void ll_empty(linked_list_t* ll, void (*free_func)(void*));
 // If free_func is NULL it will be set automatically with free(---)
 void ll_free(linked_list_t* ll, void (*free_func)(void*));
 
+// Free function which does nothing, used to free lists whose values are not allocated (E.g. INT_TO_PTR values)
+void ll_no_free(void* value);
+
 // Get the data pointed by this node
 void* node_get_value(node_t* node);
 
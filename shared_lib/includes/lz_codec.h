@@ -0,0 +1,20 @@
+#ifndef _LZ_CODEC_H_
+#define _LZ_CODEC_H_
+
+#include <stdlib.h>
+
+// Byte oriented LZ77 codec using the LZ4 block format, fast enough to compress on the request path
+// Every block is independent, the back references never point outside of it
+
+// Max size of the output of lz_compress for size bytes of input
+#define LZ_COMPRESS_BOUND(size) ((size) + (size) / 255 + 16)
+
+// Compress size bytes of src inside dst, which can hold capacity bytes
+// Returns the compressed size, or 0 if the output doesn't fit capacity
+size_t lz_compress(const void* src, size_t size, void* dst, size_t capacity);
+
+// Decompress size bytes of src, which must expand to exactly dst_size bytes written inside dst
+// Returns 0 on success, -1 if src is malformed
+int lz_decompress(const void* src, size_t size, void* dst, size_t dst_size);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef _MAILBOX_H_
+#define _MAILBOX_H_
+
+#include "utils.h"
+
+// Unbounded multi-producer single-consumer queue of ints, the posts never take a lock
+// The consumer sleeps only when the mailbox is empty, a post wakes it up only if it's sleeping
+typedef struct mailbox mailbox_t;
+
+// Create an empty mailbox
+mailbox_t* create_mailbox();
+
+// Post value to the consumer of mailbox, called by any thread
+void mailbox_post(mailbox_t* mailbox, int value);
+
+// Take the oldest value posted to mailbox waiting for it if needed, called only by the consumer
+// Returns 1 once a value is stored inside value, 0 if the wait was interrupted by mailbox_interrupt
+int mailbox_take(mailbox_t* mailbox, int* value);
+
+// Make the current or the next mailbox_take of the consumer return 0 if the mailbox is empty
+void mailbox_interrupt(mailbox_t* mailbox);
+
+// Free mailbox with the values never taken
+void free_mailbox(mailbox_t* mailbox);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef _NUMA_H_
+#define _NUMA_H_
+
+#include <sched.h>
+#include <stdlib.h>
+
+// NUMA topology read from sysfs and page placement through the raw system calls, no libnuma needed
+// Every function degrades to a single node 0 when the topology is not available
+// The CPU_* macros need _GNU_SOURCE defined before any include by the sources using them
+
+// Max number of nodes handled
+#define NUMA_MAX_NODES 64
+
+// Get the number of NUMA nodes of this machine, at least 1
+int numa_count_nodes();
+
+// Get the node of the CPU running the calling thread, 0 if unknown
+int numa_current_node();
+
+// Fill cpus with the CPUs of node, returns 0 on success, -1 if the CPUs of node are unknown
+int numa_get_node_cpus(int node, cpu_set_t* cpus);
+
+// Move the pages of length bytes at addr to node and prefer it for the pages touched later
+// addr must be aligned to the page size. Returns 0 on success, -1 with errno set otherwise
+int numa_move_pages(void* addr, size_t length, int node);
+
+#endif
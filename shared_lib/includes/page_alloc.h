@@ -0,0 +1,44 @@
+#ifndef _PAGE_ALLOC_H_
+#define _PAGE_ALLOC_H_
+
+#include <stdlib.h>
+
+// Allocator of the contents of the files, the buffers of at least HUGE_PAGE_SIZE bytes are mapped on their own and
+// backed by huge pages so reading a big file takes far fewer TLB misses. The smaller buffers come from malloc
+
+// Size of a huge page, the mapped buffers are aligned to it
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// How the big buffers get their huge pages
+// MADVISE asks for transparent huge pages, HUGETLB takes them from the reserved pool and falls back to MADVISE
+typedef enum huge_pages_mode {
+    HUGE_PAGES_NONE,
+    HUGE_PAGES_MADVISE,
+    HUGE_PAGES_HUGETLB
+} huge_pages_mode_t;
+
+// Metrics of the allocator
+typedef struct page_alloc_metrics {
+    size_t huge_buffers;
+    size_t hugetlb_buffers;
+    size_t moved_buffers;
+    size_t max_mapped_bytes;
+} page_alloc_metrics_t;
+
+// Set how the big buffers allocated from now on get their huge pages, HUGE_PAGES_NONE by default
+void page_alloc_set_mode(huge_pages_mode_t mode);
+
+// Allocate a buffer for size bytes of content, exits if there is no memory left like the other allocators
+void* content_alloc(size_t size);
+
+// Free a buffer given by content_alloc or by malloc
+void content_free(void* ptr);
+
+// Move the pages of a buffer given by content_alloc to a NUMA node
+// Returns 0 on success, -1 if ptr is not a mapped buffer or it cannot be moved
+int content_move_to_node(void* ptr, int node);
+
+// Get the metrics of the allocator
+page_alloc_metrics_t page_alloc_get_metrics();
+
+#endif
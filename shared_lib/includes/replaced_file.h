@@ -2,7 +2,8 @@
 #define __NETWORK_FILE__
 
 #include <stdlib.h>
-#include "queue.h"
+#include "wait_queue.h"
+#include "segment_list.h"
 
 typedef struct replaced_file replaced_file_t;
 
@@ -10,22 +11,25 @@ typedef struct replaced_file replaced_file_t;
 replaced_file_t* create_replfile();
 
 // Set a lock queue to this replaced file
-void replfile_set_locks_queue(replaced_file_t* r, queue_t* queue);
+void replfile_set_locks_queue(replaced_file_t* r, wait_queue_t* queue);
 
-// Set a data to this replaced file
-void replfile_set_data(replaced_file_t* r, void* data, size_t data_size);
+// Set the content segments of this replaced file
+void replfile_set_content(replaced_file_t* r, segment_list_t* content);
 
-// Set a pathname to this replaced file
+// Set a pathname to this replaced file, the pathname is copied
 void replfile_set_pathname(replaced_file_t* r, const char* pathname);
 
 // Get the data size of this replaced file
 size_t replfile_get_data_size(replaced_file_t* r);
 
 // Get the lock queue of this replaced file
-queue_t* replfile_get_locks_queue(replaced_file_t* r);
+wait_queue_t* replfile_get_locks_queue(replaced_file_t* r);
 
-// Get the data of this replaced file
-void* replfile_get_data(replaced_file_t* r);
+// Get the content segments of this replaced file
+segment_list_t* replfile_get_content(replaced_file_t* r);
+
+// Take the content segments out of this replaced file, the caller becomes their owner
+segment_list_t* replfile_take_content(replaced_file_t* r);
 
 // Get the pathname of this replaced file
 char* replfile_get_pathname(replaced_file_t* r);
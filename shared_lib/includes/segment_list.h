@@ -0,0 +1,118 @@
+#ifndef _SEGMENT_LIST_H_
+#define _SEGMENT_LIST_H_
+
+#include <stdlib.h>
+#include <sys/uio.h>
+
+#include "utils.h"
+
+// Capacity of each segment allocated by an append, bigger appends are stored as their own segment
+#define SL_SEGMENT_SIZE (64 * 1024)
+// Number of segments after which a list becomes a candidate for compaction
+#define SL_COMPACT_THRESHOLD 64
+
+typedef struct segment segment_t;
+typedef struct segment_list segment_list_t;
+typedef struct sl_view sl_view_t;
+
+// Create a new empty segment list
+segment_list_t* create_sl();
+
+// Get the total bytes stored in this segment list
+size_t sl_get_size(const segment_list_t* sl);
+
+// Get the bytes of memory used by the data of this segment list, less than its size if some blocks are compressed
+size_t sl_get_memory_size(const segment_list_t* sl);
+
+// Get the bytes of this segment list which are not sealed inside blocks yet
+size_t sl_get_unsealed_size(const segment_list_t* sl);
+
+// Get the stamp of the last change of this segment list, unique among all the lists
+uint64_t sl_get_stamp(const segment_list_t* sl);
+
+// Get the number of segments of this segment list
+size_t sl_count_segments(const segment_list_t* sl);
+
+// Replace the whole content of this segment list with data, the list takes the ownership of data
+// The data owned by a list is freed with content_free, so it can come from content_alloc or malloc
+void sl_replace(segment_list_t* sl, void* data, size_t size);
+
+// Replace the whole content of this segment list with data shared with other lists, which is never written nor freed
+// The data is sealed and not counted by the memory of this list, release is called with release_arg once it's dropped
+void sl_replace_shared(segment_list_t* sl, const void* data, size_t size, void (*release)(void*), void* release_arg);
+
+// Append data at the end of this segment list, the list takes the ownership of data
+// Small appends are copied inside the free space of the last segment, so the cost is proportional only to size
+void sl_append(segment_list_t* sl, void* data, size_t size);
+
+// Append a copy of data at the end of this segment list, the caller keeps the ownership of data
+void sl_append_copy(segment_list_t* sl, const void* data, size_t size);
+
+// Append data at the end of this segment list without copying it, data is never written nor freed by the list
+// Used for data which lives inside a memory mapping, the mapping must outlive the list
+void sl_append_mapped(segment_list_t* sl, const void* data, size_t size);
+
+// Check whether this segment list is fragmented enough to be compacted
+// The tail must be at least as big as the first segment so the copies are amortized over the appends
+bool_t sl_needs_compaction(const segment_list_t* sl);
+
+// Merge all the segments of this segment list not sealed yet in a single contiguous one
+int sl_compact(segment_list_t* sl);
+
+// Copy the bytes not sealed yet of this segment list inside buf, which must hold sl_get_unsealed_size bytes
+size_t sl_copy_unsealed_to(const segment_list_t* sl, void* buf);
+
+// Create a list of sealed blocks of SL_SEGMENT_SIZE bytes holding a copy of data
+// Each block is compressed unless it doesn't save enough memory, the content is expanded again by the reads
+segment_list_t* sl_seal(const void* data, size_t size);
+
+// Replace the bytes not sealed yet of this segment list with the blocks of sealed, which is left empty
+// Returns the change of the memory used by this list
+long sl_replace_unsealed(segment_list_t* sl, segment_list_t* sealed);
+
+// Write size bytes of data at offset of this segment list, the bytes past the end are appended. offset must not be past the end
+// The segments touched are written in place, the shared, mapped or compressed ones get a private copy first (still sealed)
+// Returns the change of the memory used by this list
+long sl_write_at(segment_list_t* sl, size_t offset, const void* data, size_t size);
+
+// Get the bytes of memory that sl_write_at of size bytes at offset would take at most: the bytes appended plus
+// the ones of the segments touched which get a private copy. offset must not be past the end
+size_t sl_write_cost_at(const segment_list_t* sl, size_t offset, size_t size);
+
+// Copy up to size bytes of this segment list inside buf, returns the bytes copied
+size_t sl_copy_to(const segment_list_t* sl, void* buf, size_t size);
+
+// Copy up to size bytes of this segment list starting at offset inside buf, returns the bytes copied (0 past the end)
+// Only the compressed blocks overlapping the range are expanded
+size_t sl_copy_range_to(const segment_list_t* sl, size_t offset, void* buf, size_t size);
+
+// Write the whole content of this segment list to a file descriptor with writev
+// Returns 1 on success, -1 on failure like writen
+int sl_writen(long fd, const segment_list_t* sl);
+
+// Create a view of at most size bytes of this segment list starting at offset, which reads them without copying
+// The view stays valid while the list changes or is freed: the segments it reads are never written again, a change of
+// the list gets a private copy of them, and they're freed with the last view. Must be called while the list doesn't change
+// Returns NULL if offset is past the end of the list
+sl_view_t* sl_view_create(const segment_list_t* sl, size_t offset, size_t size);
+
+// Get the bytes read by this view
+size_t sl_view_get_size(const sl_view_t* view);
+
+// Fill at most iovcnt iovec with the bytes of this view starting at offset, in order. A compressed block is expanded inside
+// a buffer of the view reused by the next call, so it's always the last iovec filled. Returns the count of iovec filled
+int sl_view_get_iov(sl_view_t* view, size_t offset, struct iovec* iov, int iovcnt);
+
+// Free this view, the segments read only by it are freed too
+void free_sl_view(sl_view_t* view);
+
+// Move the pages of the big buffers of this segment list to a NUMA node, the other buffers are left where they are
+void sl_move_to_node(const segment_list_t* sl, int node);
+
+// Remove all the segments of this segment list and free their data
+void sl_empty(segment_list_t* sl);
+
+// Free this segment list and all of its data
+void free_sl(segment_list_t* sl);
+
+#endif
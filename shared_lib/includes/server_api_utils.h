@@ -16,14 +16,49 @@ typedef enum server_packet_op {
     OP_REMOVE_FILE,
     OP_CLOSE_CONN,
     OP_ERROR,
-    OP_OK
+    OP_OK,
+    OP_LOCK_FILE_EX,
+    OP_WRITE_FILE_HASH,
+    // sent only by the server, a file evicted by a write of the client followed by its pathname, size and data
+    OP_PUSH_FILE,
+    // ask the sockets of the shard processes of the server, answered with their count (0 if it's a single process)
+    // followed by the socket of each shard
+    OP_SHARD_MAP,
+    // read a file and cache it, answered with its version before its size and data. Until the client closes the file
+    // the server sends an OP_INVALIDATE_FILE once its copy is stale
+    OP_READ_FILE_CACHE,
+    // sent only by the server between the replies, the file with the following pathname changed or was removed
+    OP_INVALIDATE_FILE,
+    // read a file only if its version differs from the one sent, answered like OP_READ_FILE_CACHE or with OP_NOT_MODIFIED
+    OP_READ_FILE_IF_MODIFIED,
+    // reply of a conditional read, the version of the file is still the one of the client
+    OP_NOT_MODIFIED,
+    // read at most a length of bytes of a file from an offset, answered with the size of the range and its data
+    OP_READ_FILE_RANGE,
+    // write the data sent at an offset of a file, the bytes past its end are appended. The offset can't be past the end
+    OP_WRITE_FILE_AT
 } server_packet_op_t;
 
 typedef enum server_open_file_options {
     O_CREATE = 1,
-    O_LOCK = 2
+    O_LOCK = 2,
+    O_LOCK_SHARED = 4
 } server_open_file_options_t;
 
+typedef enum server_lock_file_options {
+    L_TRY = 1,
+    L_SHARED = 2
+} server_lock_file_options_t;
+
+// How much a write must be durable before its reply, used only if the server has a write-ahead log
+// D_ASYNC replies at once, D_WRITTEN once the log survives a crash of the server, D_SYNC once it's on disk
+typedef enum server_durability {
+    D_DEFAULT,
+    D_ASYNC,
+    D_WRITTEN,
+    D_SYNC
+} server_durability_t;
+
 #define MAX_PATHNAME_API_LENGTH 108
 
 #endif
\ No newline at end of file
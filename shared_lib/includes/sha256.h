@@ -0,0 +1,13 @@
+#ifndef _SHA256_H_
+#define _SHA256_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+
+// Bytes of a SHA-256 digest
+#define SHA256_DIGEST_SIZE 32
+
+// Compute the SHA-256 digest of size bytes of data inside digest
+void sha256(const void* data, size_t size, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+#endif
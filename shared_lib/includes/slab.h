@@ -0,0 +1,30 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include <stdlib.h>
+
+// Alignment of each object given by a slab or by an arena
+#define ALLOC_ALIGNMENT 16
+// Round size up to the allocators alignment
+#define ALIGN_SIZE(size) (((size) + ALLOC_ALIGNMENT - 1) & ~((size_t)ALLOC_ALIGNMENT - 1))
+
+typedef struct slab slab_t;
+
+// Create a new slab which gives objects of obj_size bytes, memory is requested in chunks of objs_per_chunk objects
+slab_t* create_slab(size_t obj_size, size_t objs_per_chunk);
+
+// Get a free object from this slab, the content of the object is not initialized
+// Thread safe
+void* slab_alloc(slab_t* slab);
+
+// Give back an object to this slab so that it can be reused
+// Thread safe
+void slab_free(slab_t* slab, void* obj);
+
+// Get the number of objects currently in use from this slab
+size_t slab_count_used(slab_t* slab);
+
+// Free this slab and all the chunks allocated by it, objects still in use become invalid
+void free_slab(slab_t* slab);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "utils.h"
+
+// Default number of slots and resolution of a timer wheel
+#define TW_DEFAULT_SLOTS 256
+#define TW_DEFAULT_TICK_MS 10
+
+typedef struct timer_wheel timer_wheel_t;
+typedef struct timer_entry timer_entry_t;
+
+// Called for each expired timer with the values given to tw_add
+typedef void (*timer_callback_t)(int key, uint64_t id, void* data);
+
+// Create a new hashed timer wheel with slots buckets, each one covering tick_ms milliseconds
+timer_wheel_t* create_tw(size_t slots, long tick_ms);
+
+// Get the number of timers pending inside this timer wheel
+size_t count_tw(timer_wheel_t* tw);
+
+// Schedule a timer which expires after timeout_ms, key, id and data are given back to the callback of tw_advance
+// Returns the handle of the timer, valid until it's cancelled or its callback returns. Thread safe
+timer_entry_t* tw_add(timer_wheel_t* tw, long timeout_ms, int key, uint64_t id, void* data);
+
+// Cancel a pending timer in O(1)
+// Returns 1 if the timer was cancelled, 0 if it already expired (its callback is running or about to run). Thread safe
+int tw_cancel(timer_wheel_t* tw, timer_entry_t* entry);
+
+// Run the callback of every timer expired until now, the callbacks are run without holding the wheel lock
+// Returns the number of timers expired
+size_t tw_advance(timer_wheel_t* tw, timer_callback_t callback);
+
+// Get the milliseconds until the next timer expires, -1 if there are no timers (usable as a poll/select timeout)
+long tw_next_timeout_ms(timer_wheel_t* tw);
+
+// Free this timer wheel and its pending timers
+void free_tw(timer_wheel_t* tw);
+
+#endif
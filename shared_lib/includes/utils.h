@@ -3,8 +3,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/uio.h>
 
 #include "server_api_utils.h"
 
@@ -142,6 +144,11 @@ typedef enum bool { FALSE, TRUE } bool_t;
                                         istr; \
                                         UNLOCK_MUTEX(m)
 
+// Store an integer (E.g. a client fd) directly inside a pointer so that containers don't need to allocate it
+#define INT_TO_PTR(i) ((void*)(intptr_t)(i))
+// Get back an integer stored with INT_TO_PTR
+#define PTR_TO_INT(p) ((int)(intptr_t)(p))
+
 #define MIN(x, y) (x < y ? x : y)
 #define MAX(x, y) (x > y ? x : y)
 
@@ -162,12 +169,15 @@ char* get_filename_from_path(const char* path, size_t path_len, size_t* filename
 int buildpath(char* dest, const char* src1, const char* src2, size_t src1length, size_t src2length);
 
 // Convert a string which contains the size and the unit measure of a file to bytes
-// E.g. 300KB => 300000, 10B => 10, 1MB => 1000000
-int filesize_string_to_byte(char* str, unsigned int max_length);
+// E.g. 300KB => 300000, 10B => 10, 1MB => 1000000, the result is 64 bit wide so sizes over 4GB are allowed
+size_t filesize_string_to_byte(char* str, unsigned int max_length);
 
 // Check whether an operation is a valid one for the server
 bool_t is_valid_op(server_packet_op_t op);
 
+// Hash of pathname used to split the files into shards, the clients and the server processes must agree on it
+uint32_t hash_pathname(const char* pathname);
+
 #define NO_MEM_FATAL "Cannot allocate more memory!"
 #define THREAD_CREATE_FATAL "Cannot create new thread!"
 
@@ -185,6 +195,13 @@ int readn(long fd, void* buf, size_t size);
 */
 int writen(long fd, void* buf, size_t size);
 
+/**
+ * @brief Writes all the buffers described by iov to given descriptor using writev, retrying on partial writes.
+ * @returns 1 on success, -1 on failure.
+ * @exception The function may fail and set "errno" for any of the errors specified for routine "writev".
+*/
+int writen_iov(long fd, struct iovec* iov, int iovcnt);
+
 // Read a string from a file descriptor of a certain length
 // The length read by this function will be the minimum of the length in input and the one sent from the fd
 int readn_string(long fd, char* buf, size_t max_len);
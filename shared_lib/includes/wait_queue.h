@@ -0,0 +1,56 @@
+#ifndef _WAIT_QUEUE_H_
+#define _WAIT_QUEUE_H_
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "utils.h"
+
+typedef struct wait_node wait_node_t;
+typedef struct wait_queue wait_queue_t;
+
+// Create a new empty wait queue
+wait_queue_t* create_wq();
+
+// Get the number of clients waiting in this wait queue
+size_t count_wq(const wait_queue_t* wq);
+
+// Add client at the end of this wait queue, the enqueue time is saved to measure the wait
+// Returns 1 if the client was added, 0 if it was already waiting and -1 if client is not valid
+int wq_enqueue(wait_queue_t* wq, int client);
+
+// Check whether client is waiting in this wait queue
+bool_t wq_contains(const wait_queue_t* wq, int client);
+
+// Remove client from this wait queue in O(1), returns 1 if removed, 0 if it was not waiting
+int wq_cancel(wait_queue_t* wq, int client);
+
+// Get the client which would be removed by wq_dequeue without removing it, -1 if the queue is empty
+int wq_peek(const wait_queue_t* wq, bool_t lifo);
+
+// Remove the client waiting since more time (FIFO) or the last one arrived (LIFO)
+// If waited_ns is not NULL it's set to the nanoseconds the client spent in the queue
+// Returns the client removed or -1 if the queue is empty
+int wq_dequeue(wait_queue_t* wq, bool_t lifo, uint64_t* waited_ns);
+
+// Get the first node of this wait queue (the one waiting since more time)
+wait_node_t* wq_get_head_node(const wait_queue_t* wq);
+
+// Get the node enqueued after this one
+wait_node_t* wait_node_get_next(const wait_node_t* node);
+
+// Get the client of this node
+int wait_node_get_client(const wait_node_t* node);
+
+// Remove all the clients of this wait queue
+void empty_wq(wait_queue_t* wq);
+
+// Free this wait queue
+void free_wq(wait_queue_t* wq);
+
+// Helper macro to cycle through the clients waiting, from the oldest one
+#define FOREACH_WQ(wq) for(wait_node_t* local_node = wq_get_head_node(wq); local_node != NULL; local_node = wait_node_get_next(local_node))
+// Helper macro to get the client of the current node
+#define CLIENT_IT_WQ wait_node_get_client(local_node)
+
+#endif
@@ -0,0 +1,86 @@
+#include <string.h>
+
+#include "arena.h"
+#include "slab.h"
+#include "utils.h"
+
+// Header of each chunk of memory requested by an arena, the usable memory follows the header
+typedef struct arena_chunk {
+    struct arena_chunk* next;
+    size_t size;
+    size_t used;
+} arena_chunk_t;
+
+struct arena {
+    size_t chunk_size;
+    arena_chunk_t* head;
+};
+
+static arena_chunk_t* create_arena_chunk(size_t size)
+{
+    arena_chunk_t* chunk;
+    CHECK_FATAL_EQ(chunk, malloc(ALIGN_SIZE(sizeof(arena_chunk_t)) + size), NULL, NO_MEM_FATAL);
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+arena_t* create_arena(size_t chunk_size)
+{
+    arena_t* arena;
+    CHECK_FATAL_EQ(arena, malloc(sizeof(arena_t)), NULL, NO_MEM_FATAL);
+    arena->chunk_size = chunk_size > 0 ? chunk_size : ARENA_CHUNK_SIZE;
+    arena->head = create_arena_chunk(arena->chunk_size);
+    return arena;
+}
+
+void* arena_alloc(arena_t* arena, size_t size)
+{
+    RET_IF(!arena, NULL);
+
+    size = ALIGN_SIZE(MAX(size, 1));
+    arena_chunk_t* chunk = arena->head;
+    if(chunk->size - chunk->used < size)
+    {
+        chunk = create_arena_chunk(MAX(size, arena->chunk_size));
+        chunk->next = arena->head;
+        arena->head = chunk;
+    }
+
+    void* ptr = (char*)chunk + ALIGN_SIZE(sizeof(arena_chunk_t)) + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+void arena_reset(arena_t* arena)
+{
+    NRET_IF(!arena);
+
+    // the first chunk created is the last one of the list
+    arena_chunk_t* curr = arena->head;
+    while(curr->next)
+    {
+        arena_chunk_t* next = curr->next;
+        free(curr);
+        curr = next;
+    }
+
+    curr->used = 0;
+    arena->head = curr;
+}
+
+void free_arena(arena_t* arena)
+{
+    NRET_IF(!arena);
+
+    arena_chunk_t* curr = arena->head;
+    while(curr)
+    {
+        arena_chunk_t* next = curr->next;
+        free(curr);
+        curr = next;
+    }
+
+    free(arena);
+}
@@ -0,0 +1,169 @@
+#include <string.h>
+#include <pthread.h>
+
+#include "client_set.h"
+#include "slab.h"
+
+#define SETS_PER_CHUNK 128
+#define BITS_PER_WORD (sizeof(uint64_t) * 8)
+
+// Until CS_INLINE_CAPACITY clients are stored the set is a small unordered array,
+// after that every client is moved inside a bitmap which grows with the highest fd seen
+struct client_set {
+    size_t count;
+    int inline_clients[CS_INLINE_CAPACITY];
+    uint64_t* bitmap;
+    size_t bitmap_words;
+};
+
+static slab_t* sets_slab = NULL;
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+
+static void init_slab()
+{
+    sets_slab = create_slab(sizeof(client_set_t), SETS_PER_CHUNK);
+}
+
+// Make the bitmap big enough to contain client
+static void cs_grow_bitmap(client_set_t* set, int client)
+{
+    size_t words_needed = client / BITS_PER_WORD + 1;
+    if(words_needed <= set->bitmap_words)
+        return;
+
+    // double to amortize the growth of sequential fds
+    words_needed = MAX(words_needed, set->bitmap_words * 2);
+    uint64_t* new_bitmap;
+    CHECK_FATAL_EQ(new_bitmap, realloc(set->bitmap, words_needed * sizeof(uint64_t)), NULL, NO_MEM_FATAL);
+    memset(new_bitmap + set->bitmap_words, 0, (words_needed - set->bitmap_words) * sizeof(uint64_t));
+    set->bitmap = new_bitmap;
+    set->bitmap_words = words_needed;
+}
+
+static inline void cs_set_bit(client_set_t* set, int client)
+{
+    cs_grow_bitmap(set, client);
+    set->bitmap[client / BITS_PER_WORD] |= (uint64_t)1 << (client % BITS_PER_WORD);
+}
+
+// Move the inline clients inside the bitmap
+static void cs_spill(client_set_t* set)
+{
+    for(size_t i = 0; i < set->count; ++i)
+        cs_set_bit(set, set->inline_clients[i]);
+}
+
+client_set_t* create_cs()
+{
+    pthread_once(&slab_once, init_slab);
+    client_set_t* set = slab_alloc(sets_slab);
+    memset(set, 0, sizeof(client_set_t));
+    return set;
+}
+
+size_t cs_count(const client_set_t* set)
+{
+    RET_IF(!set, 0);
+    return set->count;
+}
+
+int cs_add(client_set_t* set, int client)
+{
+    RET_IF(!set || client < 0, -1);
+    RET_IF(cs_contains(set, client), 0);
+
+    if(!set->bitmap)
+    {
+        if(set->count < CS_INLINE_CAPACITY)
+        {
+            set->inline_clients[set->count++] = client;
+            return 1;
+        }
+
+        cs_spill(set);
+    }
+
+    cs_set_bit(set, client);
+    ++set->count;
+    return 1;
+}
+
+bool_t cs_contains(const client_set_t* set, int client)
+{
+    RET_IF(!set || client < 0, FALSE);
+
+    if(!set->bitmap)
+    {
+        for(size_t i = 0; i < set->count; ++i)
+        {
+            if(set->inline_clients[i] == client)
+                return TRUE;
+        }
+
+        return FALSE;
+    }
+
+    size_t word = client / BITS_PER_WORD;
+    RET_IF(word >= set->bitmap_words, FALSE);
+    return (set->bitmap[word] >> (client % BITS_PER_WORD)) & 1;
+}
+
+int cs_remove(client_set_t* set, int client)
+{
+    RET_IF(!set || !cs_contains(set, client), 0);
+
+    if(!set->bitmap)
+    {
+        for(size_t i = 0; i < set->count; ++i)
+        {
+            if(set->inline_clients[i] == client)
+            {
+                set->inline_clients[i] = set->inline_clients[--set->count];
+                break;
+            }
+        }
+
+        return 1;
+    }
+
+    set->bitmap[client / BITS_PER_WORD] &= ~((uint64_t)1 << (client % BITS_PER_WORD));
+    --set->count;
+    return 1;
+}
+
+int cs_next(const client_set_t* set, int* cursor)
+{
+    RET_IF(!set || !cursor, -1);
+
+    if(!set->bitmap)
+    {
+        RET_IF(*cursor >= set->count, -1);
+        return set->inline_clients[(*cursor)++];
+    }
+
+    size_t word = *cursor / BITS_PER_WORD;
+    while(word < set->bitmap_words)
+    {
+        // ignore the bits before the cursor
+        uint64_t bits = set->bitmap[word] & (~(uint64_t)0 << (*cursor % BITS_PER_WORD));
+        if(bits)
+        {
+            int client = word * BITS_PER_WORD + __builtin_ctzll(bits);
+            *cursor = client + 1;
+            return client;
+        }
+
+        ++word;
+        *cursor = word * BITS_PER_WORD;
+    }
+
+    return -1;
+}
+
+void free_cs(client_set_t* set)
+{
+    NRET_IF(!set);
+
+    free(set->bitmap);
+    slab_free(sets_slab, set);
+}
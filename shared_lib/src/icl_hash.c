@@ -16,8 +16,22 @@
 #include <string.h>
 #include <assert.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include "icl_hash.h"
+#include "slab.h"
+
+#define ENTRIES_PER_CHUNK 1024
+
+/* entries are allocated and freed on every insert/delete, they are taken from a shared slab */
+static slab_t* entries_slab = NULL;
+static pthread_once_t entries_slab_once = PTHREAD_ONCE_INIT;
+
+static void
+init_entries_slab()
+{
+    entries_slab = create_slab(sizeof(icl_entry_t), ENTRIES_PER_CHUNK);
+}
 
 #define BITS_IN_int     ( sizeof(int) * CHAR_BIT )
 #define THREE_QUARTERS  ((int) ((BITS_IN_int * 3) / 4))
@@ -76,6 +90,8 @@ icl_hash_create( int nbuckets, unsigned int (*hash_function)(void*), int (*hash_
     ht = (icl_hash_t*) malloc(sizeof(icl_hash_t));
     if(!ht) return NULL;
 
+    pthread_once(&entries_slab_once, init_entries_slab);
+
     ht->nentries = 0;
     ht->buckets = (icl_entry_t**)malloc(nbuckets * sizeof(icl_entry_t*));
     if(!ht->buckets) return NULL;
@@ -142,7 +158,7 @@ icl_hash_insert(icl_hash_t *ht, void* key, void *data)
             return(NULL); /* key already exists */
 
     /* if key was not found */
-    curr = (icl_entry_t*)malloc(sizeof(icl_entry_t));
+    curr = (icl_entry_t*)slab_alloc(entries_slab);
     if(!curr) return NULL;
 
     curr->key = key;
@@ -192,7 +208,7 @@ icl_hash_update_insert(icl_hash_t *ht, void* key, void *data, void **olddata)
         }
 
     /* Since key was either not found, or found-and-removed, create and prepend new node */
-    curr = (icl_entry_t*)malloc(sizeof(icl_entry_t));
+    curr = (icl_entry_t*)slab_alloc(entries_slab);
     if(curr == NULL) return NULL; /* out of memory */
 
     curr->key = key;
@@ -237,7 +253,7 @@ int icl_hash_delete(icl_hash_t *ht, void* key, void (*free_key)(void*), void (*f
             if (*free_key && curr->key) (*free_key)(curr->key);
             if (*free_data && curr->data) (*free_data)(curr->data);
             ht->nentries--; /* This was WRONG, since key has been found and icl_entry_t curr removed and nothing has been touched before */
-            free(curr);
+            slab_free(entries_slab, curr);
             return 0;
         }
         prev = curr;
@@ -270,7 +286,7 @@ icl_hash_destroy(icl_hash_t *ht, void (*free_key)(void*), void (*free_data)(void
             next=curr->next;
             if (*free_key && curr->key) (*free_key)(curr->key);
             if (*free_data && curr->data) (*free_data)(curr->data);
-            free(curr);
+            slab_free(entries_slab, curr);
             curr=next;
         }
     }
@@ -1,7 +1,13 @@
 #include <string.h>
+#include <pthread.h>
 #include "linked_list.h"
+#include "slab.h"
 #include "utils.h"
 
+// Number of nodes and lists requested at once by the slabs
+#define NODES_PER_CHUNK 1024
+#define LISTS_PER_CHUNK 256
+
 struct node {
     void* value;
     struct node* next;
@@ -13,16 +19,38 @@ struct linked_list {
     node_t* tail;
 };
 
+// Nodes and lists are small fixed size objects created and freed continuously, they are taken from slabs shared by every list
+static slab_t* nodes_slab = NULL;
+static slab_t* lists_slab = NULL;
+static pthread_once_t slabs_once = PTHREAD_ONCE_INIT;
+
+static void init_slabs()
+{
+    nodes_slab = create_slab(sizeof(node_t), NODES_PER_CHUNK);
+    lists_slab = create_slab(sizeof(linked_list_t), LISTS_PER_CHUNK);
+}
+
 // Creae and initialize a node
 int malloc_node(node_t** node)
 {
     RET_IF(!node, -1);
-    CHECK_FATAL_ERRNO(*node, malloc(sizeof(node_t)), NO_MEM_FATAL);
+    pthread_once(&slabs_once, init_slabs);
+    *node = slab_alloc(nodes_slab);
     
     (*node)->next = NULL;
     return 0;
 }
 
+// Give back a node to the nodes slab
+static inline void free_node(node_t* node)
+{
+    slab_free(nodes_slab, node);
+}
+
+void ll_no_free(void* value)
+{
+}
+
 void* node_get_value(node_t* node)
 {
     RET_IF(!node, NULL);
@@ -38,7 +66,8 @@ node_t* node_get_next(node_t* node)
 linked_list_t* ll_create()
 {
     linked_list_t* new_list;
-    CHECK_FATAL_ERRNO(new_list, malloc(sizeof(linked_list_t)), NO_MEM_FATAL);
+    pthread_once(&slabs_once, init_slabs);
+    new_list = slab_alloc(lists_slab);
     memset(new_list, 0, sizeof(linked_list_t));
 
     return new_list;
@@ -110,7 +139,7 @@ void ll_remove_first(linked_list_t* ll, void** value)
         ll->head = next;
     }
 
-    free(first);
+    free_node(first);
     ll->count -= 1;
 }
 
@@ -146,7 +175,7 @@ void ll_remove_last(linked_list_t* ll, void** value)
         ll->tail = prev;
     }
 
-    free(last);
+    free_node(last);
     ll->count -= 1;
 }
 
@@ -193,15 +222,19 @@ int ll_remove_node(linked_list_t* ll, node_t* node)
             ll->tail = NULL;
     }
     else
+    {
         prev->next = node->next;
+        if(node == ll->tail)
+            ll->tail = prev;
+    }
 
     ll->count -= 1;
-    free(node);
+    free_node(node);
 
     return 1;
 }
 
-void ll_remove_str(linked_list_t* ll, char* str)
+void ll_remove_str(linked_list_t* ll, char* str, void (*free_func)(void*))
 {
     NRET_IF(!ll || !str);
 
@@ -231,8 +264,9 @@ void ll_remove_str(linked_list_t* ll, char* str)
             ll->count -= 1;
         }
 
-        free(curr->value);
-        free(curr);
+        if(free_func)
+            free_func(curr->value);
+        free_node(curr);
     }
 }
 
@@ -298,7 +332,7 @@ void ll_free(linked_list_t* ll, void (*free_func)(void*))
     NRET_IF(!ll);
 
     ll_empty(ll, free_func ? free_func : free);
-    free(ll);
+    slab_free(lists_slab, ll);
 }
 
 int ll_contains_str(const linked_list_t* ll, char* str)
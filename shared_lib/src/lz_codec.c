@@ -0,0 +1,194 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "lz_codec.h"
+#include "utils.h"
+
+// Shortest match encoded, shorter ones cost more than the literals
+#define LZ_MIN_MATCH 4
+// The last bytes of a block are always literals and no match starts this close to its end
+#define LZ_LAST_LITERALS 5
+#define LZ_MATCH_LIMIT 12
+// Offsets are stored in 2 bytes
+#define LZ_MAX_OFFSET 65535
+// Size of the table of the last position of each hashed sequence
+#define LZ_HASH_LOG 12
+// The lengths up to this value fit the token, the longer ones continue with bytes of 255
+#define LZ_TOKEN_LENGTH 15
+
+static inline uint32_t read32(const uint8_t* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(uint32_t));
+    return value;
+}
+
+static inline uint32_t hash_sequence(uint32_t sequence)
+{
+    return (sequence * 2654435761U) >> (32 - LZ_HASH_LOG);
+}
+
+// Write the continuation of a length which doesn't fit the token
+static inline uint8_t* put_length(uint8_t* op, size_t length)
+{
+    while(length >= 255)
+    {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+// Read the continuation of a length, returns -1 if src ends first
+static inline int get_length(const uint8_t** ip, const uint8_t* iend, size_t* length)
+{
+    uint8_t byte;
+    do
+    {
+        RET_IF(*ip >= iend, -1);
+        byte = *(*ip)++;
+        *length += byte;
+    } while(byte == 255);
+
+    return 0;
+}
+
+// Write a sequence made of the literals from anchor and a match of match_length at offset
+// A match_length of 0 writes only the literals, used by the last sequence
+static uint8_t* put_sequence(uint8_t* op, const uint8_t* oend, const uint8_t* anchor, size_t literals,
+                                size_t offset, size_t match_length)
+{
+    size_t needed = 1 + literals / 255 + 1 + literals + (match_length > 0 ? 2 + match_length / 255 + 1 : 0);
+    RET_IF(needed > (size_t)(oend - op), NULL);
+
+    uint8_t* token = op++;
+    *token = (uint8_t)(MIN(literals, LZ_TOKEN_LENGTH) << 4);
+    if(literals >= LZ_TOKEN_LENGTH)
+        op = put_length(op, literals - LZ_TOKEN_LENGTH);
+    memcpy(op, anchor, literals);
+    op += literals;
+    if(match_length == 0)
+        return op;
+
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+    size_t length = match_length - LZ_MIN_MATCH;
+    *token |= (uint8_t)MIN(length, LZ_TOKEN_LENGTH);
+    if(length >= LZ_TOKEN_LENGTH)
+        op = put_length(op, length - LZ_TOKEN_LENGTH);
+
+    return op;
+}
+
+size_t lz_compress(const void* src, size_t size, void* dst, size_t capacity)
+{
+    RET_IF(!src || !dst, 0);
+
+    const uint8_t* base = src;
+    const uint8_t* iend = base + size;
+    const uint8_t* ip = base;
+    const uint8_t* anchor = base;
+    uint8_t* op = dst;
+    const uint8_t* oend = op + capacity;
+
+    if(size > LZ_MATCH_LIMIT)
+    {
+        // positions of the last sequence seen for each hash, a wrong guess is detected comparing the bytes
+        uint32_t table[1 << LZ_HASH_LOG];
+        memset(table, 0, sizeof(table));
+        const uint8_t* match_start_limit = iend - LZ_MATCH_LIMIT;
+        const uint8_t* match_end_limit = iend - LZ_LAST_LITERALS;
+
+        ++ip;
+        while(ip < match_start_limit)
+        {
+            uint32_t sequence = read32(ip);
+            uint32_t hash = hash_sequence(sequence);
+            const uint8_t* ref = base + table[hash];
+            table[hash] = ip - base;
+            if(ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != sequence)
+            {
+                ++ip;
+                continue;
+            }
+
+            while(ip > anchor && ref > base && ip[-1] == ref[-1])
+            {
+                --ip;
+                --ref;
+            }
+
+            const uint8_t* match_end = ip + LZ_MIN_MATCH;
+            const uint8_t* ref_end = ref + LZ_MIN_MATCH;
+            while(match_end < match_end_limit && *match_end == *ref_end)
+            {
+                ++match_end;
+                ++ref_end;
+            }
+
+            op = put_sequence(op, oend, anchor, ip - anchor, ip - ref, match_end - ip);
+            RET_IF(!op, 0);
+            ip = anchor = match_end;
+            if(ip < match_start_limit)
+                table[hash_sequence(read32(ip - 2))] = ip - 2 - base;
+        }
+    }
+
+    op = put_sequence(op, oend, anchor, iend - anchor, 0, 0);
+    RET_IF(!op, 0);
+    return op - (uint8_t*)dst;
+}
+
+int lz_decompress(const void* src, size_t size, void* dst, size_t dst_size)
+{
+    RET_IF(!src || (!dst && dst_size > 0), -1);
+
+    const uint8_t* ip = src;
+    const uint8_t* iend = ip + size;
+    uint8_t* op = dst;
+    uint8_t* ostart = op;
+    const uint8_t* oend = op + dst_size;
+
+    while(ip < iend)
+    {
+        uint8_t token = *ip++;
+        size_t literals = token >> 4;
+        if(literals == LZ_TOKEN_LENGTH)
+            RET_IF(get_length(&ip, iend, &literals) == -1, -1);
+        RET_IF(literals > (size_t)(iend - ip) || literals > (size_t)(oend - op), -1);
+        memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+
+        // the last sequence has only literals
+        if(ip == iend)
+            break;
+
+        RET_IF(iend - ip < 2, -1);
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        RET_IF(offset == 0 || offset > (size_t)(op - ostart), -1);
+
+        size_t match_length = token & LZ_TOKEN_LENGTH;
+        if(match_length == LZ_TOKEN_LENGTH)
+            RET_IF(get_length(&ip, iend, &match_length) == -1, -1);
+        match_length += LZ_MIN_MATCH;
+        RET_IF(match_length > (size_t)(oend - op), -1);
+
+        // an offset shorter than the match repeats the bytes just written, they are copied one at a time
+        const uint8_t* ref = op - offset;
+        if(offset >= match_length)
+        {
+            memcpy(op, ref, match_length);
+        }
+        else
+        {
+            for(size_t i = 0; i < match_length; ++i)
+                op[i] = ref[i];
+        }
+        op += match_length;
+    }
+
+    return op == oend ? 0 : -1;
+}
@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "mailbox.h"
+
+typedef struct mailbox_node {
+    int value;
+    struct mailbox_node* next;
+} mailbox_node_t;
+
+// The producers append to head by swapping it, the consumer takes from tail whose value was already taken (stub)
+// A producer swapped head but didn't link the old one yet for a moment, the consumer sees the mailbox empty until then
+struct mailbox {
+    mailbox_node_t* head;
+    mailbox_node_t* tail;
+    // set by the consumer before sleeping, the producers finding it set wake it up
+    int waiting;
+    int interrupted;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+mailbox_t* create_mailbox()
+{
+    mailbox_t* mailbox;
+    CHECK_FATAL_EQ(mailbox, malloc(sizeof(mailbox_t)), NULL, NO_MEM_FATAL);
+    mailbox_node_t* stub;
+    CHECK_FATAL_EQ(stub, malloc(sizeof(mailbox_node_t)), NULL, NO_MEM_FATAL);
+    stub->next = NULL;
+
+    mailbox->head = stub;
+    mailbox->tail = stub;
+    mailbox->waiting = 0;
+    mailbox->interrupted = 0;
+    INIT_MUTEX(&mailbox->mutex);
+    INIT_COND(&mailbox->cond);
+    return mailbox;
+}
+
+// Wake up the consumer if it's sleeping, the mutex makes sure it's either not sleeping yet or already inside the wait
+static void wake_consumer(mailbox_t* mailbox)
+{
+    NRET_IF(!__atomic_load_n(&mailbox->waiting, __ATOMIC_SEQ_CST));
+
+    LOCK_MUTEX(&mailbox->mutex);
+    COND_SIGNAL(&mailbox->cond);
+    UNLOCK_MUTEX(&mailbox->mutex);
+}
+
+void mailbox_post(mailbox_t* mailbox, int value)
+{
+    NRET_IF(!mailbox);
+
+    mailbox_node_t* node;
+    CHECK_FATAL_EQ(node, malloc(sizeof(mailbox_node_t)), NULL, NO_MEM_FATAL);
+    node->value = value;
+    node->next = NULL;
+
+    mailbox_node_t* prev = __atomic_exchange_n(&mailbox->head, node, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, node, __ATOMIC_SEQ_CST);
+    wake_consumer(mailbox);
+}
+
+// Take the oldest value without waiting, returns 0 if the mailbox is empty
+static int try_take(mailbox_t* mailbox, int* value)
+{
+    mailbox_node_t* tail = mailbox->tail;
+    mailbox_node_t* next = __atomic_load_n(&tail->next, __ATOMIC_SEQ_CST);
+    RET_IF(!next, 0);
+
+    // next becomes the stub
+    *value = next->value;
+    mailbox->tail = next;
+    free(tail);
+    return 1;
+}
+
+int mailbox_take(mailbox_t* mailbox, int* value)
+{
+    RET_IF(!mailbox, 0);
+
+    while(TRUE)
+    {
+        RET_IF(try_take(mailbox, value), 1);
+        RET_IF(__atomic_exchange_n(&mailbox->interrupted, 0, __ATOMIC_SEQ_CST), 0);
+
+        // checked again once waiting is set, a post linked after it sees waiting and signals
+        LOCK_MUTEX(&mailbox->mutex);
+        __atomic_store_n(&mailbox->waiting, 1, __ATOMIC_SEQ_CST);
+        if(!__atomic_load_n(&mailbox->tail->next, __ATOMIC_SEQ_CST) && !__atomic_load_n(&mailbox->interrupted, __ATOMIC_SEQ_CST))
+            COND_WAIT(&mailbox->cond, &mailbox->mutex);
+        __atomic_store_n(&mailbox->waiting, 0, __ATOMIC_RELAXED);
+        UNLOCK_MUTEX(&mailbox->mutex);
+    }
+}
+
+void mailbox_interrupt(mailbox_t* mailbox)
+{
+    NRET_IF(!mailbox);
+
+    __atomic_store_n(&mailbox->interrupted, 1, __ATOMIC_SEQ_CST);
+    LOCK_MUTEX(&mailbox->mutex);
+    COND_SIGNAL(&mailbox->cond);
+    UNLOCK_MUTEX(&mailbox->mutex);
+}
+
+void free_mailbox(mailbox_t* mailbox)
+{
+    NRET_IF(!mailbox);
+
+    mailbox_node_t* node = mailbox->tail;
+    while(node)
+    {
+        mailbox_node_t* next = node->next;
+        free(node);
+        node = next;
+    }
+    pthread_mutex_destroy(&mailbox->mutex);
+    pthread_cond_destroy(&mailbox->cond);
+    free(mailbox);
+}
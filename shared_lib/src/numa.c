@@ -0,0 +1,94 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "numa.h"
+#include "utils.h"
+
+#define NUMA_SYSFS_PATH "/sys/devices/system/node"
+#define NUMA_LIST_LENGTH 1024
+
+// Read the first line of a sysfs file holding a list like "0-3,8-11", returns -1 if it cannot be read
+static int read_list(const char* path, char output[NUMA_LIST_LENGTH])
+{
+    FILE* file = fopen(path, "r");
+    RET_IF(!file, -1);
+
+    bool_t res = fgets(output, NUMA_LIST_LENGTH, file) != NULL;
+    fclose(file);
+    return res ? 0 : -1;
+}
+
+// Call on_item for every number inside a list like "0-3,8-11"
+static void parse_list(const char* list, void (*on_item)(int, void*), void* arg)
+{
+    const char* curr = list;
+    while(*curr >= '0' && *curr <= '9')
+    {
+        char* end;
+        int first = strtol(curr, &end, 10);
+        int last = first;
+        if(*end == '-')
+            last = strtol(end + 1, &end, 10);
+        for(int i = first; i <= last; ++i)
+            on_item(i, arg);
+
+        curr = *end == ',' ? end + 1 : end;
+    }
+}
+
+static void count_max_node(int node, void* arg)
+{
+    *(int*)arg = MAX(*(int*)arg, node + 1);
+}
+
+static void add_cpu(int cpu, void* arg)
+{
+    if(cpu < CPU_SETSIZE)
+        CPU_SET(cpu, (cpu_set_t*)arg);
+}
+
+int numa_count_nodes()
+{
+    char list[NUMA_LIST_LENGTH];
+    RET_IF(read_list(NUMA_SYSFS_PATH "/possible", list) == -1, 1);
+
+    int count = 0;
+    parse_list(list, count_max_node, &count);
+    return count > 0 ? MIN(count, NUMA_MAX_NODES) : 1;
+}
+
+int numa_current_node()
+{
+    unsigned int cpu, node;
+    RET_IF(syscall(SYS_getcpu, &cpu, &node, NULL) == -1, 0);
+    return node < NUMA_MAX_NODES ? (int)node : 0;
+}
+
+int numa_get_node_cpus(int node, cpu_set_t* cpus)
+{
+    RET_IF(node < 0 || node >= NUMA_MAX_NODES || !cpus, -1);
+
+    char path[sizeof(NUMA_SYSFS_PATH) + 32];
+    char list[NUMA_LIST_LENGTH];
+    snprintf(path, sizeof(path), NUMA_SYSFS_PATH "/node%d/cpulist", node);
+    RET_IF(read_list(path, list) == -1, -1);
+
+    CPU_ZERO(cpus);
+    parse_list(list, add_cpu, cpus);
+    return CPU_COUNT(cpus) > 0 ? 0 : -1;
+}
+
+int numa_move_pages(void* addr, size_t length, int node)
+{
+    if(node < 0 || node >= NUMA_MAX_NODES)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    unsigned long mask = 1UL << node;
+    return syscall(SYS_mbind, addr, length, MPOL_PREFERRED, &mask, sizeof(mask) * 8, MPOL_MF_MOVE) == -1 ? -1 : 0;
+}
@@ -0,0 +1,157 @@
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "page_alloc.h"
+#include "numa.h"
+#include "icl_hash.h"
+#include "utils.h"
+
+#define MAPPED_BUFFERS_BUCKETS 256
+#define SMALL_PAGE_SIZE 4096
+#define ROUND_UP(size, alignment) (((size) + (alignment) - 1) & ~((size_t)(alignment) - 1))
+
+static huge_pages_mode_t huge_pages_mode = HUGE_PAGES_NONE;
+
+// Length of each mapped buffer indexed by its address, the mapped buffers are the only ones aligned to a huge page
+// so the other pointers are told apart without looking inside the index
+static icl_hash_t* mapped_buffers = NULL;
+static size_t mapped_count = 0;
+static size_t mapped_bytes = 0;
+static page_alloc_metrics_t metrics;
+// protects everything above
+static pthread_mutex_t mapped_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int hash_address(void* key)
+{
+    return (unsigned int)((uintptr_t)key / HUGE_PAGE_SIZE);
+}
+
+static int compare_address(void* a, void* b)
+{
+    return a == b;
+}
+
+// Map length bytes aligned to a huge page, returns NULL on failure
+static void* map_huge(size_t size, size_t* length, bool_t* is_hugetlb)
+{
+    *is_hugetlb = FALSE;
+    if(huge_pages_mode == HUGE_PAGES_HUGETLB)
+    {
+        *length = ROUND_UP(size, HUGE_PAGE_SIZE);
+        void* ptr = mmap(NULL, *length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(ptr != MAP_FAILED)
+        {
+            *is_hugetlb = TRUE;
+            return ptr;
+        }
+    }
+
+    // a bigger mapping is trimmed so the buffer starts on a huge page boundary
+    *length = ROUND_UP(size, SMALL_PAGE_SIZE);
+    char* raw = mmap(NULL, *length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    RET_IF(raw == MAP_FAILED, NULL);
+
+    char* ptr = (char*)ROUND_UP((uintptr_t)raw, HUGE_PAGE_SIZE);
+    if(ptr > raw)
+        munmap(raw, ptr - raw);
+    char* end = ptr + *length;
+    char* raw_end = raw + *length + HUGE_PAGE_SIZE;
+    if(raw_end > end)
+        munmap(end, raw_end - end);
+
+    madvise(ptr, *length, MADV_HUGEPAGE);
+    return ptr;
+}
+
+// Get the length of the mapped buffer at ptr, 0 if ptr is not a mapped buffer
+static size_t find_mapped(void* ptr, bool_t remove)
+{
+    if(((uintptr_t)ptr & (HUGE_PAGE_SIZE - 1)) != 0 || __atomic_load_n(&mapped_count, __ATOMIC_RELAXED) == 0)
+        return 0;
+
+    size_t length = 0;
+    LOCK_MUTEX(&mapped_mutex);
+    void* entry = mapped_buffers ? icl_hash_find(mapped_buffers, ptr) : NULL;
+    if(entry)
+    {
+        length = (size_t)(uintptr_t)entry;
+        if(remove)
+        {
+            icl_hash_delete(mapped_buffers, ptr, NULL, NULL);
+            __atomic_sub_fetch(&mapped_count, 1, __ATOMIC_RELAXED);
+            mapped_bytes -= length;
+        }
+    }
+    UNLOCK_MUTEX(&mapped_mutex);
+
+    return length;
+}
+
+void page_alloc_set_mode(huge_pages_mode_t mode)
+{
+    huge_pages_mode = mode;
+}
+
+void* content_alloc(size_t size)
+{
+    void* ptr;
+    if(huge_pages_mode == HUGE_PAGES_NONE || size < HUGE_PAGE_SIZE)
+    {
+        CHECK_FATAL_EQ(ptr, malloc(size), NULL, NO_MEM_FATAL);
+        return ptr;
+    }
+
+    size_t length;
+    bool_t is_hugetlb;
+    ptr = map_huge(size, &length, &is_hugetlb);
+    if(!ptr)
+    {
+        CHECK_FATAL_EQ(ptr, malloc(size), NULL, NO_MEM_FATAL);
+        return ptr;
+    }
+
+    LOCK_MUTEX(&mapped_mutex);
+    if(!mapped_buffers)
+        mapped_buffers = icl_hash_create(MAPPED_BUFFERS_BUCKETS, hash_address, compare_address);
+    icl_hash_insert(mapped_buffers, ptr, (void*)(uintptr_t)length);
+    __atomic_add_fetch(&mapped_count, 1, __ATOMIC_RELAXED);
+    mapped_bytes += length;
+    ++metrics.huge_buffers;
+    if(is_hugetlb)
+        ++metrics.hugetlb_buffers;
+    metrics.max_mapped_bytes = MAX(metrics.max_mapped_bytes, mapped_bytes);
+    UNLOCK_MUTEX(&mapped_mutex);
+
+    return ptr;
+}
+
+void content_free(void* ptr)
+{
+    NRET_IF(!ptr);
+
+    size_t length = find_mapped(ptr, TRUE);
+    if(length > 0)
+        munmap(ptr, length);
+    else
+        free(ptr);
+}
+
+int content_move_to_node(void* ptr, int node)
+{
+    RET_IF(!ptr, -1);
+
+    size_t length = find_mapped(ptr, FALSE);
+    RET_IF(length == 0 || numa_move_pages(ptr, length, node) == -1, -1);
+
+    EXEC_WITH_MUTEX(++metrics.moved_buffers, &mapped_mutex);
+    return 0;
+}
+
+page_alloc_metrics_t page_alloc_get_metrics()
+{
+    page_alloc_metrics_t result;
+    EXEC_WITH_MUTEX(result = metrics, &mapped_mutex);
+    return result;
+}
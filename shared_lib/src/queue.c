@@ -2,16 +2,30 @@
 #include <string.h>
 
 #include "queue.h"
+#include "slab.h"
 #include "utils.h"
 
+// Number of queues requested at once by the slab
+#define QUEUES_PER_CHUNK 256
+
 struct queue {
     linked_list_t* internal_list;
 };
 
+// Every file has its own lock queue, they are taken from a shared slab
+static slab_t* queues_slab = NULL;
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+
+static void init_slab()
+{
+    queues_slab = create_slab(sizeof(queue_t), QUEUES_PER_CHUNK);
+}
+
 queue_t* create_q()
 {
     queue_t* queue;
-    CHECK_FATAL_EQ(queue, malloc(sizeof(queue_t)), NULL, NO_MEM_FATAL);
+    pthread_once(&slab_once, init_slab);
+    queue = slab_alloc(queues_slab);
     queue->internal_list = ll_create();
     return queue;
 }
@@ -65,5 +79,5 @@ void free_q(queue_t* queue, void (*free_func)(void*))
     NRET_IF(!queue);
 
     ll_free(queue->internal_list, free_func);
-    free(queue);
+    slab_free(queues_slab, queue);
 }
\ No newline at end of file
@@ -1,31 +1,43 @@
 #include <string.h>
+#include <pthread.h>
 
 #include "replaced_file.h"
+#include "slab.h"
 #include "utils.h"
 
+#define REPLFILES_PER_CHUNK 64
+
 struct replaced_file {
-    char* pathname;
-    void* data;
-    size_t data_size;
-    queue_t* notify_lock_queue;
+    char pathname[MAX_PATHNAME_API_LENGTH + 1];
+    segment_list_t* content;
+    wait_queue_t* notify_lock_queue;
 };
 
+// Replaced files are created in bursts by every replacement, they are taken from a shared slab
+static slab_t* replfiles_slab = NULL;
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+
+static void init_slab()
+{
+    replfiles_slab = create_slab(sizeof(replaced_file_t), REPLFILES_PER_CHUNK);
+}
+
 replaced_file_t* create_replfile()
 {
     replaced_file_t* repl;
-    CHECK_FATAL_EQ(repl, malloc(sizeof(replaced_file_t)), NULL, NO_MEM_FATAL);
+    pthread_once(&slab_once, init_slab);
+    repl = slab_alloc(replfiles_slab);
     memset(repl, 0, sizeof(replaced_file_t));
     return repl;
 }
 
-void replfile_set_data(replaced_file_t* r, void* data, size_t data_size)
+void replfile_set_content(replaced_file_t* r, segment_list_t* content)
 {
     NRET_IF(!r);
-    r->data = data;
-    r->data_size = data_size;
+    r->content = content;
 }
 
-void replfile_set_locks_queue(replaced_file_t* r, queue_t* queue)
+void replfile_set_locks_queue(replaced_file_t* r, wait_queue_t* queue)
 {
     NRET_IF(!r);
     r->notify_lock_queue = queue;
@@ -33,23 +45,32 @@ void replfile_set_locks_queue(replaced_file_t* r, queue_t* queue)
 
 void replfile_set_pathname(replaced_file_t* r, const char* pathname)
 {
-    NRET_IF(!r);
-    r->pathname = (char*)pathname;
+    NRET_IF(!r || !pathname);
+    strncpy(r->pathname, pathname, MAX_PATHNAME_API_LENGTH);
+    r->pathname[MAX_PATHNAME_API_LENGTH] = '\0';
 }
 
 size_t replfile_get_data_size(replaced_file_t* r)
 {
     RET_IF(!r, 0);
-    return r->data_size;
+    return sl_get_size(r->content);
+}
+
+segment_list_t* replfile_get_content(replaced_file_t* r)
+{
+    RET_IF(!r, NULL);
+    return r->content;
 }
 
-void* replfile_get_data(replaced_file_t* r)
+segment_list_t* replfile_take_content(replaced_file_t* r)
 {
     RET_IF(!r, NULL);
-    return r->data;
+    segment_list_t* content = r->content;
+    r->content = NULL;
+    return content;
 }
 
-queue_t* replfile_get_locks_queue(replaced_file_t* r)
+wait_queue_t* replfile_get_locks_queue(replaced_file_t* r)
 {
     RET_IF(!r, NULL);
     return r->notify_lock_queue;
@@ -65,8 +86,7 @@ void free_replfile(replaced_file_t* r)
 {
     NRET_IF(!r);
 
-    free(r->pathname);
-    free(r->data);
-    free_q(r->notify_lock_queue, free);
-    free(r);
+    free_sl(r->content);
+    free_wq(r->notify_lock_queue);
+    slab_free(replfiles_slab, r);
 }
\ No newline at end of file
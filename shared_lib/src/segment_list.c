@@ -0,0 +1,701 @@
+#include <string.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "segment_list.h"
+#include "slab.h"
+#include "lz_codec.h"
+#include "page_alloc.h"
+
+// Max number of iovec sent with a single writev
+#define SL_IOV_BATCH 64
+// Number of objects requested at once by the slabs
+#define SEGMENTS_PER_CHUNK 256
+
+// Who owns the data of a segment, determines how it's freed
+typedef enum segment_owner {
+    SEG_MALLOC,
+    SEG_MAPPED,
+    SEG_SHARED
+} segment_owner_t;
+
+struct segment {
+    char* data;
+    // bytes of content, the data of a compressed segment expands to size bytes
+    size_t size;
+    size_t capacity;
+    // bytes of memory held by data
+    size_t stored_size;
+    bool_t compressed;
+    segment_owner_t owner;
+    // called when a shared segment is freed, the data belongs to whoever shared it
+    void (*release)(void*);
+    void* release_arg;
+    // the list holding the segment plus the views reading it, changed atomically. A segment read by a view is never
+    // written again and its data is freed by the last of them
+    size_t refs;
+    struct segment* next;
+};
+
+struct segment_list {
+    size_t size;
+    size_t count;
+    size_t memory;
+    segment_t* head;
+    segment_t* tail;
+    // the segments up to sealed_tail are blocks which are never written again, compressed or not
+    segment_t* sealed_tail;
+    size_t sealed_size;
+    size_t sealed_count;
+    uint64_t stamp;
+};
+
+// A part of a view, size bytes of a segment starting at from
+typedef struct sl_view_part {
+    segment_t* segment;
+    size_t from;
+    size_t size;
+} sl_view_part_t;
+
+struct sl_view {
+    sl_view_part_t* parts;
+    size_t count;
+    size_t size;
+    // part holding the last offset requested and where it starts, the reads move forward
+    size_t cursor;
+    size_t cursor_start;
+    // a compressed part expanded by the last read, SIZE_MAX if none
+    char* block;
+    size_t block_part;
+};
+
+// Source of the stamps of the lists, each change of a list takes a new one
+static uint64_t next_stamp = 0;
+
+// Segments and lists are taken from shared slabs, the buffers of the contents come from content_alloc
+// so the memory of the removed files goes back to the system instead of staying on a free list
+static slab_t* segments_slab = NULL;
+static slab_t* lists_slab = NULL;
+static pthread_once_t slabs_once = PTHREAD_ONCE_INIT;
+
+static void init_slabs()
+{
+    segments_slab = create_slab(sizeof(segment_t), SEGMENTS_PER_CHUNK);
+    lists_slab = create_slab(sizeof(segment_list_t), SEGMENTS_PER_CHUNK);
+}
+
+// Create a segment which owns data, capacity is the real size of the data buffer
+static segment_t* create_segment(void* data, size_t size, size_t capacity, segment_owner_t owner)
+{
+    segment_t* segment = slab_alloc(segments_slab);
+    segment->data = data;
+    segment->size = size;
+    segment->capacity = capacity;
+    segment->stored_size = size;
+    segment->compressed = FALSE;
+    segment->owner = owner;
+    segment->release = NULL;
+    segment->release_arg = NULL;
+    segment->refs = 1;
+    segment->next = NULL;
+    return segment;
+}
+
+// Free the data of a segment as its owner requires, the segment itself is left alone
+static void free_segment_data(segment_t* segment)
+{
+    if(segment->owner == SEG_MALLOC)
+        content_free(segment->data);
+    else if(segment->owner == SEG_SHARED && segment->release)
+        segment->release(segment->release_arg);
+}
+
+// Drop a reference to a segment, the last one frees it
+static void free_segment(segment_t* segment)
+{
+    NRET_IF(__atomic_sub_fetch(&segment->refs, 1, __ATOMIC_ACQ_REL) > 0);
+
+    free_segment_data(segment);
+    slab_free(segments_slab, segment);
+}
+
+static void sl_add_segment(segment_list_t* sl, segment_t* segment)
+{
+    if(sl->tail)
+        sl->tail->next = segment;
+    else
+        sl->head = segment;
+
+    sl->tail = segment;
+    sl->size += segment->size;
+    sl->memory += segment->stored_size;
+    ++sl->count;
+}
+
+static inline void sl_stamp(segment_list_t* sl)
+{
+    sl->stamp = __atomic_add_fetch(&next_stamp, 1, __ATOMIC_RELAXED);
+}
+
+static inline segment_t* sl_first_unsealed(const segment_list_t* sl)
+{
+    return sl->sealed_tail ? sl->sealed_tail->next : sl->head;
+}
+
+// Free the segments after the sealed ones
+static void sl_drop_unsealed(segment_list_t* sl)
+{
+    segment_t* curr = sl_first_unsealed(sl);
+    while(curr)
+    {
+        segment_t* next = curr->next;
+        sl->size -= curr->size;
+        sl->memory -= curr->stored_size;
+        --sl->count;
+        free_segment(curr);
+        curr = next;
+    }
+
+    sl->tail = sl->sealed_tail;
+    if(sl->tail)
+        sl->tail->next = NULL;
+    else
+        sl->head = NULL;
+}
+
+// Write the content of a segment inside buf, which must hold segment->size bytes
+static void segment_copy_to(const segment_t* segment, void* buf)
+{
+    if(!segment->compressed)
+    {
+        memcpy(buf, segment->data, segment->size);
+        return;
+    }
+
+    CHECK_FATAL_EVAL(lz_decompress(segment->data, segment->stored_size, buf, segment->size) == -1, "Compressed segment is corrupted!");
+}
+
+// Check whether the data of a segment can be written in place, the shared and mapped data belong to someone else
+// and the data read by a view must not change under it
+static inline bool_t is_segment_writable(const segment_t* segment)
+{
+    return !segment->compressed && segment->owner == SEG_MALLOC && __atomic_load_n(&segment->refs, __ATOMIC_ACQUIRE) == 1;
+}
+
+// Replace a segment of sl, which follows prev (NULL if it's the head), with a private uncompressed copy of its content
+// so it can be written in place. The copy keeps its place among the sealed blocks
+static segment_t* segment_make_private(segment_list_t* sl, segment_t* prev, segment_t* segment)
+{
+    char* buffer = content_alloc(segment->size);
+    segment_copy_to(segment, buffer);
+
+    segment_t* copy = create_segment(buffer, segment->size, segment->size, SEG_MALLOC);
+    copy->next = segment->next;
+    if(prev)
+        prev->next = copy;
+    else
+        sl->head = copy;
+    if(sl->tail == segment)
+        sl->tail = copy;
+    if(sl->sealed_tail == segment)
+        sl->sealed_tail = copy;
+
+    sl->memory = sl->memory - segment->stored_size + copy->stored_size;
+    free_segment(segment);
+    return copy;
+}
+
+segment_list_t* create_sl()
+{
+    pthread_once(&slabs_once, init_slabs);
+    segment_list_t* sl = slab_alloc(lists_slab);
+    memset(sl, 0, sizeof(segment_list_t));
+    return sl;
+}
+
+size_t sl_get_size(const segment_list_t* sl)
+{
+    RET_IF(!sl, 0);
+    return sl->size;
+}
+
+size_t sl_get_memory_size(const segment_list_t* sl)
+{
+    RET_IF(!sl, 0);
+    return sl->memory;
+}
+
+size_t sl_get_unsealed_size(const segment_list_t* sl)
+{
+    RET_IF(!sl, 0);
+    return sl->size - sl->sealed_size;
+}
+
+uint64_t sl_get_stamp(const segment_list_t* sl)
+{
+    RET_IF(!sl, 0);
+    return sl->stamp;
+}
+
+size_t sl_count_segments(const segment_list_t* sl)
+{
+    RET_IF(!sl, 0);
+    return sl->count;
+}
+
+void sl_replace(segment_list_t* sl, void* data, size_t size)
+{
+    NRET_IF(!sl);
+
+    sl_empty(sl);
+    sl_stamp(sl);
+    if(size == 0)
+    {
+        content_free(data);
+        return;
+    }
+
+    sl_add_segment(sl, create_segment(data, size, size, SEG_MALLOC));
+}
+
+void sl_replace_shared(segment_list_t* sl, const void* data, size_t size, void (*release)(void*), void* release_arg)
+{
+    NRET_IF(!sl);
+
+    sl_empty(sl);
+    sl_stamp(sl);
+
+    // the shared data is sealed, the appends and the compressions leave it untouched
+    segment_t* segment = create_segment((void*)data, size, size, SEG_SHARED);
+    segment->stored_size = 0;
+    segment->release = release;
+    segment->release_arg = release_arg;
+    sl_add_segment(sl, segment);
+    sl->sealed_tail = segment;
+    sl->sealed_size = size;
+    sl->sealed_count = 1;
+}
+
+void sl_append(segment_list_t* sl, void* data, size_t size)
+{
+    NRET_IF(!sl);
+    if(size == 0)
+    {
+        content_free(data);
+        return;
+    }
+
+    // Big appends become a segment by themselves, no copy needed
+    if(size >= SL_SEGMENT_SIZE)
+    {
+        sl_stamp(sl);
+        sl_add_segment(sl, create_segment(data, size, size, SEG_MALLOC));
+        return;
+    }
+
+    sl_append_copy(sl, data, size);
+    content_free(data);
+}
+
+void sl_append_copy(segment_list_t* sl, const void* data, size_t size)
+{
+    NRET_IF(!sl || size == 0);
+
+    sl_stamp(sl);
+    const char* src = data;
+    size_t left = size;
+    segment_t* tail = sl->tail;
+    if(tail && tail != sl->sealed_tail && tail->capacity > tail->size)
+    {
+        size_t chunk = MIN(left, tail->capacity - tail->size);
+        memcpy(tail->data + tail->size, src, chunk);
+        tail->size += chunk;
+        tail->stored_size += chunk;
+        sl->size += chunk;
+        sl->memory += chunk;
+        src += chunk;
+        left -= chunk;
+    }
+
+    while(left > 0)
+    {
+        size_t chunk = MIN(left, SL_SEGMENT_SIZE);
+        char* buffer = content_alloc(SL_SEGMENT_SIZE);
+        memcpy(buffer, src, chunk);
+        sl_add_segment(sl, create_segment(buffer, chunk, SL_SEGMENT_SIZE, SEG_MALLOC));
+        src += chunk;
+        left -= chunk;
+    }
+}
+
+void sl_append_mapped(segment_list_t* sl, const void* data, size_t size)
+{
+    NRET_IF(!sl || size == 0);
+
+    // the capacity matches the size, the appends never write inside the mapping
+    sl_stamp(sl);
+    sl_add_segment(sl, create_segment((void*)data, size, size, SEG_MAPPED));
+}
+
+bool_t sl_needs_compaction(const segment_list_t* sl)
+{
+    RET_IF(!sl || sl->count - sl->sealed_count <= SL_COMPACT_THRESHOLD, FALSE);
+
+    segment_t* first = sl_first_unsealed(sl);
+    size_t tail_size = sl->size - sl->sealed_size - first->size;
+    return tail_size >= first->size;
+}
+
+int sl_compact(segment_list_t* sl)
+{
+    RET_IF(!sl, -1);
+    RET_IF(sl->count - sl->sealed_count <= 1, 0);
+
+    // the sealed blocks are already contiguous, only the segments after them are merged
+    size_t size = sl_get_unsealed_size(sl);
+    char* buffer = content_alloc(size);
+    sl_copy_unsealed_to(sl, buffer);
+
+    sl_drop_unsealed(sl);
+    sl_stamp(sl);
+    sl_add_segment(sl, create_segment(buffer, size, size, SEG_MALLOC));
+    return 1;
+}
+
+size_t sl_copy_unsealed_to(const segment_list_t* sl, void* buf)
+{
+    RET_IF(!sl || !buf, 0);
+
+    size_t copied = 0;
+    for(segment_t* curr = sl_first_unsealed(sl); curr; curr = curr->next)
+    {
+        memcpy((char*)buf + copied, curr->data, curr->size);
+        copied += curr->size;
+    }
+
+    return copied;
+}
+
+segment_list_t* sl_seal(const void* data, size_t size)
+{
+    segment_list_t* sealed = create_sl();
+    char* compressed;
+    CHECK_FATAL_EQ(compressed, malloc(LZ_COMPRESS_BOUND(SL_SEGMENT_SIZE)), NULL, NO_MEM_FATAL);
+
+    for(size_t offset = 0; offset < size; offset += SL_SEGMENT_SIZE)
+    {
+        size_t block_size = MIN(size - offset, SL_SEGMENT_SIZE);
+        const char* block = (const char*)data + offset;
+        // a block is kept compressed only if it saves at least an eighth of its memory
+        size_t compressed_size = lz_compress(block, block_size, compressed, block_size - block_size / 8);
+
+        char* buffer;
+        size_t stored_size = compressed_size > 0 ? compressed_size : block_size;
+        CHECK_FATAL_EQ(buffer, malloc(stored_size), NULL, NO_MEM_FATAL);
+        memcpy(buffer, compressed_size > 0 ? compressed : block, stored_size);
+
+        segment_t* segment = create_segment(buffer, block_size, block_size, SEG_MALLOC);
+        segment->stored_size = stored_size;
+        segment->compressed = compressed_size > 0;
+        sl_add_segment(sealed, segment);
+    }
+
+    free(compressed);
+    sealed->sealed_tail = sealed->tail;
+    sealed->sealed_size = sealed->size;
+    sealed->sealed_count = sealed->count;
+    return sealed;
+}
+
+long sl_replace_unsealed(segment_list_t* sl, segment_list_t* sealed)
+{
+    RET_IF(!sl || !sealed, 0);
+
+    long memory = sl->memory;
+    sl_drop_unsealed(sl);
+    segment_t* curr = sealed->head;
+    while(curr)
+    {
+        segment_t* next = curr->next;
+        curr->next = NULL;
+        sl_add_segment(sl, curr);
+        curr = next;
+    }
+
+    sl->sealed_tail = sl->tail;
+    sl->sealed_size = sl->size;
+    sl->sealed_count = sl->count;
+    sl_stamp(sl);
+
+    sealed->head = sealed->tail = sealed->sealed_tail = NULL;
+    sealed->size = sealed->memory = sealed->count = 0;
+    sealed->sealed_size = sealed->sealed_count = 0;
+    return (long)sl->memory - memory;
+}
+
+long sl_write_at(segment_list_t* sl, size_t offset, const void* data, size_t size)
+{
+    RET_IF(!sl || size == 0 || offset > sl->size, 0);
+
+    long memory = sl->memory;
+    const char* src = data;
+    // the bytes inside the list are written in place, only the segments touched which are not private are copied
+    size_t overwritten = MIN(size, sl->size - offset);
+    size_t written = 0;
+    size_t start = 0;
+    segment_t* prev = NULL;
+    for(segment_t* curr = sl->head; curr && written < overwritten; prev = curr, curr = curr->next)
+    {
+        size_t end = start + curr->size;
+        if(end > offset)
+        {
+            if(!is_segment_writable(curr))
+                curr = segment_make_private(sl, prev, curr);
+            size_t from = offset + written - start;
+            size_t chunk = MIN(curr->size - from, overwritten - written);
+            memcpy(curr->data + from, src + written, chunk);
+            written += chunk;
+        }
+        start = end;
+    }
+
+    if(written < size)
+        sl_append_copy(sl, src + written, size - written);
+    sl_stamp(sl);
+    return (long)sl->memory - memory;
+}
+
+size_t sl_write_cost_at(const segment_list_t* sl, size_t offset, size_t size)
+{
+    RET_IF(!sl || size == 0 || offset > sl->size, 0);
+
+    size_t overwritten = MIN(size, sl->size - offset);
+    size_t cost = size - overwritten;
+    size_t start = 0;
+    for(segment_t* curr = sl->head; curr && start < offset + overwritten; curr = curr->next)
+    {
+        size_t end = start + curr->size;
+        // the private copy of a segment holds its whole expanded content
+        if(end > offset && !is_segment_writable(curr))
+            cost += curr->size - MIN(curr->size, curr->stored_size);
+        start = end;
+    }
+    return cost;
+}
+
+size_t sl_copy_range_to(const segment_list_t* sl, size_t offset, void* buf, size_t size)
+{
+    RET_IF(!sl || !buf || offset >= sl->size, 0);
+
+    size = MIN(size, sl->size - offset);
+    size_t copied = 0;
+    size_t start = 0;
+    char* block = NULL;
+    for(segment_t* curr = sl->head; curr && copied < size; curr = curr->next)
+    {
+        size_t end = start + curr->size;
+        if(end > offset)
+        {
+            size_t from = offset + copied - start;
+            size_t chunk = MIN(curr->size - from, size - copied);
+            if(!curr->compressed)
+            {
+                memcpy((char*)buf + copied, curr->data + from, chunk);
+            }
+            else if(chunk == curr->size)
+            {
+                segment_copy_to(curr, (char*)buf + copied);
+            }
+            else
+            {
+                // only a part of the block is requested, the blocks outside the range are never expanded
+                if(!block)
+                    CHECK_FATAL_EQ(block, malloc(SL_SEGMENT_SIZE), NULL, NO_MEM_FATAL);
+                segment_copy_to(curr, block);
+                memcpy((char*)buf + copied, block + from, chunk);
+            }
+            copied += chunk;
+        }
+        start = end;
+    }
+
+    free(block);
+    return copied;
+}
+
+size_t sl_copy_to(const segment_list_t* sl, void* buf, size_t size)
+{
+    return sl_copy_range_to(sl, 0, buf, size);
+}
+
+int sl_writen(long fd, const segment_list_t* sl)
+{
+    RET_IF(!sl, -1);
+
+    struct iovec iov[SL_IOV_BATCH];
+    char* block = NULL;
+    int res = 1;
+    segment_t* curr = sl->head;
+    while(curr && res > 0)
+    {
+        // the compressed blocks are expanded one at a time inside the same buffer
+        if(curr->compressed)
+        {
+            if(!block)
+                CHECK_FATAL_EQ(block, malloc(SL_SEGMENT_SIZE), NULL, NO_MEM_FATAL);
+            segment_copy_to(curr, block);
+            res = writen(fd, block, curr->size);
+            curr = curr->next;
+            continue;
+        }
+
+        int iovcnt = 0;
+        while(curr && !curr->compressed && iovcnt < SL_IOV_BATCH)
+        {
+            iov[iovcnt].iov_base = curr->data;
+            iov[iovcnt].iov_len = curr->size;
+            ++iovcnt;
+            curr = curr->next;
+        }
+
+        res = writen_iov(fd, iov, iovcnt);
+    }
+
+    free(block);
+    return res;
+}
+
+sl_view_t* sl_view_create(const segment_list_t* sl, size_t offset, size_t size)
+{
+    RET_IF(!sl || offset > sl->size, NULL);
+
+    size = MIN(size, sl->size - offset);
+    sl_view_t* view;
+    CHECK_FATAL_EQ(view, malloc(sizeof(sl_view_t)), NULL, NO_MEM_FATAL);
+    memset(view, 0, sizeof(sl_view_t));
+    view->block_part = SIZE_MAX;
+    view->size = size;
+    RET_IF(size == 0, view);
+
+    size_t capacity = 0;
+    size_t start = 0;
+    size_t taken = 0;
+    for(segment_t* curr = sl->head; curr && taken < size; curr = curr->next)
+    {
+        size_t end = start + curr->size;
+        if(end > offset)
+        {
+            if(view->count == capacity)
+            {
+                capacity = MAX(capacity * 2, 8);
+                CHECK_FATAL_EQ(view->parts, realloc(view->parts, capacity * sizeof(sl_view_part_t)), NULL, NO_MEM_FATAL);
+            }
+
+            sl_view_part_t* part = &view->parts[view->count++];
+            part->segment = curr;
+            part->from = offset + taken - start;
+            part->size = MIN(curr->size - part->from, size - taken);
+            __atomic_add_fetch(&curr->refs, 1, __ATOMIC_RELAXED);
+            taken += part->size;
+        }
+        start = end;
+    }
+
+    return view;
+}
+
+size_t sl_view_get_size(const sl_view_t* view)
+{
+    RET_IF(!view, 0);
+    return view->size;
+}
+
+int sl_view_get_iov(sl_view_t* view, size_t offset, struct iovec* iov, int iovcnt)
+{
+    RET_IF(!view || offset >= view->size || iovcnt <= 0, 0);
+
+    if(offset < view->cursor_start)
+    {
+        view->cursor = 0;
+        view->cursor_start = 0;
+    }
+    while(offset >= view->cursor_start + view->parts[view->cursor].size)
+        view->cursor_start += view->parts[view->cursor++].size;
+
+    int filled = 0;
+    size_t skip = offset - view->cursor_start;
+    for(size_t i = view->cursor; i < view->count && filled < iovcnt; ++i)
+    {
+        sl_view_part_t* part = &view->parts[i];
+        segment_t* segment = part->segment;
+        if(!segment->compressed)
+        {
+            iov[filled].iov_base = segment->data + part->from + skip;
+            iov[filled++].iov_len = part->size - skip;
+            skip = 0;
+            continue;
+        }
+
+        // the blocks are expanded one at a time inside the buffer of the view, so the expanded one is the last filled
+        if(view->block_part != i)
+        {
+            if(!view->block)
+                CHECK_FATAL_EQ(view->block, malloc(SL_SEGMENT_SIZE), NULL, NO_MEM_FATAL);
+            segment_copy_to(segment, view->block);
+            view->block_part = i;
+        }
+        iov[filled].iov_base = view->block + part->from + skip;
+        iov[filled++].iov_len = part->size - skip;
+        break;
+    }
+
+    return filled;
+}
+
+void free_sl_view(sl_view_t* view)
+{
+    NRET_IF(!view);
+
+    for(size_t i = 0; i < view->count; ++i)
+        free_segment(view->parts[i].segment);
+    free(view->parts);
+    free(view->block);
+    free(view);
+}
+
+void sl_move_to_node(const segment_list_t* sl, int node)
+{
+    NRET_IF(!sl);
+
+    for(segment_t* curr = sl->head; curr; curr = curr->next)
+    {
+        if(curr->owner == SEG_MALLOC || curr->owner == SEG_SHARED)
+            content_move_to_node(curr->data, node);
+    }
+}
+
+void sl_empty(segment_list_t* sl)
+{
+    NRET_IF(!sl);
+
+    segment_t* curr = sl->head;
+    while(curr)
+    {
+        segment_t* next = curr->next;
+        free_segment(curr);
+        curr = next;
+    }
+
+    sl->head = sl->tail = sl->sealed_tail = NULL;
+    sl->size = sl->memory = sl->count = 0;
+    sl->sealed_size = sl->sealed_count = 0;
+    sl_stamp(sl);
+}
+
+void free_sl(segment_list_t* sl)
+{
+    NRET_IF(!sl);
+
+    sl_empty(sl);
+    slab_free(lists_slab, sl);
+}
@@ -0,0 +1,108 @@
+#include <string.h>
+#include <pthread.h>
+
+#include "slab.h"
+#include "utils.h"
+
+// Header of each chunk of memory requested by a slab, the objects follows the header
+typedef struct slab_chunk {
+    struct slab_chunk* next;
+} slab_chunk_t;
+
+// Free objects are linked together using their first bytes
+typedef struct free_obj {
+    struct free_obj* next;
+} free_obj_t;
+
+struct slab {
+    size_t obj_size;
+    size_t objs_per_chunk;
+    size_t used;
+    slab_chunk_t* chunks;
+    free_obj_t* free_list;
+    pthread_mutex_t mutex;
+};
+
+slab_t* create_slab(size_t obj_size, size_t objs_per_chunk)
+{
+    slab_t* slab;
+    CHECK_FATAL_EQ(slab, malloc(sizeof(slab_t)), NULL, NO_MEM_FATAL);
+    memset(slab, 0, sizeof(slab_t));
+
+    slab->obj_size = ALIGN_SIZE(MAX(obj_size, sizeof(free_obj_t)));
+    slab->objs_per_chunk = objs_per_chunk > 0 ? objs_per_chunk : 1;
+    INIT_MUTEX(&slab->mutex);
+    return slab;
+}
+
+// Request a new chunk of memory and put all of its objects in the free list
+// Must be called with the slab mutex acquired
+static void slab_grow(slab_t* slab)
+{
+    size_t header_size = ALIGN_SIZE(sizeof(slab_chunk_t));
+    slab_chunk_t* chunk;
+    CHECK_FATAL_EQ(chunk, malloc(header_size + slab->obj_size * slab->objs_per_chunk), NULL, NO_MEM_FATAL);
+    chunk->next = slab->chunks;
+    slab->chunks = chunk;
+
+    char* objs = (char*)chunk + header_size;
+    for(size_t i = 0; i < slab->objs_per_chunk; ++i)
+    {
+        free_obj_t* obj = (free_obj_t*)(objs + i * slab->obj_size);
+        obj->next = slab->free_list;
+        slab->free_list = obj;
+    }
+}
+
+void* slab_alloc(slab_t* slab)
+{
+    RET_IF(!slab, NULL);
+
+    LOCK_MUTEX(&slab->mutex);
+    if(!slab->free_list)
+        slab_grow(slab);
+
+    free_obj_t* obj = slab->free_list;
+    slab->free_list = obj->next;
+    ++slab->used;
+    UNLOCK_MUTEX(&slab->mutex);
+
+    return obj;
+}
+
+void slab_free(slab_t* slab, void* obj)
+{
+    NRET_IF(!slab || !obj);
+
+    free_obj_t* free_obj = obj;
+    LOCK_MUTEX(&slab->mutex);
+    free_obj->next = slab->free_list;
+    slab->free_list = free_obj;
+    --slab->used;
+    UNLOCK_MUTEX(&slab->mutex);
+}
+
+size_t slab_count_used(slab_t* slab)
+{
+    RET_IF(!slab, 0);
+
+    size_t used;
+    GET_VAR_MUTEX(slab->used, used, &slab->mutex);
+    return used;
+}
+
+void free_slab(slab_t* slab)
+{
+    NRET_IF(!slab);
+
+    slab_chunk_t* curr = slab->chunks;
+    while(curr)
+    {
+        slab_chunk_t* next = curr->next;
+        free(curr);
+        curr = next;
+    }
+
+    pthread_mutex_destroy(&slab->mutex);
+    free(slab);
+}
@@ -0,0 +1,241 @@
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "timer_wheel.h"
+#include "slab.h"
+
+#define ENTRIES_PER_CHUNK 256
+
+typedef enum timer_state {
+    TIMER_PENDING,
+    TIMER_FIRED
+} timer_state_t;
+
+struct timer_entry {
+    uint64_t expire_tick;
+    int key;
+    uint64_t id;
+    void* data;
+    timer_state_t state;
+    struct timer_entry* prev;
+    struct timer_entry* next;
+};
+
+// Each slot contains the timers whose expire tick modulo the slots count is the slot index,
+// timers more than one round away stay in their slot until their tick comes
+struct timer_wheel {
+    timer_entry_t** slots;
+    size_t slots_count;
+    long tick_ms;
+    uint64_t current_tick;
+    size_t count;
+    pthread_mutex_t mutex;
+};
+
+static slab_t* entries_slab = NULL;
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+
+static void init_slab()
+{
+    entries_slab = create_slab(sizeof(timer_entry_t), ENTRIES_PER_CHUNK);
+}
+
+static uint64_t now_ms()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static uint64_t now_tick(const timer_wheel_t* tw)
+{
+    return now_ms() / tw->tick_ms;
+}
+
+static void tw_unlink(timer_wheel_t* tw, timer_entry_t* entry)
+{
+    size_t slot = entry->expire_tick % tw->slots_count;
+    if(entry->prev)
+        entry->prev->next = entry->next;
+    else
+        tw->slots[slot] = entry->next;
+
+    if(entry->next)
+        entry->next->prev = entry->prev;
+
+    entry->prev = entry->next = NULL;
+    --tw->count;
+}
+
+timer_wheel_t* create_tw(size_t slots, long tick_ms)
+{
+    pthread_once(&slab_once, init_slab);
+
+    timer_wheel_t* tw;
+    CHECK_FATAL_EQ(tw, malloc(sizeof(timer_wheel_t)), NULL, NO_MEM_FATAL);
+    memset(tw, 0, sizeof(timer_wheel_t));
+
+    tw->slots_count = slots > 0 ? slots : TW_DEFAULT_SLOTS;
+    tw->tick_ms = tick_ms > 0 ? tick_ms : TW_DEFAULT_TICK_MS;
+    CHECK_FATAL_EQ(tw->slots, calloc(tw->slots_count, sizeof(timer_entry_t*)), NULL, NO_MEM_FATAL);
+    tw->current_tick = now_tick(tw);
+    INIT_MUTEX(&tw->mutex);
+    return tw;
+}
+
+size_t count_tw(timer_wheel_t* tw)
+{
+    RET_IF(!tw, 0);
+
+    size_t count;
+    LOCK_MUTEX(&tw->mutex);
+    count = tw->count;
+    UNLOCK_MUTEX(&tw->mutex);
+    return count;
+}
+
+timer_entry_t* tw_add(timer_wheel_t* tw, long timeout_ms, int key, uint64_t id, void* data)
+{
+    RET_IF(!tw || timeout_ms < 0, NULL);
+
+    timer_entry_t* entry = slab_alloc(entries_slab);
+    entry->key = key;
+    entry->id = id;
+    entry->data = data;
+    entry->state = TIMER_PENDING;
+    entry->prev = NULL;
+
+    // round up, a timer never expires before its timeout
+    uint64_t expire_tick = (now_ms() + timeout_ms + tw->tick_ms - 1) / tw->tick_ms;
+    LOCK_MUTEX(&tw->mutex);
+    // the ticks already visited are never checked again
+    entry->expire_tick = MAX(expire_tick, tw->current_tick + 1);
+    size_t slot = entry->expire_tick % tw->slots_count;
+    entry->next = tw->slots[slot];
+    if(entry->next)
+        entry->next->prev = entry;
+    tw->slots[slot] = entry;
+    ++tw->count;
+    UNLOCK_MUTEX(&tw->mutex);
+
+    return entry;
+}
+
+int tw_cancel(timer_wheel_t* tw, timer_entry_t* entry)
+{
+    RET_IF(!tw || !entry, 0);
+
+    LOCK_MUTEX(&tw->mutex);
+    if(entry->state != TIMER_PENDING)
+    {
+        UNLOCK_MUTEX(&tw->mutex);
+        return 0;
+    }
+
+    tw_unlink(tw, entry);
+    UNLOCK_MUTEX(&tw->mutex);
+
+    slab_free(entries_slab, entry);
+    return 1;
+}
+
+size_t tw_advance(timer_wheel_t* tw, timer_callback_t callback)
+{
+    RET_IF(!tw, 0);
+
+    timer_entry_t* expired = NULL;
+    size_t expired_count = 0;
+
+    LOCK_MUTEX(&tw->mutex);
+    uint64_t target = now_tick(tw);
+    // after a full round every slot was already visited
+    uint64_t start = target - tw->current_tick > tw->slots_count ? target - tw->slots_count : tw->current_tick;
+    for(uint64_t tick = start + 1; tick <= target && tw->count > 0; ++tick)
+    {
+        timer_entry_t* curr = tw->slots[tick % tw->slots_count];
+        while(curr)
+        {
+            timer_entry_t* next = curr->next;
+            if(curr->expire_tick <= target)
+            {
+                tw_unlink(tw, curr);
+                curr->state = TIMER_FIRED;
+                curr->next = expired;
+                expired = curr;
+                ++expired_count;
+            }
+            curr = next;
+        }
+    }
+    tw->current_tick = MAX(target, tw->current_tick);
+    UNLOCK_MUTEX(&tw->mutex);
+
+    while(expired)
+    {
+        timer_entry_t* next = expired->next;
+        if(callback)
+            callback(expired->key, expired->id, expired->data);
+        slab_free(entries_slab, expired);
+        expired = next;
+    }
+
+    return expired_count;
+}
+
+long tw_next_timeout_ms(timer_wheel_t* tw)
+{
+    RET_IF(!tw, -1);
+
+    long timeout = -1;
+    LOCK_MUTEX(&tw->mutex);
+    if(tw->count > 0)
+    {
+        uint64_t now = now_tick(tw);
+        uint64_t nearest = UINT64_MAX;
+        // the first slot with a timer expiring in this round gives the nearest expiration,
+        // otherwise the nearest one is searched between the timers of the next rounds
+        for(uint64_t tick = tw->current_tick + 1; tick <= tw->current_tick + tw->slots_count && nearest == UINT64_MAX; ++tick)
+        {
+            for(timer_entry_t* curr = tw->slots[tick % tw->slots_count]; curr; curr = curr->next)
+            {
+                if(curr->expire_tick == tick)
+                {
+                    nearest = tick;
+                    break;
+                }
+            }
+        }
+
+        for(size_t slot = 0; slot < tw->slots_count && nearest == UINT64_MAX; ++slot)
+        {
+            for(timer_entry_t* curr = tw->slots[slot]; curr; curr = curr->next)
+                nearest = MIN(nearest, curr->expire_tick);
+        }
+
+        timeout = nearest <= now ? 0 : (long)(nearest - now) * tw->tick_ms;
+    }
+    UNLOCK_MUTEX(&tw->mutex);
+
+    return timeout;
+}
+
+void free_tw(timer_wheel_t* tw)
+{
+    NRET_IF(!tw);
+
+    for(size_t slot = 0; slot < tw->slots_count; ++slot)
+    {
+        timer_entry_t* curr = tw->slots[slot];
+        while(curr)
+        {
+            timer_entry_t* next = curr->next;
+            slab_free(entries_slab, curr);
+            curr = next;
+        }
+    }
+
+    free(tw->slots);
+    pthread_mutex_destroy(&tw->mutex);
+    free(tw);
+}
@@ -18,7 +18,17 @@ int get_file_size(FILE* f)
 
 bool_t is_valid_op(server_packet_op_t op)
 {
-    return op >= OP_OPEN_FILE && op <= OP_OK;
+    return (op >= OP_OPEN_FILE && op <= OP_WRITE_FILE_HASH) || op == OP_SHARD_MAP || op == OP_READ_FILE_CACHE || op == OP_READ_FILE_IF_MODIFIED
+        || op == OP_READ_FILE_RANGE || op == OP_WRITE_FILE_AT;
+}
+
+uint32_t hash_pathname(const char* pathname)
+{
+    // FNV-1a, unrelated to the hash of the buckets of the file systems
+    uint32_t hash = 2166136261u;
+    for(const unsigned char* c = (const unsigned char*)pathname; *c != '\0'; ++c)
+        hash = (hash ^ *c) * 16777619u;
+    return hash;
 }
 
 int read_file_util(const char* pathname, void** buffer, size_t* size)
@@ -99,9 +109,9 @@ static inline bool_t is_digit(char c)
     return c >= '0' && c <= '9';
 }
 
-static inline int n_atoi(const char* str, int len)
+static inline size_t n_atoi(const char* str, int len)
 {
-    int ret = 0;
+    size_t ret = 0;
     for(int i = 0; i < len; ++i)
     {
         ret = ret * 10 + (str[i] - '0');
@@ -109,7 +119,7 @@ static inline int n_atoi(const char* str, int len)
     return ret;
 }
 
-int filesize_string_to_byte(char* str, unsigned int max_length)
+size_t filesize_string_to_byte(char* str, unsigned int max_length)
 {
     RET_IF(!str, 0);
 
@@ -119,7 +129,7 @@ int filesize_string_to_byte(char* str, unsigned int max_length)
     if(i == len)
     {
         PRINT_INFO("No unit of measure specified, BYTE choosen by default!");
-        return atoi(str);
+        return n_atoi(str, len);
     }
 
     const char* str_unit = (const char*)(str + i);
@@ -200,6 +210,39 @@ int writen(long fd, void* buf, size_t size)
 	return 1;
 }
 
+/**
+ * @brief Writes all the buffers described by iov to given descriptor using writev, retrying on partial writes.
+ * @returns 1 on success, -1 on failure.
+ * @exception The function may fail and set "errno" for any of the errors specified for routine "writev".
+*/
+int writen_iov(long fd, struct iovec* iov, int iovcnt)
+{
+    while(iovcnt > 0)
+    {
+        ssize_t r = writev((int) fd, iov, iovcnt);
+        if(r == -1)
+        {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        if(r == 0) return 0;
+
+        // skip the buffers fully written and move forward the partial one
+        while(iovcnt > 0 && r >= iov->iov_len)
+        {
+            r -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if(iovcnt > 0)
+        {
+            iov->iov_base = (char*)iov->iov_base + r;
+            iov->iov_len -= r;
+        }
+    }
+    return 1;
+}
+
 int readn_string(long fd, char* buf, size_t max_len)
 {
     RET_IF(!buf || max_len == 0, 0);
@@ -0,0 +1,236 @@
+#include <string.h>
+#include <pthread.h>
+
+#include "wait_queue.h"
+#include "slab.h"
+
+#define NODES_PER_CHUNK 256
+#define QUEUES_PER_CHUNK 128
+// Initial capacity of the index by client, must be a power of 2
+#define WQ_INDEX_MIN_CAPACITY 8
+
+struct wait_node {
+    int client;
+    struct timespec enqueue_time;
+    struct wait_node* prev;
+    struct wait_node* next;
+};
+
+// The waiters are a doubly linked list, so that any node can be unlinked in O(1),
+// the index is an open addressing table (linear probing) from client to its node
+struct wait_queue {
+    size_t count;
+    wait_node_t* head;
+    wait_node_t* tail;
+
+    wait_node_t** index;
+    size_t index_capacity;
+};
+
+static slab_t* nodes_slab = NULL;
+static slab_t* queues_slab = NULL;
+static pthread_once_t slabs_once = PTHREAD_ONCE_INIT;
+
+static void init_slabs()
+{
+    nodes_slab = create_slab(sizeof(wait_node_t), NODES_PER_CHUNK);
+    queues_slab = create_slab(sizeof(wait_queue_t), QUEUES_PER_CHUNK);
+}
+
+static inline size_t wq_hash(int client, size_t capacity)
+{
+    // fds are sequential, multiply to spread them over the table
+    return ((uint32_t)client * 2654435761u) & (capacity - 1);
+}
+
+// Get the slot of client inside the index, or the empty slot where it should be inserted
+static size_t wq_find_slot(const wait_queue_t* wq, int client)
+{
+    size_t slot = wq_hash(client, wq->index_capacity);
+    while(wq->index[slot] && wq->index[slot]->client != client)
+        slot = (slot + 1) & (wq->index_capacity - 1);
+
+    return slot;
+}
+
+// Keep the load factor of the index under 1/2
+static void wq_grow_index(wait_queue_t* wq)
+{
+    if(wq->index && (wq->count + 1) * 2 <= wq->index_capacity)
+        return;
+
+    size_t old_capacity = wq->index_capacity;
+    wait_node_t** old_index = wq->index;
+
+    wq->index_capacity = old_capacity > 0 ? old_capacity * 2 : WQ_INDEX_MIN_CAPACITY;
+    CHECK_FATAL_EQ(wq->index, calloc(wq->index_capacity, sizeof(wait_node_t*)), NULL, NO_MEM_FATAL);
+    for(size_t i = 0; i < old_capacity; ++i)
+    {
+        if(old_index[i])
+            wq->index[wq_find_slot(wq, old_index[i]->client)] = old_index[i];
+    }
+
+    free(old_index);
+}
+
+// Delete the slot from the index shifting back the following entries of the same cluster, no tombstones needed
+static void wq_index_delete(wait_queue_t* wq, size_t slot)
+{
+    size_t mask = wq->index_capacity - 1;
+    size_t hole = slot;
+    size_t curr = (slot + 1) & mask;
+    while(wq->index[curr])
+    {
+        size_t home = wq_hash(wq->index[curr]->client, wq->index_capacity);
+        // move the entry only if its home is not between the hole and its position (cyclically)
+        if(((curr - home) & mask) >= ((curr - hole) & mask))
+        {
+            wq->index[hole] = wq->index[curr];
+            hole = curr;
+        }
+
+        curr = (curr + 1) & mask;
+    }
+
+    wq->index[hole] = NULL;
+}
+
+static void wq_unlink(wait_queue_t* wq, wait_node_t* node)
+{
+    if(node->prev)
+        node->prev->next = node->next;
+    else
+        wq->head = node->next;
+
+    if(node->next)
+        node->next->prev = node->prev;
+    else
+        wq->tail = node->prev;
+
+    wq_index_delete(wq, wq_find_slot(wq, node->client));
+    --wq->count;
+    slab_free(nodes_slab, node);
+}
+
+wait_queue_t* create_wq()
+{
+    pthread_once(&slabs_once, init_slabs);
+    wait_queue_t* wq = slab_alloc(queues_slab);
+    memset(wq, 0, sizeof(wait_queue_t));
+    return wq;
+}
+
+size_t count_wq(const wait_queue_t* wq)
+{
+    RET_IF(!wq, 0);
+    return wq->count;
+}
+
+int wq_enqueue(wait_queue_t* wq, int client)
+{
+    RET_IF(!wq || client < 0, -1);
+    RET_IF(wq_contains(wq, client), 0);
+
+    wq_grow_index(wq);
+
+    wait_node_t* node = slab_alloc(nodes_slab);
+    node->client = client;
+    clock_gettime(CLOCK_MONOTONIC, &node->enqueue_time);
+    node->next = NULL;
+    node->prev = wq->tail;
+    if(wq->tail)
+        wq->tail->next = node;
+    else
+        wq->head = node;
+    wq->tail = node;
+
+    wq->index[wq_find_slot(wq, client)] = node;
+    ++wq->count;
+    return 1;
+}
+
+bool_t wq_contains(const wait_queue_t* wq, int client)
+{
+    RET_IF(!wq || wq->count == 0 || client < 0, FALSE);
+    return wq->index[wq_find_slot(wq, client)] != NULL;
+}
+
+int wq_cancel(wait_queue_t* wq, int client)
+{
+    RET_IF(!wq || wq->count == 0 || client < 0, 0);
+
+    wait_node_t* node = wq->index[wq_find_slot(wq, client)];
+    RET_IF(!node, 0);
+
+    wq_unlink(wq, node);
+    return 1;
+}
+
+int wq_peek(const wait_queue_t* wq, bool_t lifo)
+{
+    RET_IF(!wq || wq->count == 0, -1);
+    return lifo ? wq->tail->client : wq->head->client;
+}
+
+int wq_dequeue(wait_queue_t* wq, bool_t lifo, uint64_t* waited_ns)
+{
+    RET_IF(!wq || wq->count == 0, -1);
+
+    wait_node_t* node = lifo ? wq->tail : wq->head;
+    int client = node->client;
+    if(waited_ns)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        *waited_ns = (uint64_t)(now.tv_sec - node->enqueue_time.tv_sec) * 1000000000ULL
+                        + now.tv_nsec - node->enqueue_time.tv_nsec;
+    }
+
+    wq_unlink(wq, node);
+    return client;
+}
+
+wait_node_t* wq_get_head_node(const wait_queue_t* wq)
+{
+    RET_IF(!wq, NULL);
+    return wq->head;
+}
+
+wait_node_t* wait_node_get_next(const wait_node_t* node)
+{
+    RET_IF(!node, NULL);
+    return node->next;
+}
+
+int wait_node_get_client(const wait_node_t* node)
+{
+    RET_IF(!node, -1);
+    return node->client;
+}
+
+void empty_wq(wait_queue_t* wq)
+{
+    NRET_IF(!wq);
+
+    wait_node_t* curr = wq->head;
+    while(curr)
+    {
+        wait_node_t* next = curr->next;
+        slab_free(nodes_slab, curr);
+        curr = next;
+    }
+
+    wq->head = wq->tail = NULL;
+    wq->count = 0;
+    if(wq->index)
+        memset(wq->index, 0, wq->index_capacity * sizeof(wait_node_t*));
+}
+
+void free_wq(wait_queue_t* wq)
+{
+    NRET_IF(!wq);
+
+    empty_wq(wq);
+    free(wq->index);
+    slab_free(queues_slab, wq);
+}